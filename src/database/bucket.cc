@@ -12,6 +12,7 @@
 #include "common.h"
 #include "filesystem.h"
 #include "logger.h"
+#include "zmalloc.h"
 #include "md5.h"
 #include "everdata.h"
 
@@ -20,57 +21,107 @@
 #include "channel.h"
 #include "object.h"
 #include "bucketdb.h"
+#include "kvdb.h"
+#include "executor.h"
+
+/* Consecutive PUTs handled in one go are written in one transaction. */
+#define BUCKET_PUT_GROUP_MAX 64
+
+/* ================ create_delete_status_message() ================ */
+static zmsg_t *create_delete_status_message(int rc, uint32_t total_deleted)
+{
+    const char *status = MSG_STATUS_WORKER_ACK;
+    if ( rc != 0 ){
+        status = MSG_STATUS_WORKER_ERROR;
+    } else if ( total_deleted == 0 ){
+        status = MSG_STATUS_WORKER_NOTFOUND;
+    }
+    zmsg_t *sendback_msg = create_status_message(status);
+    zmsg_addmem(sendback_msg, &total_deleted, sizeof(uint32_t));
+
+    return sendback_msg;
+}
 
 /* ================ bucket_del_data() ================ */
+/* The slices of a chunked object are spread over all buckets, so every
+ * bucket gets the DEL and removes the ones it keeps. */
 zmsg_t *bucket_del_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zmsg_t *msg)
 {
-    zmsg_t *sendback_msg = NULL;
+    bucketdb_t *bucketdb = bucket->bucketdb;
 
-    if ( sendback_msg == NULL ){
-        sendback_msg = create_status_message(MSG_STATUS_WORKER_ERROR);
+    zframe_t *frame_key = message_first_argument(msg);
+    if ( frame_key == NULL ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
 
-        zmsg_wrap(sendback_msg, identity);
-        zmsg_send(&sendback_msg, sock);
+    const char *key = (const char *)zframe_data(frame_key);
+    uint32_t key_len = zframe_size(frame_key);
+
+    md5_value_t key_md5;
+    md5(&key_md5, (uint8_t *)key, key_len);
+
+    uint32_t total_deleted = 0;
+    int rc = bucketdb_delete_object(bucketdb, key_md5, key, key_len, &total_deleted);
+
+    return create_delete_status_message(rc, total_deleted);
+}
+
+/* ================ bucket_del_prefix_data() ================ */
+zmsg_t *bucket_del_prefix_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zmsg_t *msg)
+{
+    bucketdb_t *bucketdb = bucket->bucketdb;
+
+    zframe_t *frame_prefix = message_first_argument(msg);
+    if ( frame_prefix == NULL ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
     }
 
-    return sendback_msg;
+    uint32_t total_deleted = 0;
+    int rc = bucketdb_delete_prefix(bucketdb, (const char *)zframe_data(frame_prefix), zframe_size(frame_prefix), &total_deleted);
+
+    return create_delete_status_message(rc, total_deleted);
 }
 
 
-/* ================ bucket_get_data() ================ */
+/* ================ bucket_release_view() ================ */
+static void bucket_release_view(void *data, void *hint)
+{
+    kvdb_view_release((kvdb_view_t*)hint);
+}
+
+/* ================ bucket_get_data() ================ 
+ * The data frame points into storage and is sent from here, so a found
+ * object consumes identity and NULL is returned. */
 zmsg_t *bucket_get_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zmsg_t *msg)
 {
     bucketdb_t *bucketdb = bucket->bucketdb;
 
     zmsg_t *sendback_msg = NULL;
 
-    zframe_t *frame_msgtype = zmsg_first(msg);
-    if ( frame_msgtype != NULL ){
-        zframe_t *frame_action = zmsg_next(msg);
-        if ( frame_action != NULL ){
+    zframe_t *frame_key = message_first_argument(msg);
+    if ( frame_key != NULL ){
 
-            zframe_t *frame_key = zmsg_next(msg);
-            if ( frame_key != NULL ){
+        const char *key = (const char *)zframe_data(frame_key);
+        uint32_t key_len = zframe_size(frame_key);
 
-                const char *key = (const char *)zframe_data(frame_key);
-                uint32_t key_len = zframe_size(frame_key);
+        md5_value_t key_md5;
+        md5(&key_md5, (uint8_t *)key, key_len);
 
-                md5_value_t key_md5;
-                md5(&key_md5, (uint8_t *)key, key_len);
+        uint32_t slice_idx = 0;
+        kvdb_view_t *view = bucketdb_read_view_from_storage(bucketdb, key_md5, slice_idx);
+        if ( view != NULL ){
 
-                uint32_t slice_idx = 0;
-                slice_t *slice = bucketdb_read_from_storage(bucketdb, key_md5, slice_idx);
-                if ( slice != NULL ){
+            sendback_msg = create_base_message(MSGTYPE_DATA);
+            zmsg_addmem(sendback_msg, key, key_len);
+            zmsg_wrap(sendback_msg, identity);
 
-                    sendback_msg = create_key_data_message(key, slice->data, slice->size);
+            message_send_zerocopy(&sendback_msg, sock, (void*)view->data, view->size, bucket_release_view, view);
 
-                    slice_free(slice);
-                } else {
-                    sendback_msg = create_status_message(MSG_STATUS_WORKER_NOTFOUND);
-                } // slice != NULL
-            } // frame_key != NULL
-        } // frame_action != NULL
-    } // frame_msgtype != NULL
+            return NULL;
+        } else {
+            sendback_msg = create_status_message(MSG_STATUS_WORKER_NOTFOUND);
+        } // view != NULL
+    } // frame_key != NULL
 
     if ( sendback_msg == NULL ){
         sendback_msg = create_status_message(MSG_STATUS_WORKER_ERROR);
@@ -85,34 +136,31 @@ zmsg_t *bucket_put_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zms
     bucketdb_t *bucketdb = bucket->bucketdb;
     zmsg_t *sendback_msg = NULL;
 
-    UNUSED zframe_t *frame_msgtype = zmsg_first(msg);
-    if ( frame_msgtype != NULL ){
-        UNUSED zframe_t *frame_action = zmsg_next(msg);
-        if ( frame_action != NULL ) {
-            zframe_t *frame_key = zmsg_next(msg);
-            if ( frame_key != NULL ) {
-                const char *key = (const char *)zframe_data(frame_key);
-                UNUSED uint32_t key_len = zframe_size(frame_key);
+    zframe_t *frame_key = message_first_argument(msg);
+    if ( frame_key != NULL ) {
+        const char *key = (const char *)zframe_data(frame_key);
+        UNUSED uint32_t key_len = zframe_size(frame_key);
 
-                zframe_t *frame = zmsg_next(msg);
+        zframe_t *frame = zmsg_next(msg);
 
-                if ( frame != NULL ){
-                    const char *data = (const char *)zframe_data(frame);
-                    uint32_t data_size = zframe_size(frame);
+        if ( frame != NULL ){
+            const char *data = (const char *)zframe_data(frame);
+            uint32_t data_size = zframe_size(frame);
 
-                    md5_value_t key_md5;
-                    md5(&key_md5, (uint8_t *)key, key_len);
+            md5_value_t key_md5;
+            md5(&key_md5, (uint8_t *)key, key_len);
 
-                    uint32_t slice_idx = 0;
-                    slice_t *slice = slice_new(key_md5, slice_idx, data, data_size);
+            uint32_t slice_idx = 0;
+            slice_t *slice = slice_new(key_md5, slice_idx, data, data_size);
 
-                    bucketdb_write_to_storage(bucketdb, slice);
+            key_record_t key_record;
+            key_record.key_md5 = key_md5;
+            key_record.object_size = data_size;
+            int rc = bucketdb_put_objects(bucketdb, &slice, &key, &key_len, &key_record, NULL, 1);
 
-                    slice_free(slice);
+            slice_free(slice);
 
-                    sendback_msg = create_status_message(MSG_STATUS_WORKER_ACK);
-                }
-            }
+            sendback_msg = create_status_message(rc == 0 ? MSG_STATUS_WORKER_ACK : MSG_STATUS_WORKER_ERROR);
         }
     }
     if ( sendback_msg == NULL ){
@@ -122,6 +170,258 @@ zmsg_t *bucket_put_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zms
     return sendback_msg;
 }
 
+/* ================ bucket_put_batch_data() ================ */
+zmsg_t *bucket_put_batch_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zmsg_t *msg)
+{
+    bucketdb_t *bucketdb = bucket->bucketdb;
+    zmsg_t *sendback_msg = NULL;
+
+    uint32_t total_arguments = message_total_arguments(msg);
+    if ( total_arguments < 2 ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+    uint32_t total_slices = total_arguments / 2;
+    slice_t **slices = (slice_t**)zmalloc(sizeof(slice_t*) * total_slices);
+    memset(slices, 0, sizeof(slice_t*) * total_slices);
+    const char **keys = (const char**)zmalloc(sizeof(const char*) * total_slices);
+    uint32_t *key_lens = (uint32_t*)zmalloc(sizeof(uint32_t) * total_slices);
+    key_record_t *key_records = (key_record_t*)zmalloc(sizeof(key_record_t) * total_slices);
+
+    uint32_t n = 0;
+    while ( n < total_slices ){
+        zframe_t *frame_key = n == 0 ? message_first_argument(msg) : zmsg_next(msg);
+        zframe_t *frame_data = zmsg_next(msg);
+        if ( frame_key == NULL || frame_data == NULL ){
+            break;
+        }
+
+        keys[n] = (const char *)zframe_data(frame_key);
+        key_lens[n] = zframe_size(frame_key);
+        md5(&key_records[n].key_md5, (uint8_t *)keys[n], key_lens[n]);
+        key_records[n].object_size = zframe_size(frame_data);
+
+        uint32_t slice_idx = 0;
+        slices[n] = slice_new(key_records[n].key_md5, slice_idx, (const char *)zframe_data(frame_data), zframe_size(frame_data));
+        n++;
+    }
+
+    if ( n == total_slices && bucketdb_put_objects(bucketdb, slices, keys, key_lens, key_records, NULL, total_slices) == 0 ){
+        sendback_msg = create_status_message(MSG_STATUS_WORKER_ACK);
+    } else {
+        sendback_msg = create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+    zmsg_addmem(sendback_msg, &total_slices, sizeof(uint32_t));
+
+    for ( uint32_t i = 0 ; i < n ; i++ ){
+        slice_free(slices[i]);
+    }
+    zfree(slices);
+    zfree(keys);
+    zfree(key_lens);
+    zfree(key_records);
+
+    return sendback_msg;
+}
+
+/* ================ create_slice_status_message() ================ */
+static zmsg_t *create_slice_status_message(const char *status, zframe_t *frame_key, zframe_t *frame_header)
+{
+    zmsg_t *sendback_msg = create_status_message(status);
+    zmsg_addmem(sendback_msg, zframe_data(frame_key), zframe_size(frame_key));
+    zmsg_addmem(sendback_msg, zframe_data(frame_header), zframe_size(frame_header));
+
+    return sendback_msg;
+}
+
+/* ================ bucket_put_slice_data() ================ */
+zmsg_t *bucket_put_slice_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zmsg_t *msg)
+{
+    bucketdb_t *bucketdb = bucket->bucketdb;
+
+    if ( message_total_arguments(msg) < 3 ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+
+    zframe_t *frame_key = message_first_argument(msg);
+    zframe_t *frame_header = zmsg_next(msg);
+    zframe_t *frame_data = zmsg_next(msg);
+    if ( zframe_size(frame_header) != sizeof(slice_header_t) ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+    slice_header_t *slice_header = (slice_header_t*)zframe_data(frame_header);
+
+    md5_value_t key_md5;
+    md5(&key_md5, (uint8_t *)zframe_data(frame_key), zframe_size(frame_key));
+
+    /* Every bucket holding a slice knows the key, see bucket_del_data(). */
+    const char *key = (const char *)zframe_data(frame_key);
+    uint32_t key_len = zframe_size(frame_key);
+    key_record_t key_record;
+    key_record.key_md5 = key_md5;
+    key_record.object_size = slice_header->object_size;
+
+    object_header_t object_header;
+    object_header.object_size = slice_header->object_size;
+    object_header.nslices = slice_header->nslices;
+    object_header.slice_size = slice_header->slice_size;
+    const object_header_t *header = slice_header->slice_idx == 0 ? &object_header : NULL;
+
+    slice_t *slice = slice_new(key_md5, slice_header->slice_idx, (const char *)zframe_data(frame_data), zframe_size(frame_data));
+    int rc = bucketdb_put_objects(bucketdb, &slice, &key, &key_len, &key_record, &header, 1);
+    slice_free(slice);
+
+    return create_slice_status_message(rc == 0 ? MSG_STATUS_WORKER_ACK : MSG_STATUS_WORKER_ERROR, frame_key, frame_header);
+}
+
+/* ================ bucket_get_slice_data() ================ */
+/* Like bucket_get_data(). Slice 0 fills in the object header so the client
+ * learns how many more slices to fetch. */
+zmsg_t *bucket_get_slice_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zmsg_t *msg)
+{
+    bucketdb_t *bucketdb = bucket->bucketdb;
+
+    if ( message_total_arguments(msg) < 2 ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+
+    zframe_t *frame_key = message_first_argument(msg);
+    zframe_t *frame_header = zmsg_next(msg);
+    if ( zframe_size(frame_header) != sizeof(slice_header_t) ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+    slice_header_t slice_header = *(slice_header_t*)zframe_data(frame_header);
+
+    md5_value_t key_md5;
+    md5(&key_md5, (uint8_t *)zframe_data(frame_key), zframe_size(frame_key));
+
+    kvdb_view_t *view = bucketdb_read_view_from_storage(bucketdb, key_md5, slice_header.slice_idx);
+    if ( view == NULL ){
+        return create_slice_status_message(MSG_STATUS_WORKER_NOTFOUND, frame_key, frame_header);
+    }
+
+    if ( slice_header.slice_idx == 0 ){
+        object_header_t object_header;
+        if ( bucketdb_get_object_header(bucketdb, key_md5, &object_header) == 0 ){
+            slice_header.object_size = object_header.object_size;
+            slice_header.nslices = object_header.nslices;
+            slice_header.slice_size = object_header.slice_size;
+        } else {
+            /* Stored by a plain PUT. */
+            slice_header.object_size = view->size;
+            slice_header.nslices = 1;
+            slice_header.slice_size = view->size;
+        }
+    }
+
+    zmsg_t *sendback_msg = create_base_message(MSGTYPE_DATA);
+    zmsg_addmem(sendback_msg, zframe_data(frame_key), zframe_size(frame_key));
+    zmsg_addmem(sendback_msg, &slice_header, sizeof(slice_header_t));
+    zmsg_wrap(sendback_msg, identity);
+
+    message_send_zerocopy(&sendback_msg, sock, (void*)view->data, view->size, bucket_release_view, view);
+
+    return NULL;
+}
+
+/* ================ bucket_del_slice_data() ================ */
+/* A slice left past the end of a shrunk object. The key name stays, other
+ * slices of the object may still live in this bucket. */
+zmsg_t *bucket_del_slice_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zmsg_t *msg)
+{
+    bucketdb_t *bucketdb = bucket->bucketdb;
+
+    if ( message_total_arguments(msg) < 2 ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+
+    zframe_t *frame_key = message_first_argument(msg);
+    zframe_t *frame_header = zmsg_next(msg);
+    if ( zframe_size(frame_header) != sizeof(slice_header_t) ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+    slice_header_t *slice_header = (slice_header_t*)zframe_data(frame_header);
+
+    md5_value_t key_md5;
+    md5(&key_md5, (uint8_t *)zframe_data(frame_key), zframe_size(frame_key));
+
+    uint32_t total_deleted = 0;
+    int rc = bucketdb_delete_from_storage(bucketdb, key_md5, slice_header->slice_idx, &total_deleted);
+
+    /* Keep the size listed by SCAN in step with the other buckets. */
+    if ( rc == 0 && total_deleted > 0 ){
+        const char *key = (const char *)zframe_data(frame_key);
+        uint32_t key_len = zframe_size(frame_key);
+        key_record_t key_record;
+        key_record.key_md5 = key_md5;
+        key_record.object_size = slice_header->object_size;
+        rc = bucketdb_put_key_names(bucketdb, &key, &key_len, &key_record, 1);
+    }
+
+    const char *status = MSG_STATUS_WORKER_ACK;
+    if ( rc != 0 ){
+        status = MSG_STATUS_WORKER_ERROR;
+    } else if ( total_deleted == 0 ){
+        status = MSG_STATUS_WORKER_NOTFOUND;
+    }
+
+    return create_slice_status_message(status, frame_key, frame_header);
+}
+
+/* ================ add_scan_entry() ================ */
+static void add_scan_entry(void *user_data, const char *key, uint32_t key_len, uint64_t object_size)
+{
+    zmsg_t *entries = (zmsg_t*)user_data;
+    zmsg_addmem(entries, key, key_len);
+    zmsg_addmem(entries, &object_size, sizeof(uint64_t));
+}
+
+/* ================ bucket_scan_data() ================ */
+/* One page of the keys kept in this bucket, see MSG_ACTION_SCAN. */
+zmsg_t *bucket_scan_data(bucket_t *bucket, zsock_t *sock, zframe_t *identity, zmsg_t *msg)
+{
+    bucketdb_t *bucketdb = bucket->bucketdb;
+
+    if ( message_total_arguments(msg) < 3 ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+
+    zframe_t *frame_prefix = message_first_argument(msg);
+    zframe_t *frame_start_after = zmsg_next(msg);
+    zframe_t *frame_request = zmsg_next(msg);
+    if ( zframe_size(frame_request) != sizeof(scan_request_t) ){
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+    scan_request_t *scan_request = (scan_request_t*)zframe_data(frame_request);
+    uint32_t limit = scan_request->limit;
+    if ( limit == 0 || limit > SCAN_MAX_LIMIT ){
+        limit = SCAN_MAX_LIMIT;
+    }
+
+    zmsg_t *entries = zmsg_new();
+    int rc = bucketdb_scan_keys(bucketdb,
+            (const char *)zframe_data(frame_prefix), zframe_size(frame_prefix),
+            (const char *)zframe_data(frame_start_after), zframe_size(frame_start_after),
+            (char)scan_request->delimiter, limit, add_scan_entry, entries);
+    if ( rc < 0 ){
+        zmsg_destroy(&entries);
+        return create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+
+    scan_reply_t scan_reply;
+    scan_reply.total_entries = zmsg_size(entries) / 2;
+    scan_reply.more = rc;
+
+    zmsg_t *sendback_msg = create_status_message(MSG_STATUS_WORKER_ACK);
+    zmsg_addmem(sendback_msg, &scan_reply, sizeof(scan_reply_t));
+    zframe_t *frame = NULL;
+    while ( (frame = zmsg_pop(entries)) != NULL ){
+        zmsg_append(sendback_msg, &frame);
+    }
+    zmsg_destroy(&entries);
+
+    return sendback_msg;
+}
+
 /* ================ bucket_handle_message() ================ */
 int bucket_handle_message(bucket_t *bucket, zsock_t *sock, zmsg_t *msg)
 {
@@ -135,10 +435,22 @@ int bucket_handle_message(bucket_t *bucket, zsock_t *sock, zmsg_t *msg)
 
     if ( message_check_action(msg, MSG_ACTION_PUT) == 0 ){
         sendback_msg = bucket_put_data(bucket, sock, identity, msg);
+    } else if ( message_check_action(msg, MSG_ACTION_PUT_BATCH) == 0 ){
+        sendback_msg = bucket_put_batch_data(bucket, sock, identity, msg);
+    } else if ( message_check_action(msg, MSG_ACTION_PUT_SLICE) == 0 ){
+        sendback_msg = bucket_put_slice_data(bucket, sock, identity, msg);
     } else if (message_check_action(msg, MSG_ACTION_GET) == 0 ) {
         sendback_msg = bucket_get_data(bucket, sock, identity, msg);
+    } else if ( message_check_action(msg, MSG_ACTION_GET_SLICE) == 0 ){
+        sendback_msg = bucket_get_slice_data(bucket, sock, identity, msg);
     } else if (message_check_action(msg, MSG_ACTION_DEL) == 0 ) {
         sendback_msg = bucket_del_data(bucket, sock, identity, msg);
+    } else if ( message_check_action(msg, MSG_ACTION_DEL_SLICE) == 0 ){
+        sendback_msg = bucket_del_slice_data(bucket, sock, identity, msg);
+    } else if ( message_check_action(msg, MSG_ACTION_DEL_PREFIX) == 0 ){
+        sendback_msg = bucket_del_prefix_data(bucket, sock, identity, msg);
+    } else if ( message_check_action(msg, MSG_ACTION_SCAN) == 0 ){
+        sendback_msg = bucket_scan_data(bucket, sock, identity, msg);
     }
 
     zmsg_destroy(&msg);
@@ -151,6 +463,121 @@ int bucket_handle_message(bucket_t *bucket, zsock_t *sock, zmsg_t *msg)
     return 0;
 }
 
+/* ================ bucket_put_group() ================ */
+/* Same replies as bucket_put_data(), the data of all requests goes to
+ * storage in one write. */
+static void bucket_put_group(bucket_t *bucket, executor_request_t **requests, uint32_t total_requests)
+{
+    bucketdb_t *bucketdb = bucket->bucketdb;
+
+    zframe_t *identities[BUCKET_PUT_GROUP_MAX];
+    int valid[BUCKET_PUT_GROUP_MAX];
+    slice_t *slices[BUCKET_PUT_GROUP_MAX];
+    const char *keys[BUCKET_PUT_GROUP_MAX];
+    uint32_t key_lens[BUCKET_PUT_GROUP_MAX];
+    key_record_t key_records[BUCKET_PUT_GROUP_MAX];
+
+    uint32_t total_slices = 0;
+    for ( uint32_t i = 0 ; i < total_requests ; i++ ){
+        zmsg_t *msg = requests[i]->msg;
+        identities[i] = zmsg_unwrap(msg);
+        valid[i] = 0;
+        if ( message_total_arguments(msg) < 2 ){
+            continue;
+        }
+
+        zframe_t *frame_key = message_first_argument(msg);
+        zframe_t *frame_data = zmsg_next(msg);
+
+        keys[total_slices] = (const char *)zframe_data(frame_key);
+        key_lens[total_slices] = zframe_size(frame_key);
+        md5(&key_records[total_slices].key_md5, (uint8_t *)keys[total_slices], key_lens[total_slices]);
+        key_records[total_slices].object_size = zframe_size(frame_data);
+
+        uint32_t slice_idx = 0;
+        slices[total_slices] = slice_new(key_records[total_slices].key_md5, slice_idx, (const char *)zframe_data(frame_data), zframe_size(frame_data));
+        total_slices++;
+        valid[i] = 1;
+    }
+
+    int rc = 0;
+    if ( total_slices > 0 ){
+        rc = bucketdb_put_objects(bucketdb, slices, keys, key_lens, key_records, NULL, total_slices);
+        for ( uint32_t i = 0 ; i < total_slices ; i++ ){
+            slice_free(slices[i]);
+        }
+        trace_log("Bucket(%d) put %d slices in one write. rc:%d", bucket->id, total_slices, rc);
+    }
+
+    for ( uint32_t i = 0 ; i < total_requests ; i++ ){
+        zmsg_destroy(&requests[i]->msg);
+        zmsg_t *sendback_msg = create_status_message(valid[i] && rc == 0 ? MSG_STATUS_WORKER_ACK : MSG_STATUS_WORKER_ERROR);
+        zmsg_wrap(sendback_msg, identities[i]);
+        zmsg_send(&sendback_msg, requests[i]->reply_sock);
+    }
+}
+
+/* ================ request_check_action() ================ */
+/* message_check_action() looking past the envelope, which
+ * bucket_handle_message() unwraps. */
+static int request_check_action(zmsg_t *msg, const char *action)
+{
+    zframe_t *frame = zmsg_first(msg);
+    while ( frame != NULL && zframe_size(frame) > 0 ){
+        frame = zmsg_next(msg);
+    }
+    zframe_t *frame_msgtype = zmsg_next(msg);
+    const request_header_t *header = message_request_header(frame_msgtype);
+    if ( header != NULL ){
+        return memcmp(header->opcode, action, sizeof(header->opcode));
+    }
+    zframe_t *frame_action = zmsg_next(msg);
+    if ( frame_msgtype == NULL || frame_action == NULL || zframe_size(frame_msgtype) != sizeof(int16_t) ||
+            *(int16_t*)zframe_data(frame_msgtype) != MSGTYPE_ACTION || zframe_size(frame_action) < strlen(action) ){
+        return -1;
+    }
+
+    return memcmp(zframe_data(frame_action), action, strlen(action));
+}
+
+/* ================ bucket_is_read_request() ================ */
+/* Reads only need references to the slicedbs, channels run them on their
+ * own thread unless requests of the channel are still queued. Everything
+ * else goes to the storage thread. */
+int bucket_is_read_request(zmsg_t *msg)
+{
+    return request_check_action(msg, MSG_ACTION_GET) == 0 ||
+        request_check_action(msg, MSG_ACTION_GET_SLICE) == 0 ||
+        request_check_action(msg, MSG_ACTION_SCAN) == 0;
+}
+
+/* ================ bucket_handle_requests() ================ */
+/* executor_handler_fn of the bucket, runs on its storage thread. */
+static void bucket_handle_requests(void *user_data, executor_request_t **requests, uint32_t total_requests)
+{
+    bucket_t *bucket = (bucket_t*)user_data;
+
+    uint32_t i = 0;
+    while ( i < total_requests ){
+        uint32_t n = 0;
+        while ( i + n < total_requests && n < BUCKET_PUT_GROUP_MAX ){
+            if ( request_check_action(requests[i + n]->msg, MSG_ACTION_PUT) != 0 ){
+                break;
+            }
+            n++;
+        }
+
+        if ( n > 1 ){
+            bucket_put_group(bucket, &requests[i], n);
+            i += n;
+        } else {
+            bucket_handle_message(bucket, requests[i]->reply_sock, requests[i]->msg);
+            requests[i]->msg = NULL;
+            i++;
+        }
+    }
+}
+
 /* ================ bucket_thread_main() ================ */
 void bucket_thread_main(zsock_t *pipe, void *user_data)
 {
@@ -179,7 +606,10 @@ bucket_t *bucket_new(datanode_t *datanode, uint32_t bucket_id)
     bucket->verbose = datanode->verbose;
 
     /* -------- bucket->bucketdb -------- */
-    bucket->bucketdb = bucketdb_new(datanode->data_dir, bucket_id, bucket->storage_type);
+    bucket->bucketdb = bucketdb_new(datanode->data_dir, bucket_id, bucket->storage_type, &datanode->bucketdb_options);
+
+    /* -------- bucket->executor -------- */
+    bucket->executor = executor_new(bucket->total_channels, bucket_handle_requests, bucket);
 
     bucket->heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
 
@@ -196,6 +626,11 @@ void bucket_free(bucket_t *bucket)
 
     ZPIPE_ACTOR_FREE(bucket);
 
+    if ( bucket->executor != NULL ){
+        executor_free(bucket->executor);
+        bucket->executor = NULL;
+    }
+
     if ( bucket->bucketdb != NULL ){
         bucketdb_free(bucket->bucketdb);
         bucket->bucketdb = NULL;
@@ -24,6 +24,7 @@ typedef struct datanode_t datanode_t;
 typedef struct vnode_t vnode_t;
 typedef struct channel_t channel_t;
 typedef struct bucketdb_t bucketdb_t;
+typedef struct executor_t executor_t;
 
 /* -------- struct bucket_t -------- */
 typedef struct bucket_t {
@@ -41,6 +42,9 @@ typedef struct bucket_t {
     int verbose;
 
     bucketdb_t *bucketdb;
+    /* The single writer of bucketdb, every channel hands its writes to
+     * this storage thread and serves reads itself. */
+    executor_t *executor;
     //vnode_t *vnode;
     int64_t heartbeat_at;
 
@@ -50,6 +54,7 @@ typedef struct bucket_t {
 bucket_t *bucket_new(datanode_t *datanode, uint32_t bucket_id);
 void bucket_free(bucket_t *bucket);
 int bucket_handle_message(bucket_t *bucket, zsock_t *sock, zmsg_t *msg);
+int bucket_is_read_request(zmsg_t *msg);
 
 #ifdef __cplusplus
 }
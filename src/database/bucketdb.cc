@@ -14,6 +14,84 @@
 #include "filesystem.h"
 #include "kvdb.h"
 #include "object.h"
+#include "slicecache.h"
+#include "sliceindex.h"
+#include "compactor.h"
+#include "logstore.h"
+#include "scrubber.h"
+#include "slicecodec.h"
+#include "crc32c.h"
+#include <ftw.h>
+#include <dirent.h>
+
+typedef struct slice_metadata_t{
+    uint32_t version;
+    uint32_t slicedb_id;
+    uint32_t size;
+    uint32_t crc;
+    uint32_t codec;
+} slice_metadata_t;
+/* Records written before the size was kept. */
+#define SLICE_METADATA_V0_SIZE 8
+/* Records written before the checksum was kept. */
+#define SLICE_METADATA_V1_SIZE 12
+/* Records written before slices were compressed. */
+#define SLICE_METADATA_V2_SIZE 16
+
+/* slice_metadata_t.version of slices stored with their CRC32C. */
+#define SLICE_VERSION_CRC 1
+
+#define SLICEINDEX_SNAPSHOT "sliceindex.snap"
+
+/* Keys a prefix delete removes per transaction. */
+#define DELETE_BATCH_KEYS 128
+
+/* -------- struct tombstone_t -------- */
+/* Left in kvdb_tombstones by a slice deleted from a historical slicedb.
+ * Its bytes stay there until the compactor retires the slicedb, that
+ * also drops the tombstone. */
+typedef struct tombstone_t {
+    uint32_t slicedb_id;
+    uint32_t size;
+} tombstone_t;
+
+#define DEFAULT_MAX_OPEN_SLICEDBS 64
+#define DEFAULT_LOG_SEGMENT_SIZE (256L * 1024L * 1024L)
+
+/* Open slicedb environments of all buckets in the worker, most recently
+ * used first. Every env maps max_dbsize of address space and holds a few
+ * descriptors, historical slicedbs are opened on demand and the idle ones
+ * beyond max_open_slicedbs are closed again. */
+static pthread_mutex_t open_slicedbs_lock = PTHREAD_MUTEX_INITIALIZER;
+static slicedb_t *open_slicedbs_head = NULL;
+static slicedb_t *open_slicedbs_tail = NULL;
+static uint32_t total_open_slicedbs = 0;
+static uint32_t max_open_slicedbs = DEFAULT_MAX_OPEN_SLICEDBS;
+
+/* ================ bucketdb_options_init() ================= */
+void bucketdb_options_init(bucketdb_options_t *options)
+{
+    memset(options, 0, sizeof(bucketdb_options_t));
+    options->cache_size = 0;
+    options->compact_threshold = 50;
+    options->compact_rate = 16L * 1024L * 1024L;
+    options->max_open_slicedbs = DEFAULT_MAX_OPEN_SLICEDBS;
+    options->log_segment_size = DEFAULT_LOG_SEGMENT_SIZE;
+    options->verify_reads = 100;
+    options->scrub_rate = 4L * 1024L * 1024L;
+    options->compression = SLICE_CODEC_RAW;
+    options->cold_compression = SLICE_CODEC_RAW;
+}
+
+/* ================ bucketdb_set_max_open_slicedbs() ================= */
+void bucketdb_set_max_open_slicedbs(const bucketdb_options_t *options)
+{
+    if ( options->max_open_slicedbs > 0 ){
+        pthread_mutex_lock(&open_slicedbs_lock);
+        max_open_slicedbs = options->max_open_slicedbs;
+        pthread_mutex_unlock(&open_slicedbs_lock);
+    }
+}
 
 /* ================ slicedb_new() ================= */
 slicedb_t *slicedb_new(uint32_t id, kvdb_t *kvdb, uint64_t max_dbsize)
@@ -32,15 +110,75 @@ void slicedb_init(slicedb_t *slicedb, uint32_t id, kvdb_t *kvdb, uint64_t max_db
     slicedb->id = id;
     slicedb->kvdb = kvdb,
     slicedb->max_dbsize = max_dbsize;
+    slicedb->refs = 1;
 }
 
-/* ================ slicedb_free() ================= */
-void slicedb_free(slicedb_t *slicedb)
+/* ================ remove_file_callback() ================= */
+static int remove_file_callback(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+    return remove(fpath);
+}
+
+/* ================ open_slicedbs_unlink() ================= */
+static void open_slicedbs_unlink(slicedb_t *slicedb)
+{
+    if ( slicedb->lru_prev != NULL ){
+        slicedb->lru_prev->lru_next = slicedb->lru_next;
+    } else {
+        open_slicedbs_head = slicedb->lru_next;
+    }
+    if ( slicedb->lru_next != NULL ){
+        slicedb->lru_next->lru_prev = slicedb->lru_prev;
+    } else {
+        open_slicedbs_tail = slicedb->lru_prev;
+    }
+    slicedb->lru_prev = NULL;
+    slicedb->lru_next = NULL;
+}
+
+/* ================ open_slicedbs_push_front() ================= */
+static void open_slicedbs_push_front(slicedb_t *slicedb)
+{
+    slicedb->lru_prev = NULL;
+    slicedb->lru_next = open_slicedbs_head;
+    if ( open_slicedbs_head != NULL ){
+        open_slicedbs_head->lru_prev = slicedb;
+    } else {
+        open_slicedbs_tail = slicedb;
+    }
+    open_slicedbs_head = slicedb;
+}
+
+/* ================ slicedb_close() ================= */
+/* Called under open_slicedbs_lock. */
+static void slicedb_close(slicedb_t *slicedb)
 {
     if ( slicedb->kvdb != NULL ){
+        open_slicedbs_unlink(slicedb);
+        total_open_slicedbs--;
+
+        kvenv_t *kvenv = slicedb->kvdb->kvenv;
         kvdb_close(slicedb->kvdb);
         slicedb->kvdb = NULL;
+        kvenv_free(kvenv);
+    }
+}
+
+/* ================ slicedb_free() ================= */
+void slicedb_free(slicedb_t *slicedb)
+{
+    pthread_mutex_lock(&open_slicedbs_lock);
+    slicedb_close(slicedb);
+    pthread_mutex_unlock(&open_slicedbs_lock);
+
+    if ( slicedb->retired && slicedb->dbpath[0] != '\0' ){
+        if ( nftw(slicedb->dbpath, remove_file_callback, 8, FTW_DEPTH | FTW_PHYS) != 0 ){
+            error_log("Remove slicedb files failed. dbpath:%s", slicedb->dbpath);
+        } else {
+            notice_log("Removed retired slicedb. dbpath:%s", slicedb->dbpath);
+        }
     }
+
     zfree(slicedb);
 }
 
@@ -88,38 +226,287 @@ kvdb_t *open_kvdb(const char *dbname, int storage_type, const char *root_dir, ui
     return kvdb;
 }
 
+/* ================ evict_open_slicedbs() ================= */
+/* Called under open_slicedbs_lock. Slicedbs in use are skipped, so the
+ * limit may be exceeded for a while. */
+static void evict_open_slicedbs(void)
+{
+    slicedb_t *slicedb = open_slicedbs_tail;
+    while ( slicedb != NULL && total_open_slicedbs > max_open_slicedbs ){
+        slicedb_t *prev = slicedb->lru_prev;
+        if ( slicedb->users == 0 ){
+            trace_log("Close idle slicedb. dbpath:%s", slicedb->dbpath);
+            slicedb_close(slicedb);
+        }
+        slicedb = prev;
+    }
+}
+
+/* ================ slicedb_open() ================= */
+/* The caller holds a reference. Opens the environment if it is closed and
+ * registers one more user of it, see slicedb_unuse(). */
+static int slicedb_open(bucketdb_t *bucketdb, slicedb_t *slicedb)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&open_slicedbs_lock);
+
+    if ( slicedb->kvdb == NULL ){
+        char dbname[NAME_MAX];
+        sprintf(dbname, "slice-%03d", slicedb->id);
+
+        uint32_t max_dbs = 4;
+        slicedb->kvdb = open_kvdb(dbname, bucketdb->storage_type, bucketdb->root_dir, slicedb->max_dbsize, max_dbs);
+        if ( slicedb->kvdb != NULL ){
+            open_slicedbs_push_front(slicedb);
+            total_open_slicedbs++;
+        } else {
+            error_log("SliceDB open failed. dbname:%s", dbname);
+            rc = -1;
+        }
+    } else if ( open_slicedbs_head != slicedb ){
+        open_slicedbs_unlink(slicedb);
+        open_slicedbs_push_front(slicedb);
+    }
+
+    if ( rc == 0 ){
+        slicedb->users++;
+        evict_open_slicedbs();
+    }
+
+    pthread_mutex_unlock(&open_slicedbs_lock);
+
+    return rc;
+}
+
+/* ================ slicedb_unuse() ================= */
+static void slicedb_unuse(slicedb_t *slicedb)
+{
+    pthread_mutex_lock(&open_slicedbs_lock);
+    assert(slicedb->users > 0);
+    slicedb->users--;
+    evict_open_slicedbs();
+    pthread_mutex_unlock(&open_slicedbs_lock);
+}
+
+/* ================ slicedb_unref() ================= */
+static void slicedb_unref(slicedb_t *slicedb)
+{
+    if ( __sync_sub_and_fetch(&slicedb->refs, 1) == 0 ){
+        slicedb_free(slicedb);
+    }
+}
+
+/* ================ slicedbs_read_begin() ================= */
+/* A synchronize flipping the epoch between the load and the increment
+ * may already have drained the counter we joined, so join again. */
+static uint32_t slicedbs_read_begin(bucketdb_t *bucketdb)
+{
+    while ( 1 ){
+        uint32_t epoch = bucketdb->slicedbs_epoch;
+        __sync_add_and_fetch(&bucketdb->slicedbs_readers[epoch & 1], 1);
+        if ( bucketdb->slicedbs_epoch == epoch ){
+            return epoch & 1;
+        }
+        __sync_sub_and_fetch(&bucketdb->slicedbs_readers[epoch & 1], 1);
+    }
+}
+
+/* ================ slicedbs_read_end() ================= */
+static void slicedbs_read_end(bucketdb_t *bucketdb, uint32_t epoch)
+{
+    __sync_sub_and_fetch(&bucketdb->slicedbs_readers[epoch], 1);
+}
+
+/* ================ slicedbs_synchronize() ================= */
+/* Called under write_lock after clearing a slot of slicedbs[]. Readers
+ * counted after the flip can only see the cleared slot, the ones of the
+ * previous epoch are waited for. They only take a reference, so this is
+ * short. */
+static void slicedbs_synchronize(bucketdb_t *bucketdb)
+{
+    uint32_t epoch = __sync_fetch_and_add(&bucketdb->slicedbs_epoch, 1) & 1;
+    while ( __sync_add_and_fetch(&bucketdb->slicedbs_readers[epoch], 0) != 0 ){
+        sched_yield();
+    }
+}
+
+/* ================ bucketdb_unpublish_slicedb() ================= */
+/* Clear slot db_id and drop the table's reference once no reader can
+ * pick it up anymore. */
+static void bucketdb_unpublish_slicedb(bucketdb_t *bucketdb, uint32_t db_id)
+{
+    slicedb_t *slicedb = bucketdb->slicedbs[db_id];
+    bucketdb->slicedbs[db_id] = NULL;
+    __sync_synchronize();
+    slicedbs_synchronize(bucketdb);
+    slicedb_unref(slicedb);
+}
+
+/* ================ bucketdb_pin_slicedb() ================= */
+/* Reference and open a slicedb already in bucketdb->slicedbs[], for
+ * callers holding write_lock. Undone by bucketdb_release_slicedb(). */
+static int bucketdb_pin_slicedb(bucketdb_t *bucketdb, slicedb_t *slicedb)
+{
+    __sync_add_and_fetch(&slicedb->refs, 1);
+    if ( slicedb_open(bucketdb, slicedb) != 0 ){
+        slicedb_unref(slicedb);
+        return -1;
+    }
+    return 0;
+}
+
+/* ================ bucketdb_add_slicedb() ================= */
+/* Registers slicedb db_id, its environment is opened on first use. */
+static slicedb_t *bucketdb_add_slicedb(bucketdb_t *bucketdb, uint32_t db_id)
+{
+    slicedb_t *slicedb = slicedb_new(db_id, NULL, bucketdb->max_dbsize);
+    sprintf(slicedb->dbpath, "%s/slice-%03d", bucketdb->root_dir, db_id);
+
+    __sync_synchronize();
+    bucketdb->slicedbs[db_id] = slicedb;
+
+    return slicedb;
+}
+
 /* ================ bucketdb_open_slicedb() ================= */
+/* Registers slicedb db_id and opens it at once, for the active slicedb.
+ * The extra reference keeps it open until it is rolled over. */
 slicedb_t *bucketdb_open_slicedb(bucketdb_t *bucketdb, uint32_t db_id)
 {
-    slicedb_t *slicedb = NULL;
+    slicedb_t *slicedb = bucketdb_add_slicedb(bucketdb, db_id);
+    if ( bucketdb_pin_slicedb(bucketdb, slicedb) != 0 ){
+        bucketdb_unpublish_slicedb(bucketdb, db_id);
+        return NULL;
+    }
+
+    return slicedb;
+}
 
-    char dbname[NAME_MAX];
-    sprintf(dbname, "slice-%03d", db_id);
+/* ================ bucketdb_next_slicedb_id() ================= */
+/* Lowest id that is neither open nor still on disk, ids of slicedbs removed
+ * by the compactor are reused. */
+static int bucketdb_next_slicedb_id(bucketdb_t *bucketdb, uint32_t *p_slicedb_id)
+{
+    for ( uint32_t db_id = 0 ; db_id < SLICEDB_MAX ; db_id++ ){
+        if ( bucketdb->slicedbs[db_id] == NULL ){
+            char dbpath[NAME_MAX];
+            sprintf(dbpath, "%s/slice-%03d", bucketdb->root_dir, db_id);
+            if ( !file_exist(dbpath) ){
+                *p_slicedb_id = db_id;
+                return 0;
+            }
+        }
+    }
 
-    uint64_t max_dbsize = bucketdb->max_dbsize;
-    uint32_t max_dbs = 4;
-    kvdb_t *kvdb = open_kvdb(dbname, bucketdb->storage_type, bucketdb->root_dir, max_dbsize, max_dbs);
+    error_log("All %d slicedbs in use. bucketdb->id:%d", SLICEDB_MAX, bucketdb->id);
+    return -1;
+}
 
-    if ( kvdb != NULL ){
-        slicedb = slicedb_new(db_id, kvdb, bucketdb->max_dbsize);
-        bucketdb->slicedbs[db_id] = slicedb;
-    } else {
-        error_log("SliceDB create failed. dbname:%s", dbname);
+/* ================ metadata_to_location() ================= */
+static int metadata_to_location(const char *value, uint32_t vlen, slice_location_t *location)
+{
+    if ( vlen != sizeof(slice_metadata_t) && vlen != SLICE_METADATA_V2_SIZE && vlen != SLICE_METADATA_V1_SIZE && vlen != SLICE_METADATA_V0_SIZE ){
+        return -1;
+    }
+    slice_metadata_t slice_metadata;
+    memset(&slice_metadata, 0, sizeof(slice_metadata_t));
+    memcpy(&slice_metadata, value, vlen);
+
+    location->version = slice_metadata.version;
+    location->slicedb_id = slice_metadata.slicedb_id;
+    location->size = slice_metadata.size;
+    location->crc = slice_metadata.crc;
+    location->codec = slice_metadata.codec;
+    if ( vlen < SLICE_METADATA_V2_SIZE ){
+        location->version = 0;
     }
 
-    return slicedb;
+    return 0;
+}
+
+/* ================ bucketdb_account_slice() ================= */
+/* Called under write_lock, sign is +1 when location starts to be live and
+ * -1 when it stops. */
+static void bucketdb_account_slice(bucketdb_t *bucketdb, const slice_location_t *location, int sign)
+{
+    if ( location->slicedb_id >= SLICEDB_MAX ){
+        return;
+    }
+    slicedb_t *slicedb = bucketdb->slicedbs[location->slicedb_id];
+    if ( slicedb != NULL ){
+        if ( sign > 0 ){
+            slicedb->live_bytes += location->size;
+            slicedb->live_slices++;
+        } else {
+            slicedb->live_bytes -= location->size;
+            slicedb->live_slices--;
+        }
+    }
+}
+
+/* ================ account_slice_callback() ================= */
+static void account_slice_callback(void *user_data, const slice_key_t *slice_key, const slice_location_t *location)
+{
+    bucketdb_account_slice((bucketdb_t*)user_data, location, 1);
+}
+
+/* ================ rebuild_sliceindex_callback() ================= */
+static int rebuild_sliceindex_callback(void *user_data, const char *key, uint32_t klen, const char *value, uint32_t vlen)
+{
+    sliceindex_t *sliceindex = (sliceindex_t*)user_data;
+
+    /* Object headers and named values share the DB, keys differ in size. */
+    slice_location_t location;
+    if ( klen == sizeof(slice_key_t) && metadata_to_location(value, vlen, &location) == 0 ){
+        sliceindex_put(sliceindex, (const slice_key_t*)key, &location);
+    }
+
+    return 0;
+}
+
+/* ================ bucketdb_load_sliceindex() ================= */
+/* The snapshot is only written by a clean shutdown and removed once it is
+ * loaded, so after a crash the index is rebuilt from the metadata DB. */
+static int bucketdb_load_sliceindex(bucketdb_t *bucketdb)
+{
+    char snapshot_file[NAME_MAX];
+    sprintf(snapshot_file, "%s/%s", bucketdb->root_dir, SLICEINDEX_SNAPSHOT);
+
+    bucketdb->sliceindex = sliceindex_new(0);
+    if ( sliceindex_load(bucketdb->sliceindex, snapshot_file) == 0 ){
+        unlink(snapshot_file);
+        notice_log("bucketdb(%d) loaded %d slices from sliceindex snapshot.", bucketdb->id, sliceindex_size(bucketdb->sliceindex));
+        return 0;
+    }
+
+    if ( kvdb_scan(bucketdb->kvdb_metadata, NULL, 0, rebuild_sliceindex_callback, bucketdb->sliceindex) != 0 ){
+        error_log("Rebuild sliceindex failed. bucketdb->id:%d", bucketdb->id);
+        return -1;
+    }
+    notice_log("bucketdb(%d) rebuilt sliceindex with %d slices.", bucketdb->id, sliceindex_size(bucketdb->sliceindex));
+
+    return 0;
 }
 
 /* ================ bucketdb_new() ================= */
-bucketdb_t *bucketdb_new(const char *root_dir, uint32_t id, int storage_type)
+bucketdb_t *bucketdb_new(const char *root_dir, uint32_t id, int storage_type, const bucketdb_options_t *options)
 {
     bucketdb_t *bucketdb = (bucketdb_t*)zmalloc(sizeof(bucketdb_t));
     memset(bucketdb, 0, sizeof(bucketdb_t));
 
+    if ( options != NULL ){
+        bucketdb->options = *options;
+    } else {
+        bucketdb_options_init(&bucketdb->options);
+    }
+
     bucketdb->id = id;
     bucketdb->storage_type = storage_type;
     bucketdb->max_dbsize = 1024L * 1024L * 800L;
 
+    pthread_mutex_init(&bucketdb->write_lock, NULL);
+
     /* Create bucketdbn root dir */
     sprintf(bucketdb->root_dir, "%s/%04d", root_dir, id);
     if ( mkdir_if_not_exist(bucketdb->root_dir) != 0 ){
@@ -140,6 +527,26 @@ bucketdb_t *bucketdb_new(const char *root_dir, uint32_t id, int storage_type)
     }
     bucketdb->kvdb_metadata = kvdb_metadata;
 
+    bucketdb->kvdb_keys = kvdb_open(kvdb_metadata->kvenv, "keys");
+    bucketdb->kvdb_tombstones = kvdb_open(kvdb_metadata->kvenv, "tombstones");
+    if ( bucketdb->kvdb_keys == NULL || bucketdb->kvdb_tombstones == NULL ){
+        error_log("Open keys and tombstones DB failed. bucketdb->id:%d", id);
+        if ( bucketdb->kvdb_keys != NULL ) kvdb_close(bucketdb->kvdb_keys);
+        if ( bucketdb->kvdb_tombstones != NULL ) kvdb_close(bucketdb->kvdb_tombstones);
+        kvdb_close(kvdb_metadata);
+        zfree(bucketdb);
+        return NULL;
+    }
+
+    if ( bucketdb_load_sliceindex(bucketdb) != 0 ){
+        sliceindex_free(bucketdb->sliceindex);
+        kvdb_close(bucketdb->kvdb_tombstones);
+        kvdb_close(bucketdb->kvdb_keys);
+        kvdb_close(kvdb_metadata);
+        zfree(bucketdb);
+        return NULL;
+    }
+
     /* Slices DB */
     if ( bucketdb->storage_type >= BUCKETDB_KVDB ){
         uint32_t active_slicedb_id = 0;
@@ -148,23 +555,59 @@ bucketdb_t *bucketdb_new(const char *root_dir, uint32_t id, int storage_type)
         }
         trace_log("bucketdb active_slicedb_id:%d", active_slicedb_id);
 
-        // Create Slice DB.
-        for ( int db_id = 0 ; db_id <= active_slicedb_id ; db_id++ ){
-            slicedb_t *slicedb = bucketdb_open_slicedb(bucketdb, db_id);
-            if ( slicedb != NULL ){
-            } else {
-                for ( int n = 0 ; n < db_id ; n++ ){
-                    slicedb_free(bucketdb->slicedbs[n]);
-                    bucketdb->slicedbs[n] = NULL;
+        // Register Slice DBs, only the active one is opened now.
+        // Compaction leaves holes in the ids.
+        for ( uint32_t db_id = 0 ; db_id < SLICEDB_MAX ; db_id++ ){
+            if ( db_id != active_slicedb_id ){
+                char dbpath[NAME_MAX];
+                sprintf(dbpath, "%s/slice-%03d", bucketdb->root_dir, db_id);
+                if ( file_exist(dbpath) ){
+                    bucketdb_add_slicedb(bucketdb, db_id);
                 }
-                zfree(bucketdb);
-                return NULL;
             }
         }
-        bucketdb->active_slicedb = bucketdb->slicedbs[active_slicedb_id];
+        bucketdb->active_slicedb = bucketdb_open_slicedb(bucketdb, active_slicedb_id);
+        if ( bucketdb->active_slicedb == NULL ){
+            for ( uint32_t db_id = 0 ; db_id < SLICEDB_MAX ; db_id++ ){
+                if ( bucketdb->slicedbs[db_id] != NULL ){
+                    slicedb_free(bucketdb->slicedbs[db_id]);
+                    bucketdb->slicedbs[db_id] = NULL;
+                }
+            }
+            sliceindex_free(bucketdb->sliceindex);
+            kvdb_close(bucketdb->kvdb_tombstones);
+            kvdb_close(bucketdb->kvdb_keys);
+            kvdb_close(kvdb_metadata);
+            zfree(bucketdb);
+            return NULL;
+        }
+
+        sliceindex_foreach(bucketdb->sliceindex, account_slice_callback, bucketdb);
+    } else if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
+        uint64_t log_segment_size = bucketdb->options.log_segment_size > 0 ? bucketdb->options.log_segment_size : DEFAULT_LOG_SEGMENT_SIZE;
+        bucketdb->logstore = logstore_new(bucketdb->root_dir, log_segment_size, bucketdb->options.compact_threshold, bucketdb->options.compact_rate);
+        if ( bucketdb->logstore == NULL ){
+            error_log("Open logstore failed. bucketdb->id:%d", id);
+            sliceindex_free(bucketdb->sliceindex);
+            kvdb_close(bucketdb->kvdb_tombstones);
+            kvdb_close(bucketdb->kvdb_keys);
+            kvdb_close(kvdb_metadata);
+            zfree(bucketdb);
+            return NULL;
+        }
+    }
+
+    if ( bucketdb->options.cache_size > 0 ){
+        bucketdb->slicecache = slicecache_new(bucketdb->options.cache_size);
     }
 
-    /*bucketdb->caching_objects = object_queue_new(object_compare_md5_func);*/
+    if ( bucketdb->storage_type >= BUCKETDB_KVDB && bucketdb->options.compact_threshold > 0 ){
+        bucketdb->compactor = compactor_new(bucketdb, bucketdb->options.compact_threshold, bucketdb->options.compact_rate);
+    }
+
+    if ( bucketdb->storage_type >= BUCKETDB_KVDB && bucketdb->options.scrub_rate > 0 ){
+        bucketdb->scrubber = scrubber_new(bucketdb, bucketdb->options.scrub_rate);
+    }
 
     return bucketdb;
 }
@@ -172,26 +615,79 @@ bucketdb_t *bucketdb_new(const char *root_dir, uint32_t id, int storage_type)
 /* ================ bucketdb_free() ================= */
 void bucketdb_free(bucketdb_t *bucketdb)
 {
+    if ( bucketdb->scrubber != NULL ){
+        scrubber_free(bucketdb->scrubber);
+        bucketdb->scrubber = NULL;
+    }
+
+    if ( bucketdb->compactor != NULL ){
+        compactor_free(bucketdb->compactor);
+        bucketdb->compactor = NULL;
+    }
+
+    if ( bucketdb->logstore != NULL ){
+        logstore_free(bucketdb->logstore);
+        bucketdb->logstore = NULL;
+    }
 
     if ( bucketdb->active_slicedb != NULL ){
-        uint32_t active_slicedb_id = bucketdb->active_slicedb->id;
-        for ( int db_id = 0 ; db_id < active_slicedb_id ; db_id++ ){
-            if ( bucketdb->slicedbs[db_id] != NULL ){
-                slicedb_free(bucketdb->slicedbs[db_id]);
-                bucketdb->slicedbs[db_id] = NULL;
-            }
+        bucketdb_release_slicedb(bucketdb, bucketdb->active_slicedb);
+        bucketdb->active_slicedb = NULL;
+    }
+
+    for ( uint32_t db_id = 0 ; db_id < SLICEDB_MAX ; db_id++ ){
+        slicedb_t *slicedb = bucketdb->slicedbs[db_id];
+        if ( slicedb != NULL ){
+            bucketdb->slicedbs[db_id] = NULL;
+            slicedb_unref(slicedb);
         }
     }
 
+    if ( bucketdb->batch_updates != NULL ){
+        zfree(bucketdb->batch_updates);
+        bucketdb->batch_updates = NULL;
+    }
+
+    if ( bucketdb->sliceindex != NULL ){
+        char snapshot_file[NAME_MAX];
+        sprintf(snapshot_file, "%s/%s", bucketdb->root_dir, SLICEINDEX_SNAPSHOT);
+        sliceindex_save(bucketdb->sliceindex, snapshot_file);
+
+        sliceindex_free(bucketdb->sliceindex);
+        bucketdb->sliceindex = NULL;
+    }
+
+    if ( bucketdb->kvdb_tombstones != NULL ){
+        kvdb_close(bucketdb->kvdb_tombstones);
+        bucketdb->kvdb_tombstones = NULL;
+    }
+    if ( bucketdb->kvdb_keys != NULL ){
+        kvdb_close(bucketdb->kvdb_keys);
+        bucketdb->kvdb_keys = NULL;
+    }
+
     if ( bucketdb->kvdb_metadata != NULL ){
         kvdb_close(bucketdb->kvdb_metadata);
         bucketdb->kvdb_metadata = NULL;
     }
 
-    /*if ( bucketdb->caching_objects != NULL ){*/
-        /*object_queue_free(bucketdb->caching_objects);*/
-        /*bucketdb->caching_objects = NULL;*/
-    /*}*/
+    if ( bucketdb->slicecache != NULL ){
+        slicecache_stats_t stats;
+        slicecache_get_stats(bucketdb->slicecache, &stats);
+        notice_log("bucketdb(%d) cache hits:%llu misses:%llu inserts:%llu evictions:%llu invalidations:%llu used:%llu/%llu",
+                bucketdb->id, (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+                (unsigned long long)stats.inserts, (unsigned long long)stats.evictions,
+                (unsigned long long)stats.invalidations, (unsigned long long)stats.used_bytes,
+                (unsigned long long)stats.capacity);
+        slicecache_free(bucketdb->slicecache);
+        bucketdb->slicecache = NULL;
+    }
+
+    if ( bucketdb->total_corrupt_slices > 0 ){
+        warning_log("bucketdb(%d) found %d corrupt slices.", bucketdb->id, bucketdb->total_corrupt_slices);
+    }
+
+    pthread_mutex_destroy(&bucketdb->write_lock);
 
     zfree(bucketdb);
 }
@@ -212,21 +708,34 @@ int bucketdb_get_metadata(bucketdb_t *bucketdb, const char *key, char **data, ui
     return kvdb_get(bucketdb->kvdb_metadata, key, strlen(key), (void**)data, data_size);
 }
 
+/* ================ bucketdb_put_object_header() ================= */
+/* Keyed by the bare md5, which never collides with a slice_key_t. */
+int bucketdb_put_object_header(bucketdb_t *bucketdb, md5_value_t key_md5, const object_header_t *header)
+{
+    assert(bucketdb->kvdb_metadata != NULL);
+
+    return kvdb_put(bucketdb->kvdb_metadata, (const char *)&key_md5, sizeof(md5_value_t), (void*)header, sizeof(object_header_t));
+}
 
-/* ==================== bucketdb_write_to_file() ==================== */
-int bucketdb_write_to_file(bucketdb_t *bucketdb, object_t *object)
+/* ================ bucketdb_get_object_header() ================= */
+int bucketdb_get_object_header(bucketdb_t *bucketdb, md5_value_t key_md5, object_header_t *header)
 {
-    /*int logFile = bucketdb->logFile;*/
-    /*if ( logFile == 0 ) {*/
-        /*char log_filename[NAME_MAX];*/
-        /*sprintf(log_filename, "%s/bucketdb.log", bucketdb->root_dir);*/
-        /*logFile = open(log_filename, O_APPEND | O_CREAT | O_WRONLY, 0640);*/
-        /*bucketdb->logFile = logFile;*/
-    /*}*/
+    assert(bucketdb->kvdb_metadata != NULL);
 
-    /*object_put_into_file(logFile, object);*/
+    int rc = -1;
+    object_header_t *value = NULL;
+    uint32_t value_len = 0;
+    if ( kvdb_get(bucketdb->kvdb_metadata, (const char *)&key_md5, sizeof(md5_value_t), (void**)&value, &value_len) == 0 ){
+        if ( value != NULL && value_len == sizeof(object_header_t) ){
+            *header = *value;
+            rc = 0;
+        }
+    }
+    if ( value != NULL ){
+        zfree(value);
+    }
 
-    return 0;
+    return rc;
 }
 
 /* ==================== bucketdb_write_to_kvdb() ==================== */
@@ -237,127 +746,1395 @@ int bucketdb_write_to_kvdb(bucketdb_t *bucketdb, object_t *object)
     return 0;
 }
 
-typedef struct slice_metadata_t{
-    uint32_t version;
-    uint32_t slicedb_id;
-} slice_metadata_t;
-
-/* ==================== bucketdb_get_slicedb_id() ==================== */
-int bucketdb_get_slicedb_id(bucketdb_t *bucketdb, slice_key_t *slice_key, uint32_t *p_slicedb_id)
+/* ==================== bucketdb_ref_slicedb() ==================== */
+static slicedb_t *bucketdb_ref_slicedb(bucketdb_t *bucketdb, uint32_t slicedb_id)
 {
-    int ret = 0;
+    slicedb_t *slicedb = NULL;
 
-    slice_metadata_t *slice_metadata = NULL;
-    uint32_t value_len = 0;
-    if ( kvdb_get(bucketdb->kvdb_metadata, (const char*)slice_key, sizeof(slice_key_t), (void**)&slice_metadata, &value_len) == 0 ){
-        if ( slice_metadata != NULL && value_len == sizeof(slice_metadata_t) ){
-            *p_slicedb_id = slice_metadata->slicedb_id;
-            ret = 1;
+    if ( slicedb_id < SLICEDB_MAX ){
+        uint32_t epoch = slicedbs_read_begin(bucketdb);
+        slicedb = bucketdb->slicedbs[slicedb_id];
+        if ( slicedb != NULL ){
+            __sync_add_and_fetch(&slicedb->refs, 1);
         }
+        slicedbs_read_end(bucketdb, epoch);
     }
 
-    return ret;
+    return slicedb;
 }
 
-/* ==================== bucketdb_write_to_storage() ==================== */
-int bucketdb_write_to_storage(bucketdb_t *bucketdb, slice_t *slice)
+/* ==================== bucketdb_acquire_slicedb() ==================== */
+slicedb_t *bucketdb_acquire_slicedb(bucketdb_t *bucketdb, uint32_t slicedb_id)
 {
-    int ret = 0;
+    slicedb_t *slicedb = bucketdb_ref_slicedb(bucketdb, slicedb_id);
+    if ( slicedb != NULL && slicedb_open(bucketdb, slicedb) != 0 ){
+        slicedb_unref(slicedb);
+        slicedb = NULL;
+    }
 
-    if ( bucketdb->storage_type >= BUCKETDB_KVDB ){
-        uint32_t active_slicedb_id = bucketdb->active_slicedb->id;
-        uint32_t slicedb_id = active_slicedb_id;
-        int old_slice = bucketdb_get_slicedb_id(bucketdb, &slice->slice_key, &slicedb_id);
-
-        int try_to_write_full_db = 0;
-        if ( kvenv_get_dbsize(bucketdb->active_slicedb->kvdb->kvenv) > 0.9 * bucketdb->active_slicedb->max_dbsize ){
-            if ( old_slice  && active_slicedb_id == slicedb_id ){
-                try_to_write_full_db = 1;
-            }
-            slicedb_t *slicedb = bucketdb_open_slicedb(bucketdb, active_slicedb_id + 1);
-            bucketdb->active_slicedb = slicedb;
+    return slicedb;
+}
 
-            if ( kvdb_put_uint32(bucketdb->kvdb_metadata, "active_slicedb_id", active_slicedb_id) != 0 ){
-                error_log("Save active_slicedb_id failed. bucketdb->id:%d active_slicedb_id:%d", bucketdb->id, active_slicedb_id + 1);
-            }
-        }
+/* ==================== bucketdb_release_slicedb() ==================== */
+void bucketdb_release_slicedb(bucketdb_t *bucketdb, slicedb_t *slicedb)
+{
+    slicedb_unuse(slicedb);
+    slicedb_unref(slicedb);
+}
 
-        slicedb_t *active_slicedb = bucketdb->active_slicedb;
+/* ==================== directory_size() ==================== */
+static uint64_t directory_size(const char *path)
+{
+    uint64_t total_size = 0;
 
-        if ( old_slice ) {
-            if ( try_to_write_full_db ){
-                ret = slice_delete_from_kvdb(bucketdb->slicedbs[slicedb_id]->kvdb, slice->slice_key.key_md5, slice->slice_key.slice_idx);
-            } else {
-                active_slicedb = bucketdb->slicedbs[slicedb_id];
+    DIR *dir = opendir(path);
+    if ( dir == NULL ){
+        return 0;
+    }
+    struct dirent *entry;
+    while ( (entry = readdir(dir)) != NULL ){
+        if ( strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ){
+            continue;
+        }
+        char entry_path[PATH_MAX];
+        snprintf(entry_path, PATH_MAX, "%s/%s", path, entry->d_name);
+        struct stat st;
+        if ( lstat(entry_path, &st) == 0 ){
+            if ( S_ISDIR(st.st_mode) ){
+                total_size += directory_size(entry_path);
+            } else if ( S_ISREG(st.st_mode) ){
+                total_size += st.st_size;
             }
         }
+    }
+    closedir(dir);
 
-        slice_metadata_t slice_metadata;
-        memset(&slice_metadata, 0, sizeof(slice_metadata_t));
-        slice_metadata.version = 0;
-        slice_metadata.slicedb_id = active_slicedb->id;
-        ret = kvdb_put(bucketdb->kvdb_metadata, (const char *)&slice->slice_key, sizeof(slice_key_t), (void*)&slice_metadata, sizeof(slice_metadata_t));
-        if ( ret == 0 ){
-            ret = slice_write_to_kvdb(active_slicedb->kvdb, slice);
-        } else {
-            error_log("Write metadata failed. bucketdb->id:%d slice_idx:%d", bucketdb->id, slice->slice_key.slice_idx);
-        }
-    } else if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
-        /*ret = bucketdb_write_to_file(bucketdb, object);*/
+    return total_size;
+}
+
+/* ==================== bucketdb_get_slicedb_usage() ==================== */
+/* A closed slicedb is measured on disk, which is what an open one would
+ * report as well once its pages are flushed. */
+int bucketdb_get_slicedb_usage(bucketdb_t *bucketdb, uint32_t slicedb_id, uint64_t *live_bytes, uint64_t *dbsize)
+{
+    slicedb_t *slicedb = bucketdb_ref_slicedb(bucketdb, slicedb_id);
+    if ( slicedb == NULL ){
+        return -1;
     }
 
-    if ( ret == 0 ) {
-        /*object_queue_remove(bucketdb->caching_objects, object);*/
+    *live_bytes = slicedb->live_bytes;
+
+    int is_open = 0;
+    pthread_mutex_lock(&open_slicedbs_lock);
+    if ( slicedb->kvdb != NULL ){
+        *dbsize = kvenv_get_dbsize(slicedb->kvdb->kvenv);
+        is_open = 1;
+    }
+    pthread_mutex_unlock(&open_slicedbs_lock);
+    if ( !is_open ){
+        *dbsize = directory_size(slicedb->dbpath);
     }
 
-    return ret;
+    slicedb_unref(slicedb);
+
+    return 0;
 }
 
-/* ==================== bucketdb_read_from_storage() ==================== */
-slice_t *bucketdb_read_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx)
+/* ==================== bucketdb_acquire_slicedb_of() ==================== */
+/* The slicedb holding slice_key, with a reference, and where it is in
+ * location. The compactor may move the slice and retire its slicedb
+ * between the index lookup and the acquire, then the index already points
+ * at the new place. */
+static slicedb_t *bucketdb_acquire_slicedb_of(bucketdb_t *bucketdb, const slice_key_t *slice_key, slice_location_t *location)
 {
-    slice_key_t slice_key;
-    slice_key.key_md5 = key_md5;
-    slice_key.slice_idx = slice_idx;
-    slice_t *slice = NULL;
+    for ( int retry = 0 ; retry < 2 ; retry++ ){
+        if ( !sliceindex_get(bucketdb->sliceindex, slice_key, location) ){
+            return NULL;
+        }
+        slicedb_t *slicedb = bucketdb_acquire_slicedb(bucketdb, location->slicedb_id);
+        if ( slicedb != NULL ){
+            return slicedb;
+        }
+    }
 
-    if ( bucketdb->storage_type >= BUCKETDB_KVDB ){
+    return NULL;
+}
 
-        uint32_t active_slicedb_id = bucketdb->active_slicedb->id;
-        uint32_t slicedb_id = active_slicedb_id;
-        int old_slice = bucketdb_get_slicedb_id(bucketdb, &slice_key, &slicedb_id);
+/* ==================== bucketdb_is_live_slice() ==================== */
+int bucketdb_is_live_slice(bucketdb_t *bucketdb, const slice_key_t *slice_key, uint32_t slicedb_id)
+{
+    slice_location_t location;
+    return sliceindex_get(bucketdb->sliceindex, slice_key, &location) && location.slicedb_id == slicedb_id;
+}
 
-        if ( old_slice ){
-            slice = slice_read_from_kvdb(bucketdb->slicedbs[slicedb_id]->kvdb, key_md5, slice_idx);
-        }
-    } else if (bucketdb->storage_type == BUCKETDB_NONE ){
-        slice = slice_new(key_md5, slice_idx, NULL, 0);
-    } else if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
+/* ==================== bucketdb_verify_slice() ==================== */
+int bucketdb_verify_slice(bucketdb_t *bucketdb, const slice_key_t *slice_key, uint32_t slicedb_id, const char *data, uint32_t size)
+{
+    slice_location_t location;
+    if ( !sliceindex_get(bucketdb->sliceindex, slice_key, &location) || location.slicedb_id != slicedb_id ){
+        return 1;
+    }
+    if ( location.version < SLICE_VERSION_CRC ){
+        return 0;
     }
 
-    return slice;
+    return crc32c(0, data, size) == location.crc && size == location.size ? 0 : -1;
 }
 
-/* ==================== bucketdb_delete_from_storage() ==================== */
-int bucketdb_delete_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx)
+/* ==================== bucketdb_reread_slice() ==================== */
+/* The index follows the commit of the slicedbs, so a reader racing a
+ * writer may see new data next to the old index entry. Holding write_lock
+ * rules that out, what fails here is corrupt: it is reported, *corrupt set and
+ * NULL returned. Otherwise returns the decoded data in a zmalloc buffer,
+ * NULL if there is none. */
+static char *bucketdb_reread_slice(bucketdb_t *bucketdb, const slice_key_t *slice_key, uint32_t *raw_size, int *corrupt)
 {
-    int rc = -1;
+    char *data = NULL;
+    *corrupt = 0;
 
-    slice_key_t slice_key;
-    slice_key.key_md5 = key_md5;
-    slice_key.slice_idx = slice_idx;
+    pthread_mutex_lock(&bucketdb->write_lock);
 
-    if ( bucketdb->storage_type >= BUCKETDB_KVDB ){
-        uint32_t active_slicedb_id = bucketdb->active_slicedb->id;
-        uint32_t slicedb_id = active_slicedb_id;
-        int old_slice = bucketdb_get_slicedb_id(bucketdb, &slice_key, &slicedb_id);
+    slice_location_t location;
+    slicedb_t *slicedb = NULL;
+    if ( sliceindex_get(bucketdb->sliceindex, slice_key, &location) ){
+        slicedb = bucketdb_acquire_slicedb(bucketdb, location.slicedb_id);
+    }
+    if ( slicedb != NULL ){
+        int has_crc = location.version >= SLICE_VERSION_CRC;
+        uint32_t crc = 0;
+        uint32_t size = 0;
+        kvdb_view_t *view = slice_read_view_from_kvdb(slicedb->kvdb, slice_key->key_md5, slice_key->slice_idx);
+        if ( view != NULL ){
+            crc = has_crc ? crc32c(0, view->data, view->size) : 0;
+            size = view->size;
+            if ( !has_crc || (crc == location.crc && size == location.size) ){
+                data = slicecodec_decode(location.codec, view->data, view->size, raw_size);
+            }
+            kvdb_view_release(view);
+        }
+        bucketdb_release_slicedb(bucketdb, slicedb);
+
+        /* Empty slices are not stored. */
+        if ( data == NULL && (view != NULL || (has_crc && location.size > 0)) ){
+            error_log("bucketdb(%d) slice %08x%08x%08x%08x-%d in slicedb(%d) is corrupt. size: %d/%d crc: %08x/%08x codec: %s",
+                    bucketdb->id,
+                    slice_key->key_md5.h0, slice_key->key_md5.h1, slice_key->key_md5.h2, slice_key->key_md5.h3,
+                    slice_key->slice_idx, location.slicedb_id, size, location.size, crc, location.crc,
+                    slicecodec_name(location.codec));
+            __sync_add_and_fetch(&bucketdb->total_corrupt_slices, 1);
+            *corrupt = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&bucketdb->write_lock);
+
+    return data;
+}
+
+/* ==================== bucketdb_confirm_corrupt_slice() ==================== */
+int bucketdb_confirm_corrupt_slice(bucketdb_t *bucketdb, const slice_key_t *slice_key)
+{
+    int corrupt = 0;
+    uint32_t raw_size = 0;
+    char *data = bucketdb_reread_slice(bucketdb, slice_key, &raw_size, &corrupt);
+    if ( data != NULL ){
+        zfree(data);
+    }
+
+    return corrupt ? -1 : 0;
+}
+
+/* ==================== bucketdb_sample_read() ==================== */
+/* Spread verify_reads percent of the reads evenly. */
+static int bucketdb_sample_read(bucketdb_t *bucketdb)
+{
+    uint32_t verify_reads = bucketdb->options.verify_reads;
+    if ( verify_reads >= 100 ){
+        return 1;
+    }
+    if ( verify_reads == 0 ){
+        return 0;
+    }
+    uint32_t n = __sync_fetch_and_add(&bucketdb->read_sequence, 1);
+    return (n * verify_reads) % 100 < verify_reads;
+}
+
+/* -------- struct slice_update_t -------- */
+typedef struct slice_update_t {
+    slice_key_t slice_key;
+    int deleted;
+    slice_location_t location;
+} slice_update_t;
+
+/* ==================== bucketdb_queue_update() ==================== */
+/* location is NULL for a delete. */
+static void bucketdb_queue_update(bucketdb_t *bucketdb, const slice_key_t *slice_key, const slice_location_t *location)
+{
+    if ( bucketdb->total_batch_updates >= bucketdb->max_batch_updates ){
+        bucketdb->max_batch_updates = bucketdb->max_batch_updates > 0 ? bucketdb->max_batch_updates * 2 : 16;
+        bucketdb->batch_updates = (slice_update_t*)zrealloc(bucketdb->batch_updates, sizeof(slice_update_t) * bucketdb->max_batch_updates);
+    }
+    slice_update_t *update = &bucketdb->batch_updates[bucketdb->total_batch_updates++];
+    update->slice_key = *slice_key;
+    update->deleted = location == NULL;
+    if ( location != NULL ){
+        update->location = *location;
+    } else {
+        memset(&update->location, 0, sizeof(slice_location_t));
+    }
+}
+
+/* ==================== bucketdb_batch_lookup() ==================== */
+/* Like sliceindex_get(), seeing the changes of the open batch too. */
+static int bucketdb_batch_lookup(bucketdb_t *bucketdb, const slice_key_t *slice_key, slice_location_t *location)
+{
+    for ( uint32_t i = bucketdb->total_batch_updates ; i > 0 ; i-- ){
+        const slice_update_t *update = &bucketdb->batch_updates[i - 1];
+        if ( memcmp(&update->slice_key, slice_key, sizeof(slice_key_t)) == 0 ){
+            *location = update->location;
+            return !update->deleted;
+        }
+    }
+    return sliceindex_get(bucketdb->sliceindex, slice_key, location);
+}
+
+/* ==================== bucketdb_apply_updates() ==================== */
+/* After the commit, in batch order. A rolled back batch just drops them,
+ * the sliceindex never left what is stored. */
+static void bucketdb_apply_updates(bucketdb_t *bucketdb, int commit)
+{
+    for ( uint32_t i = 0 ; commit && i < bucketdb->total_batch_updates ; i++ ){
+        const slice_update_t *update = &bucketdb->batch_updates[i];
+        slice_location_t old_location;
+        if ( sliceindex_get(bucketdb->sliceindex, &update->slice_key, &old_location) ){
+            bucketdb_account_slice(bucketdb, &old_location, -1);
+        }
+        if ( update->deleted ){
+            sliceindex_remove(bucketdb->sliceindex, &update->slice_key);
+        } else {
+            sliceindex_put(bucketdb->sliceindex, &update->slice_key, &update->location);
+            bucketdb_account_slice(bucketdb, &update->location, 1);
+        }
+    }
+    bucketdb->total_batch_updates = 0;
+}
+
+/* ==================== bucketdb_batch_join() ==================== */
+/* Keeps slicedb open until bucketdb_end_batch(). */
+static int bucketdb_batch_join(bucketdb_t *bucketdb, slicedb_t *slicedb)
+{
+    if ( !slicedb->joined ){
+        if ( bucketdb_pin_slicedb(bucketdb, slicedb) != 0 ){
+            return -1;
+        }
+        slicedb->joined = 1;
+        if ( bucketdb->in_batch && kvdb_begin(slicedb->kvdb) == 0 ){
+            slicedb->in_batch = 1;
+        }
+    }
+
+    return 0;
+}
+
+/* ==================== bucketdb_begin_batch() ==================== */
+static void bucketdb_begin_batch(bucketdb_t *bucketdb)
+{
+    bucketdb->in_batch = 1;
+    if ( kvdb_begin(bucketdb->kvdb_metadata) == 0 ){
+        bucketdb->metadata_in_batch = 1;
+    }
+}
+
+/* ==================== bucketdb_end_batch() ==================== */
+/* Slice DBs are committed before the metadata, so a crash in between never
+ * leaves metadata pointing at slices that were not stored. The sliceindex
+ * follows once both are, a reader never finds it ahead of the storage. */
+static int bucketdb_end_batch(bucketdb_t *bucketdb, int rollback)
+{
+    int ret = 0;
+
+    int publish = !rollback && bucketdb->total_batch_updates > 0;
+    if ( publish ){
+        __sync_add_and_fetch(&bucketdb->index_sequence, 1);
+    }
+
+    for ( uint32_t db_id = 0 ; db_id < SLICEDB_MAX ; db_id++ ){
+        slicedb_t *slicedb = bucketdb->slicedbs[db_id];
+        if ( slicedb == NULL || !slicedb->joined ){
+            continue;
+        }
+        if ( slicedb->in_batch ){
+            if ( rollback ){
+                kvdb_rollback(slicedb->kvdb);
+            } else if ( kvdb_commit(slicedb->kvdb) != 0 ){
+                error_log("Commit slicedb failed. bucketdb->id:%d slicedb_id:%d", bucketdb->id, db_id);
+                ret = -1;
+                rollback = 1;
+            }
+            slicedb->in_batch = 0;
+        }
+        slicedb->batch_bytes = 0;
+        slicedb->joined = 0;
+        bucketdb_release_slicedb(bucketdb, slicedb);
+    }
+
+    if ( bucketdb->metadata_in_batch ){
+        if ( rollback ){
+            kvdb_rollback(bucketdb->kvdb_metadata);
+        } else if ( kvdb_commit(bucketdb->kvdb_metadata) != 0 ){
+            error_log("Commit metadata failed. bucketdb->id:%d", bucketdb->id);
+            ret = -1;
+        }
+        bucketdb->metadata_in_batch = 0;
+    }
+    bucketdb->in_batch = 0;
+
+    bucketdb_apply_updates(bucketdb, !rollback && ret == 0);
+    if ( publish ){
+        __sync_add_and_fetch(&bucketdb->index_sequence, 1);
+    }
+
+    return ret;
+}
 
-        if ( old_slice ){
-            rc = slice_delete_from_kvdb(bucketdb->slicedbs[slicedb_id]->kvdb, key_md5, slice_idx);
+/* ==================== bucketdb_write_slice() ==================== */
+/* A rewrite normally stays in the slicedb already holding the key.
+ * relocate forces it into the active slicedb, the compactor uses that. */
+static int bucketdb_write_slice(bucketdb_t *bucketdb, slice_t *slice, int relocate)
+{
+    int ret = 0;
+
+    uint32_t active_slicedb_id = bucketdb->active_slicedb->id;
+    slice_location_t old_location;
+    int old_slice = bucketdb_batch_lookup(bucketdb, &slice->slice_key, &old_location);
+    uint32_t slicedb_id = old_slice ? old_location.slicedb_id : active_slicedb_id;
+
+    /* The env only counts committed pages, a big batch would run into a
+     * full map without what it wrote so far. */
+    int try_to_write_full_db = 0;
+    uint64_t dbsize = kvenv_get_dbsize(bucketdb->active_slicedb->kvdb->kvenv) + bucketdb->active_slicedb->batch_bytes;
+    if ( dbsize > 0.9 * bucketdb->active_slicedb->max_dbsize ){
+        if ( old_slice  && active_slicedb_id == slicedb_id ){
+            try_to_write_full_db = 1;
+        }
+        uint32_t next_slicedb_id = 0;
+        if ( bucketdb_next_slicedb_id(bucketdb, &next_slicedb_id) != 0 ){
+            return -1;
+        }
+        slicedb_t *slicedb = bucketdb_open_slicedb(bucketdb, next_slicedb_id);
+        if ( slicedb == NULL ){
+            return -1;
+        }
+        /* The old one stays pinned until the batch is over, a rollback
+         * makes it active again. */
+        if ( bucketdb->batch_active_slicedb == NULL ){
+            bucketdb->batch_active_slicedb = bucketdb->active_slicedb;
+        } else {
+            bucketdb_release_slicedb(bucketdb, bucketdb->active_slicedb);
+        }
+        slicedb->rolled_in_batch = 1;
+        bucketdb->active_slicedb = slicedb;
+
+        if ( kvdb_put_uint32(bucketdb->kvdb_metadata, "active_slicedb_id", next_slicedb_id) != 0 ){
+            error_log("Save active_slicedb_id failed. bucketdb->id:%d active_slicedb_id:%d", bucketdb->id, next_slicedb_id);
+        }
+    }
+
+    slicedb_t *active_slicedb = bucketdb->active_slicedb;
+
+    if ( old_slice && slicedb_id != active_slicedb->id ) {
+        if ( try_to_write_full_db ){
+            slicedb_t *full_slicedb = bucketdb->slicedbs[slicedb_id];
+            if ( bucketdb_batch_join(bucketdb, full_slicedb) != 0 ){
+                return -1;
+            }
+            ret = slice_delete_from_kvdb(full_slicedb->kvdb, slice->slice_key.key_md5, slice->slice_key.slice_idx);
+        } else if ( !relocate ){
+            active_slicedb = bucketdb->slicedbs[slicedb_id];
+        }
+    }
+
+    if ( bucketdb_batch_join(bucketdb, active_slicedb) != 0 ){
+        return -1;
+    }
+
+    slice_metadata_t slice_metadata;
+    memset(&slice_metadata, 0, sizeof(slice_metadata_t));
+    slice_metadata.version = SLICE_VERSION_CRC;
+    slice_metadata.slicedb_id = active_slicedb->id;
+    slice_metadata.size = slice->size;
+    slice_metadata.crc = slice->crc;
+    slice_metadata.codec = slice->codec;
+    ret = kvdb_put(bucketdb->kvdb_metadata, (const char *)&slice->slice_key, sizeof(slice_key_t), (void*)&slice_metadata, sizeof(slice_metadata_t));
+    if ( ret == 0 ){
+        slice_location_t location;
+        location.version = slice_metadata.version;
+        location.slicedb_id = slice_metadata.slicedb_id;
+        location.size = slice_metadata.size;
+        location.crc = slice_metadata.crc;
+        location.codec = slice_metadata.codec;
+        bucketdb_queue_update(bucketdb, &slice->slice_key, &location);
+
+        ret = slice_write_to_kvdb(active_slicedb->kvdb, slice);
+        if ( ret == 0 ){
+            active_slicedb->batch_bytes += sizeof(slice_key_t) + slice->size;
+        }
+    } else {
+        error_log("Write metadata failed. bucketdb->id:%d slice_idx:%d", bucketdb->id, slice->slice_key.slice_idx);
+    }
+
+    return ret;
+}
+
+/* ==================== bucketdb_end_rollover() ==================== */
+/* After a batch that rolled the active slicedb over. A rollback makes the
+ * old one active again and drops the new ones still empty, the metadata
+ * never learned about them. Called under write_lock. */
+static void bucketdb_end_rollover(bucketdb_t *bucketdb, int rollback)
+{
+    slicedb_t *batch_active_slicedb = bucketdb->batch_active_slicedb;
+    if ( batch_active_slicedb == NULL ){
+        return;
+    }
+    bucketdb->batch_active_slicedb = NULL;
+
+    if ( rollback ){
+        bucketdb_release_slicedb(bucketdb, bucketdb->active_slicedb);
+        bucketdb->active_slicedb = batch_active_slicedb;
+    } else {
+        bucketdb_release_slicedb(bucketdb, batch_active_slicedb);
+    }
+
+    for ( uint32_t db_id = 0 ; db_id < SLICEDB_MAX ; db_id++ ){
+        slicedb_t *slicedb = bucketdb->slicedbs[db_id];
+        if ( slicedb == NULL || !slicedb->rolled_in_batch ){
+            continue;
+        }
+        slicedb->rolled_in_batch = 0;
+        if ( rollback && slicedb->live_slices == 0 ){
+            slicedb->retired = 1;
+            bucketdb_unpublish_slicedb(bucketdb, db_id);
+        }
+    }
+}
+
+/* -------- struct object_names_t -------- */
+/* Key names and object headers going with the slices of a write, see
+ * bucketdb_put_objects(). */
+typedef struct object_names_t {
+    const char **keys;
+    const uint32_t *key_lens;
+    const key_record_t *records;
+    const object_header_t **headers;
+} object_names_t;
+
+/* ==================== bucketdb_write_names() ==================== */
+/* Into the metadata transaction, if one is open. keys or headers may be
+ * NULL, so may headers[i]. */
+static int bucketdb_write_names(bucketdb_t *bucketdb, slice_t **slices, uint32_t total_slices, const object_names_t *names)
+{
+    int ret = 0;
+    for ( uint32_t i = 0 ; i < total_slices && ret == 0 ; i++ ){
+        if ( names->keys != NULL ){
+            ret = kvdb_put(bucketdb->kvdb_keys, names->keys[i], names->key_lens[i], (void*)&names->records[i], sizeof(key_record_t));
+        }
+        if ( ret == 0 && names->headers != NULL && names->headers[i] != NULL ){
+            ret = bucketdb_put_object_header(bucketdb, slices[i]->slice_key.key_md5, names->headers[i]);
         }
+    }
+    if ( ret != 0 ){
+        error_log("Write key names failed. bucketdb->id:%d", bucketdb->id);
+    }
+
+    return ret;
+}
+
+/* ==================== bucketdb_write_slices() ==================== */
+/* Called under write_lock. names may be NULL. */
+static int bucketdb_write_slices(bucketdb_t *bucketdb, slice_t **slices, uint32_t total_slices, const object_names_t *names, int relocate)
+{
+    int ret = 0;
+
+    bucketdb_begin_batch(bucketdb);
+    for ( uint32_t i = 0 ; i < total_slices ; i++ ){
+        ret = bucketdb_write_slice(bucketdb, slices[i], relocate);
+        if ( ret != 0 ){
+            break;
+        }
+    }
+    if ( ret == 0 && names != NULL ){
+        ret = bucketdb_write_names(bucketdb, slices, total_slices, names);
+    }
+    if ( bucketdb_end_batch(bucketdb, ret != 0) != 0 ){
+        ret = -1;
+    }
+    bucketdb_end_rollover(bucketdb, ret != 0);
+
+    return ret;
+}
+
+/* ==================== bucketdb_put_objects() ==================== */
+/* Apply all slices in one transaction per touched slicedb plus one for the
+ * metadata DB, which takes the key names and object headers too. Either
+ * the whole batch is stored or none of it. The bucket's storage thread is
+ * the only writer and hands in its queued writes together, see
+ * bucket_put_group(). */
+int bucketdb_put_objects(bucketdb_t *bucketdb, slice_t **slices, const char **keys, const uint32_t *key_lens, const key_record_t *records,
+        const object_header_t **headers, uint32_t total_slices)
+{
+    int ret = 0;
+
+    object_names_t names;
+    names.keys = keys;
+    names.key_lens = key_lens;
+    names.records = records;
+    names.headers = headers;
+
+    if ( bucketdb->storage_type >= BUCKETDB_KVDB ){
+        /* Outside the lock. The checksum covers what is stored. */
+        for ( uint32_t i = 0 ; i < total_slices ; i++ ){
+            slice_encode(slices[i], bucketdb->options.compression);
+            slices[i]->crc = crc32c(0, slices[i]->data, slices[i]->size);
+        }
+        pthread_mutex_lock(&bucketdb->write_lock);
+        ret = bucketdb_write_slices(bucketdb, slices, total_slices, &names, 0);
+        pthread_mutex_unlock(&bucketdb->write_lock);
     } else if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
+        /* The log commits on its own, the names follow in one transaction. */
+        ret = logstore_write_slices(bucketdb->logstore, slices, total_slices);
+        if ( ret == 0 ){
+            int in_txn = kvdb_begin(bucketdb->kvdb_metadata) == 0;
+            ret = bucketdb_write_names(bucketdb, slices, total_slices, &names);
+            if ( in_txn ){
+                if ( ret != 0 ){
+                    kvdb_rollback(bucketdb->kvdb_metadata);
+                } else if ( kvdb_commit(bucketdb->kvdb_metadata) != 0 ){
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    /* After the commit, see slicecache_generation(). */
+    if ( bucketdb->slicecache != NULL ){
+        for ( uint32_t i = 0 ; i < total_slices ; i++ ){
+            slicecache_invalidate(bucketdb->slicecache, &slices[i]->slice_key);
+        }
+    }
+
+    return ret;
+}
+
+/* ==================== bucketdb_write_slices_to_storage() ==================== */
+int bucketdb_write_slices_to_storage(bucketdb_t *bucketdb, slice_t **slices, uint32_t total_slices)
+{
+    return bucketdb_put_objects(bucketdb, slices, NULL, NULL, NULL, NULL, total_slices);
+}
+
+/* ==================== bucketdb_write_to_storage() ==================== */
+int bucketdb_write_to_storage(bucketdb_t *bucketdb, slice_t *slice)
+{
+    return bucketdb_write_slices_to_storage(bucketdb, &slice, 1);
+}
+
+/* -------- struct slicedb_view_hold_t -------- */
+typedef struct slicedb_view_hold_t {
+    bucketdb_t *bucketdb;
+    slicedb_t *slicedb;
+    kvdb_view_t *view;
+} slicedb_view_hold_t;
+
+/* ==================== slicedb_release_held_view() ==================== */
+static void slicedb_release_held_view(kvdb_view_t *view)
+{
+    slicedb_view_hold_t *hold = (slicedb_view_hold_t*)view->handle;
+    kvdb_view_release(hold->view);
+    bucketdb_release_slicedb(hold->bucketdb, hold->slicedb);
+    zfree(hold);
+}
+
+/* ==================== slicedb_hold_view() ==================== */
+/* Wrap view so its release also drops the slicedb reference. */
+static kvdb_view_t *slicedb_hold_view(bucketdb_t *bucketdb, slicedb_t *slicedb, kvdb_view_t *view)
+{
+    slicedb_view_hold_t *hold = (slicedb_view_hold_t*)zmalloc(sizeof(slicedb_view_hold_t));
+    hold->bucketdb = bucketdb;
+    hold->slicedb = slicedb;
+    hold->view = view;
+
+    return kvdb_view_new(view->data, view->size, slicedb_release_held_view, hold);
+}
+
+/* ==================== bucketdb_read_slicedb() ==================== */
+/* Read slice_key from its slicedb, decoded. A raw slice comes back as a
+ * view into the slicedb, an encoded one as a copy. */
+static kvdb_view_t *bucketdb_read_slicedb(bucketdb_t *bucketdb, const slice_key_t *slice_key)
+{
+    uint32_t sequence = __sync_add_and_fetch(&bucketdb->index_sequence, 0);
+
+    slice_location_t location;
+    slicedb_t *slicedb = bucketdb_acquire_slicedb_of(bucketdb, slice_key, &location);
+    if ( slicedb == NULL ){
+        return NULL;
+    }
+
+    kvdb_view_t *view = slice_read_view_from_kvdb(slicedb->kvdb, slice_key->key_md5, slice_key->slice_idx);
+    /* A commit overlapping the read may have moved or rewritten the slice
+     * under the index entry, even with the same size. */
+    __sync_synchronize();
+    int suspect = (sequence & 1) || sequence != bucketdb->index_sequence;
+    /* A size other than the index says is a racing rewrite. */
+    suspect = suspect || (view != NULL &&
+        ((location.version >= SLICE_VERSION_CRC && view->size != location.size) ||
+         (bucketdb_sample_read(bucketdb) && bucketdb_verify_slice(bucketdb, slice_key, slicedb->id, view->data, view->size) < 0)));
+
+    if ( view != NULL && !suspect && location.codec != SLICE_CODEC_RAW ){
+        uint32_t raw_size = 0;
+        char *data = slicecodec_decode(location.codec, view->data, view->size, &raw_size);
+        kvdb_view_release(view);
+        view = NULL;
+        if ( data != NULL ){
+            view = kvdb_view_new(data, raw_size, NULL, data);
+        } else {
+            suspect = 1;
+        }
+    }
+
+    if ( suspect ){
+        /* The view may hold a read transaction, drop it before looking
+         * again. A false alarm is served from the second read. */
+        if ( view != NULL ){
+            kvdb_view_release(view);
+            view = NULL;
+        }
+        bucketdb_release_slicedb(bucketdb, slicedb);
+
+        int corrupt = 0;
+        uint32_t raw_size = 0;
+        char *data = bucketdb_reread_slice(bucketdb, slice_key, &raw_size, &corrupt);
+        return data != NULL ? kvdb_view_new(data, raw_size, NULL, data) : NULL;
+    }
+
+    if ( view != NULL && view->release != NULL ){
+        /* The view points into the slicedb, keep it open. */
+        return slicedb_hold_view(bucketdb, slicedb, view);
+    }
+    bucketdb_release_slicedb(bucketdb, slicedb);
+
+    return view;
+}
+
+/* ==================== bucketdb_read_from_storage() ==================== */
+slice_t *bucketdb_read_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx)
+{
+    slice_key_t slice_key;
+    slice_key.key_md5 = key_md5;
+    slice_key.slice_idx = slice_idx;
+    slice_t *slice = NULL;
+
+    if ( bucketdb->storage_type >= BUCKETDB_KVDB ){
+        kvdb_view_t *view = bucketdb_read_slicedb(bucketdb, &slice_key);
+        if ( view != NULL ){
+            slice = slice_new(key_md5, slice_idx, view->data, view->size);
+            kvdb_view_release(view);
+        }
+    } else if (bucketdb->storage_type == BUCKETDB_NONE ){
+        slice = slice_new(key_md5, slice_idx, NULL, 0);
+    } else if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
+        slice = logstore_read_slice(bucketdb->logstore, key_md5, slice_idx, bucketdb_sample_read(bucketdb));
+    }
+
+    return slice;
+}
+
+/* ==================== bucketdb_read_view_from_storage() ==================== */
+kvdb_view_t *bucketdb_read_view_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx)
+{
+    slice_key_t slice_key;
+    slice_key.key_md5 = key_md5;
+    slice_key.slice_idx = slice_idx;
+    kvdb_view_t *view = NULL;
+
+    if ( bucketdb->storage_type == BUCKETDB_NONE ){
+        return kvdb_view_new(NULL, 0, NULL, NULL);
+    }
+
+    uint64_t generation = 0;
+    if ( bucketdb->slicecache != NULL ){
+        view = slicecache_get(bucketdb->slicecache, &slice_key);
+        if ( view != NULL ){
+            return view;
+        }
+        generation = slicecache_generation(bucketdb->slicecache);
+    }
+
+    if ( bucketdb->storage_type >= BUCKETDB_KVDB ){
+        view = bucketdb_read_slicedb(bucketdb, &slice_key);
+    } else if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
+        view = logstore_read_view(bucketdb->logstore, key_md5, slice_idx, bucketdb_sample_read(bucketdb));
+    }
+
+    if ( view != NULL && bucketdb->slicecache != NULL ){
+        /* Serve the cached copy and drop the storage view at once. */
+        kvdb_view_t *cached_view = slicecache_put(bucketdb->slicecache, &slice_key, view->data, view->size, generation);
+        if ( cached_view != NULL ){
+            kvdb_view_release(view);
+            view = cached_view;
+        }
+    }
+
+    return view;
+}
+
+/* ==================== bucketdb_delete_slice() ==================== */
+/* Called under write_lock inside a batch. Only the active slicedb is
+ * written to, a slice in a historical one is left to the compactor and
+ * marked by a tombstone, so deletes never open cold slicedbs. */
+static int bucketdb_delete_slice(bucketdb_t *bucketdb, const slice_key_t *slice_key, const slice_location_t *location)
+{
+    int rc = 0;
+
+    slicedb_t *active_slicedb = bucketdb->active_slicedb;
+    if ( location->slicedb_id == active_slicedb->id ){
+        if ( bucketdb_batch_join(bucketdb, active_slicedb) != 0 ){
+            return -1;
+        }
+        rc = slice_delete_from_kvdb(active_slicedb->kvdb, slice_key->key_md5, slice_key->slice_idx);
+    } else {
+        tombstone_t tombstone;
+        tombstone.slicedb_id = location->slicedb_id;
+        tombstone.size = location->size;
+        rc = kvdb_put(bucketdb->kvdb_tombstones, (const char*)slice_key, sizeof(slice_key_t), &tombstone, sizeof(tombstone_t));
     }
 
+    if ( rc == 0 ){
+        kvdb_del(bucketdb->kvdb_metadata, (const char*)slice_key, sizeof(slice_key_t));
+        bucketdb_queue_update(bucketdb, slice_key, NULL);
+    } else {
+        error_log("Delete slice failed. bucketdb->id:%d slicedb_id:%d slice_idx:%d", bucketdb->id, location->slicedb_id, slice_key->slice_idx);
+    }
+
+    return rc;
+}
+
+/* -------- struct slice_key_list_t -------- */
+typedef struct slice_key_list_t {
+    slice_key_t *slice_keys;
+    uint32_t total_slice_keys;
+    uint32_t max_slice_keys;
+} slice_key_list_t;
+
+/* ==================== slice_key_list_add() ==================== */
+static void slice_key_list_add(slice_key_list_t *list, const slice_key_t *slice_key)
+{
+    if ( list->total_slice_keys >= list->max_slice_keys ){
+        list->max_slice_keys = list->max_slice_keys > 0 ? list->max_slice_keys * 2 : 16;
+        list->slice_keys = (slice_key_t*)zrealloc(list->slice_keys, sizeof(slice_key_t) * list->max_slice_keys);
+    }
+    list->slice_keys[list->total_slice_keys++] = *slice_key;
+}
+
+/* ==================== slice_key_list_release() ==================== */
+static void slice_key_list_release(slice_key_list_t *list)
+{
+    if ( list->slice_keys != NULL ){
+        zfree(list->slice_keys);
+    }
+    memset(list, 0, sizeof(slice_key_list_t));
+}
+
+/* -------- struct object_slices_scan_t -------- */
+typedef struct object_slices_scan_t {
+    md5_value_t key_md5;
+    slice_key_list_t slice_keys;
+} object_slices_scan_t;
+
+/* ==================== collect_object_slices() ==================== */
+/* Slice records start with the object md5 and sort right behind its
+ * header, the scan stops at the first key of another object. */
+static int collect_object_slices(void *user_data, const char *key, uint32_t klen, const char *value, uint32_t vlen)
+{
+    object_slices_scan_t *scan = (object_slices_scan_t*)user_data;
+
+    if ( klen < sizeof(md5_value_t) || memcmp(key, &scan->key_md5, sizeof(md5_value_t)) != 0 ){
+        return 1;
+    }
+    if ( klen == sizeof(slice_key_t) ){
+        slice_key_list_add(&scan->slice_keys, (const slice_key_t*)key);
+    }
+
+    return 0;
+}
+
+/* ==================== bucketdb_delete_object_slices() ==================== */
+/* Called under write_lock inside a batch. Deleted keys are appended to
+ * deleted for the resync or cache invalidation after the batch. */
+static int bucketdb_delete_object_slices(bucketdb_t *bucketdb, md5_value_t key_md5, slice_key_list_t *deleted)
+{
+    object_slices_scan_t scan;
+    memset(&scan, 0, sizeof(object_slices_scan_t));
+    scan.key_md5 = key_md5;
+
+    int rc = kvdb_scan(bucketdb->kvdb_metadata, (const char*)&key_md5, sizeof(md5_value_t), collect_object_slices, &scan);
+    for ( uint32_t i = 0 ; i < scan.slice_keys.total_slice_keys && rc == 0 ; i++ ){
+        const slice_key_t *slice_key = &scan.slice_keys.slice_keys[i];
+        slice_location_t location;
+        if ( sliceindex_get(bucketdb->sliceindex, slice_key, &location) ){
+            rc = bucketdb_delete_slice(bucketdb, slice_key, &location);
+        } else {
+            kvdb_del(bucketdb->kvdb_metadata, (const char*)slice_key, sizeof(slice_key_t));
+        }
+        if ( rc == 0 ){
+            slice_key_list_add(deleted, slice_key);
+        }
+    }
+    slice_key_list_release(&scan.slice_keys);
+
+    if ( rc == 0 ){
+        kvdb_del(bucketdb->kvdb_metadata, (const char*)&key_md5, sizeof(md5_value_t));
+    }
+
+    return rc;
+}
+
+/* ==================== bucketdb_end_delete() ==================== */
+/* Commit or roll back a delete batch and unlock. */
+static int bucketdb_end_delete(bucketdb_t *bucketdb, int ret, slice_key_list_t *deleted)
+{
+    if ( bucketdb_end_batch(bucketdb, ret != 0) != 0 ){
+        ret = -1;
+    }
+
+    pthread_mutex_unlock(&bucketdb->write_lock);
+
+    if ( ret == 0 && bucketdb->slicecache != NULL ){
+        for ( uint32_t i = 0 ; i < deleted->total_slice_keys ; i++ ){
+            slicecache_invalidate(bucketdb->slicecache, &deleted->slice_keys[i]);
+        }
+    }
+
+    return ret;
+}
+
+/* ==================== bucketdb_delete_from_storage() ==================== */
+int bucketdb_delete_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx, uint32_t *total_deleted)
+{
+    int rc = 0;
+    *total_deleted = 0;
+
+    slice_key_t slice_key;
+    slice_key.key_md5 = key_md5;
+    slice_key.slice_idx = slice_idx;
+
+    if ( bucketdb->storage_type >= BUCKETDB_KVDB ){
+        slice_key_list_t deleted;
+        memset(&deleted, 0, sizeof(slice_key_list_t));
+
+        pthread_mutex_lock(&bucketdb->write_lock);
+        bucketdb_begin_batch(bucketdb);
+
+        slice_location_t location;
+        if ( sliceindex_get(bucketdb->sliceindex, &slice_key, &location) ){
+            rc = bucketdb_delete_slice(bucketdb, &slice_key, &location);
+            if ( rc == 0 ){
+                slice_key_list_add(&deleted, &slice_key);
+            }
+        }
+
+        rc = bucketdb_end_delete(bucketdb, rc, &deleted);
+        if ( rc == 0 ){
+            *total_deleted = deleted.total_slice_keys;
+        }
+        slice_key_list_release(&deleted);
+    } else if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
+        int n = logstore_delete_slice(bucketdb->logstore, key_md5, slice_idx);
+        if ( n < 0 ){
+            rc = -1;
+        } else if ( n > 0 ){
+            *total_deleted = n;
+            if ( bucketdb->slicecache != NULL ){
+                slicecache_invalidate(bucketdb->slicecache, &slice_key);
+            }
+        }
+    }
+
+    return rc;
+}
+
+/* ==================== invalidate_deleted_slice() ==================== */
+static void invalidate_deleted_slice(void *user_data, const slice_key_t *slice_key)
+{
+    bucketdb_t *bucketdb = (bucketdb_t*)user_data;
+
+    if ( bucketdb->slicecache != NULL ){
+        slicecache_invalidate(bucketdb->slicecache, slice_key);
+    }
+}
+
+/* ==================== bucketdb_delete_logged_objects() ==================== */
+/* BUCKETDB_LOGFILE keeps no slice records in the metadata DB. The
+ * tombstones are on disk before the headers and key names go, all of
+ * those in one transaction. */
+static int bucketdb_delete_logged_objects(bucketdb_t *bucketdb, const md5_value_t *key_md5s, const char **keys, const uint32_t *key_lens,
+        uint32_t total_keys, uint32_t *total_deleted)
+{
+    int rc = 0;
+    for ( uint32_t i = 0 ; i < total_keys && rc == 0 ; i++ ){
+        uint32_t total_slices = 0;
+        rc = logstore_delete_object(bucketdb->logstore, key_md5s[i], invalidate_deleted_slice, bucketdb, &total_slices);
+        *total_deleted += total_slices;
+    }
+    if ( rc != 0 ){
+        return rc;
+    }
+
+    pthread_mutex_lock(&bucketdb->write_lock);
+    int in_txn = kvdb_begin(bucketdb->kvdb_metadata) == 0;
+    for ( uint32_t i = 0 ; i < total_keys ; i++ ){
+        kvdb_del(bucketdb->kvdb_metadata, (const char*)&key_md5s[i], sizeof(md5_value_t));
+        if ( keys[i] != NULL ){
+            kvdb_del(bucketdb->kvdb_keys, keys[i], key_lens[i]);
+        }
+    }
+    if ( in_txn && kvdb_commit(bucketdb->kvdb_metadata) != 0 ){
+        error_log("Delete object headers failed. bucketdb->id:%d", bucketdb->id);
+        rc = -1;
+    }
+    pthread_mutex_unlock(&bucketdb->write_lock);
+
+    return rc;
+}
+
+/* ==================== bucketdb_put_key_names() ==================== */
+int bucketdb_put_key_names(bucketdb_t *bucketdb, const char **keys, const uint32_t *key_lens, const key_record_t *records, uint32_t total_keys)
+{
+    if ( bucketdb->storage_type == BUCKETDB_NONE ){
+        return 0;
+    }
+
+    int rc = 0;
+    int in_txn = kvdb_begin(bucketdb->kvdb_keys) == 0;
+    for ( uint32_t i = 0 ; i < total_keys && rc == 0 ; i++ ){
+        rc = kvdb_put(bucketdb->kvdb_keys, keys[i], key_lens[i], (void*)&records[i], sizeof(key_record_t));
+    }
+    if ( in_txn ){
+        if ( rc != 0 ){
+            kvdb_rollback(bucketdb->kvdb_keys);
+        } else if ( kvdb_commit(bucketdb->kvdb_keys) != 0 ){
+            rc = -1;
+        }
+    }
+    if ( rc != 0 ){
+        error_log("Put key names failed. bucketdb->id:%d", bucketdb->id);
+    }
+
+    return rc;
+}
+
+/* ==================== bucketdb_delete_object() ==================== */
+int bucketdb_delete_object(bucketdb_t *bucketdb, md5_value_t key_md5, const char *key, uint32_t key_len, uint32_t *total_deleted)
+{
+    *total_deleted = 0;
+    if ( bucketdb->storage_type == BUCKETDB_NONE ){
+        return 0;
+    }
+    if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
+        return bucketdb_delete_logged_objects(bucketdb, &key_md5, &key, &key_len, 1, total_deleted);
+    }
+
+    slice_key_list_t deleted;
+    memset(&deleted, 0, sizeof(slice_key_list_t));
+
+    pthread_mutex_lock(&bucketdb->write_lock);
+    bucketdb_begin_batch(bucketdb);
+
+    int rc = bucketdb_delete_object_slices(bucketdb, key_md5, &deleted);
+    if ( rc == 0 && key != NULL ){
+        kvdb_del(bucketdb->kvdb_keys, key, key_len);
+    }
+
+    rc = bucketdb_end_delete(bucketdb, rc, &deleted);
+    if ( rc == 0 ){
+        *total_deleted = deleted.total_slice_keys;
+    }
+    slice_key_list_release(&deleted);
+
+    return rc;
+}
+
+/* -------- struct prefix_keys_scan_t -------- */
+typedef struct prefix_keys_scan_t {
+    const char *prefix;
+    uint32_t prefix_len;
+
+    char *keys[DELETE_BATCH_KEYS];
+    uint32_t key_lens[DELETE_BATCH_KEYS];
+    md5_value_t key_md5s[DELETE_BATCH_KEYS];
+    uint32_t total_keys;
+} prefix_keys_scan_t;
+
+/* ==================== collect_prefix_keys() ==================== */
+static int collect_prefix_keys(void *user_data, const char *key, uint32_t klen, const char *value, uint32_t vlen)
+{
+    prefix_keys_scan_t *scan = (prefix_keys_scan_t*)user_data;
+
+    if ( klen < scan->prefix_len || memcmp(key, scan->prefix, scan->prefix_len) != 0 ){
+        return 1;
+    }
+    if ( scan->total_keys >= DELETE_BATCH_KEYS ){
+        return 1;
+    }
+    if ( vlen != sizeof(key_record_t) ){
+        return 0;
+    }
+
+    uint32_t n = scan->total_keys++;
+    scan->keys[n] = (char*)zmalloc(klen);
+    memcpy(scan->keys[n], key, klen);
+    scan->key_lens[n] = klen;
+    scan->key_md5s[n] = ((const key_record_t*)value)->key_md5;
+
+    return 0;
+}
+
+/* ==================== bucketdb_delete_prefix() ==================== */
+/* Every batch starts over at the prefix, the keys of the previous one are
+ * gone by then. write_lock is dropped in between so writers get through. */
+int bucketdb_delete_prefix(bucketdb_t *bucketdb, const char *prefix, uint32_t prefix_len, uint32_t *total_deleted)
+{
+    *total_deleted = 0;
+    if ( bucketdb->storage_type == BUCKETDB_NONE ){
+        return 0;
+    }
+
+    int rc = 0;
+    uint32_t total_keys = 0;
+    do {
+        prefix_keys_scan_t scan;
+        memset(&scan, 0, sizeof(prefix_keys_scan_t));
+        scan.prefix = prefix;
+        scan.prefix_len = prefix_len;
+
+        if ( bucketdb->storage_type == BUCKETDB_LOGFILE ){
+            rc = kvdb_scan(bucketdb->kvdb_keys, prefix, prefix_len, collect_prefix_keys, &scan);
+            if ( rc == 0 ){
+                rc = bucketdb_delete_logged_objects(bucketdb, scan.key_md5s, (const char**)scan.keys, scan.key_lens, scan.total_keys, total_deleted);
+            }
+            if ( rc == 0 ){
+                total_keys += scan.total_keys;
+            }
+        } else {
+            slice_key_list_t deleted;
+            memset(&deleted, 0, sizeof(slice_key_list_t));
+
+            pthread_mutex_lock(&bucketdb->write_lock);
+            bucketdb_begin_batch(bucketdb);
+
+            rc = kvdb_scan(bucketdb->kvdb_keys, prefix, prefix_len, collect_prefix_keys, &scan);
+            for ( uint32_t i = 0 ; i < scan.total_keys && rc == 0 ; i++ ){
+                rc = bucketdb_delete_object_slices(bucketdb, scan.key_md5s[i], &deleted);
+                if ( rc == 0 ){
+                    kvdb_del(bucketdb->kvdb_keys, scan.keys[i], scan.key_lens[i]);
+                }
+            }
+
+            rc = bucketdb_end_delete(bucketdb, rc, &deleted);
+            if ( rc == 0 ){
+                *total_deleted += deleted.total_slice_keys;
+                total_keys += scan.total_keys;
+            }
+            slice_key_list_release(&deleted);
+        }
+
+        for ( uint32_t i = 0 ; i < scan.total_keys ; i++ ){
+            zfree(scan.keys[i]);
+        }
+        if ( scan.total_keys < DELETE_BATCH_KEYS ){
+            break;
+        }
+    } while ( rc == 0 );
+
+    trace_log("bucketdb(%d) deleted %d keys, %d slices under prefix %.*s", bucketdb->id, total_keys, *total_deleted, prefix_len, prefix);
+
     return rc;
 }
 
+/* ==================== key_compare() ==================== */
+/* The order of the keys DB: bytes first, then length. */
+static int key_compare(const char *a, uint32_t a_len, const char *b, uint32_t b_len)
+{
+    int rc = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if ( rc == 0 ){
+        rc = a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+    }
+    return rc;
+}
+
+/* -------- struct keys_scan_t -------- */
+typedef struct keys_scan_t {
+    const char *prefix;
+    uint32_t prefix_len;
+    const char *start_after;
+    uint32_t start_after_len;
+    char delimiter;
+    uint32_t limit;
+
+    bucketdb_scan_keys_fn *scan_fn;
+    void *user_data;
+
+    uint32_t total_keys;
+    int more;
+    /* Set after a common prefix, the scan goes on at seek_key. */
+    int reseek;
+    char *seek_key;
+    uint32_t seek_key_len;
+    uint32_t seek_key_size;
+} keys_scan_t;
+
+/* ==================== collect_scan_keys() ==================== */
+static int collect_scan_keys(void *user_data, const char *key, uint32_t klen, const char *value, uint32_t vlen)
+{
+    keys_scan_t *scan = (keys_scan_t*)user_data;
+
+    if ( klen < scan->prefix_len || memcmp(key, scan->prefix, scan->prefix_len) != 0 ){
+        return 1;
+    }
+    if ( scan->start_after_len > 0 && key_compare(key, klen, scan->start_after, scan->start_after_len) <= 0 ){
+        return 0;
+    }
+    if ( scan->total_keys >= scan->limit ){
+        scan->more = 1;
+        return 1;
+    }
+
+    if ( scan->delimiter != 0 ){
+        const char *delimiter = (const char*)memchr(key + scan->prefix_len, scan->delimiter, klen - scan->prefix_len);
+        if ( delimiter != NULL ){
+            uint32_t common_len = delimiter - key + 1;
+            /* The page before may have ended inside this common prefix. */
+            if ( scan->start_after_len == 0 || key_compare(key, common_len, scan->start_after, scan->start_after_len) > 0 ){
+                scan->scan_fn(scan->user_data, key, common_len, BUCKETDB_PREFIX_SIZE);
+                scan->total_keys++;
+            }
+            /* Skip the whole subtree, its keys are all below "prefix/sub0".
+             * Trailing 0xFF bytes carry into the byte before them, with
+             * nothing left there is no key after the subtree. */
+            uint32_t seek_key_len = common_len;
+            while ( seek_key_len > 0 && (uint8_t)key[seek_key_len - 1] == 0xFF ){
+                seek_key_len--;
+            }
+            if ( seek_key_len == 0 ){
+                return 1;
+            }
+            if ( seek_key_len > scan->seek_key_size ){
+                scan->seek_key = (char*)zrealloc(scan->seek_key, seek_key_len);
+                scan->seek_key_size = seek_key_len;
+            }
+            memcpy(scan->seek_key, key, seek_key_len);
+            scan->seek_key[seek_key_len - 1]++;
+            scan->seek_key_len = seek_key_len;
+            scan->reseek = 1;
+            return 1;
+        }
+    }
+
+    uint64_t object_size = vlen == sizeof(key_record_t) ? ((const key_record_t*)value)->object_size : 0;
+    scan->scan_fn(scan->user_data, key, klen, object_size);
+    scan->total_keys++;
+
+    return 0;
+}
+
+/* ==================== bucketdb_scan_keys() ==================== */
+int bucketdb_scan_keys(bucketdb_t *bucketdb, const char *prefix, uint32_t prefix_len, const char *start_after, uint32_t start_after_len,
+        char delimiter, uint32_t limit, bucketdb_scan_keys_fn *scan_fn, void *user_data)
+{
+    if ( bucketdb->storage_type == BUCKETDB_NONE ){
+        return 0;
+    }
+
+    keys_scan_t scan;
+    memset(&scan, 0, sizeof(keys_scan_t));
+    scan.prefix = prefix;
+    scan.prefix_len = prefix_len;
+    scan.start_after = start_after;
+    scan.start_after_len = start_after_len;
+    scan.delimiter = delimiter;
+    scan.limit = limit;
+    scan.scan_fn = scan_fn;
+    scan.user_data = user_data;
+
+    const char *start_key = prefix;
+    uint32_t start_klen = prefix_len;
+    if ( start_after_len > 0 && key_compare(start_after, start_after_len, prefix, prefix_len) > 0 ){
+        start_key = start_after;
+        start_klen = start_after_len;
+    }
+
+    /* The scan overwrites scan.seek_key, it starts from a copy. */
+    char *seek_key = NULL;
+    int ret = 0;
+    do {
+        scan.reseek = 0;
+        if ( kvdb_scan(bucketdb->kvdb_keys, start_klen > 0 ? start_key : NULL, start_klen, collect_scan_keys, &scan) != 0 ){
+            error_log("Scan keys failed. bucketdb->id:%d", bucketdb->id);
+            ret = -1;
+            break;
+        }
+        if ( scan.reseek ){
+            seek_key = (char*)zrealloc(seek_key, scan.seek_key_len);
+            memcpy(seek_key, scan.seek_key, scan.seek_key_len);
+            start_key = seek_key;
+            start_klen = scan.seek_key_len;
+        }
+    } while ( scan.reseek );
+
+    zfree(seek_key);
+    zfree(scan.seek_key);
+
+    return ret == 0 ? scan.more : ret;
+}
+
+/* -------- struct tombstones_scan_t -------- */
+typedef struct tombstones_scan_t {
+    uint32_t slicedb_id;
+    slice_key_list_t slice_keys;
+} tombstones_scan_t;
+
+/* ==================== collect_tombstones() ==================== */
+static int collect_tombstones(void *user_data, const char *key, uint32_t klen, const char *value, uint32_t vlen)
+{
+    tombstones_scan_t *scan = (tombstones_scan_t*)user_data;
+
+    if ( klen == sizeof(slice_key_t) && vlen == sizeof(tombstone_t) &&
+            ((const tombstone_t*)value)->slicedb_id == scan->slicedb_id ){
+        slice_key_list_add(&scan->slice_keys, (const slice_key_t*)key);
+    }
+
+    return 0;
+}
+
+/* ==================== bucketdb_drop_tombstones() ==================== */
+/* Called under write_lock once slicedb_id is retired. */
+static void bucketdb_drop_tombstones(bucketdb_t *bucketdb, uint32_t slicedb_id)
+{
+    tombstones_scan_t scan;
+    memset(&scan, 0, sizeof(tombstones_scan_t));
+    scan.slicedb_id = slicedb_id;
+
+    int in_txn = kvdb_begin(bucketdb->kvdb_tombstones) == 0;
+    if ( kvdb_scan(bucketdb->kvdb_tombstones, NULL, 0, collect_tombstones, &scan) == 0 ){
+        for ( uint32_t i = 0 ; i < scan.slice_keys.total_slice_keys ; i++ ){
+            kvdb_del(bucketdb->kvdb_tombstones, (const char*)&scan.slice_keys.slice_keys[i], sizeof(slice_key_t));
+        }
+    }
+    if ( in_txn && kvdb_commit(bucketdb->kvdb_tombstones) != 0 ){
+        error_log("Drop tombstones failed. bucketdb->id:%d slicedb_id:%d", bucketdb->id, slicedb_id);
+    }
+    slice_key_list_release(&scan.slice_keys);
+}
+
+/* ==================== bucketdb_move_slices() ==================== */
+int bucketdb_move_slices(bucketdb_t *bucketdb, uint32_t slicedb_id, slice_t **slices, uint32_t total_slices)
+{
+    int ret = 0;
+    uint32_t cold_codec = bucketdb->options.cold_compression;
+
+    /* Checksum, and recode for cold storage, before taking the lock. */
+    uint32_t *stored_crcs = (uint32_t*)zmalloc(sizeof(uint32_t) * total_slices);
+    for ( uint32_t i = 0 ; i < total_slices ; i++ ){
+        slice_t *slice = slices[i];
+        stored_crcs[i] = crc32c(0, slice->data, slice->size);
+        slice->crc = stored_crcs[i];
+
+        slice_location_t location;
+        if ( !sliceindex_get(bucketdb->sliceindex, &slice->slice_key, &location) || location.slicedb_id != slicedb_id ||
+                (location.version >= SLICE_VERSION_CRC && location.crc != stored_crcs[i]) ){
+            continue;
+        }
+        slice->codec = location.codec;
+        if ( cold_codec != SLICE_CODEC_RAW && location.codec != cold_codec ){
+            uint32_t raw_size = 0;
+            char *data = slicecodec_decode(location.codec, slice->data, slice->size, &raw_size);
+            if ( data != NULL ){
+                slice_attach_data(slice, data, raw_size);
+                slice->codec = SLICE_CODEC_RAW;
+                slice_encode(slice, cold_codec);
+                slice->crc = crc32c(0, slice->data, slice->size);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&bucketdb->write_lock);
+
+    if ( bucketdb->active_slicedb == NULL || bucketdb->active_slicedb->id == slicedb_id ){
+        pthread_mutex_unlock(&bucketdb->write_lock);
+        zfree(stored_crcs);
+        return -1;
+    }
+
+    /* Writers may have replaced some of them since they were read, in
+     * another slicedb or in place. The latter is read again, and if it
+     * still does not match its checksum it rotted and moves along with the
+     * old checksum, staying caught. The caller frees all of them, the live
+     * ones are swapped up front. */
+    uint32_t total_live_slices = 0;
+    for ( uint32_t i = 0 ; i < total_slices ; i++ ){
+        slice_t *slice = slices[i];
+        slice_location_t location;
+        if ( !sliceindex_get(bucketdb->sliceindex, &slice->slice_key, &location) || location.slicedb_id != slicedb_id ){
+            continue;
+        }
+        if ( location.version >= SLICE_VERSION_CRC && location.crc != stored_crcs[i] ){
+            slice_t *current = NULL;
+            slicedb_t *slicedb = bucketdb_acquire_slicedb(bucketdb, slicedb_id);
+            if ( slicedb != NULL ){
+                current = slice_read_from_kvdb(slicedb->kvdb, slice->slice_key.key_md5, slice->slice_key.slice_idx);
+                bucketdb_release_slicedb(bucketdb, slicedb);
+            }
+            if ( current == NULL ){
+                continue;
+            }
+            slice_attach_data(slice, current->data, current->size);
+            current->data = NULL;
+            slice_free(current);
+            slice->crc = location.crc;
+            slice->codec = location.codec;
+        } else if ( slice->crc == stored_crcs[i] ){
+            /* Not recoded. */
+            slice->codec = location.codec;
+        }
+        slices[i] = slices[total_live_slices];
+        slices[total_live_slices++] = slice;
+    }
+    if ( total_live_slices > 0 ){
+        ret = bucketdb_write_slices(bucketdb, slices, total_live_slices, NULL, 1);
+    }
+
+    pthread_mutex_unlock(&bucketdb->write_lock);
+
+    zfree(stored_crcs);
+
+    return ret;
+}
+
+/* ==================== bucketdb_retire_slicedb() ==================== */
+int bucketdb_retire_slicedb(bucketdb_t *bucketdb, uint32_t slicedb_id)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&bucketdb->write_lock);
+
+    slicedb_t *slicedb = bucketdb->slicedbs[slicedb_id];
+    if ( slicedb != NULL && slicedb != bucketdb->active_slicedb && slicedb->live_slices == 0 ){
+        slicedb->retired = 1;
+        bucketdb_unpublish_slicedb(bucketdb, slicedb_id);
+        bucketdb_drop_tombstones(bucketdb, slicedb_id);
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&bucketdb->write_lock);
+
+    return ret;
+}
+
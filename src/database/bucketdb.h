@@ -21,6 +21,16 @@ extern "C" {
 
 typedef struct kvdb_t kvdb_t;
 typedef struct slice_t slice_t;
+typedef struct slice_key_t slice_key_t;
+typedef struct kvdb_view_t kvdb_view_t;
+typedef struct object_header_t object_header_t;
+typedef struct slicecache_t slicecache_t;
+typedef struct sliceindex_t sliceindex_t;
+typedef struct compactor_t compactor_t;
+typedef struct logstore_t logstore_t;
+typedef struct scrubber_t scrubber_t;
+
+#define SLICEDB_MAX 1024
 
 typedef enum eBucketDBType {
     BUCKETDB_NONE = 0,
@@ -34,11 +44,82 @@ typedef enum eBucketDBType {
     BUCKETDB_KVDB_LSM
 } eBucketDBType;
 
+/* ---------- struct bucketdb_options_t ---------- */
+typedef struct bucketdb_options_t {
+    /* Bytes of hot slices kept in memory, 0 disables the cache. */
+    uint64_t cache_size;
+    /* Slicedbs whose live data falls below compact_threshold percent of
+     * their size are copied into the active one and removed, moving at
+     * most compact_rate bytes per second. 0 disables the compactor. */
+    uint32_t compact_threshold;
+    uint64_t compact_rate;
+    /* Worker-wide, not per bucketdb: slicedb environments kept open at
+     * once by all buckets of the worker, the least recently used idle
+     * ones are closed. Set once by bucketdb_set_max_open_slicedbs(),
+     * bucketdb_new() ignores it. */
+    uint32_t max_open_slicedbs;
+    /* BUCKETDB_LOGFILE rolls over to a new segment file past this size,
+     * the compactor settings drive its GC. */
+    uint64_t log_segment_size;
+    /* Percent of the reads checked against the slice checksum. */
+    uint32_t verify_reads;
+    /* Bytes per second the scrubber reads while it checks every stored
+     * slice once a day, 0 disables it. */
+    uint64_t scrub_rate;
+    /* SLICE_CODEC_* for slices written to slicedbs, cold_compression for
+     * the ones the compactor moves. Changing them needs no migration,
+     * every slice records its own codec. */
+    uint32_t compression;
+    uint32_t cold_compression;
+} bucketdb_options_t;
+
+void bucketdb_options_init(bucketdb_options_t *options);
+/* Applies options->max_open_slicedbs to the whole worker, before the
+ * first bucketdb_new(). */
+void bucketdb_set_max_open_slicedbs(const bucketdb_options_t *options);
+
+/* ---------- struct key_record_t ---------- */
+/* Value of a key name in bucketdb->kvdb_keys. */
+typedef struct key_record_t {
+    md5_value_t key_md5;
+    uint64_t object_size;
+} key_record_t;
+
+/* object_size of a common prefix reported by bucketdb_scan_keys(). */
+#define BUCKETDB_PREFIX_SIZE ((uint64_t)-1)
+
+/* Called by bucketdb_scan_keys() for every key or common prefix. */
+typedef void (bucketdb_scan_keys_fn)(void *user_data, const char *key, uint32_t key_len, uint64_t object_size);
+
 /* ---------- struct slicedb_t ---------- */
 typedef struct slicedb_t {
     uint32_t id;
+    /* NULL while the environment is closed, see bucketdb_acquire_slicedb(). */
     kvdb_t *kvdb;
     uint64_t max_dbsize;
+    int joined;
+    int in_batch;
+    /* Written in the open batch and not in kvenv_get_dbsize() yet. */
+    uint64_t batch_bytes;
+    /* Created by a rollover of the open batch, see bucketdb_end_rollover(). */
+    int rolled_in_batch;
+
+    char dbpath[NAME_MAX];
+    /* bucketdb->slicedbs[] holds one reference, readers take their own
+     * while they use the kvdb. The last one closes it, and removes the
+     * files too once the compactor retired it. */
+    volatile uint32_t refs;
+    int retired;
+
+    /* Holders of an open kvdb and the place in the open slicedbs LRU,
+     * both under the LRU lock. Only slicedbs without users get closed. */
+    uint32_t users;
+    struct slicedb_t *lru_prev;
+    struct slicedb_t *lru_next;
+
+    /* Bytes and slices the sliceindex points at, under write_lock. */
+    uint64_t live_bytes;
+    uint32_t live_slices;
 } slicedb_t;
 
 slicedb_t *slicedb_new(uint32_t id, kvdb_t *kvdb, uint64_t max_dbsize);
@@ -52,22 +133,112 @@ typedef struct bucketdb_t {
     int storage_type;
 
     kvdb_t *kvdb_metadata;
+    /* Memory copy of the slice records in kvdb_metadata. */
+    sliceindex_t *sliceindex;
+    /* Key names of the objects with slices here, for prefix deletes, and
+     * slices deleted from historical slicedbs. Both live in the metadata
+     * env and share its transactions. */
+    kvdb_t *kvdb_keys;
+    kvdb_t *kvdb_tombstones;
 
     slicedb_t *active_slicedb;
-    slicedb_t *slicedbs[1024];
+    slicedb_t *slicedbs[SLICEDB_MAX];
     uint64_t max_dbsize;
 
+    /* write_lock serializes writes, deletes and compaction moves, and
+     * is the only one changing slicedbs[]. Readers take a reference from
+     * slicedbs[] inside a read section counted in slicedbs_readers[] and
+     * never block, a removed slicedb loses the table's reference only
+     * after the readers of the current epoch left. */
+    pthread_mutex_t write_lock;
+    volatile uint32_t slicedbs_epoch;
+    volatile uint32_t slicedbs_readers[2];
+
+    int in_batch;
+    int metadata_in_batch;
+    /* The active slicedb the batch started with, still pinned, when the
+     * batch rolled it over. */
+    slicedb_t *batch_active_slicedb;
+    /* Sliceindex changes of the open batch, readers only see them once it
+     * committed, see bucketdb_end_batch(). */
+    struct slice_update_t *batch_updates;
+    uint32_t total_batch_updates;
+    uint32_t max_batch_updates;
+    /* Odd while a batch commits and publishes its sliceindex changes,
+     * bumped twice per commit. A read that saw it odd or changed may pair
+     * an index entry with the other side's data. */
+    volatile uint32_t index_sequence;
+
+    bucketdb_options_t options;
+    slicecache_t *slicecache;
+    compactor_t *compactor;
+    /* Holds the slices instead of the slicedbs for BUCKETDB_LOGFILE. */
+    logstore_t *logstore;
+    scrubber_t *scrubber;
+
+    /* Picks the reads verify_reads samples. */
+    volatile uint32_t read_sequence;
+    volatile uint32_t total_corrupt_slices;
+
 } bucketdb_t;
 
-bucketdb_t *bucketdb_new(const char *root_dir, uint32_t id, int storage_type);
+bucketdb_t *bucketdb_new(const char *root_dir, uint32_t id, int storage_type, const bucketdb_options_t *options);
 void bucketdb_free(bucketdb_t *bucketdb);
 
 int bucketdb_put_metadata(bucketdb_t *bucketdb, const char *key, const char *data, uint32_t data_size);
 int bucketdb_get_metadata(bucketdb_t *bucketdb, const char *key, char **data, uint32_t *data_size);
 
+int bucketdb_put_object_header(bucketdb_t *bucketdb, md5_value_t key_md5, const object_header_t *header);
+int bucketdb_get_object_header(bucketdb_t *bucketdb, md5_value_t key_md5, object_header_t *header);
+
 int bucketdb_write_to_storage(bucketdb_t *bucketdb, slice_t *slice);
+int bucketdb_write_slices_to_storage(bucketdb_t *bucketdb, slice_t **slices, uint32_t total_slices);
+/* Slices with the key names of their objects, records[i] for keys[i], and
+ * headers[i] unless NULL, committed together. keys or headers may be NULL. */
+int bucketdb_put_objects(bucketdb_t *bucketdb, slice_t **slices, const char **keys, const uint32_t *key_lens, const key_record_t *records,
+        const object_header_t **headers, uint32_t total_slices);
 slice_t *bucketdb_read_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx);
-int bucketdb_delete_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx);
+/* Same as above without copying the data out of storage. The view must be
+ * released by kvdb_view_release(). */
+kvdb_view_t *bucketdb_read_view_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx);
+/* *total_deleted is 0 if the slice is not there, which is no error. */
+int bucketdb_delete_from_storage(bucketdb_t *bucketdb, md5_value_t key_md5, uint32_t slice_idx, uint32_t *total_deleted);
+
+/* Remember the key names of stored objects, all in one transaction. */
+int bucketdb_put_key_names(bucketdb_t *bucketdb, const char **keys, const uint32_t *key_lens, const key_record_t *records, uint32_t total_keys);
+/* Up to limit keys starting with prefix and ordered after start_after, in
+ * key order. With a delimiter, keys sharing the part of the name up to the
+ * next delimiter after prefix are reported once as that common prefix.
+ * Returns 1 if more keys follow, 0 at the end and -1 on error. */
+int bucketdb_scan_keys(bucketdb_t *bucketdb, const char *prefix, uint32_t prefix_len, const char *start_after, uint32_t start_after_len,
+        char delimiter, uint32_t limit, bucketdb_scan_keys_fn *scan_fn, void *user_data);
+/* Delete every slice of the object kept in this bucketdb, its header and
+ * key name in one transaction. *total_deleted counts the slices. */
+int bucketdb_delete_object(bucketdb_t *bucketdb, md5_value_t key_md5, const char *key, uint32_t key_len, uint32_t *total_deleted);
+/* Delete all objects whose key starts with prefix, a transaction per
+ * batch of keys. */
+int bucketdb_delete_prefix(bucketdb_t *bucketdb, const char *prefix, uint32_t prefix_len, uint32_t *total_deleted);
+
+/* Used by the compactor. Acquire opens the slicedb if needed, the kvdb
+ * stays open until the matching release. */
+slicedb_t *bucketdb_acquire_slicedb(bucketdb_t *bucketdb, uint32_t slicedb_id);
+void bucketdb_release_slicedb(bucketdb_t *bucketdb, slicedb_t *slicedb);
+/* Live bytes and size of slicedb_id without opening it. */
+int bucketdb_get_slicedb_usage(bucketdb_t *bucketdb, uint32_t slicedb_id, uint64_t *live_bytes, uint64_t *dbsize);
+int bucketdb_is_live_slice(bucketdb_t *bucketdb, const slice_key_t *slice_key, uint32_t slicedb_id);
+/* Rewrite the slices that still live in slicedb_id into the active slicedb. */
+int bucketdb_move_slices(bucketdb_t *bucketdb, uint32_t slicedb_id, slice_t **slices, uint32_t total_slices);
+/* Drop slicedb_id if nothing lives in it anymore. Returns 0 when retired. */
+int bucketdb_retire_slicedb(bucketdb_t *bucketdb, uint32_t slicedb_id);
+
+/* Used by the scrubber. Check data read from slicedb_id against the
+ * checksum of slice_key. Returns 0 when it matches or there is none, 1
+ * when the slice does not live there anymore and -1 on a mismatch. */
+int bucketdb_verify_slice(bucketdb_t *bucketdb, const slice_key_t *slice_key, uint32_t slicedb_id, const char *data, uint32_t size);
+/* Re-read a slice that failed bucketdb_verify_slice() once no write is in
+ * flight, a reader may have raced a rewrite. Returns -1 and reports it if
+ * it is still corrupt, 0 otherwise. */
+int bucketdb_confirm_corrupt_slice(bucketdb_t *bucketdb, const slice_key_t *slice_key);
 
 #ifdef __cplusplus
 }
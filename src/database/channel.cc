@@ -16,6 +16,10 @@
 #include "datanode.h"
 #include "bucket.h"
 #include "channel.h"
+#include "executor.h"
+
+/* Stop reading the broker while the storage thread is this far behind. */
+#define CHANNEL_MAX_PENDING 1024
 
 /* ================ channel_connect_to_broker() ================ */
 zsock_t *channel_connect_to_broker(channel_t *channel)
@@ -24,7 +28,11 @@ zsock_t *channel_connect_to_broker(channel_t *channel)
     bucket_t *bucket = channel->bucket;
     datanode_t *datanode = bucket->datanode;
 
-    zsock_t *broker_sock = zsock_new_dealer(channel->broker_endpoint);
+    zsock_t *broker_sock = zsock_new(ZMQ_DEALER);
+    zsock_set_identity(broker_sock, channel->identity);
+    if ( zsock_connect(broker_sock, "%s", channel->broker_endpoint) != 0 ){
+        zsock_destroy(&broker_sock);
+    }
 
     if ( broker_sock != NULL ){
         zmsg_t *msg_worker_ready = create_status_message(MSG_STATUS_WORKER_READY);
@@ -39,6 +47,63 @@ zsock_t *channel_connect_to_broker(channel_t *channel)
     return broker_sock;
 }
 
+/* ================ channel_connect_to_shards() ================ */
+/* Drops the shard backends of the last broker connection and connects to
+ * total_shards new ones. A request the broker routes here before this
+ * connected is lost to its timeout. */
+static void channel_connect_to_shards(channel_t *channel, uint32_t total_shards)
+{
+    for ( uint32_t i = 0 ; i < channel->total_shards ; i++ ){
+        zsock_destroy(&channel->shard_socks[i]);
+    }
+    free(channel->shard_socks);
+    channel->shard_socks = NULL;
+    channel->total_shards = 0;
+    if ( total_shards == 0 ){
+        return;
+    }
+
+    channel->shard_socks = (zsock_t**)malloc(sizeof(zsock_t*) * total_shards);
+    for ( uint32_t i = 0 ; i < total_shards ; i++ ){
+        char endpoint[NAME_MAX];
+        zsock_t *sock = zsock_new(ZMQ_DEALER);
+        zsock_set_identity(sock, channel->identity);
+        if ( message_shard_endpoint(channel->broker_endpoint, i, endpoint, NAME_MAX) != 0 ||
+                zsock_connect(sock, "%s", endpoint) != 0 ){
+            warning_log("Channel(%d) connect to broker shard %d failed. endpoint:%s", channel->id, i, channel->broker_endpoint);
+        }
+        channel->shard_socks[i] = sock;
+    }
+    channel->total_shards = total_shards;
+}
+
+/* ================ channel_poller_new() ================ */
+static zpoller_t *channel_poller_new(channel_t *channel, zsock_t *broker_sock, zsock_t *reply_sock)
+{
+    zpoller_t *poller = zpoller_new(broker_sock, reply_sock, NULL);
+    for ( uint32_t i = 0 ; i < channel->total_shards ; i++ ){
+        zpoller_add(poller, channel->shard_socks[i]);
+    }
+
+    return poller;
+}
+
+/* ================ channel_reply_sock() ================ */
+/* The shard backend named by the first byte of the envelope, NULL for
+ * none. */
+static zsock_t *channel_reply_sock(channel_t *channel, zmsg_t *msg)
+{
+    zframe_t *frame_envelope = zmsg_first(msg);
+    if ( frame_envelope != NULL && zframe_size(frame_envelope) > 0 ){
+        uint8_t shard_id = *(uint8_t*)zframe_data(frame_envelope);
+        if ( shard_id < channel->total_shards ){
+            return channel->shard_socks[shard_id];
+        }
+    }
+
+    return NULL;
+}
+
 /* ================ channel_thread_main() ================ */
 void channel_thread_main(zsock_t *pipe, void *user_data)
 {
@@ -53,35 +118,79 @@ void channel_thread_main(zsock_t *pipe, void *user_data)
     if ( broker_sock == NULL ){
     }
 
+    /* Replies of the storage thread, forwarded to the broker as they are. */
+    char reply_endpoint[NAME_MAX];
+    executor_reply_endpoint(bucket->executor, channel->id, reply_endpoint, NAME_MAX);
+    zsock_t *reply_sock = zsock_new(ZMQ_PULL);
+    zsock_set_rcvhwm(reply_sock, 0);
+    if ( zsock_bind(reply_sock, "%s", reply_endpoint) != 0 ){
+        error_log("Channel(%d) Bucket(%d) Datanode(%d) bind failed. endpoint:%s", channel->id, bucket->id, datanode->id, reply_endpoint);
+    }
+
     uint32_t interval = INTERVAL_INIT;
     uint32_t liveness = HEARTBEAT_LIVENESS * 2;
 
-    zpoller_t *poller = zpoller_new(broker_sock, NULL);
+    zpoller_t *poller = channel_poller_new(channel, broker_sock, reply_sock);
+    zpoller_t *poller_replies = zpoller_new(reply_sock, NULL);
     while ( true ){
-        zsock_t *sock = (zsock_t*)zpoller_wait(poller, HEARTBEAT_INTERVAL);
+        int throttled = executor_pending(bucket->executor) >= CHANNEL_MAX_PENDING;
+        zsock_t *sock = (zsock_t*)zpoller_wait(throttled ? poller_replies : poller, HEARTBEAT_INTERVAL);
 
-        if ( zclock_time() > channel->heartbeat_at ){
+        /* Replies go to the shards, the broker backend only sees the
+         * heartbeat and READY. */
+        int64_t now = zclock_time();
+        if ( now > channel->heartbeat_at ){
             trace_log("--> Channel(%d) Bucket(%d) Datanode(%d) Send worker heartbeat.", channel->id, bucket->id, datanode->id);
-            channel->heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
+            channel->heartbeat_at = now + HEARTBEAT_INTERVAL;
 
             message_send_heartbeat(broker_sock, MSG_HEARTBEAT_WORKER);
         }
 
-        if ( sock != NULL ){
+        if ( sock == reply_sock ){
+            zmsg_t *msg = zmsg_recv(sock);
+            if ( msg == NULL ){
+                break;
+            }
+            zsock_t *shard_sock = channel_reply_sock(channel, msg);
+            if ( shard_sock != NULL ){
+                zmsg_send(&msg, shard_sock);
+            } else {
+                warning_log("Channel(%d) Bucket(%d) Datanode(%d) drop reply without a shard.", channel->id, bucket->id, datanode->id);
+                zmsg_destroy(&msg);
+            }
+        } else if ( sock != NULL ){
             zmsg_t *msg = zmsg_recv(sock);
             if ( msg == NULL ){
                 break;
             }
             /*zmsg_print(msg);*/
 
+            /* Any message shows the broker is alive. */
+            liveness = HEARTBEAT_LIVENESS;
+
             if ( message_check_heartbeat(msg, MSG_HEARTBEAT_BROKER) == 0 ){
             trace_log("<-- Channel(%d) Bucket(%d) Datanode(%d) Receive broker heartbeat.", channel->id, bucket->id, datanode->id);
-                liveness = HEARTBEAT_LIVENESS;
                 zmsg_destroy(&msg);
-            } else {
+            } else if ( sock == broker_sock ){
+                if ( message_check_status(msg, MSG_STATUS_BROKER_READY) == 0 && zmsg_size(msg) >= 3 ){
+                    zmsg_first(msg);
+                    zmsg_next(msg);
+                    zframe_t *frame = zmsg_next(msg);
+                    if ( zframe_size(frame) == sizeof(uint32_t) ){
+                        channel_connect_to_shards(channel, *(uint32_t*)zframe_data(frame));
+                        zpoller_destroy(&poller);
+                        poller = channel_poller_new(channel, broker_sock, reply_sock);
+                    }
+                }
+                zmsg_destroy(&msg);
+            } else if ( bucket_is_read_request(msg) && executor_channel_pending(bucket->executor, channel->id) == 0 ){
+                /* Queued behind writes of this channel otherwise, so a
+                 * client reads what it wrote before. */
                 bucket_handle_message(bucket, sock, msg);
+            } else {
+                executor_submit(bucket->executor, channel->id, msg);
             }
-        } else {
+        } else if ( !throttled ){
             if ( --liveness == 0 ){
                 /*zclock_sleep(interval);*/
                 if ( interval < INTERVAL_MAX ){
@@ -90,18 +199,22 @@ void channel_thread_main(zsock_t *pipe, void *user_data)
 
                 warning_log("Channel(%d) Bucket(%d) Datanode(%d) timeout. Try reconnect...", channel->id, bucket->id, datanode->id);
                 zsock_destroy(&broker_sock);
+                channel_connect_to_shards(channel, 0);
 
                 broker_sock = channel_connect_to_broker(channel);
                 zpoller_destroy(&poller);
-                poller = zpoller_new(broker_sock, NULL);
+                poller = channel_poller_new(channel, broker_sock, reply_sock);
 
                 liveness = HEARTBEAT_LIVENESS;
             }
         }
 
     }
+    zpoller_destroy(&poller_replies);
     zpoller_destroy(&poller);
 
+    zsock_destroy(&reply_sock);
+    channel_connect_to_shards(channel, 0);
     zsock_destroy(&broker_sock);
 
     trace_log("Channel(%d) Bucket(%d) Datanode(%d) Exit.", channel->id, channel->bucket->id, channel->bucket->datanode->id);
@@ -118,6 +231,7 @@ channel_t *channel_new(bucket_t *bucket, uint32_t channel_id)
     channel->id = channel_id;
     channel->bucket = bucket;
     channel->broker_endpoint = bucket->broker_endpoint;
+    snprintf(channel->identity, sizeof(channel->identity), "W%d-%d-%d", bucket->datanode->id, bucket->id, channel_id);
     channel->heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
 
     /* --------channel->actor -------- */
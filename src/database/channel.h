@@ -30,8 +30,14 @@ typedef struct channel_t {
     uint32_t id;
     const char *broker_endpoint;
     int64_t heartbeat_at;
+    /* The same on the broker backend and on every shard backend, so the
+     * broker routes to the worker it registered. */
+    char identity[32];
 
     zsock_t *broker_sock;
+    /* Backends of the broker shards, learned from MSG_STATUS_BROKER_READY. */
+    uint32_t total_shards;
+    zsock_t **shard_socks;
 
 } channel_t;
 
@@ -0,0 +1,289 @@
+/**
+ * @file   compactor.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-19 10:06:12
+ *
+ * @brief  Background space reclamation of rolled-over slicedbs.
+ *
+ * Every bucketdb knows how many bytes the sliceindex points at in each of
+ * its slicedbs. The compactor thread wakes up now and then, picks the
+ * non-active slicedb with the lowest live/size ratio under the threshold,
+ * and copies its live slices into the active slicedb in small batches.
+ * Each batch goes through the write lock like a foreground write, and a
+ * token bucket spaces the batches out. Once nothing lives in the slicedb
+ * anymore it is retired, its files go away with the last reader.
+ *
+ */
+
+#include "common.h"
+#include "zmalloc.h"
+#include "logger.h"
+#include "kvdb.h"
+#include "object.h"
+#include "bucketdb.h"
+#include "compactor.h"
+
+#define COMPACT_CHECK_INTERVAL_MSEC 5000
+#define COMPACT_BATCH_SLICES 64
+#define COMPACT_BATCH_BYTES (4 * 1024 * 1024)
+/* Writers may keep a slicedb alive for a while, retry later. */
+#define COMPACT_MAX_PASSES 3
+
+/* -------- struct compactor_t -------- */
+typedef struct compactor_t {
+    bucketdb_t *bucketdb;
+    uint32_t threshold;
+    uint64_t rate;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+
+    /* Token bucket, in bytes. */
+    double tokens;
+    uint64_t refill_usec;
+
+    uint64_t total_moved_bytes;
+    uint32_t total_retired;
+} compactor_t;
+
+/* -------- struct compact_batch_t -------- */
+typedef struct compact_batch_t {
+    bucketdb_t *bucketdb;
+    uint32_t slicedb_id;
+
+    slice_t *slices[COMPACT_BATCH_SLICES];
+    uint32_t total_slices;
+    uint64_t total_bytes;
+
+    slice_key_t last_key;
+    int has_last_key;
+    int full;
+} compact_batch_t;
+
+/* ================ now_usec() ================ */
+static uint64_t now_usec(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+}
+
+/* ================ compactor_sleep() ================ */
+/* Returns non-zero when the compactor is asked to stop. */
+static int compactor_sleep(compactor_t *compactor, uint64_t usec)
+{
+    uint64_t deadline_usec = now_usec() + usec;
+    struct timespec deadline;
+    deadline.tv_sec = deadline_usec / 1000000L;
+    deadline.tv_nsec = (deadline_usec % 1000000L) * 1000L;
+
+    pthread_mutex_lock(&compactor->lock);
+    while ( !compactor->stop ){
+        if ( pthread_cond_timedwait(&compactor->cond, &compactor->lock, &deadline) == ETIMEDOUT ){
+            break;
+        }
+    }
+    int stop = compactor->stop;
+    pthread_mutex_unlock(&compactor->lock);
+
+    return stop;
+}
+
+/* ================ compactor_throttle() ================ */
+static int compactor_throttle(compactor_t *compactor, uint64_t bytes)
+{
+    if ( compactor->rate == 0 ){
+        return compactor_sleep(compactor, 0);
+    }
+
+    uint64_t now = now_usec();
+    compactor->tokens += (double)(now - compactor->refill_usec) * compactor->rate / 1000000.0;
+    if ( compactor->tokens > compactor->rate ){
+        compactor->tokens = compactor->rate;
+    }
+    compactor->refill_usec = now;
+
+    compactor->tokens -= bytes;
+    uint64_t wait_usec = 0;
+    if ( compactor->tokens < 0 ){
+        wait_usec = (uint64_t)(-compactor->tokens * 1000000.0 / compactor->rate);
+    }
+
+    return compactor_sleep(compactor, wait_usec);
+}
+
+/* ================ collect_live_slices() ================ */
+static int collect_live_slices(void *user_data, const char *key, uint32_t klen, const char *value, uint32_t vlen)
+{
+    compact_batch_t *batch = (compact_batch_t*)user_data;
+
+    if ( klen != sizeof(slice_key_t) ){
+        return 0;
+    }
+    /* The scan resumes at the last key of the previous batch. */
+    if ( batch->has_last_key && memcmp(key, &batch->last_key, sizeof(slice_key_t)) == 0 ){
+        return 0;
+    }
+    if ( batch->total_slices >= COMPACT_BATCH_SLICES || batch->total_bytes >= COMPACT_BATCH_BYTES ){
+        batch->full = 1;
+        return 1;
+    }
+
+    memcpy(&batch->last_key, key, sizeof(slice_key_t));
+    batch->has_last_key = 1;
+
+    const slice_key_t *slice_key = (const slice_key_t*)key;
+    if ( bucketdb_is_live_slice(batch->bucketdb, slice_key, batch->slicedb_id) ){
+        batch->slices[batch->total_slices++] = slice_new(slice_key->key_md5, slice_key->slice_idx, value, vlen);
+        batch->total_bytes += vlen;
+    }
+
+    return 0;
+}
+
+/* ================ compactor_pick_slicedb() ================ */
+static int compactor_pick_slicedb(compactor_t *compactor, uint32_t *p_slicedb_id)
+{
+    bucketdb_t *bucketdb = compactor->bucketdb;
+
+    int found = 0;
+    double min_ratio = compactor->threshold / 100.0;
+    /* Sizes come from disk, checking does not open historical slicedbs. */
+    uint32_t active_slicedb_id = bucketdb->active_slicedb->id;
+    for ( uint32_t db_id = 0 ; db_id < SLICEDB_MAX ; db_id++ ){
+        uint64_t live_bytes = 0;
+        uint64_t dbsize = 0;
+        if ( db_id == active_slicedb_id || bucketdb_get_slicedb_usage(bucketdb, db_id, &live_bytes, &dbsize) != 0 ){
+            continue;
+        }
+        if ( dbsize > 0 ){
+            double ratio = (double)live_bytes / dbsize;
+            if ( ratio < min_ratio ){
+                min_ratio = ratio;
+                *p_slicedb_id = db_id;
+                found = 1;
+            }
+        }
+    }
+
+    return found;
+}
+
+/* ================ compactor_compact_slicedb() ================ */
+static void compactor_compact_slicedb(compactor_t *compactor, uint32_t slicedb_id)
+{
+    bucketdb_t *bucketdb = compactor->bucketdb;
+
+    slicedb_t *slicedb = bucketdb_acquire_slicedb(bucketdb, slicedb_id);
+    if ( slicedb == NULL ){
+        return;
+    }
+    notice_log("bucketdb(%d) compacting slicedb %d. live_bytes:%llu live_slices:%d",
+            bucketdb->id, slicedb_id, (unsigned long long)slicedb->live_bytes, slicedb->live_slices);
+
+    int stop = 0;
+    uint64_t moved_bytes = 0;
+    for ( int pass = 0 ; pass < COMPACT_MAX_PASSES && !stop ; pass++ ){
+        compact_batch_t batch;
+        memset(&batch, 0, sizeof(compact_batch_t));
+        batch.bucketdb = bucketdb;
+        batch.slicedb_id = slicedb_id;
+
+        do {
+            batch.total_slices = 0;
+            batch.total_bytes = 0;
+            batch.full = 0;
+
+            if ( kvdb_scan(slicedb->kvdb, batch.has_last_key ? (const char*)&batch.last_key : NULL, sizeof(slice_key_t), collect_live_slices, &batch) != 0 ){
+                stop = 1;
+            }
+
+            if ( batch.total_slices > 0 ){
+                if ( bucketdb_move_slices(bucketdb, slicedb_id, batch.slices, batch.total_slices) != 0 ){
+                    error_log("Move slices failed. bucketdb->id:%d slicedb_id:%d", bucketdb->id, slicedb_id);
+                    stop = 1;
+                } else {
+                    moved_bytes += batch.total_bytes;
+                }
+                for ( uint32_t i = 0 ; i < batch.total_slices ; i++ ){
+                    slice_free(batch.slices[i]);
+                }
+            }
+
+            if ( compactor_throttle(compactor, batch.total_bytes) ){
+                stop = 1;
+            }
+        } while ( batch.full && !stop );
+
+        if ( !stop && bucketdb_retire_slicedb(bucketdb, slicedb_id) == 0 ){
+            compactor->total_retired++;
+            notice_log("bucketdb(%d) retired slicedb %d. moved %llu bytes.", bucketdb->id, slicedb_id, (unsigned long long)moved_bytes);
+            break;
+        }
+    }
+    compactor->total_moved_bytes += moved_bytes;
+
+    bucketdb_release_slicedb(bucketdb, slicedb);
+}
+
+/* ================ compactor_thread_main() ================ */
+static void *compactor_thread_main(void *user_data)
+{
+    compactor_t *compactor = (compactor_t*)user_data;
+
+    while ( !compactor_sleep(compactor, COMPACT_CHECK_INTERVAL_MSEC * 1000L) ){
+        uint32_t slicedb_id = 0;
+        if ( compactor_pick_slicedb(compactor, &slicedb_id) ){
+            compactor_compact_slicedb(compactor, slicedb_id);
+        }
+    }
+
+    return NULL;
+}
+
+/* ================ compactor_new() ================ */
+compactor_t *compactor_new(bucketdb_t *bucketdb, uint32_t threshold, uint64_t rate)
+{
+    compactor_t *compactor = (compactor_t*)zmalloc(sizeof(compactor_t));
+    memset(compactor, 0, sizeof(compactor_t));
+
+    compactor->bucketdb = bucketdb;
+    compactor->threshold = threshold;
+    compactor->rate = rate;
+    compactor->tokens = rate;
+    compactor->refill_usec = now_usec();
+
+    pthread_mutex_init(&compactor->lock, NULL);
+    pthread_cond_init(&compactor->cond, NULL);
+
+    if ( pthread_create(&compactor->thread, NULL, compactor_thread_main, compactor) != 0 ){
+        error_log("Start compactor failed. bucketdb->id:%d", bucketdb->id);
+        pthread_cond_destroy(&compactor->cond);
+        pthread_mutex_destroy(&compactor->lock);
+        zfree(compactor);
+        return NULL;
+    }
+
+    return compactor;
+}
+
+/* ================ compactor_free() ================ */
+void compactor_free(compactor_t *compactor)
+{
+    pthread_mutex_lock(&compactor->lock);
+    compactor->stop = 1;
+    pthread_cond_broadcast(&compactor->cond);
+    pthread_mutex_unlock(&compactor->lock);
+
+    pthread_join(compactor->thread, NULL);
+
+    notice_log("bucketdb(%d) compactor moved %llu bytes, retired %d slicedbs.",
+            compactor->bucketdb->id, (unsigned long long)compactor->total_moved_bytes, compactor->total_retired);
+
+    pthread_cond_destroy(&compactor->cond);
+    pthread_mutex_destroy(&compactor->lock);
+    zfree(compactor);
+}
+
@@ -0,0 +1,35 @@
+/**
+ * @file   compactor.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-19 10:05:31
+ *
+ * @brief  Background space reclamation of rolled-over slicedbs.
+ *
+ *
+ */
+
+#ifndef __COMPACTOR_H__
+#define __COMPACTOR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct bucketdb_t bucketdb_t;
+typedef struct compactor_t compactor_t;
+
+/* Starts the compactor thread. threshold is the live data percentage
+ * below which a slicedb gets compacted, rate the bytes per second it may
+ * copy (0 means unlimited). */
+compactor_t *compactor_new(bucketdb_t *bucketdb, uint32_t threshold, uint64_t rate);
+/* Stops the thread, waiting for the batch in progress. */
+void compactor_free(compactor_t *compactor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __COMPACTOR_H__
+
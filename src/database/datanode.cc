@@ -16,19 +16,21 @@
 #include "bucket.h"
 #include "datanode.h"
 
-datanode_t *datanode_new(uint32_t total_buckets, uint32_t total_channels, int storage_type, const char *broker_endpoint, int verbose)
+datanode_t *datanode_new(uint32_t datanode_id, const char *data_dir, uint32_t total_buckets, uint32_t total_channels, int storage_type, const bucketdb_options_t *bucketdb_options, const char *broker_endpoint, int verbose)
 {
     datanode_t *datanode = (datanode_t*)malloc(sizeof(datanode_t));
     memset(datanode, 0, sizeof(datanode_t));
 
-    datanode->id = 0;
+    datanode->id = datanode_id;
     datanode->total_buckets = total_buckets;
     datanode->total_channels = total_channels;
     datanode->storage_type = storage_type;
     datanode->broker_endpoint = broker_endpoint;
     datanode->verbose = verbose;
+    datanode->bucketdb_options = *bucketdb_options;
+    /* One LRU of open slicedbs for all buckets of this worker. */
+    bucketdb_set_max_open_slicedbs(bucketdb_options);
 
-    const char *data_dir = "./data";
     if ( mkdir_if_not_exist(data_dir) != 0 ){
         error_log("mkdir %s failed.", data_dir);
         abort();
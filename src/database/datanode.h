@@ -17,6 +17,7 @@ extern "C" {
 
 #include <stdint.h>
 #include "zpipe.h"
+#include "bucketdb.h"
 
 typedef struct datanode_t{
     ZPIPE;
@@ -30,10 +31,12 @@ typedef struct datanode_t{
     const char *broker_endpoint;
     int verbose;
 
+    bucketdb_options_t bucketdb_options;
+
 } datanode_t;
 
 //datanode_t *datanode_new(uint32_t total_containers, uint32_t total_buckets, uint32_t total_channels, int storage_type, const char *broker_endpoint, int verbose);
-datanode_t *datanode_new(uint32_t total_buckets, uint32_t total_channels, int storage_type, const char *broker_endpoint, int verbose);
+datanode_t *datanode_new(uint32_t datanode_id, const char *data_dir, uint32_t total_buckets, uint32_t total_channels, int storage_type, const bucketdb_options_t *bucketdb_options, const char *broker_endpoint, int verbose);
 void datanode_free(datanode_t *datanode);
 void datanode_loop(datanode_t *datanode);
 
@@ -0,0 +1,461 @@
+/**
+ * @file   edbench.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-25 14:21:18
+ *
+ * @brief  Load generator of edclient --bench.
+ *
+ * One thread picks operations and keys and hands them to libedclient,
+ * whose I/O thread runs the callbacks that record the results, so the
+ * statistics need no lock. With a target rate every operation has its
+ * due time and its latency counts from then, not from when it was really
+ * sent, so a stalled server shows up in the tail instead of silently
+ * lowering the load (coordinated omission).
+ *
+ */
+
+#include <czmq.h>
+#include <math.h>
+#include "common.h"
+#include "logger.h"
+#include "farmhash.h"
+#include "histogram.h"
+#include "libedclient.h"
+#include "edbench.h"
+
+/* Latencies are kept in microseconds up to an hour. */
+#define BENCH_HIGHEST_LATENCY (3600ULL * 1000000)
+/* Time left to the requests still in flight at the end. */
+#define BENCH_DRAIN_SECONDS 30
+
+enum {
+    BENCH_OP_READ = 0,
+    BENCH_OP_WRITE,
+    BENCH_OP_DELETE,
+    BENCH_OPS,
+};
+static const char *bench_op_names[BENCH_OPS] = {"read", "write", "delete"};
+
+/* -------- struct zipf_t -------- */
+/* Gray et al. "Quickly generating billion-record synthetic databases",
+ * as in YCSB. Rank 0 is the hottest. */
+typedef struct zipf_t {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow_theta;
+} zipf_t;
+
+/* -------- struct bench_stats_t -------- */
+typedef struct bench_stats_t {
+    histogram_t *latency;
+    uint64_t ok;
+    uint64_t notfound;
+    uint64_t errors;
+    uint64_t timeouts;
+} bench_stats_t;
+
+/* -------- struct edbench_t -------- */
+typedef struct edbench_t {
+    const edbench_options_t *options;
+    edc_t *edc;
+    uint64_t rng;
+    zipf_t zipf;
+    char *value;
+
+    int64_t start_us;
+    /* Results count from here, after the warm-up. */
+    int64_t measure_us;
+    int64_t end_us;
+
+    /* Written by the callbacks only. */
+    bench_stats_t stats[BENCH_OPS];
+    uint32_t total_seconds;
+    uint64_t *ops_per_second;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t outstanding;
+} edbench_t;
+
+/* -------- struct bench_op_t -------- */
+typedef struct bench_op_t {
+    edbench_t *bench;
+    int op;
+    int64_t intended_us;
+} bench_op_t;
+
+/* ================ now_us() ================ */
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* ================ bench_random() ================ */
+/* xorshift64*, for the bench thread only. */
+static uint64_t bench_random(edbench_t *bench)
+{
+    bench->rng ^= bench->rng >> 12;
+    bench->rng ^= bench->rng << 25;
+    bench->rng ^= bench->rng >> 27;
+    return bench->rng * 2685821657736338717ULL;
+}
+
+/* ================ bench_random_double() ================ */
+static double bench_random_double(edbench_t *bench)
+{
+    return (bench_random(bench) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* ================ zipf_init() ================ */
+static void zipf_init(zipf_t *zipf, uint64_t n, double theta)
+{
+    zipf->n = n;
+    zipf->theta = theta;
+    zipf->alpha = 1.0 / (1.0 - theta);
+
+    double zetan = 0;
+    for ( uint64_t i = 1 ; i <= n ; i++ ){
+        zetan += 1.0 / pow((double)i, theta);
+    }
+    double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    zipf->zetan = zetan;
+    zipf->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    zipf->half_pow_theta = 1.0 + pow(0.5, theta);
+}
+
+/* ================ zipf_next() ================ */
+static uint64_t zipf_next(zipf_t *zipf, double u)
+{
+    double uz = u * zipf->zetan;
+    if ( uz < 1.0 ) return 0;
+    if ( uz < zipf->half_pow_theta ) return 1;
+
+    uint64_t rank = (uint64_t)(zipf->n * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+    return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+/* ================ bench_next_key() ================ */
+static uint64_t bench_next_key(edbench_t *bench)
+{
+    uint64_t total_keys = bench->options->total_keys;
+    if ( bench->options->zipf_theta <= 0 ){
+        return bench_random(bench) % total_keys;
+    }
+    /* Scatter the hot ranks over the key space, and so over the buckets. */
+    uint64_t rank = zipf_next(&bench->zipf, bench_random_double(bench));
+    return util::Hash64((const char *)&rank, sizeof(uint64_t)) % total_keys;
+}
+
+/* ================ bench_next_op() ================ */
+static int bench_next_op(edbench_t *bench)
+{
+    uint32_t n = bench_random(bench) % 100;
+    if ( n < bench->options->read_percent ) return BENCH_OP_READ;
+    if ( n < bench->options->read_percent + bench->options->write_percent ) return BENCH_OP_WRITE;
+    return BENCH_OP_DELETE;
+}
+
+/* ================ handle_bench_result() ================ */
+/* On the libedclient I/O thread. */
+static void handle_bench_result(edc_future_t *future, void *user_data)
+{
+    bench_op_t *bench_op = (bench_op_t*)user_data;
+    edbench_t *bench = bench_op->bench;
+    int64_t now = now_us();
+
+    if ( bench_op->intended_us >= bench->measure_us ){
+        bench_stats_t *stats = &bench->stats[bench_op->op];
+        int status = edc_future_status(future);
+        if ( status == EDC_OK || status == EDC_NOTFOUND ){
+            if ( status == EDC_OK ){
+                stats->ok++;
+            } else {
+                stats->notfound++;
+            }
+            histogram_record(stats->latency, now - bench_op->intended_us);
+        } else if ( status == EDC_TIMEOUT ){
+            stats->timeouts++;
+        } else {
+            stats->errors++;
+        }
+
+        uint64_t second = (now - bench->measure_us) / 1000000;
+        if ( second < bench->total_seconds ){
+            bench->ops_per_second[second]++;
+        }
+    }
+
+    edc_future_free(future);
+    free(bench_op);
+
+    pthread_mutex_lock(&bench->lock);
+    bench->outstanding--;
+    pthread_cond_signal(&bench->cond);
+    pthread_mutex_unlock(&bench->lock);
+}
+
+/* ================ bench_wait() ================ */
+/* Until fewer than limit requests are in flight or deadline passes. */
+static void bench_wait(edbench_t *bench, uint32_t limit, int64_t deadline)
+{
+    pthread_mutex_lock(&bench->lock);
+    while ( bench->outstanding >= limit && now_us() < deadline ){
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 10 * 1000000;
+        if ( ts.tv_nsec >= 1000000000 ){
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&bench->cond, &bench->lock, &ts);
+    }
+    pthread_mutex_unlock(&bench->lock);
+}
+
+/* ================ bench_submit() ================ */
+static void bench_submit(edbench_t *bench, int op, int64_t intended_us)
+{
+    const edbench_options_t *options = bench->options;
+
+    char key[NAME_MAX];
+    snprintf(key, NAME_MAX, "/bench/%s/%012llu", options->key, (unsigned long long)bench_next_key(bench));
+
+    bench_op_t *bench_op = (bench_op_t*)malloc(sizeof(bench_op_t));
+    bench_op->bench = bench;
+    bench_op->op = op;
+    bench_op->intended_us = intended_us;
+
+    pthread_mutex_lock(&bench->lock);
+    bench->outstanding++;
+    pthread_mutex_unlock(&bench->lock);
+
+    if ( op == BENCH_OP_READ ){
+        edc_get(bench->edc, key, handle_bench_result, bench_op);
+    } else if ( op == BENCH_OP_WRITE ){
+        uint32_t value_size = options->value_size_min;
+        if ( options->value_size_max > options->value_size_min ){
+            value_size += bench_random(bench) % (options->value_size_max - options->value_size_min + 1);
+        }
+        edc_put(bench->edc, key, bench->value, value_size, handle_bench_result, bench_op);
+    } else {
+        edc_del(bench->edc, key, handle_bench_result, bench_op);
+    }
+}
+
+/* ================ bench_loop() ================ */
+static void bench_loop(edbench_t *bench)
+{
+    const edbench_options_t *options = bench->options;
+    uint32_t concurrency = options->concurrency > 0 ? options->concurrency : 1;
+
+    uint64_t total_sent = 0;
+    uint32_t reported_seconds = 0;
+    while ( true ){
+        int64_t now = now_us();
+        if ( now >= bench->end_us ) break;
+
+        int64_t intended_us = now;
+        if ( options->rate > 0 ){
+            intended_us = bench->start_us + (int64_t)(total_sent * 1000000.0 / options->rate);
+            if ( intended_us >= bench->end_us ) break;
+            if ( intended_us > now ){
+                int64_t sleep_us = intended_us - now;
+                usleep(sleep_us < 1000 ? sleep_us : 1000);
+                continue;
+            }
+        }
+
+        bench_wait(bench, concurrency, bench->end_us);
+        if ( now_us() >= bench->end_us ) break;
+
+        bench_submit(bench, bench_next_op(bench), options->rate > 0 ? intended_us : now_us());
+        total_sent++;
+
+        /* The count of the last full second is final by now. */
+        if ( now > bench->measure_us ){
+            uint32_t seconds = (now - bench->measure_us) / 1000000;
+            if ( seconds > reported_seconds && seconds <= bench->total_seconds ){
+                reported_seconds = seconds;
+                info_log("[%4d s] %llu ops/s, %d in flight", seconds, (unsigned long long)bench->ops_per_second[seconds - 1], bench->outstanding);
+            }
+        }
+    }
+
+    bench_wait(bench, 1, now_us() + BENCH_DRAIN_SECONDS * 1000000LL);
+    if ( bench->outstanding > 0 ){
+        warning_log("%d requests still in flight after %d seconds.", bench->outstanding, BENCH_DRAIN_SECONDS);
+    }
+}
+
+/* ================ bench_report() ================ */
+static void bench_report(edbench_t *bench)
+{
+    const edbench_options_t *options = bench->options;
+
+    uint64_t total_ops = 0;
+    for ( int i = 0 ; i < BENCH_OPS ; i++ ){
+        bench_stats_t *stats = &bench->stats[i];
+        total_ops += stats->ok + stats->notfound + stats->errors + stats->timeouts;
+    }
+    double throughput = options->duration > 0 ? (double)total_ops / options->duration : 0;
+
+    notice_log("========> Bench %d s, %llu ops, %.1f ops/s <========", options->duration, (unsigned long long)total_ops, throughput);
+    for ( int i = 0 ; i < BENCH_OPS ; i++ ){
+        bench_stats_t *stats = &bench->stats[i];
+        if ( stats->ok + stats->notfound + stats->errors + stats->timeouts == 0 ) continue;
+        notice_log("%-6s ok:%llu notfound:%llu errors:%llu timeouts:%llu | us mean:%.0f p50:%llu p99:%llu p999:%llu max:%llu",
+                bench_op_names[i],
+                (unsigned long long)stats->ok, (unsigned long long)stats->notfound,
+                (unsigned long long)stats->errors, (unsigned long long)stats->timeouts,
+                histogram_mean(stats->latency),
+                (unsigned long long)histogram_percentile(stats->latency, 50.0),
+                (unsigned long long)histogram_percentile(stats->latency, 99.0),
+                (unsigned long long)histogram_percentile(stats->latency, 99.9),
+                (unsigned long long)histogram_max(stats->latency));
+    }
+
+    if ( options->json_file == NULL ) return;
+
+    FILE *file = strcmp(options->json_file, "-") == 0 ? stdout : fopen(options->json_file, "w");
+    if ( file == NULL ){
+        error_log("fopen() failed. file:%s", options->json_file);
+        return;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"config\": {\"endpoint\": \"%s\", \"connections\": %d, \"concurrency\": %d, \"read\": %d, \"write\": %d, \"delete\": %d, \"keys\": %llu, \"zipf_theta\": %.3f, \"value_size_min\": %d, \"value_size_max\": %d, \"rate\": %d, \"duration\": %d, \"warmup\": %d},\n",
+            options->endpoint, options->total_connections, options->concurrency,
+            options->read_percent, options->write_percent, options->delete_percent,
+            (unsigned long long)options->total_keys, options->zipf_theta,
+            options->value_size_min, options->value_size_max,
+            options->rate, options->duration, options->warmup);
+    fprintf(file, "  \"total_ops\": %llu,\n", (unsigned long long)total_ops);
+    fprintf(file, "  \"throughput\": %.1f,\n", throughput);
+    fprintf(file, "  \"operations\": {");
+    int first = 1;
+    for ( int i = 0 ; i < BENCH_OPS ; i++ ){
+        bench_stats_t *stats = &bench->stats[i];
+        if ( stats->ok + stats->notfound + stats->errors + stats->timeouts == 0 ) continue;
+        fprintf(file, "%s\n    \"%s\": {\"ok\": %llu, \"notfound\": %llu, \"errors\": %llu, \"timeouts\": %llu, \"latency_us\": {\"mean\": %.1f, \"min\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}",
+                first ? "" : ",", bench_op_names[i],
+                (unsigned long long)stats->ok, (unsigned long long)stats->notfound,
+                (unsigned long long)stats->errors, (unsigned long long)stats->timeouts,
+                histogram_mean(stats->latency),
+                (unsigned long long)histogram_min(stats->latency),
+                (unsigned long long)histogram_percentile(stats->latency, 50.0),
+                (unsigned long long)histogram_percentile(stats->latency, 90.0),
+                (unsigned long long)histogram_percentile(stats->latency, 99.0),
+                (unsigned long long)histogram_percentile(stats->latency, 99.9),
+                (unsigned long long)histogram_max(stats->latency));
+        first = 0;
+    }
+    fprintf(file, "\n  },\n");
+    fprintf(file, "  \"ops_per_second\": [");
+    for ( uint32_t i = 0 ; i < options->duration && i < bench->total_seconds ; i++ ){
+        fprintf(file, "%s%llu", i > 0 ? ", " : "", (unsigned long long)bench->ops_per_second[i]);
+    }
+    fprintf(file, "]\n}\n");
+
+    if ( file != stdout ){
+        fclose(file);
+    }
+}
+
+/* ================ edbench_options_init() ================ */
+void edbench_options_init(edbench_options_t *options)
+{
+    memset(options, 0, sizeof(edbench_options_t));
+    options->endpoint = "tcp://127.0.0.1:19977";
+    options->key = "default";
+    options->total_connections = 4;
+    options->concurrency = 64;
+    options->read_percent = 50;
+    options->write_percent = 50;
+    options->delete_percent = 0;
+    options->total_keys = 100000;
+    options->zipf_theta = 0;
+    options->value_size_min = 4096;
+    options->value_size_max = 4096;
+    options->rate = 0;
+    options->duration = 60;
+    options->warmup = 5;
+}
+
+/* ================ run_edbench() ================ */
+int run_edbench(const edbench_options_t *options)
+{
+    if ( options->read_percent + options->write_percent + options->delete_percent != 100 ){
+        error_log("The read/write/delete mix must add up to 100.");
+        return -1;
+    }
+    if ( options->total_keys == 0 || options->duration == 0 ){
+        error_log("Need some keys and some duration.");
+        return -1;
+    }
+
+    edbench_t *bench = (edbench_t*)malloc(sizeof(edbench_t));
+    memset(bench, 0, sizeof(edbench_t));
+    bench->options = options;
+    bench->rng = (uint64_t)now_us() | 1;
+    pthread_mutex_init(&bench->lock, NULL);
+    pthread_cond_init(&bench->cond, NULL);
+
+    if ( options->zipf_theta > 0 ){
+        zipf_init(&bench->zipf, options->total_keys, options->zipf_theta);
+    }
+    uint32_t value_size = options->value_size_max > options->value_size_min ? options->value_size_max : options->value_size_min;
+    bench->value = (char*)malloc(value_size > 0 ? value_size : 1);
+    for ( uint32_t i = 0 ; i < value_size ; i++ ){
+        bench->value[i] = (char)bench_random(bench);
+    }
+    for ( int i = 0 ; i < BENCH_OPS ; i++ ){
+        bench->stats[i].latency = histogram_new(BENCH_HIGHEST_LATENCY);
+    }
+    bench->total_seconds = options->duration + BENCH_DRAIN_SECONDS;
+    bench->ops_per_second = (uint64_t*)malloc(sizeof(uint64_t) * bench->total_seconds);
+    memset(bench->ops_per_second, 0, sizeof(uint64_t) * bench->total_seconds);
+
+    edc_options_t edc_options;
+    edc_options_init(&edc_options);
+    edc_options.total_connections = options->total_connections;
+    edc_options.max_inflight = options->concurrency;
+    bench->edc = edc_new(options->endpoint, &edc_options);
+    if ( bench->edc == NULL ){
+        error_log("Start client library failed.");
+    } else {
+        info_log("Bench %s %d/%d/%d read/write/delete, %llu keys %s, %d-%d bytes, %s, %d s after %d s warm-up.",
+                options->endpoint, options->read_percent, options->write_percent, options->delete_percent,
+                (unsigned long long)options->total_keys, options->zipf_theta > 0 ? "zipfian" : "uniform",
+                options->value_size_min, options->value_size_max,
+                options->rate > 0 ? "open loop" : "closed loop",
+                options->duration, options->warmup);
+
+        bench->start_us = now_us();
+        bench->measure_us = bench->start_us + (int64_t)options->warmup * 1000000;
+        bench->end_us = bench->measure_us + (int64_t)options->duration * 1000000;
+
+        bench_loop(bench);
+        /* Joins the I/O thread, the statistics are ours from here. */
+        edc_free(bench->edc);
+        bench->edc = NULL;
+
+        bench_report(bench);
+    }
+
+    for ( int i = 0 ; i < BENCH_OPS ; i++ ){
+        histogram_free(bench->stats[i].latency);
+    }
+    free(bench->ops_per_second);
+    free(bench->value);
+    pthread_cond_destroy(&bench->cond);
+    pthread_mutex_destroy(&bench->lock);
+    free(bench);
+
+    return 0;
+}
+
@@ -0,0 +1,60 @@
+/**
+ * @file   edbench.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-25 14:20:41
+ *
+ * @brief  Load generator of edclient --bench.
+ *
+ *
+ */
+
+#ifndef __EDBENCH_H__
+#define __EDBENCH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* -------- struct edbench_options_t -------- */
+typedef struct edbench_options_t {
+    const char *endpoint;
+    /* Keys are /bench/<key>/<index> */
+    const char *key;
+    uint32_t total_connections;
+    /* Requests in flight at most. */
+    uint32_t concurrency;
+
+    /* Percent of each operation, they add up to 100. */
+    uint32_t read_percent;
+    uint32_t write_percent;
+    uint32_t delete_percent;
+
+    uint64_t total_keys;
+    /* 0 for uniform keys, the zipfian skew otherwise (0.99 is YCSB's). */
+    double zipf_theta;
+    /* Values are uniform between the two sizes. */
+    uint32_t value_size_min;
+    uint32_t value_size_max;
+
+    /* Operations per second sent on schedule whatever the latency, 0 to
+     * send the next one as soon as one finishes. */
+    uint32_t rate;
+    uint32_t duration;
+    /* Seconds before the measurement starts. */
+    uint32_t warmup;
+
+    /* JSON report file, "-" for stdout, NULL for none. */
+    const char *json_file;
+} edbench_options_t;
+
+void edbench_options_init(edbench_options_t *options);
+int run_edbench(const edbench_options_t *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __EDBENCH_H__
+
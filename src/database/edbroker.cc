@@ -14,16 +14,127 @@
 #include "logger.h"
 #include "farmhash.h"
 #include "everdata.h"
+#include "hashring.h"
+#include "workertable.h"
+#include "zpipe.h"
+#include "timerwheel.h"
 
 #include "cboost.h"
 
+/* Points every bucket owns on the hash ring. */
+#define RING_VNODES 160
+#define MAX_REPLICAS 8
+/* Replicas go to different datanodes first, see hashring_lookup_n(). */
+#define DATANODE_MASK 0xFFFFFFFF00000000ULL
+/* A prefix delete may walk many keys in every bucket. */
+#define SCATTER_TIMEOUT 60000
+
+/* Frontend I/O threads, see broker_shard_t. */
+#define MAX_SHARDS 64
+#define PROXY_ENDPOINT "inproc://edbroker-proxy"
+
+/* Resolution of worker heartbeats and expiry. */
+#define WHEEL_TICK 100
+
+/* Every envelope a shard sends to a worker starts with the shard id, the
+ * channel sends the reply back to that shard's backend by it. Requests sent
+ * to replicas carry this tag in place of the client address. Workers
+ * echo it back like any other envelope. A shard envelope as short as the
+ * tag has the small size of the client identity where the marker goes. */
+#define REQUEST_TAG_MARKER 0xFE
+
+/* Frames a client may put in front of the empty delimiter, its identity
+ * included, see client_address_fold(). */
+#define CLIENT_ADDRESS_MAX_FRAMES 8
+typedef struct request_tag_t {
+    uint8_t shard_id;
+    uint8_t marker;
+    uint32_t request_id;
+} __attribute__((packed)) request_tag_t;
+
+/* -------- struct pending_request_t -------- */
+typedef struct pending_request_t {
+    uint32_t id;
+    zframe_t *client_identity;
+    int is_read;
+    uint32_t total_replicas;
+    uint32_t quorum;
+    uint32_t total_acks;
+    uint32_t total_replies;
+    int replied;
+    int64_t expiry;
+    /* Scattered to all buckets, answered once all replied with the sum
+     * of their counts. */
+    int is_scatter;
+    uint32_t total_count;
+    /* A scan keeps the page of every bucket until all are in. */
+    int is_scan;
+    uint32_t scan_limit;
+    zmsg_t **scan_pages;
+} pending_request_t;
+
+/* ================ pending_request_free() ================ */
+static void pending_request_free(pending_request_t *request)
+{
+    if ( request->client_identity != NULL ){
+        zframe_destroy(&request->client_identity);
+    }
+    if ( request->scan_pages != NULL ){
+        for ( uint32_t i = 0 ; i < request->total_replicas ; i++ ){
+            if ( request->scan_pages[i] != NULL ){
+                zmsg_destroy(&request->scan_pages[i]);
+            }
+        }
+        free(request->scan_pages);
+    }
+    free(request);
+}
+
+typedef struct backend_bucket_t backend_bucket_t;
+typedef struct broker_t broker_t;
+
 /* -------- struct worker_t -------- */
 typedef struct worker_t {
     zframe_t *identity;
     char *id_string;
+    broker_t *broker;
+    /* Pushed on by every message from the worker, expiry_timer only
+     * checks it when it fires. */
     int64_t expiry;
+    timerwheel_timer_t expiry_timer;
+    timerwheel_timer_t heartbeat_timer;
+
+    uint32_t datanode_id;
+    uint32_t bucket_id;
+    uint32_t channel_id;
+    backend_bucket_t *bucket;
 } worker_t;
 
+/* -------- struct backend_bucket_t -------- */
+/* One bucket of one datanode. Buckets, not channels, are placed on the
+ * hash ring, so channels coming and going never move keys. */
+typedef struct backend_bucket_t {
+    uint64_t node_id;
+    char *id_string;
+    g_vector_t *workers;
+} backend_bucket_t;
+
+/* -------- struct route_bucket_t -------- */
+typedef struct route_bucket_t {
+    uint32_t total_workers;
+    zframe_t **identities;
+} route_bucket_t;
+
+/* -------- struct routing_t -------- */
+/* What the frontend path needs to route a message: the ring and the
+ * channel identities of every bucket, copied out of the worker registry.
+ * Never modified once published, membership changes build a new one. */
+typedef struct routing_t {
+    hashring_t *ring;
+    uint32_t total_buckets;
+    route_bucket_t *buckets;
+} routing_t;
+
 worker_t *worker_new(zframe_t *identity)
 {
     worker_t *worker = (worker_t*)malloc(sizeof(worker_t));
@@ -31,7 +142,6 @@ worker_t *worker_new(zframe_t *identity)
 
     worker->identity = identity;
     worker->id_string = zframe_strhex(identity);
-    worker->expiry = zclock_time() + HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS;
 
     return worker;
 }
@@ -48,214 +158,445 @@ void worker_free(worker_t *worker)
 }
 
 /* -------- struct broker_t -------- */
+typedef struct broker_shard_t broker_shard_t;
+
+/* -------- struct broker_t -------- */
+/* The thread running run_broker() owns the backend socket and the worker
+ * registry. Workers only announce themselves and heartbeat there, requests
+ * and replies go straight between the shards and the workers. It runs the
+ * heartbeat and expiry timers of the workers. */
 typedef struct broker_t{
     zloop_t *loop;
-    zsock_t *sock_local_frontend;
     zsock_t *sock_local_backend;
-    int heartbeat_timer_id;
-    int64_t heartbeat_at;
-
-    pthread_mutex_t workers_lock;
-
-    g_stringmap_t *backends;
-    g_vector_t *select_backends;
+    /* The shard backends listen next to it, see message_shard_endpoint(). */
+    const char *backend;
+
+    uint32_t total_shards;
+    broker_shard_t **shards;
+
+    /* Worker registry, owned by the backend thread. */
+    workertable_t *workers;
+    timerwheel_t *timers;
+    /* Clock of the backend thread, read once per wheel tick. */
+    int64_t now;
+    g_stringmap_t *buckets;
+    int routing_dirty;
+
+    /* Routing snapshot, swapped in by broker_update_routing(). Readers
+     * count themselves in routing_readers[] of the current epoch, an old
+     * snapshot is freed once the readers of its epoch left. */
+    routing_t *volatile routing;
+    volatile uint32_t routing_epoch;
+    volatile uint32_t routing_readers[2];
 
     int is_stub;
 
+    /* Replication. Writes go to replicas copies and are acked after
+     * write_quorum replies, reads ask read_quorum of them and the first
+     * data reply wins. */
+    uint32_t replicas;
+    uint32_t write_quorum;
+    uint32_t read_quorum;
+
 } broker_t;
 
+/* -------- struct broker_shard_t -------- */
+/* One frontend I/O thread. The frontend proxy spreads client requests
+ * over the shards, each routes them from the shared routing snapshot and
+ * keeps the replicated and scattered requests it sent out to itself. */
+typedef struct broker_shard_t {
+    ZPIPE_ACTOR;
+
+    broker_t *broker;
+    uint8_t id;
+
+    zloop_t *loop;
+    /* Client requests and their replies, through the frontend proxy. */
+    zsock_t *sock_frontend;
+    /* ROUTER of its own every worker connects to, addressed by the same
+     * identity the worker has in the registry. */
+    zsock_t *sock_backend;
+
+    uint32_t next_request_id;
+    g_intmap_t *pending_requests;
+} broker_shard_t;
+
 broker_t *broker_new(void)
 {
     broker_t *broker = (broker_t*)malloc(sizeof(broker_t));
     memset(broker, 0, sizeof(broker_t));
 
-    pthread_mutex_init(&broker->workers_lock, NULL);
-
-    broker->heartbeat_timer_id = -1;
-    broker->heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
-
-    broker->backends = g_stringmap_new();
-    broker->select_backends = g_vector_new();
+    broker->workers = workertable_new(0);
+    broker->buckets = g_stringmap_new();
+    broker->now = zclock_time();
+    broker->timers = timerwheel_new(WHEEL_TICK, broker->now);
 
     broker->is_stub = 0;
 
+    broker->replicas = 1;
+    broker->write_quorum = 1;
+    broker->read_quorum = 1;
+
     return broker;
 }
 
-void broker_lock_workers(broker_t *broker)
+/* ================ routing_free() ================ */
+static void routing_free(routing_t *routing)
 {
-    pthread_mutex_lock(&broker->workers_lock);
-}
+    if ( routing == NULL ) return;
 
-void broker_unlock_workers(broker_t *broker)
-{
-    pthread_mutex_unlock(&broker->workers_lock);
+    for ( uint32_t i = 0 ; i < routing->total_buckets ; i++ ){
+        route_bucket_t *bucket = &routing->buckets[i];
+        for ( uint32_t n = 0 ; n < bucket->total_workers ; n++ ){
+            zframe_destroy(&bucket->identities[n]);
+        }
+        free(bucket->identities);
+    }
+    free(routing->buckets);
+    hashring_free(routing->ring);
+    free(routing);
 }
 
-void broker_free(broker_t *broker)
+/* ================ routing_new() ================ */
+static routing_t *routing_new(g_stringmap_t *buckets)
 {
+    routing_t *routing = (routing_t*)malloc(sizeof(routing_t));
+    memset(routing, 0, sizeof(routing_t));
 
-    broker_lock_workers(broker);
+    routing->ring = hashring_new(RING_VNODES);
+    routing->buckets = (route_bucket_t*)malloc(sizeof(route_bucket_t) * (g_stringmap_size(buckets) + 1));
+    uint64_t *node_ids = (uint64_t*)malloc(sizeof(uint64_t) * (g_stringmap_size(buckets) + 1));
+    void **datas = (void**)malloc(sizeof(void*) * (g_stringmap_size(buckets) + 1));
 
-    g_iterator_t *it = g_stringmap_begin(broker->backends);
-    g_iterator_t *itend = g_stringmap_end(broker->backends);
+    g_iterator_t *it = g_stringmap_begin(buckets);
+    g_iterator_t *itend = g_stringmap_end(buckets);
     while ( g_iterator_compare(it, itend) != 0 ){
-        worker_t *w = (worker_t*)g_iterator_get(it);
-        if ( w != NULL )
-            worker_free(w);
+        backend_bucket_t *backend_bucket = (backend_bucket_t*)g_iterator_get(it);
+        route_bucket_t *bucket = &routing->buckets[routing->total_buckets++];
+
+        uint32_t total_workers = g_vector_size(backend_bucket->workers);
+        bucket->total_workers = total_workers;
+        bucket->identities = (zframe_t**)malloc(sizeof(zframe_t*) * (total_workers + 1));
+        for ( uint32_t n = 0 ; n < total_workers ; n++ ){
+            worker_t *worker = (worker_t*)g_vector_get_element(backend_bucket->workers, n);
+            bucket->identities[n] = zframe_dup(worker->identity);
+        }
+
+        node_ids[routing->total_buckets - 1] = backend_bucket->node_id;
+        datas[routing->total_buckets - 1] = bucket;
         g_iterator_next(it);
-    };
+    }
     g_iterator_free(it);
     g_iterator_free(itend);
-    g_stringmap_free(broker->backends);
-    broker->backends = NULL;
-    g_vector_free(broker->select_backends);
-    broker->select_backends = NULL;
-
-    broker_unlock_workers(broker);
 
-    pthread_mutex_destroy(&broker->workers_lock);
+    /* One sort for the whole ring instead of one per bucket. */
+    hashring_add_many(routing->ring, node_ids, datas, routing->total_buckets);
+    free(node_ids);
+    free(datas);
 
+    return routing;
+}
 
-    free(broker);
+/* ================ broker_routing_begin() ================ */
+/* The snapshot and the identities in it stay valid until the matching
+ * broker_routing_end(). */
+static routing_t *broker_routing_begin(broker_t *broker, uint32_t *epoch)
+{
+    while ( 1 ){
+        uint32_t current_epoch = broker->routing_epoch;
+        __sync_add_and_fetch(&broker->routing_readers[current_epoch & 1], 1);
+        /* An update flipping the epoch before the increment may have
+         * drained this counter already, join the new one instead. */
+        if ( broker->routing_epoch == current_epoch ){
+            *epoch = current_epoch & 1;
+            return broker->routing;
+        }
+        __sync_sub_and_fetch(&broker->routing_readers[current_epoch & 1], 1);
+    }
 }
 
-uint32_t broker_get_available_workers(broker_t *broker)
+/* ================ broker_routing_end() ================ */
+static void broker_routing_end(broker_t *broker, uint32_t epoch)
 {
-    return g_stringmap_size(broker->backends);
+    __sync_sub_and_fetch(&broker->routing_readers[epoch], 1);
 }
 
-void broker_end_local_frontend(broker_t *broker)
+/* ================ broker_update_routing() ================ */
+/* Publish a new snapshot if workers came or went. Only the thread owning
+ * the registry calls this. */
+static void broker_update_routing(broker_t *broker)
 {
-    if ( broker->sock_local_frontend != NULL ){
-        zloop_reader_end(broker->loop, broker->sock_local_frontend);
-        broker->sock_local_frontend = NULL;
+    if ( !broker->routing_dirty ) return;
+    broker->routing_dirty = 0;
+
+    routing_t *old_routing = broker->routing;
+    routing_t *routing = routing_new(broker->buckets);
+    __sync_synchronize();
+    broker->routing = routing;
+
+    uint32_t epoch = __sync_fetch_and_add(&broker->routing_epoch, 1) & 1;
+    while ( __sync_add_and_fetch(&broker->routing_readers[epoch], 0) != 0 ){
+        sched_yield();
     }
+    routing_free(old_routing);
 }
 
-void broker_end_local_backend(broker_t *broker)
+/* ================ free_worker() ================ */
+static void free_worker(void *user_data, void *worker)
 {
-    if ( broker->sock_local_backend != NULL ){
-        zloop_reader_end(broker->loop, broker->sock_local_backend);
-        broker->sock_local_backend = NULL;
-    }
+    worker_free((worker_t*)worker);
 }
 
-void broker_end_timer(broker_t *broker)
+void broker_free(broker_t *broker)
 {
-    if ( broker->heartbeat_timer_id != -1 ){
-        zloop_timer_end(broker->loop, broker->heartbeat_timer_id);
-        broker->heartbeat_timer_id = -1;
-    }
+    workertable_foreach(broker->workers, free_worker, NULL);
+    workertable_free(broker->workers);
+    broker->workers = NULL;
+
+    g_iterator_t *it = g_stringmap_begin(broker->buckets);
+    g_iterator_t *itend = g_stringmap_end(broker->buckets);
+    while ( g_iterator_compare(it, itend) != 0 ){
+        backend_bucket_t *bucket = (backend_bucket_t*)g_iterator_get(it);
+        g_vector_free(bucket->workers);
+        free(bucket->id_string);
+        free(bucket);
+        g_iterator_next(it);
+    };
+    g_iterator_free(it);
+    g_iterator_free(itend);
+    g_stringmap_free(broker->buckets);
+    broker->buckets = NULL;
+    routing_free(broker->routing);
+    broker->routing = NULL;
+    timerwheel_free(broker->timers);
+    broker->timers = NULL;
+
+    free(broker);
+}
+
+uint32_t broker_get_available_workers(broker_t *broker)
+{
+    return workertable_size(broker->workers);
 }
 
 void broker_end_loop(broker_t *broker)
 {
-    broker_end_local_frontend(broker);
-    broker_end_local_backend(broker);
-    broker_end_timer(broker);
+    if ( broker->sock_local_backend != NULL ){
+        zloop_reader_end(broker->loop, broker->sock_local_backend);
+    }
 }
 
-void refresh_select_backends(broker_t *broker)
+/* ================ broker_attach_worker() ================ */
+void broker_attach_worker(broker_t *broker, worker_t *worker)
 {
-    g_vector_t *backends = broker->select_backends;
-    g_vector_clear(backends);
-    g_iterator_t *it = g_stringmap_begin(broker->backends);
-    g_iterator_t *itend = g_stringmap_end(broker->backends);
-    while ( g_iterator_compare(it, itend) != 0 ){
-        worker_t *w = (worker_t*)g_iterator_get(it);
-        g_vector_push_back(backends, w);
-        g_iterator_next(it);
+    char id_string[64];
+    sprintf(id_string, "%u-%u", worker->datanode_id, worker->bucket_id);
+
+    backend_bucket_t *bucket = NULL;
+    g_iterator_t *it = g_stringmap_find(broker->buckets, id_string);
+    g_iterator_t *itend = g_stringmap_end(broker->buckets);
+    if ( g_iterator_compare(it, itend) != 0 ){
+        bucket = (backend_bucket_t*)g_iterator_get(it);
     }
     g_iterator_free(it);
     g_iterator_free(itend);
+
+    if ( bucket == NULL ){
+        bucket = (backend_bucket_t*)malloc(sizeof(backend_bucket_t));
+        memset(bucket, 0, sizeof(backend_bucket_t));
+        bucket->node_id = ((uint64_t)worker->datanode_id << 32) | worker->bucket_id;
+        bucket->id_string = strdup(id_string);
+        bucket->workers = g_vector_new();
+        g_stringmap_insert(broker->buckets, bucket->id_string, bucket);
+        notice_log("Bucket %s joins the ring. Buckets:%zu", bucket->id_string, g_stringmap_size(broker->buckets));
+    }
+
+    g_vector_push_back(bucket->workers, worker);
+    worker->bucket = bucket;
+    broker->routing_dirty = 1;
 }
 
-/* ================ broker_set_worker_ready() ================ */
-worker_t *broker_set_worker_ready(broker_t *broker, zframe_t *worker_identity)
+/* ================ broker_detach_worker() ================ */
+void broker_detach_worker(broker_t *broker, worker_t *worker)
 {
+    backend_bucket_t *bucket = worker->bucket;
+    if ( bucket == NULL ) return;
+    worker->bucket = NULL;
+    broker->routing_dirty = 1;
+
+    size_t total_workers = g_vector_size(bucket->workers);
+    for ( size_t i = 0 ; i < total_workers ; i++ ){
+        if ( g_vector_get_element(bucket->workers, i) == worker ){
+            g_vector_erase(bucket->workers, i);
+            break;
+        }
+    }
 
-    broker_lock_workers(broker);
+    if ( g_vector_empty(bucket->workers) ){
+        g_iterator_t *it = g_stringmap_find(broker->buckets, bucket->id_string);
+        g_iterator_t *itend = g_stringmap_end(broker->buckets);
+        if ( g_iterator_compare(it, itend) != 0 ){
+            g_iterator_erase(it);
+        }
+        g_iterator_free(it);
+        g_iterator_free(itend);
+        warning_log("Bucket %s leaves the ring. Buckets:%zu", bucket->id_string, g_stringmap_size(broker->buckets));
 
-    char *id_string = zframe_strhex(worker_identity);
+        g_vector_free(bucket->workers);
+        free(bucket->id_string);
+        free(bucket);
+    }
+}
 
-    int worker_found = 0;
+/* ================ handle_worker_heartbeat_timer() ================ */
+/* Requests go out through the shards, unseen here, so every worker gets a
+ * heartbeat each interval. */
+static void handle_worker_heartbeat_timer(void *user_data, timerwheel_timer_t *timer)
+{
+    worker_t *worker = (worker_t*)user_data;
+    broker_t *broker = worker->broker;
 
-    g_stringmap_t *backends = broker->backends;
-    g_iterator_t *it = g_stringmap_find(backends, id_string);
-    g_iterator_t *itend = g_stringmap_end(backends);
-    free(id_string);
+    zmsg_t *heartbeat_msg = zmsg_new();
+    zmsg_push(heartbeat_msg, zframe_dup(worker->identity));
+    message_add_heartbeat(heartbeat_msg, MSG_HEARTBEAT_BROKER);
+    zmsg_send(&heartbeat_msg, broker->sock_local_backend);
 
-    worker_t *worker = NULL;
-    if ( g_iterator_compare(it, itend) != 0){
-        worker_found = 1;
-        worker = (worker_t*)g_iterator_get(it);
-    } else {
-        worker_found = 0;
-        worker = worker_new(worker_identity);
+    timerwheel_add(broker->timers, timer, broker->now + HEARTBEAT_INTERVAL, handle_worker_heartbeat_timer, worker);
+}
+
+/* ================ handle_worker_expiry_timer() ================ */
+static void handle_worker_expiry_timer(void *user_data, timerwheel_timer_t *timer)
+{
+    worker_t *worker = (worker_t*)user_data;
+    broker_t *broker = worker->broker;
+
+    if ( worker->expiry >= broker->now ){
+        timerwheel_add(broker->timers, timer, worker->expiry, handle_worker_expiry_timer, worker);
+        return;
     }
 
-    if ( worker_found == 1 ){
-        int64_t now = zclock_time();
-        worker->expiry = now + HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS;
-        /*notice_log("worker(%s) ready. expiry:%zu", worker->id_string, worker->expiry - now);*/
+    workertable_remove(broker->workers, zframe_data(worker->identity), zframe_size(worker->identity));
+    warning_log("Worker %s workers(%d) timeout. Remove from queue. now:%lld worker expiry:%lld(%d)", worker->id_string, workertable_size(broker->workers), (long long)broker->now, (long long)worker->expiry, (int32_t)(worker->expiry - broker->now));
+
+    timerwheel_remove(broker->timers, &worker->heartbeat_timer);
+    broker_detach_worker(broker, worker);
+    worker_free(worker);
+}
+
+/* ================ broker_set_worker_ready() ================ */
+/* location is the [datanode][bucket][channel] ids of a READY message, NULL
+ * for any other message. Workers only join on READY, others just refresh
+ * their expiry. Takes the ownership of worker_identity. */
+worker_t *broker_set_worker_ready(broker_t *broker, zframe_t *worker_identity, const uint32_t *location)
+{
+    worker_t *worker = (worker_t*)workertable_get(broker->workers, zframe_data(worker_identity), zframe_size(worker_identity));
+    if ( worker != NULL ){
+        zframe_destroy(&worker_identity);
+    } else if ( location != NULL ){
+        worker = worker_new(worker_identity);
+        worker->broker = broker;
+        worker->datanode_id = location[0];
+        worker->bucket_id = location[1];
+        worker->channel_id = location[2];
+        workertable_put(broker->workers, zframe_data(worker->identity), zframe_size(worker->identity), worker);
+        broker_attach_worker(broker, worker);
+
+        timerwheel_add(broker->timers, &worker->heartbeat_timer, broker->now + HEARTBEAT_INTERVAL, handle_worker_heartbeat_timer, worker);
+        timerwheel_add(broker->timers, &worker->expiry_timer, broker->now + HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS, handle_worker_expiry_timer, worker);
     } else {
-        g_stringmap_insert(backends, worker->id_string, worker);
-        refresh_select_backends(broker);
+        zframe_destroy(&worker_identity);
     }
 
-    /*refresh_select_backends(broker);*/
-
-    broker_unlock_workers(broker);
+    if ( worker != NULL ){
+        worker->expiry = broker->now + HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS;
+        /*notice_log("worker(%s) ready. expiry:%zu", worker->id_string, worker->expiry - broker->now);*/
+    }
 
     return worker;
 }
 
 /* ================ broker_workers_purge() ================ */
+/* Runs the worker timers due by now, the cost is in the timers that fire
+ * and not in the size of the registry. */
 void broker_workers_purge(broker_t *broker)
 {
+    broker->now = zclock_time();
+    timerwheel_advance(broker->timers, broker->now);
 
-    broker_lock_workers(broker);
+    broker_update_routing(broker);
+}
 
-    g_stringmap_t *backends = broker->backends;
+/* ================ route_bucket_choose_worker() ================ */
+/* The hash also spreads the keys of a bucket over its channels. */
+zframe_t *route_bucket_choose_worker(route_bucket_t *bucket, uint32_t hash)
+{
+    if ( bucket->total_workers == 0 ){
+        return NULL;
+    }
 
-    g_iterator_t *it = g_stringmap_begin(backends);
-    g_iterator_t *itend = g_stringmap_end(backends);
-    while ( g_iterator_compare(it, itend) != 0 ){
-        worker_t *worker = (worker_t*)g_iterator_get(it);
-        if ( worker != NULL ){
-            int64_t now = zclock_time();
-            int64_t expiry = worker->expiry;
-            if ( now > expiry ){
-                g_iterator_erase(it);
-                warning_log("Worker %s workers(%zu) timeout. Remove from queue. now:%llu worker expiry:%llu(%d)", worker->id_string, g_stringmap_size(backends), now, expiry, (int32_t)(expiry - now));
+    return bucket->identities[hash % bucket->total_workers];
+}
 
-                zframe_t *identity = worker->identity;
-                zframe_destroy(&identity);
-                worker->identity = NULL;
-                worker_free(worker);
+/* ================ broker_choose_worker_by_hash() ================ */
+zframe_t *broker_choose_worker_by_hash(routing_t *routing, uint32_t hash)
+{
+    if ( routing == NULL ){
+        return NULL;
+    }
+    route_bucket_t *bucket = (route_bucket_t*)hashring_lookup(routing->ring, hash);
+    if ( bucket == NULL ){
+        return NULL;
+    }
 
-                continue;
-            }
-        }
-        g_iterator_next(it);
-    };
+    return route_bucket_choose_worker(bucket, hash);
+}
 
-    refresh_select_backends(broker);
+/* ================ broker_choose_replicas() ================ */
+uint32_t broker_choose_replicas(routing_t *routing, uint32_t hash, zframe_t **workers, uint32_t total_replicas)
+{
+    if ( routing == NULL ){
+        return 0;
+    }
+
+    void *buckets[MAX_REPLICAS];
+    uint32_t total_buckets = hashring_lookup_n(routing->ring, hash, DATANODE_MASK, buckets, total_replicas);
 
-    broker_unlock_workers(broker);
+    uint32_t total_workers = 0;
+    for ( uint32_t i = 0 ; i < total_buckets ; i++ ){
+        zframe_t *worker = route_bucket_choose_worker((route_bucket_t*)buckets[i], hash);
+        if ( worker != NULL ){
+            workers[total_workers++] = worker;
+        }
+    }
+
+    return total_workers;
 }
 
-/* ================ broker_choose_worker_identity() ================ */
-zframe_t *broker_choose_worker_identity(broker_t *broker, zmsg_t *msg)
+/* ================ is_slice_action() ================ */
+static int is_slice_action(zframe_t *frame_action)
 {
-    zframe_t *worker_identity = NULL;
+    return zframe_size(frame_action) == 2 &&
+        ( memcmp(zframe_data(frame_action), MSG_ACTION_PUT_SLICE, 2) == 0 ||
+          memcmp(zframe_data(frame_action), MSG_ACTION_GET_SLICE, 2) == 0 ||
+          memcmp(zframe_data(frame_action), MSG_ACTION_DEL_SLICE, 2) == 0 );
+}
 
+/* ================ broker_message_hash() ================ */
+/* Routing hash of a frontend message. A binary request carries it in its
+ * header, the action format has the key hashed here, see
+ * everdata_key_hash(). Returns -1 without a key. */
+int broker_message_hash(zmsg_t *msg, uint32_t *hash)
+{
     UNUSED zframe_t *frame_identity = zmsg_first(msg);
     if ( frame_identity != NULL ){
         UNUSED zframe_t *frame_empty = zmsg_next(msg);
         if ( frame_empty != NULL ){
             UNUSED zframe_t *frame_msgtype = zmsg_next(msg);
+            const request_header_t *header = message_request_header(frame_msgtype);
+            if ( header != NULL ){
+                *hash = header->key_hash;
+                return 0;
+            }
             if ( frame_msgtype != NULL ){
                 UNUSED zframe_t *frame_action = zmsg_next(msg);
                 if ( frame_action != NULL ) {
@@ -264,71 +605,706 @@ zframe_t *broker_choose_worker_identity(broker_t *broker, zmsg_t *msg)
                         const char *key = (const char *)zframe_data(frame_key);
                         UNUSED uint32_t key_len = zframe_size(frame_key);
 
-                        //md5_value_t key_md5;
-                        //md5(&key_md5, (uint8_t *)key, key_len);
-                        int32_t hash = util::Hash32(key, key_len);
-
-                        /*g_vector_t *backends = g_vector_new();*/
-                        /*g_iterator_t *it = g_stringmap_begin(broker->backends);*/
-                        /*g_iterator_t *itend = g_stringmap_end(broker->backends);*/
-                        /*while ( g_iterator_compare(it, itend) != 0 ){*/
-                            /*worker_t *w = g_iterator_get(it);*/
-                            /*g_vector_push_back(backends, w);*/
-                            /*g_iterator_next(it);*/
-                        /*}*/
-                        /*g_iterator_free(it);*/
-                        /*g_iterator_free(itend);*/
-                        g_vector_t *backends = broker->select_backends;
-                        size_t total_backends = g_vector_size(backends);
-                        if ( total_backends > 0 ){
-                            //int idx = key_md5.h1 % total_backends;
-                            int idx = hash % total_backends;
-                            worker_t *worker = (worker_t*)g_vector_get_element(backends, idx);
-                            if ( worker != NULL ){
-                                worker_identity = zframe_dup(worker->identity);
-                                /*notice_log("Choose worker identity: %s, key: %s", worker->id_string, key);*/
+                        uint32_t slice_idx = 0;
+                        if ( is_slice_action(frame_action) ){
+                            zframe_t *frame_header = zmsg_next(msg);
+                            if ( frame_header == NULL || zframe_size(frame_header) != sizeof(slice_header_t) ){
+                                return -1;
                             }
+                            slice_idx = ((slice_header_t*)zframe_data(frame_header))->slice_idx;
                         }
-
-                        /*g_vector_free(backends);*/
+                        *hash = everdata_key_hash(key, key_len, slice_idx);
+                        return 0;
                     }
                 }
             }
         }
     }
 
+    return -1;
+}
+
+/* ================ broker_choose_worker_identity() ================ */
+zframe_t *broker_choose_worker_identity(routing_t *routing, zmsg_t *msg)
+{
+    zframe_t *worker_identity = NULL;
+
+    uint32_t hash = 0;
+    if ( broker_message_hash(msg, &hash) == 0 ){
+        zframe_t *worker = broker_choose_worker_by_hash(routing, hash);
+        if ( worker != NULL ){
+            worker_identity = zframe_dup(worker);
+        }
+    }
+
     return worker_identity;
 }
 
-/* ================ handle_pullin_on_local_frontend() ================ */
-int handle_pullin_on_local_frontend(zloop_t *loop, zsock_t *sock, void *user_data)
+/* ================ broker_check_action() ================ */
+/* Like message_check_action() but for a frontend message that still carries
+ * the [client identity][empty] envelope. */
+int broker_check_action(zmsg_t *msg, const char *action)
 {
-    broker_t *broker = (broker_t*)user_data;
+    zmsg_first(msg);
+    zmsg_next(msg);
+    zframe_t *frame_msgtype = zmsg_next(msg);
+    const request_header_t *header = message_request_header(frame_msgtype);
+    if ( header != NULL ){
+        return memcmp(header->opcode, action, sizeof(header->opcode));
+    }
+    if ( frame_msgtype != NULL && zframe_size(frame_msgtype) == sizeof(int16_t) &&
+            *(int16_t*)zframe_data(frame_msgtype) == MSGTYPE_ACTION ){
+        zframe_t *frame_action = zmsg_next(msg);
+        if ( frame_action != NULL && zframe_size(frame_action) >= strlen(action) ){
+            return memcmp(zframe_data(frame_action), action, strlen(action));
+        }
+    }
+    return -1;
+}
 
-    zmsg_t *msg = zmsg_recv(sock);
-    if ( msg == NULL ){
-        broker_end_loop(broker);
+/* ================ client_address_fold() ================ */
+/* Clients may stack frames of their own, a request id say, between their
+ * identity and the empty delimiter. The broker carries them as one
+ * opaque client address [size][identity][size][frame]... in place of the
+ * identity, and unfolds it again in broker_send_to_client(). */
+static int client_address_fold(zmsg_t *msg)
+{
+    uint32_t total_frames = 0;
+    size_t address_size = 0;
+    zframe_t *frame = zmsg_first(msg);
+    while ( frame != NULL && zframe_size(frame) > 0 ){
+        if ( zframe_size(frame) > UINT8_MAX || ++total_frames > CLIENT_ADDRESS_MAX_FRAMES ){
+            return -1;
+        }
+        address_size += 1 + zframe_size(frame);
+        frame = zmsg_next(msg);
+    }
+    if ( frame == NULL || total_frames == 0 ){
         return -1;
     }
-    /*zmsg_print(msg);*/
 
-    if ( broker->is_stub ) {
+    zframe_t *address = zframe_new(NULL, address_size);
+    uint8_t *p = zframe_data(address);
+    for ( uint32_t i = 0 ; i < total_frames ; i++ ){
+        frame = zmsg_pop(msg);
+        *p++ = zframe_size(frame);
+        memcpy(p, zframe_data(frame), zframe_size(frame));
+        p += zframe_size(frame);
+        zframe_destroy(&frame);
+    }
+    zmsg_push(msg, address);
+
+    return 0;
+}
+
+/* ================ broker_send_to_client() ================ */
+/* msg starts with a client address from client_address_fold(). */
+int broker_send_to_client(zmsg_t **msg_p, zsock_t *sock)
+{
+    zmsg_t *msg = *msg_p;
+    zframe_t *address = zmsg_pop(msg);
+    if ( address == NULL ){
+        zmsg_destroy(msg_p);
+        return -1;
+    }
+
+    const uint8_t *data = zframe_data(address);
+    size_t address_size = zframe_size(address);
+    uint32_t offsets[CLIENT_ADDRESS_MAX_FRAMES];
+    uint32_t total_frames = 0;
+    size_t pos = 0;
+    while ( pos < address_size && total_frames < CLIENT_ADDRESS_MAX_FRAMES ){
+        offsets[total_frames++] = pos;
+        pos += 1 + data[pos];
+    }
+    if ( pos != address_size ){
+        warning_log("Drop reply with a malformed client address.");
+        zframe_destroy(&address);
+        zmsg_destroy(msg_p);
+        return -1;
+    }
+    while ( total_frames > 0 ){
+        uint32_t offset = offsets[--total_frames];
+        zmsg_pushmem(msg, data + offset + 1, data[offset]);
+    }
+    zframe_destroy(&address);
+
+    return zmsg_send(msg_p, sock);
+}
+
+/* ================ broker_send_batch_status() ================ */
+void broker_send_batch_status(zsock_t *sock, zframe_t *client_identity, const char *status, uint32_t total_objects)
+{
+    zmsg_t *sendback_msg = create_status_message(status);
+    zmsg_addmem(sendback_msg, &total_objects, sizeof(uint32_t));
+    zmsg_wrap(sendback_msg, client_identity);
+    broker_send_to_client(&sendback_msg, sock);
+}
+
+/* ================ shard_envelope_new() ================ */
+/* client_identity behind the shard id, see request_tag_t. */
+static zframe_t *shard_envelope_new(broker_shard_t *shard, zframe_t *client_identity)
+{
+    size_t size = zframe_size(client_identity);
+    zframe_t *envelope = zframe_new(NULL, size + 1);
+    uint8_t *data = zframe_data(envelope);
+    data[0] = shard->id;
+    memcpy(data + 1, zframe_data(client_identity), size);
+
+    return envelope;
+}
+
+/* ================ shard_send_to_worker() ================ */
+/* [worker identity][envelope]... A worker not connected to this shard,
+ * yet or any more, fails the send. The request is dropped and left to
+ * the timeouts. Consumes *msg_p. */
+static int shard_send_to_worker(broker_shard_t *shard, zmsg_t **msg_p)
+{
+    if ( zmsg_send(msg_p, shard->sock_backend) != 0 ){
+        warning_log("Broker shard %d cannot reach the worker. errno:%d", shard->id, errno);
+        zmsg_destroy(msg_p);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ================ broker_send_to_replicas() ================ */
+/* Send msg, without its client envelope, to every worker under one tag.
+ * Consumes client_identity and *msg_p. */
+pending_request_t *broker_send_to_replicas(broker_shard_t *shard, zframe_t *client_identity, zmsg_t **msg_p, zframe_t **workers, uint32_t total_workers, int is_read, uint32_t quorum)
+{
+    pending_request_t *request = (pending_request_t*)malloc(sizeof(pending_request_t));
+    memset(request, 0, sizeof(pending_request_t));
+    request->id = shard->next_request_id++;
+    request->client_identity = client_identity;
+    request->is_read = is_read;
+    request->total_replicas = total_workers;
+    request->quorum = quorum;
+    request->expiry = zclock_time() + HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS;
+    g_intmap_insert(shard->pending_requests, request->id, request);
+
+    request_tag_t tag;
+    tag.shard_id = shard->id;
+    tag.marker = REQUEST_TAG_MARKER;
+    tag.request_id = request->id;
+
+    zmsg_t *msg = *msg_p;
+    *msg_p = NULL;
+    for ( uint32_t i = 0 ; i < total_workers ; i++ ){
+        zmsg_t *replica_msg = i + 1 < total_workers ? zmsg_dup(msg) : msg;
+        zmsg_pushmem(replica_msg, "", 0);
+        zmsg_pushmem(replica_msg, &tag, sizeof(request_tag_t));
+        zmsg_push(replica_msg, zframe_dup(workers[i]));
+        shard_send_to_worker(shard, &replica_msg);
+    }
+
+    return request;
+}
+
+/* ================ broker_dispatch_replicated() ================ */
+void broker_dispatch_replicated(broker_shard_t *shard, routing_t *routing, zsock_t *sock, zmsg_t **msg_p)
+{
+    zmsg_t *msg = *msg_p;
+
+    int is_read = broker_check_action(msg, MSG_ACTION_GET) == 0 || broker_check_action(msg, MSG_ACTION_GET_SLICE) == 0;
+
+    zframe_t *workers[MAX_REPLICAS];
+    uint32_t total_workers = 0;
+    uint32_t hash = 0;
+    if ( broker_message_hash(msg, &hash) == 0 ){
+        total_workers = broker_choose_replicas(routing, hash, workers, is_read ? shard->broker->read_quorum : shard->broker->replicas);
+    }
+
+    if ( total_workers == 0 ){
         zmsg_t *sendback_msg = create_sendback_message(msg);
-        message_add_status(sendback_msg, MSG_STATUS_WORKER_ACK);
-        zmsg_send(&sendback_msg, sock);
+        message_add_status(sendback_msg, MSG_STATUS_WORKER_ERROR);
+        broker_send_to_client(&sendback_msg, sock);
+        return;
+    }
+
+    uint32_t quorum = 1;
+    if ( !is_read ){
+        quorum = shard->broker->write_quorum < total_workers ? shard->broker->write_quorum : total_workers;
+    }
+
+    zframe_t *client_identity = zmsg_unwrap(msg);
+    broker_send_to_replicas(shard, client_identity, msg_p, workers, total_workers, is_read, quorum);
+}
+
+/* ================ broker_dispatch_scatter() ================ */
+/* DEL, DEL_PREFIX and SCAN go to one worker of every bucket. With
+ * replication the delete counts include the replicas. */
+void broker_dispatch_scatter(broker_shard_t *shard, routing_t *routing, zsock_t *sock, zmsg_t **msg_p)
+{
+    zmsg_t *msg = *msg_p;
+
+    uint32_t max_workers = routing != NULL ? routing->total_buckets : 0;
+    zframe_t **workers = (zframe_t**)malloc(sizeof(zframe_t*) * (max_workers + 1));
+    uint32_t total_workers = 0;
+
+    for ( uint32_t i = 0 ; i < max_workers ; i++ ){
+        zframe_t *worker = route_bucket_choose_worker(&routing->buckets[i], shard->next_request_id);
+        if ( worker != NULL ){
+            workers[total_workers++] = worker;
+        }
+    }
+
+    if ( total_workers == 0 ){
+        zmsg_t *sendback_msg = create_sendback_message(msg);
+        message_add_status(sendback_msg, MSG_STATUS_WORKER_ERROR);
+        broker_send_to_client(&sendback_msg, sock);
+        free(workers);
+        return;
+    }
+
+    zframe_t *client_identity = zmsg_unwrap(msg);
+
+    int is_scan = message_check_action(msg, MSG_ACTION_SCAN) == 0;
+    uint32_t scan_limit = SCAN_MAX_LIMIT;
+    if ( is_scan ){
+        zframe_t *frame_request = zmsg_last(msg);
+        if ( message_total_arguments(msg) < 3 || zframe_size(frame_request) != sizeof(scan_request_t) ){
+            zmsg_t *sendback_msg = create_status_message(MSG_STATUS_WORKER_ERROR);
+            zmsg_wrap(sendback_msg, client_identity);
+            broker_send_to_client(&sendback_msg, sock);
+            free(workers);
+            return;
+        }
+        uint32_t limit = ((scan_request_t*)zframe_data(frame_request))->limit;
+        if ( limit > 0 && limit < SCAN_MAX_LIMIT ){
+            scan_limit = limit;
+        }
+    }
+
+    pending_request_t *request = broker_send_to_replicas(shard, client_identity, msg_p, workers, total_workers, 0, total_workers);
+    request->is_scatter = 1;
+    request->expiry = zclock_time() + SCATTER_TIMEOUT;
+    if ( is_scan ){
+        request->is_scan = 1;
+        request->scan_limit = scan_limit;
+        request->scan_pages = (zmsg_t**)malloc(sizeof(zmsg_t*) * total_workers);
+        memset(request->scan_pages, 0, sizeof(zmsg_t*) * total_workers);
+    }
+
+    free(workers);
+}
+
+/* -------- struct scan_page_t -------- */
+typedef struct scan_page_t {
+    zframe_t **keys;
+    uint64_t *sizes;
+    uint32_t total_entries;
+    uint32_t pos;
+    int more;
+} scan_page_t;
+
+/* ================ scan_page_parse() ================ */
+/* Frames stay owned by msg. */
+static int scan_page_parse(scan_page_t *page, zmsg_t *msg)
+{
+    memset(page, 0, sizeof(scan_page_t));
+
+    zmsg_first(msg);
+    zmsg_next(msg);
+    zframe_t *frame_reply = zmsg_next(msg);
+    if ( frame_reply == NULL || zframe_size(frame_reply) != sizeof(scan_reply_t) ){
+        return -1;
+    }
+    scan_reply_t *scan_reply = (scan_reply_t*)zframe_data(frame_reply);
+    page->more = scan_reply->more;
+
+    page->keys = (zframe_t**)malloc(sizeof(zframe_t*) * (scan_reply->total_entries + 1));
+    page->sizes = (uint64_t*)malloc(sizeof(uint64_t) * (scan_reply->total_entries + 1));
+    for ( uint32_t i = 0 ; i < scan_reply->total_entries ; i++ ){
+        zframe_t *frame_key = zmsg_next(msg);
+        zframe_t *frame_size = zmsg_next(msg);
+        if ( frame_key == NULL || frame_size == NULL || zframe_size(frame_size) != sizeof(uint64_t) ){
+            free(page->keys);
+            free(page->sizes);
+            memset(page, 0, sizeof(scan_page_t));
+            return -1;
+        }
+        page->keys[i] = frame_key;
+        page->sizes[i] = *(uint64_t*)zframe_data(frame_size);
+        page->total_entries++;
+    }
+
+    return 0;
+}
+
+/* ================ frame_compare() ================ */
+static int frame_compare(zframe_t *a, zframe_t *b)
+{
+    size_t a_size = zframe_size(a);
+    size_t b_size = zframe_size(b);
+    int rc = memcmp(zframe_data(a), zframe_data(b), a_size < b_size ? a_size : b_size);
+    if ( rc == 0 ){
+        rc = a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+    }
+    return rc;
+}
+
+/* ================ broker_reply_scan() ================ */
+/* Merge the sorted bucket pages. A bucket that filled its page may hold
+ * more keys right behind its last one, so the merged page must not go
+ * past the smallest last key of the full pages. Keys kept by several
+ * buckets, replicas or the slices of one object, are listed once. */
+static void broker_reply_scan(broker_shard_t *shard, pending_request_t *request)
+{
+    uint32_t total_pages = request->total_replies;
+    scan_page_t *pages = (scan_page_t*)malloc(sizeof(scan_page_t) * (total_pages + 1));
+    int ok = 1;
+    zframe_t *cutoff = NULL;
+    for ( uint32_t i = 0 ; i < total_pages ; i++ ){
+        memset(&pages[i], 0, sizeof(scan_page_t));
+        if ( request->scan_pages[i] == NULL || scan_page_parse(&pages[i], request->scan_pages[i]) != 0 ){
+            ok = 0;
+            continue;
+        }
+        if ( pages[i].more && pages[i].total_entries > 0 ){
+            zframe_t *last_key = pages[i].keys[pages[i].total_entries - 1];
+            if ( cutoff == NULL || frame_compare(last_key, cutoff) < 0 ){
+                cutoff = last_key;
+            }
+        }
+    }
+
+    zmsg_t *entries = zmsg_new();
+    uint32_t total_entries = 0;
+    int more = cutoff != NULL;
+    while ( ok ){
+        zframe_t *min_key = NULL;
+        uint64_t min_size = 0;
+        for ( uint32_t i = 0 ; i < total_pages ; i++ ){
+            scan_page_t *page = &pages[i];
+            if ( page->pos >= page->total_entries ){
+                continue;
+            }
+            zframe_t *key = page->keys[page->pos];
+            int rc = min_key == NULL ? -1 : frame_compare(key, min_key);
+            if ( rc < 0 ){
+                min_key = key;
+                min_size = page->sizes[page->pos];
+            } else if ( rc == 0 && page->sizes[page->pos] > min_size ){
+                min_size = page->sizes[page->pos];
+            }
+        }
+        if ( min_key == NULL || (cutoff != NULL && frame_compare(min_key, cutoff) > 0) ){
+            break;
+        }
+        if ( total_entries >= request->scan_limit ){
+            more = 1;
+            break;
+        }
+
+        zmsg_addmem(entries, zframe_data(min_key), zframe_size(min_key));
+        zmsg_addmem(entries, &min_size, sizeof(uint64_t));
+        total_entries++;
+
+        for ( uint32_t i = 0 ; i < total_pages ; i++ ){
+            scan_page_t *page = &pages[i];
+            if ( page->pos < page->total_entries && frame_compare(page->keys[page->pos], min_key) == 0 ){
+                page->pos++;
+            }
+        }
+    }
+
+    zmsg_t *sendback_msg = NULL;
+    if ( ok ){
+        scan_reply_t scan_reply;
+        scan_reply.total_entries = total_entries;
+        scan_reply.more = more;
+        sendback_msg = create_status_message(MSG_STATUS_WORKER_ACK);
+        zmsg_addmem(sendback_msg, &scan_reply, sizeof(scan_reply_t));
+        zframe_t *frame = NULL;
+        while ( (frame = zmsg_pop(entries)) != NULL ){
+            zmsg_append(sendback_msg, &frame);
+        }
     } else {
-        zframe_t *worker_identity = broker_choose_worker_identity(broker, msg);
+        sendback_msg = create_status_message(MSG_STATUS_WORKER_ERROR);
+    }
+    zmsg_destroy(&entries);
+
+    for ( uint32_t i = 0 ; i < total_pages ; i++ ){
+        free(pages[i].keys);
+        free(pages[i].sizes);
+    }
+    free(pages);
+
+    zmsg_wrap(sendback_msg, request->client_identity);
+    request->client_identity = NULL;
+    broker_send_to_client(&sendback_msg, shard->sock_frontend);
+    request->replied = 1;
+}
+
+/* ================ broker_reply_scatter() ================ */
+/* Consumes the client identity of request. */
+static void broker_reply_scatter(broker_shard_t *shard, pending_request_t *request)
+{
+    if ( request->is_scan && request->total_acks == request->total_replicas ){
+        broker_reply_scan(shard, request);
+        return;
+    }
+
+    const char *status = MSG_STATUS_WORKER_ACK;
+    if ( request->total_acks < request->total_replicas ){
+        status = MSG_STATUS_WORKER_ERROR;
+    } else if ( request->total_count == 0 ){
+        status = MSG_STATUS_WORKER_NOTFOUND;
+    }
+    broker_send_batch_status(shard->sock_frontend, request->client_identity, status, request->total_count);
+    request->client_identity = NULL;
+    request->replied = 1;
+}
+
+/* ================ broker_handle_replica_reply() ================ */
+/* A write is answered with the reply that completes its quorum, or with
+ * the failure that makes the quorum unreachable. A read is answered with
+ * its first data reply, or with the last failure once all replicas
+ * failed. */
+void broker_handle_replica_reply(broker_shard_t *shard, zmsg_t *msg)
+{
+    zframe_t *frame_tag = zmsg_unwrap(msg);
+    uint32_t request_id = ((request_tag_t*)zframe_data(frame_tag))->request_id;
+    zframe_destroy(&frame_tag);
+
+    g_iterator_t *it = g_intmap_find(shard->pending_requests, request_id);
+    g_iterator_t *itend = g_intmap_end(shard->pending_requests);
+    if ( g_iterator_compare(it, itend) == 0 ){
+        /* Expired already. */
+        g_iterator_free(it);
+        g_iterator_free(itend);
+        zmsg_destroy(&msg);
+        return;
+    }
+    pending_request_t *request = (pending_request_t*)g_iterator_get(it);
+
+    int ok = 0;
+    if ( request->is_scan ){
+        ok = message_check_status(msg, MSG_STATUS_WORKER_ACK) == 0;
+        if ( ok && request->total_replies < request->total_replicas ){
+            request->scan_pages[request->total_replies] = msg;
+            msg = NULL;
+        }
+    } else if ( request->is_scatter ){
+        ok = message_check_status(msg, MSG_STATUS_WORKER_ACK) == 0 || message_check_status(msg, MSG_STATUS_WORKER_NOTFOUND) == 0;
+        zframe_t *frame_count = zmsg_last(msg);
+        if ( ok && zmsg_size(msg) >= 3 && zframe_size(frame_count) == sizeof(uint32_t) ){
+            request->total_count += *(uint32_t*)zframe_data(frame_count);
+        }
+    } else if ( request->is_read ){
+        ok = message_get_msgtype(msg) == MSGTYPE_DATA;
+    } else {
+        ok = message_check_status(msg, MSG_STATUS_WORKER_ACK) == 0;
+    }
+    request->total_replies++;
+    if ( ok ) request->total_acks++;
+
+    if ( request->is_scatter ){
+        if ( request->total_replies >= request->total_replicas ){
+            broker_reply_scatter(shard, request);
+        }
+    } else if ( !request->replied ){
+        uint32_t total_fails = request->total_replies - request->total_acks;
+        if ( (ok && request->total_acks >= request->quorum) ||
+                (!ok && total_fails > request->total_replicas - request->quorum) ){
+            request->replied = 1;
+            zmsg_wrap(msg, zframe_dup(request->client_identity));
+            broker_send_to_client(&msg, shard->sock_frontend);
+        }
+    }
+
+    if ( request->total_replies >= request->total_replicas ){
+        g_iterator_erase(it);
+        pending_request_free(request);
+    }
+    g_iterator_free(it);
+    g_iterator_free(itend);
+
+    if ( msg != NULL ){
+        zmsg_destroy(&msg);
+    }
+}
+
+/* ================ broker_expire_requests() ================ */
+void broker_expire_requests(broker_shard_t *shard)
+{
+    int64_t now = zclock_time();
+
+    g_iterator_t *it = g_intmap_begin(shard->pending_requests);
+    g_iterator_t *itend = g_intmap_end(shard->pending_requests);
+    while ( g_iterator_compare(it, itend) != 0 ){
+        pending_request_t *request = (pending_request_t*)g_iterator_get(it);
+        if ( now > request->expiry ){
+            if ( request->is_scatter ){
+                warning_log("Request %d timeout. %d/%d buckets replied.", request->id, request->total_replies, request->total_replicas);
+                broker_reply_scatter(shard, request);
+            } else if ( !request->replied ){
+                warning_log("Request %d timeout. %d/%d replicas replied.", request->id, request->total_replies, request->total_replicas);
+                zmsg_t *sendback_msg = create_status_message(MSG_STATUS_WORKER_ERROR);
+                zmsg_wrap(sendback_msg, request->client_identity);
+                request->client_identity = NULL;
+                broker_send_to_client(&sendback_msg, shard->sock_frontend);
+            }
+            pending_request_free(request);
+            g_iterator_erase(it);
+            continue;
+        }
+        g_iterator_next(it);
+    }
+    g_iterator_free(it);
+    g_iterator_free(itend);
+}
+
+/* ================ broker_dispatch_batch() ================ */
+/* A MSG_ACTION_PUT_BATCH message carries objects that belong to different
+ * workers. Split it into one sub-batch per worker, moving the key/data frames
+ * without copying. Every worker acks its own sub-batch with an object count,
+ * which the client sums up. */
+void broker_dispatch_batch(broker_shard_t *shard, routing_t *routing, zsock_t *sock, zmsg_t *msg)
+{
+    zframe_t *client_identity = zmsg_unwrap(msg);
+    /* A binary request has its header in place of both. */
+    zframe_t *frame_msgtype = zmsg_pop(msg);
+    zframe_t *frame_action = message_request_header(frame_msgtype) == NULL ? zmsg_pop(msg) : NULL;
+
+    uint32_t total_objects = zmsg_size(msg) / 2;
+
+    typedef struct sub_batch_t {
+        zframe_t *workers[MAX_REPLICAS];
+        uint32_t total_workers;
+        zmsg_t *msg;
+    } sub_batch_t;
+    sub_batch_t *sub_batches = (sub_batch_t*)malloc(sizeof(sub_batch_t) * (total_objects + 1));
+    uint32_t total_sub_batches = 0;
+    uint32_t unrouted_objects = 0;
+
+    for ( uint32_t n = 0 ; n < total_objects ; n++ ){
+        zframe_t *frame_key = zmsg_pop(msg);
+        zframe_t *frame_data = zmsg_pop(msg);
+
+        /* Objects are grouped by their whole replica set. */
+        zframe_t *workers[MAX_REPLICAS];
+        uint32_t hash = everdata_key_hash((const char*)zframe_data(frame_key), zframe_size(frame_key), 0);
+        uint32_t total_workers = broker_choose_replicas(routing, hash, workers, shard->broker->replicas);
+        if ( total_workers == 0 ){
+            unrouted_objects++;
+            zframe_destroy(&frame_key);
+            zframe_destroy(&frame_data);
+            continue;
+        }
+
+        sub_batch_t *sub_batch = NULL;
+        for ( uint32_t i = 0 ; i < total_sub_batches ; i++ ){
+            if ( sub_batches[i].total_workers == total_workers &&
+                    memcmp(sub_batches[i].workers, workers, sizeof(zframe_t*) * total_workers) == 0 ){
+                sub_batch = &sub_batches[i];
+                break;
+            }
+        }
+        if ( sub_batch == NULL ){
+            sub_batch = &sub_batches[total_sub_batches++];
+            memcpy(sub_batch->workers, workers, sizeof(zframe_t*) * total_workers);
+            sub_batch->total_workers = total_workers;
+            sub_batch->msg = zmsg_new();
+            zmsg_addmem(sub_batch->msg, zframe_data(frame_msgtype), zframe_size(frame_msgtype));
+            if ( frame_action != NULL ){
+                zmsg_addmem(sub_batch->msg, zframe_data(frame_action), zframe_size(frame_action));
+            }
+        }
+        zmsg_append(sub_batch->msg, &frame_key);
+        zmsg_append(sub_batch->msg, &frame_data);
+    }
+
+    for ( uint32_t i = 0 ; i < total_sub_batches ; i++ ){
+        zmsg_t *sub_msg = sub_batches[i].msg;
+        if ( shard->broker->replicas > 1 ){
+            uint32_t total_workers = sub_batches[i].total_workers;
+            uint32_t quorum = shard->broker->write_quorum < total_workers ? shard->broker->write_quorum : total_workers;
+            broker_send_to_replicas(shard, zframe_dup(client_identity), &sub_msg, sub_batches[i].workers, total_workers, 0, quorum);
+        } else {
+            zmsg_wrap(sub_msg, shard_envelope_new(shard, client_identity));
+            zmsg_push(sub_msg, zframe_dup(sub_batches[i].workers[0]));
+            shard_send_to_worker(shard, &sub_msg);
+        }
+    }
+    free(sub_batches);
+
+    if ( unrouted_objects > 0 || total_objects == 0 ){
+        broker_send_batch_status(sock, client_identity, MSG_STATUS_WORKER_ERROR, unrouted_objects);
+    } else {
+        zframe_destroy(&client_identity);
+    }
+
+    zframe_destroy(&frame_msgtype);
+    zframe_destroy(&frame_action);
+}
+
+/* ================ broker_dispatch() ================ */
+/* Route one frontend message. Whatever is left in *msg_p is the caller's
+ * to destroy. */
+void broker_dispatch(broker_shard_t *shard, routing_t *routing, zsock_t *sock, zmsg_t **msg_p)
+{
+    zmsg_t *msg = *msg_p;
+
+    if ( broker_check_action(msg, MSG_ACTION_PUT_BATCH) == 0 ){
+        broker_dispatch_batch(shard, routing, sock, msg);
+    } else if ( broker_check_action(msg, MSG_ACTION_DEL) == 0 || broker_check_action(msg, MSG_ACTION_DEL_PREFIX) == 0 ||
+            broker_check_action(msg, MSG_ACTION_SCAN) == 0 ){
+        broker_dispatch_scatter(shard, routing, sock, msg_p);
+    } else if ( shard->broker->replicas > 1 ){
+        broker_dispatch_replicated(shard, routing, sock, msg_p);
+    } else {
+        zframe_t *worker_identity = broker_choose_worker_identity(routing, msg);
 
         if ( worker_identity != NULL ){
             /* for req */
             /*zmsg_pushmem(msg, "", 0);*/
+            zframe_t *client_identity = zmsg_pop(msg);
+            zmsg_push(msg, shard_envelope_new(shard, client_identity));
+            zframe_destroy(&client_identity);
             zmsg_push(msg, worker_identity);
-            zmsg_send(&msg, broker->sock_local_backend);
+            shard_send_to_worker(shard, msg_p);
         } else {
             zmsg_t *sendback_msg = create_sendback_message(msg);
             message_add_status(sendback_msg, MSG_STATUS_WORKER_ERROR);
-            zmsg_send(&sendback_msg, sock);
+            broker_send_to_client(&sendback_msg, sock);
+        }
+    }
+}
+
+/* ================ handle_pullin_on_shard_frontend() ================ */
+int handle_pullin_on_shard_frontend(zloop_t *loop, zsock_t *sock, void *user_data)
+{
+    broker_shard_t *shard = (broker_shard_t*)user_data;
+
+    zmsg_t *msg = zmsg_recv(sock);
+    if ( msg == NULL ){
+        return -1;
+    }
+    /*zmsg_print(msg);*/
+
+    if ( client_address_fold(msg) != 0 ){
+        warning_log("Drop client request without a valid envelope.");
+        zmsg_destroy(&msg);
+        return 0;
+    }
+
+    if ( shard->broker->is_stub ) {
+        int is_batch = broker_check_action(msg, MSG_ACTION_PUT_BATCH) == 0;
+        uint32_t total_objects = (zmsg_size(msg) - 4) / 2;
+        zmsg_t *sendback_msg = create_sendback_message(msg);
+        message_add_status(sendback_msg, MSG_STATUS_WORKER_ACK);
+        if ( is_batch ){
+            zmsg_addmem(sendback_msg, &total_objects, sizeof(uint32_t));
         }
+        broker_send_to_client(&sendback_msg, sock);
+    } else {
+        uint32_t epoch = 0;
+        routing_t *routing = broker_routing_begin(shard->broker, &epoch);
+        broker_dispatch(shard, routing, sock, &msg);
+        broker_routing_end(shard->broker, epoch);
     }
 
     zmsg_destroy(&msg);
@@ -336,6 +1312,131 @@ int handle_pullin_on_local_frontend(zloop_t *loop, zsock_t *sock, void *user_dat
     return 0;
 }
 
+/* ================ handle_pullin_on_shard_backend() ================ */
+/* Worker replies, [worker identity][envelope]... */
+int handle_pullin_on_shard_backend(zloop_t *loop, zsock_t *sock, void *user_data)
+{
+    broker_shard_t *shard = (broker_shard_t*)user_data;
+
+    zmsg_t *msg = zmsg_recv(sock);
+    if ( msg == NULL ){
+        return -1;
+    }
+    zframe_t *worker_identity = zmsg_unwrap(msg);
+    zframe_destroy(&worker_identity);
+
+    zframe_t *frame_envelope = zmsg_first(msg);
+    if ( frame_envelope == NULL || zframe_size(frame_envelope) == 0 ){
+        zmsg_destroy(&msg);
+    } else if ( zframe_size(frame_envelope) == sizeof(request_tag_t) &&
+            ((request_tag_t*)zframe_data(frame_envelope))->marker == REQUEST_TAG_MARKER ){
+        broker_handle_replica_reply(shard, msg);
+    } else {
+        /* Strip the shard id, see shard_envelope_new(). */
+        zframe_t *envelope = zmsg_pop(msg);
+        zmsg_pushmem(msg, (uint8_t*)zframe_data(envelope) + 1, zframe_size(envelope) - 1);
+        zframe_destroy(&envelope);
+        broker_send_to_client(&msg, shard->sock_frontend);
+    }
+
+    return 0;
+}
+
+/* ================ handle_shard_expire_timer() ================ */
+int handle_shard_expire_timer(zloop_t *loop, int timer_id, void *user_data)
+{
+    broker_shard_t *shard = (broker_shard_t*)user_data;
+
+    broker_expire_requests(shard);
+
+    return 0;
+}
+
+/* ================ handle_pullin_on_pipe() ================ */
+static int handle_pullin_on_pipe(zloop_t *loop, zsock_t *pipe, void *user_data)
+{
+    zmsg_t *msg = zmsg_recv(pipe);
+    if ( msg == NULL ){
+        return -1;
+    }
+    char *command = zmsg_popstr(msg);
+    int rc = command != NULL && strcmp(command, "$TERM") == 0 ? -1 : 0;
+    if ( command != NULL ){
+        free(command);
+    }
+    zmsg_destroy(&msg);
+
+    return rc;
+}
+
+/* ================ shard_thread_main() ================ */
+void shard_thread_main(zsock_t *pipe, void *user_data)
+{
+    broker_shard_t *shard = (broker_shard_t*)user_data;
+
+    shard->sock_frontend = zsock_new_dealer(">" PROXY_ENDPOINT);
+
+    char endpoint[NAME_MAX];
+    shard->sock_backend = zsock_new(ZMQ_ROUTER);
+    zsock_set_router_mandatory(shard->sock_backend, 1);
+    /* A reconnecting worker takes its identity over. */
+    zsock_set_router_handover(shard->sock_backend, 1);
+    if ( message_shard_endpoint(shard->broker->backend, shard->id, endpoint, NAME_MAX) != 0 ||
+            zsock_bind(shard->sock_backend, "%s", endpoint) < 0 ){
+        error_log("Broker shard %d bind backend failed. backend:%s", shard->id, shard->broker->backend);
+    }
+
+    shard->loop = zloop_new();
+    zloop_reader(shard->loop, pipe, handle_pullin_on_pipe, shard);
+    zloop_reader(shard->loop, shard->sock_frontend, handle_pullin_on_shard_frontend, shard);
+    zloop_reader(shard->loop, shard->sock_backend, handle_pullin_on_shard_backend, shard);
+    zloop_timer(shard->loop, HEARTBEAT_INTERVAL, 0, handle_shard_expire_timer, shard);
+
+    trace_log("Broker shard %d Ready.", shard->id);
+    zloop_start(shard->loop);
+
+    zloop_destroy(&shard->loop);
+    zsock_destroy(&shard->sock_frontend);
+    zsock_destroy(&shard->sock_backend);
+
+    trace_log("Broker shard %d Exit.", shard->id);
+}
+
+/* ================ broker_shard_new() ================ */
+broker_shard_t *broker_shard_new(broker_t *broker, uint8_t shard_id)
+{
+    broker_shard_t *shard = (broker_shard_t*)malloc(sizeof(broker_shard_t));
+    memset(shard, 0, sizeof(broker_shard_t));
+
+    shard->broker = broker;
+    shard->id = shard_id;
+    shard->pending_requests = g_intmap_new();
+
+    /* -------- shard->actor -------- */
+    ZPIPE_ACTOR_NEW(shard, shard_thread_main);
+
+    return shard;
+}
+
+/* ================ broker_shard_free() ================ */
+void broker_shard_free(broker_shard_t *shard)
+{
+    ZPIPE_ACTOR_FREE(shard);
+
+    g_iterator_t *it = g_intmap_begin(shard->pending_requests);
+    g_iterator_t *itend = g_intmap_end(shard->pending_requests);
+    while ( g_iterator_compare(it, itend) != 0 ){
+        pending_request_t *request = (pending_request_t*)g_iterator_get(it);
+        pending_request_free(request);
+        g_iterator_next(it);
+    };
+    g_iterator_free(it);
+    g_iterator_free(itend);
+    g_intmap_free(shard->pending_requests);
+
+    free(shard);
+}
+
 /* ================ handle_pullin_on_local_backend() ================ */
 int handle_pullin_on_local_backend(zloop_t *loop, zsock_t *sock, void *user_data)
 {
@@ -351,72 +1452,62 @@ int handle_pullin_on_local_backend(zloop_t *loop, zsock_t *sock, void *user_data
     zframe_t *worker_identity = zmsg_unwrap(msg);
     assert(zframe_is(worker_identity));
 
-    worker_t *worker = broker_set_worker_ready(broker, worker_identity);
+    /* READY carries [datanode_id][bucket_id][channel_id]. */
+    uint32_t location[3];
+    int is_ready = 0;
+    if ( message_check_status(msg, MSG_STATUS_WORKER_READY) == 0 && zmsg_size(msg) >= 5 ){
+        zmsg_first(msg);
+        zmsg_next(msg);
+        is_ready = 1;
+        for ( int i = 0 ; i < 3 ; i++ ){
+            zframe_t *frame = zmsg_next(msg);
+            if ( zframe_size(frame) != sizeof(uint32_t) ){
+                is_ready = 0;
+                break;
+            }
+            location[i] = *(uint32_t*)zframe_data(frame);
+        }
+    }
+
+    worker_t *worker = broker_set_worker_ready(broker, worker_identity, is_ready ? location : NULL);
+    broker_update_routing(broker);
 
     if ( message_check_heartbeat(msg, MSG_HEARTBEAT_WORKER) == 0 ){
-        broker_lock_workers(broker);
         uint32_t available_workers = broker_get_available_workers(broker);
-        int64_t now = zclock_time();
-        int64_t expiry = 0;
+        int64_t expiry = worker != NULL ? worker->expiry : 0;
 
-        expiry = worker->expiry;
-
-        broker_unlock_workers(broker);
-        trace_log("<-- Receive worker heartbeat. Workers:%d. now:%llu first expiry:%llu(%d)", available_workers, now, expiry, (int32_t)(expiry - now));
+        trace_log("<-- Receive worker heartbeat. Workers:%d. now:%lld expiry:%lld(%d)", available_workers, (long long)broker->now, (long long)expiry, (int32_t)(expiry - broker->now));
         zmsg_destroy(&msg);
 
     } else if ( message_check_status(msg, MSG_STATUS_WORKER_READY) == 0 ) {
-        broker_lock_workers(broker);
         uint32_t available_workers = broker_get_available_workers(broker);
-        broker_unlock_workers(broker);
-        notice_log("WORKER(%s) READY. Workers:%d", worker->id_string, available_workers);
+        if ( worker != NULL ){
+            notice_log("WORKER(%s) datanode:%d bucket:%d channel:%d READY. Workers:%d", worker->id_string, worker->datanode_id, worker->bucket_id, worker->channel_id, available_workers);
+
+            /* The worker connects to the shards once it knows them. */
+            zmsg_t *ready_msg = create_status_message(MSG_STATUS_BROKER_READY);
+            zmsg_addmem(ready_msg, &broker->total_shards, sizeof(uint32_t));
+            zmsg_push(ready_msg, zframe_dup(worker->identity));
+            zmsg_send(&ready_msg, broker->sock_local_backend);
+        } else {
+            warning_log("Drop malformed WORKER READY. Workers:%d", available_workers);
+        }
         zmsg_destroy(&msg);
     }
 
     if ( msg != NULL ){
-        /*zmsg_print(msg);*/
-        zmsg_send(&msg, broker->sock_local_frontend);
+        /* Replies belong on the shard backends. */
+        warning_log("Drop worker message outside a shard.");
+        zmsg_destroy(&msg);
     }
 
     return 0;
 }
 
-/* ================ handle_heartbeat_timer() ================ */
-int handle_heartbeat_timer(zloop_t *loop, int timer_id, void *user_data)
+/* ================ handle_wheel_timer() ================ */
+int handle_wheel_timer(zloop_t *loop, int timer_id, void *user_data)
 {
     broker_t *broker = (broker_t*)user_data;
-    assert(broker != NULL);
-
-    if ( zclock_time() >= broker->heartbeat_at ){
-
-        broker->heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
-
-        broker_lock_workers(broker);
-
-        g_stringmap_t *backends = broker->backends;
-        g_iterator_t *it = g_stringmap_begin(backends);
-        g_iterator_t *itend = g_stringmap_end(backends);
-        while ( g_iterator_compare(it, itend) != 0 ){
-            worker_t *worker = (worker_t*)g_iterator_get(it);
-            {
-                uint32_t available_workers = broker_get_available_workers(broker);
-                int64_t now = zclock_time();
-                int64_t expiry = 0;
-                expiry = worker->expiry;
-                trace_log("--> Send broker heartbeat to worker %s. Workers:%d. now:%llu first expiry:%llu(%d)", worker->id_string, available_workers, now, expiry, (int32_t)(expiry - now));
-            }
-
-            zmsg_t *heartbeat_msg = zmsg_new();
-            zmsg_push(heartbeat_msg, zframe_dup(worker->identity));
-            message_add_heartbeat(heartbeat_msg, MSG_HEARTBEAT_BROKER);
-            zmsg_send(&heartbeat_msg, broker->sock_local_backend);
-
-            g_iterator_next(it);
-        };
-
-        broker_unlock_workers(broker);
-
-    }
 
     broker_workers_purge(broker);
 
@@ -424,32 +1515,67 @@ int handle_heartbeat_timer(zloop_t *loop, int timer_id, void *user_data)
 }
 
 /* ================ run_broker() ================ */
-int run_broker(const char *frontend, const char *backend, int is_stub, int verbose)
+int run_broker(const char *frontend, const char *backend, uint32_t replicas, uint32_t write_quorum, uint32_t read_quorum, uint32_t total_threads, int is_stub, int verbose)
 {
-    info_log("run_broker() with frontend:%s backend:%s", frontend, backend);
+    if ( total_threads == 0 ) total_threads = 1;
+    if ( total_threads > MAX_SHARDS ) total_threads = MAX_SHARDS;
+
+    info_log("run_broker() with frontend:%s backend:%s replicas:%d W:%d R:%d threads:%d", frontend, backend, replicas, write_quorum, read_quorum, total_threads);
 
     int rc = 0;
     broker_t *broker = broker_new();
     broker->is_stub = is_stub;
+    broker->replicas = replicas > MAX_REPLICAS ? MAX_REPLICAS : (replicas > 0 ? replicas : 1);
+    broker->write_quorum = write_quorum > 0 ? write_quorum : broker->replicas / 2 + 1;
+    broker->read_quorum = read_quorum > 0 ? read_quorum : broker->replicas;
+    if ( broker->read_quorum > broker->replicas ){
+        broker->read_quorum = broker->replicas;
+    }
+
+    /* Socket I/O scales with the shards too. */
+    zsys_set_io_threads(total_threads);
 
-    zsock_t *sock_local_frontend = zsock_new_router(frontend);
-    zsock_t *sock_local_backend = zsock_new_router(backend);
+    zsock_t *sock_local_backend = zsock_new(ZMQ_ROUTER);
+    /* Workers keep their identity over reconnects, see channel_t. */
+    zsock_set_router_handover(sock_local_backend, 1);
+    if ( zsock_bind(sock_local_backend, "%s", backend) < 0 ){
+        error_log("Broker bind backend failed. backend:%s", backend);
+    }
 
     zloop_t *loop = zloop_new();
     zloop_set_verbose(loop, verbose);
 
     broker->loop = loop;
-    broker->sock_local_frontend = sock_local_frontend;
     broker->sock_local_backend = sock_local_backend;
+    broker->backend = backend;
+
+    /* -------- frontend proxy -------- */
+    /* Spreads the client requests over the shards and their replies back. */
+    zactor_t *proxy = zactor_new(zproxy, NULL);
+    zstr_sendx(proxy, "FRONTEND", "ROUTER", frontend, NULL);
+    zsock_wait(proxy);
+    zstr_sendx(proxy, "BACKEND", "DEALER", "@" PROXY_ENDPOINT, NULL);
+    zsock_wait(proxy);
+
+    broker->total_shards = total_threads;
+    broker->shards = (broker_shard_t**)malloc(sizeof(broker_shard_t*) * total_threads);
+    for ( uint32_t i = 0 ; i < total_threads ; i++ ){
+        broker->shards[i] = broker_shard_new(broker, i);
+    }
 
-    broker->heartbeat_timer_id = zloop_timer(loop, HEARTBEAT_INTERVAL, -1, handle_heartbeat_timer, broker);
-
-    zloop_reader(loop, sock_local_frontend, handle_pullin_on_local_frontend, broker);
     zloop_reader(loop, sock_local_backend, handle_pullin_on_local_backend, broker);
+    zloop_timer(loop, WHEEL_TICK, 0, handle_wheel_timer, broker);
 
     zloop_start(loop);
 
-    zsock_destroy(&sock_local_frontend);
+    zactor_destroy(&proxy);
+    for ( uint32_t i = 0 ; i < broker->total_shards ; i++ ){
+        broker_shard_free(broker->shards[i]);
+    }
+    free(broker->shards);
+    broker->shards = NULL;
+
+    zloop_destroy(&loop);
     zsock_destroy(&sock_local_backend);
 
     broker_free(broker);
@@ -457,4 +1583,3 @@ int run_broker(const char *frontend, const char *backend, int is_stub, int verbo
     return rc;
 }
 
-
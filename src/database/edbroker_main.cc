@@ -22,6 +22,10 @@ typedef struct{
 
     int is_daemon;
     int is_stub;
+    uint32_t replicas;
+    uint32_t write_quorum;
+    uint32_t read_quorum;
+    uint32_t threads;
     int log_level;
 } program_options_t;
 
@@ -30,6 +34,9 @@ static struct option const long_options[] = {
 	{"backend", required_argument, NULL, 'b'},
 	{"threads", required_argument, NULL, 'u'},
 	{"stub", no_argument, NULL, 's'},
+	{"replicas", required_argument, NULL, 'r'},
+	{"write-quorum", required_argument, NULL, 'W'},
+	{"read-quorum", required_argument, NULL, 'R'},
 	{"daemon", no_argument, NULL, 'd'},
 	{"verbose", no_argument, NULL, 'v'},
 	{"trace", no_argument, NULL, 't'},
@@ -37,9 +44,9 @@ static struct option const long_options[] = {
 
 	{NULL, 0, NULL, 0},
 };
-static const char *short_options = "f:b:u:sdvth";
+static const char *short_options = "f:b:u:sr:W:R:dvth";
 
-extern int run_broker(const char *frontend, const char *backend, int is_stub, int verbose);
+extern int run_broker(const char *frontend, const char *backend, uint32_t replicas, uint32_t write_quorum, uint32_t read_quorum, uint32_t total_threads, int is_stub, int verbose);
 
 /* ==================== daemon_loop() ==================== */
 int daemon_loop(void *data)
@@ -47,7 +54,7 @@ int daemon_loop(void *data)
     notice_log("In daemon_loop()");
 
     const program_options_t *po = (const program_options_t *)data;
-    return run_broker(po->frontend, po->backend, po->is_stub, po->log_level >= LOG_DEBUG ? 1 : 0);
+    return run_broker(po->frontend, po->backend, po->replicas, po->write_quorum, po->read_quorum, po->threads, po->is_stub, po->log_level >= LOG_DEBUG ? 1 : 0);
 }
 
 /* ==================== usage() ==================== */
@@ -61,8 +68,12 @@ static void usage(int status)
         printf("Everdata Worker\n\
                 -f, --frontend          specify the edbroker frontend endpoint\n\
                 -b, --backend          specify the edbroker backend endpoint\n\
-                -u, --threads           count of threads\n\
+                -u, --threads           count of broker shard threads (default 1), each listens\n\
+                                        for workers on a port after the backend's\n\
                 -s, --stub            run in the stub mode. \n\
+                -r, --replicas          copies of every object, on distinct datanodes if possible\n\
+                -W, --write-quorum      acks needed before a write is acked (default replicas/2+1)\n\
+                -R, --read-quorum       replicas asked by a read, first data wins (default replicas)\n\
                 -d, --daemon            run in the daemon mode. \n\
                 -v, --verbose           print debug messages\n\
                 -t, --trace             print trace messages\n\
@@ -82,6 +93,10 @@ int main(int argc, char *argv[])
 
     po.is_daemon = 0;
     po.is_stub = 0;
+    po.replicas = 1;
+    po.write_quorum = 0;
+    po.read_quorum = 0;
+    po.threads = 1;
     po.log_level = LOG_INFO;
 
 	int ch, longindex;
@@ -94,9 +109,21 @@ int main(int argc, char *argv[])
             case 'b':
                 po.backend = optarg;
                 break;
+            case 'u':
+                po.threads = atoi(optarg);
+                break;
             case 's':
                 po.is_stub = 1;
                 break;
+            case 'r':
+                po.replicas = atoi(optarg);
+                break;
+            case 'W':
+                po.write_quorum = atoi(optarg);
+                break;
+            case 'R':
+                po.read_quorum = atoi(optarg);
+                break;
             case 'd':
                 po.is_daemon = 1;
                 break;
@@ -132,6 +159,6 @@ int main(int argc, char *argv[])
     if ( po.is_daemon ){
         return daemon_fork(daemon_loop, (void*)&po);
     } else
-        return run_broker(po.frontend, po.backend, po.is_stub, po.log_level >= LOG_DEBUG ? 1 : 0);
+        return run_broker(po.frontend, po.backend, po.replicas, po.write_quorum, po.read_quorum, po.threads, po.is_stub, po.log_level >= LOG_DEBUG ? 1 : 0);
 }
 
@@ -12,6 +12,7 @@
 #include "common.h"
 #include "logger.h"
 #include "filesystem.h"
+#include "zmalloc.h"
 #include "everdata.h"
 
 #include "zpipe.h"
@@ -19,6 +20,9 @@
 static char *file_data = NULL;
 static uint32_t file_size = 0;
 
+/* Slices in flight per client when chunking and --pipeline is not given. */
+#define DEFAULT_SLICE_WINDOW 8
+
 /* -------- struct client_t -------- */
 typedef struct client_t {
     ZPIPE_ACTOR;
@@ -34,6 +38,10 @@ typedef struct client_t {
     int verbose;
 
     uint32_t start_index;
+    uint32_t pipeline;
+    uint32_t batch;
+    uint32_t slice_size;
+    const char *output_dir;
     /*zactor_t *actor;*/
 
 } client_t;
@@ -82,8 +90,7 @@ void client_rebuild_data_key(client_t *client, uint32_t data_id, char *key)
 int delete_data(zsock_t *sock, const char *key)
 {
     /* ---------------- Send Message ---------------- */
-    zmsg_t *delete_msg = create_action_message(MSG_ACTION_DEL);
-    message_add_key_data(delete_msg, key, "", 0);
+    zmsg_t *delete_msg = create_request_message(MSG_ACTION_DEL, 0, 0, key, strlen(key), 0);
 
     zmsg_send(&delete_msg, sock);
 
@@ -96,7 +103,9 @@ int delete_data(zsock_t *sock, const char *key)
     zmsg_print(recv_msg);
 
     int rc = -1;
-    if (message_check_status(recv_msg, MSG_STATUS_WORKER_NOTFOUND) == 0 ){
+    if ( message_check_status(recv_msg, MSG_STATUS_WORKER_ACK) == 0 ){
+        rc = 0;
+    } else if (message_check_status(recv_msg, MSG_STATUS_WORKER_NOTFOUND) == 0 ){
         warning_log("Not Found. key=%s", key);
         rc = 0;
     } else if ( message_check_status(recv_msg, MSG_STATUS_WORKER_ERROR) == 0 ){
@@ -109,12 +118,116 @@ int delete_data(zsock_t *sock, const char *key)
     return rc;
 }
 
+/* ================ delete_prefix() ================ */
+int delete_prefix(zsock_t *sock, const char *prefix)
+{
+    /* ---------------- Send Message ---------------- */
+    zmsg_t *delete_msg = create_action_message(MSG_ACTION_DEL_PREFIX);
+    zmsg_addstr(delete_msg, prefix);
+
+    zmsg_send(&delete_msg, sock);
+
+    /* ---------------- Receive Message ---------------- */
+
+    zmsg_t *recv_msg = zmsg_recv(sock);
+    if ( recv_msg == NULL ){
+        return -2;
+    }
+
+    int rc = -1;
+    uint32_t total_deleted = 0;
+    zframe_t *frame_count = zmsg_last(recv_msg);
+    if ( zmsg_size(recv_msg) >= 3 && zframe_size(frame_count) == sizeof(uint32_t) ){
+        total_deleted = *(uint32_t*)zframe_data(frame_count);
+    }
+    if ( message_check_status(recv_msg, MSG_STATUS_WORKER_ACK) == 0 ||
+            message_check_status(recv_msg, MSG_STATUS_WORKER_NOTFOUND) == 0 ){
+        info_log("Deleted %d slices under %s", total_deleted, prefix);
+        rc = 0;
+    } else {
+        error_log("Delete prefix failed. prefix=%s deleted=%d", prefix, total_deleted);
+    }
+
+    zmsg_destroy(&recv_msg);
+
+    return rc;
+}
+
+/* ================ list_keys() ================ */
+/* Page through the keys under prefix, sub directories are shown once. */
+int list_keys(zsock_t *sock, const char *prefix)
+{
+    char start_after[NAME_MAX];
+    uint32_t start_after_len = 0;
+    uint32_t total_keys = 0;
+    uint32_t total_dirs = 0;
+
+    int more = 1;
+    while ( more ){
+        /* ---------------- Send Message ---------------- */
+        zmsg_t *scan_msg = create_action_message(MSG_ACTION_SCAN);
+        zmsg_addstr(scan_msg, prefix);
+        zmsg_addmem(scan_msg, start_after, start_after_len);
+        scan_request_t scan_request;
+        scan_request.limit = SCAN_MAX_LIMIT;
+        scan_request.delimiter = '/';
+        zmsg_addmem(scan_msg, &scan_request, sizeof(scan_request_t));
+
+        zmsg_send(&scan_msg, sock);
+
+        /* ---------------- Receive Message ---------------- */
+        zmsg_t *recv_msg = zmsg_recv(sock);
+        if ( recv_msg == NULL ){
+            return -2;
+        }
+        if ( message_check_status(recv_msg, MSG_STATUS_WORKER_ACK) != 0 || zmsg_size(recv_msg) < 3 ){
+            error_log("List keys failed. prefix=%s", prefix);
+            zmsg_destroy(&recv_msg);
+            return -1;
+        }
+
+        zmsg_first(recv_msg);
+        zmsg_next(recv_msg);
+        zframe_t *frame_reply = zmsg_next(recv_msg);
+        scan_reply_t scan_reply = *(scan_reply_t*)zframe_data(frame_reply);
+        more = scan_reply.more && scan_reply.total_entries > 0;
+
+        for ( uint32_t i = 0 ; i < scan_reply.total_entries ; i++ ){
+            zframe_t *frame_key = zmsg_next(recv_msg);
+            zframe_t *frame_size = zmsg_next(recv_msg);
+            if ( frame_key == NULL || frame_size == NULL ){
+                more = 0;
+                break;
+            }
+            uint64_t object_size = *(uint64_t*)zframe_data(frame_size);
+            uint32_t key_len = zframe_size(frame_key);
+            if ( object_size == SCAN_PREFIX_SIZE ){
+                notice_log("%.*s", key_len, (const char *)zframe_data(frame_key));
+                total_dirs++;
+            } else {
+                notice_log("%.*s %llu", key_len, (const char *)zframe_data(frame_key), (unsigned long long)object_size);
+                total_keys++;
+            }
+            if ( key_len <= NAME_MAX ){
+                memcpy(start_after, zframe_data(frame_key), key_len);
+                start_after_len = key_len;
+            }
+        }
+
+        zmsg_destroy(&recv_msg);
+    }
+
+    info_log("%s: %d keys, %d directories.", prefix, total_keys, total_dirs);
+
+    return 0;
+}
+
 /* ================ download_data() ================ */
 int download_data(zsock_t *sock, const char *key)
 {
     /* ---------------- Send Message ---------------- */
-    zmsg_t *download_msg = create_action_message(MSG_ACTION_GET);
-    message_add_key_data(download_msg, key, "", 0);
+    uint32_t key_len = strlen(key);
+    zmsg_t *download_msg = create_request_message(MSG_ACTION_GET, 0, everdata_key_hash(key, key_len, 0), key, key_len, 0);
 
     zmsg_send(&download_msg, sock);
 
@@ -162,8 +275,9 @@ int download_data(zsock_t *sock, const char *key)
 int upload_data(zsock_t *sock, const char *key, const char *data, uint32_t data_size)
 {
     /* ---------------- Send Message ---------------- */
-    zmsg_t *upload_msg = create_action_message(MSG_ACTION_PUT);
-    message_add_key_data(upload_msg, key, data, data_size);
+    uint32_t key_len = strlen(key);
+    zmsg_t *upload_msg = create_request_message(MSG_ACTION_PUT, 0, everdata_key_hash(key, key_len, 0), key, key_len, data_size);
+    zmsg_addmem(upload_msg, data, data_size);
 
     zmsg_send(&upload_msg, sock);
 
@@ -189,6 +303,360 @@ int upload_data(zsock_t *sock, const char *key, const char *data, uint32_t data_
     return rc;
 }
 
+/* ================ upload_data_pipelined() ================ */
+/* Keep up to client->pipeline requests in flight over a DEALER socket
+ * instead of waiting for every ack. Each request carries client->batch
+ * objects, sent as one MSG_ACTION_PUT_BATCH message when batch > 1. */
+int upload_data_pipelined(client_t *client, zsock_t *sock)
+{
+    uint32_t total_files = client->total_files;
+    uint32_t max_inflight = client->pipeline * client->batch;
+    uint32_t sent = 0;
+    uint32_t acked = 0;
+    uint32_t failed = 0;
+    uint32_t inflight = 0;
+
+    zpoller_t *poller = zpoller_new(sock, NULL);
+
+    while ( acked + failed < total_files ){
+
+        /* ---------------- Send Messages ---------------- */
+        while ( sent < total_files && inflight < max_inflight ){
+            uint32_t batch = client->batch;
+            if ( batch > total_files - sent ){
+                batch = total_files - sent;
+            }
+
+            zmsg_t *upload_msg = create_action_message(batch > 1 ? MSG_ACTION_PUT_BATCH : MSG_ACTION_PUT);
+            for ( uint32_t i = 0 ; i < batch ; i++ ){
+                char key[NAME_MAX];
+                client_rebuild_data_key(client, sent + i, key);
+                message_add_key_data(upload_msg, key, client->file_data, client->file_size);
+            }
+            /* Empty delimiter, as a REQ socket would add. */
+            zmsg_pushmem(upload_msg, "", 0);
+            zmsg_send(&upload_msg, sock);
+
+            sent += batch;
+            inflight += batch;
+        }
+
+        /* ---------------- Receive Message ---------------- */
+        zsock_t *ready_sock = (zsock_t*)zpoller_wait(poller, HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS);
+        if ( ready_sock == NULL ){
+            error_log("Client %d timeout. %d objects in flight lost.", client->id, inflight);
+            failed += inflight;
+            inflight = 0;
+            if ( zpoller_terminated(poller) ){
+                break;
+            }
+            continue;
+        }
+
+        zmsg_t *recv_msg = zmsg_recv(sock);
+        if ( recv_msg == NULL ){
+            break;
+        }
+        zframe_t *frame_empty = zmsg_pop(recv_msg);
+        zframe_destroy(&frame_empty);
+
+        /* Batch acks carry the number of objects they cover. */
+        uint32_t total_objects = 1;
+        if ( zmsg_size(recv_msg) >= 3 ){
+            zframe_t *frame_count = zmsg_last(recv_msg);
+            if ( zframe_size(frame_count) == sizeof(uint32_t) ){
+                total_objects = *(uint32_t*)zframe_data(frame_count);
+            }
+        }
+        if ( total_objects > inflight ){
+            total_objects = inflight;
+        }
+
+        if ( message_check_status(recv_msg, MSG_STATUS_WORKER_ACK) == 0 ){
+            acked += total_objects;
+        } else {
+            error_log("Client %d return error for %d objects.", client->id, total_objects);
+            failed += total_objects;
+        }
+        inflight -= total_objects;
+
+        zmsg_destroy(&recv_msg);
+
+        uint32_t done = acked + failed;
+        if ( done % 100 < total_objects || done + 5 >= total_files ){
+            info_log("Client %d Send message %d/%d", client->id, done, total_files);
+        }
+    }
+
+    zpoller_destroy(&poller);
+
+    return failed == 0 ? 0 : -1;
+}
+
+/* ================ client_slice_window() ================ */
+static uint32_t client_slice_window(client_t *client)
+{
+    return client->pipeline > 1 ? client->pipeline : DEFAULT_SLICE_WINDOW;
+}
+
+/* ================ send_slice_request() ================ */
+static void send_slice_request(zsock_t *sock, const char *action, const char *key, const slice_header_t *slice_header, zframe_t **frame_data)
+{
+    uint32_t key_len = strlen(key);
+    uint32_t value_len = frame_data != NULL ? zframe_size(*frame_data) : 0;
+    zmsg_t *msg = create_request_message(action, 0, everdata_key_hash(key, key_len, slice_header->slice_idx), key, key_len, value_len);
+    zmsg_addmem(msg, slice_header, sizeof(slice_header_t));
+    if ( frame_data != NULL ){
+        zmsg_append(msg, frame_data);
+    }
+    /* Empty delimiter, as a REQ socket would add. */
+    zmsg_pushmem(msg, "", 0);
+    zmsg_send(&msg, sock);
+}
+
+/* ================ upload_data_sliced() ================ */
+/* Stream client->filename as slices of client->slice_size. Every slice is
+ * read from the file right before it is sent, so no more than the window
+ * of slices is held in memory whatever the object size is. */
+int upload_data_sliced(client_t *client, zsock_t *sock)
+{
+    int fd = open(client->filename, O_RDONLY);
+    if ( fd < 0 ){
+        error_log("open() failed. file:%s", client->filename);
+        return -1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+
+    uint64_t object_size = st.st_size;
+    uint32_t slice_size = client->slice_size;
+    uint32_t nslices = object_size > 0 ? (object_size + slice_size - 1) / slice_size : 1;
+
+    uint64_t total_slices = (uint64_t)client->total_files * nslices;
+    uint32_t max_inflight = client_slice_window(client);
+    uint64_t sent = 0;
+    uint64_t acked = 0;
+    uint64_t failed = 0;
+    uint32_t inflight = 0;
+
+    zpoller_t *poller = zpoller_new(sock, NULL);
+
+    while ( acked + failed < total_slices ){
+
+        /* ---------------- Send Messages ---------------- */
+        while ( sent < total_slices && inflight < max_inflight ){
+            uint32_t data_id = sent / nslices;
+            uint32_t slice_idx = sent % nslices;
+            sent++;
+
+            char key[NAME_MAX];
+            client_rebuild_data_key(client, data_id, key);
+
+            slice_header_t slice_header;
+            memset(&slice_header, 0, sizeof(slice_header_t));
+            slice_header.object_size = object_size;
+            slice_header.nslices = nslices;
+            slice_header.slice_size = slice_size;
+            slice_header.slice_idx = slice_idx;
+
+            uint64_t offset = (uint64_t)slice_idx * slice_size;
+            uint32_t data_size = object_size - offset < slice_size ? object_size - offset : slice_size;
+
+            zframe_t *frame_data = zframe_new(NULL, data_size);
+            if ( pread(fd, zframe_data(frame_data), data_size, offset) != (ssize_t)data_size ){
+                error_log("pread() failed. file:%s offset:%llu", client->filename, (unsigned long long)offset);
+                zframe_destroy(&frame_data);
+                failed++;
+                continue;
+            }
+
+            send_slice_request(sock, MSG_ACTION_PUT_SLICE, key, &slice_header, &frame_data);
+            inflight++;
+        }
+
+        /* ---------------- Receive Message ---------------- */
+        zsock_t *ready_sock = (zsock_t*)zpoller_wait(poller, HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS);
+        if ( ready_sock == NULL ){
+            error_log("Client %d timeout. %d slices in flight lost.", client->id, inflight);
+            failed += inflight;
+            inflight = 0;
+            if ( zpoller_terminated(poller) ){
+                break;
+            }
+            continue;
+        }
+
+        zmsg_t *recv_msg = zmsg_recv(sock);
+        if ( recv_msg == NULL ){
+            break;
+        }
+        zframe_t *frame_empty = zmsg_pop(recv_msg);
+        zframe_destroy(&frame_empty);
+
+        if ( inflight > 0 ){
+            if ( message_check_status(recv_msg, MSG_STATUS_WORKER_ACK) == 0 ){
+                acked++;
+            } else {
+                error_log("Client %d return error for a slice.", client->id);
+                failed++;
+            }
+            inflight--;
+        }
+
+        zmsg_destroy(&recv_msg);
+
+        uint64_t done = acked + failed;
+        if ( done % nslices == 0 ){
+            uint32_t done_files = done / nslices;
+            if ( done_files % 100 == 1 || done_files + 5 >= client->total_files ){
+                info_log("Client %d Send message %d/%d", client->id, done_files, client->total_files);
+            }
+        }
+    }
+
+    zpoller_destroy(&poller);
+    close(fd);
+
+    return failed == 0 ? 0 : -1;
+}
+
+/* ================ download_object_sliced() ================ */
+/* Fetch slice 0 to learn the object header, then prefetch the remaining
+ * slices with a window of requests in flight. Slices are written to fd at
+ * their own offset as they arrive, in whatever order. */
+int download_object_sliced(client_t *client, zsock_t *sock, zpoller_t *poller, const char *key, int fd)
+{
+    uint32_t max_inflight = client_slice_window(client);
+    uint32_t nslices = 1;
+    uint32_t slice_size = 0;
+    uint32_t next_slice = 0;
+    uint32_t received = 0;
+    uint32_t inflight = 0;
+    int rc = 0;
+
+    while ( received < nslices ){
+
+        /* ---------------- Send Messages ---------------- */
+        /* Only slice 0 until its reply tells how many there are. */
+        while ( next_slice < nslices && inflight < max_inflight ){
+            slice_header_t slice_header;
+            memset(&slice_header, 0, sizeof(slice_header_t));
+            slice_header.slice_idx = next_slice++;
+
+            send_slice_request(sock, MSG_ACTION_GET_SLICE, key, &slice_header, NULL);
+            inflight++;
+        }
+
+        /* ---------------- Receive Message ---------------- */
+        zsock_t *ready_sock = (zsock_t*)zpoller_wait(poller, HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS);
+        if ( ready_sock == NULL ){
+            error_log("Client %d timeout. key=%s %d/%d slices received.", client->id, key, received, nslices);
+            return -1;
+        }
+
+        zmsg_t *recv_msg = zmsg_recv(sock);
+        if ( recv_msg == NULL ){
+            return -2;
+        }
+        zframe_t *frame_empty = zmsg_pop(recv_msg);
+        zframe_destroy(&frame_empty);
+
+        /* [msgtype][key][slice_header_t][data] or [msgtype][status][key][slice_header_t] */
+        zframe_t *frame_msgtype = zmsg_first(recv_msg);
+        int16_t msgtype = frame_msgtype != NULL && zframe_size(frame_msgtype) == sizeof(int16_t) ? *(int16_t*)zframe_data(frame_msgtype) : MSGTYPE_UNKNOWN;
+        if ( msgtype != MSGTYPE_DATA ){
+            zframe_t *frame_key = NULL;
+            if ( zmsg_size(recv_msg) >= 4 ){
+                zmsg_next(recv_msg);
+                frame_key = zmsg_next(recv_msg);
+            }
+            if ( frame_key != NULL && !zframe_streq(frame_key, key) ){
+                /* Late reply for an object we already gave up on. */
+                zmsg_destroy(&recv_msg);
+                continue;
+            }
+            if ( message_check_status(recv_msg, MSG_STATUS_WORKER_NOTFOUND) == 0 ){
+                warning_log("Not Found. key=%s", key);
+                rc = 0;
+            } else {
+                error_log("Return error. key=%s", key);
+                rc = -1;
+            }
+            zmsg_destroy(&recv_msg);
+            break;
+        }
+
+        zframe_t *frame_key = zmsg_next(recv_msg);
+        zframe_t *frame_header = zmsg_next(recv_msg);
+        zframe_t *frame_data = zmsg_next(recv_msg);
+        if ( frame_data == NULL || zframe_size(frame_header) != sizeof(slice_header_t) || !zframe_streq(frame_key, key) ){
+            zmsg_destroy(&recv_msg);
+            continue;
+        }
+        inflight--;
+
+        const slice_header_t *slice_header = (const slice_header_t*)zframe_data(frame_header);
+        if ( slice_header->slice_idx == 0 ){
+            nslices = slice_header->nslices > 0 ? slice_header->nslices : 1;
+            slice_size = slice_header->slice_size;
+        }
+        if ( fd >= 0 ){
+            uint64_t offset = (uint64_t)slice_header->slice_idx * slice_size;
+            if ( pwrite(fd, zframe_data(frame_data), zframe_size(frame_data), offset) != (ssize_t)zframe_size(frame_data) ){
+                error_log("pwrite() failed. key=%s slice_idx=%d", key, slice_header->slice_idx);
+                rc = -1;
+            }
+        }
+        received++;
+
+        zmsg_destroy(&recv_msg);
+    }
+
+    return rc;
+}
+
+/* ================ download_data_sliced() ================ */
+int download_data_sliced(client_t *client, zsock_t *sock)
+{
+    zpoller_t *poller = zpoller_new(sock, NULL);
+
+    int rc = 0;
+    for ( uint32_t file_count = 0 ; file_count < client->total_files ; file_count++ ){
+        char key[NAME_MAX];
+        client_rebuild_data_key(client, file_count, key);
+
+        int fd = -1;
+        if ( client->output_dir != NULL ){
+            char file_name[NAME_MAX];
+            get_path_file_name(key, file_name, NAME_MAX - 1);
+            char output_file[PATH_MAX];
+            sprintf(output_file, "%s/%04d-%s", client->output_dir, client->id, file_name);
+            fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+            if ( fd < 0 ){
+                error_log("open() failed. file:%s", output_file);
+            }
+        }
+
+        int ret = download_object_sliced(client, sock, poller, key, fd);
+        if ( fd >= 0 ){
+            close(fd);
+        }
+        if ( ret == -2 ) {
+            rc = -1;
+            break;
+        }
+        if ( ret != 0 ) rc = -1;
+
+        if ( file_count % 100 == 0 || file_count + 6 >= client->total_files ){
+            info_log("Client %d Receive message %d/%d", client->id, file_count + 1, client->total_files);
+        }
+    }
+
+    zpoller_destroy(&poller);
+
+    return rc;
+}
+
 #define RETRIES 3
 /* ================ client_thread_main() ================ */
 void client_thread_main(zsock_t *pipe, void *user_data)
@@ -202,12 +670,57 @@ void client_thread_main(zsock_t *pipe, void *user_data)
 
     /*ZPIPE_ACTOR_THREAD_BEGIN(pipe);*/
 
+    if ( client->slice_size > 0 && (client->op_code == 1 || client->op_code == 2) ){
+        zsock_t *sock_client = zsock_new_dealer(client->endpoint);
+        if ( sock_client == NULL ){
+            error_log("Connect broker failed. Client %d", client->id);
+            return;
+        }
+        if ( client->op_code == 1 ){
+            upload_data_sliced(client, sock_client);
+        } else {
+            download_data_sliced(client, sock_client);
+        }
+        zsock_destroy(&sock_client);
+
+        trace_log("Client %d Exit.", id);
+        return;
+    }
+
+    if ( client->op_code == 1 && (client->pipeline > 1 || client->batch > 1) ){
+        zsock_t *sock_client = zsock_new_dealer(client->endpoint);
+        if ( sock_client == NULL ){
+            error_log("Connect broker failed. Client %d", client->id);
+            return;
+        }
+        upload_data_pipelined(client, sock_client);
+        zsock_destroy(&sock_client);
+
+        trace_log("Client %d Exit.", id);
+        return;
+    }
+
     zsock_t *sock_client = zsock_new_req(client->endpoint);
     if ( sock_client == NULL ){
         error_log("Connect broker failed. Client %d", client->id);
         return;
     }
 
+    if ( client->op_code == 4 || client->op_code == 5 ){
+        /* Every key client_rebuild_data_key() makes for this client. */
+        char prefix[NAME_MAX];
+        sprintf(prefix, "/test/%s/%04d/", client->key, client->id);
+        if ( client->op_code == 4 ){
+            delete_prefix(sock_client, prefix);
+        } else {
+            list_keys(sock_client, prefix);
+        }
+        zsock_destroy(&sock_client);
+
+        trace_log("Client %d Exit.", id);
+        return;
+    }
+
     uint32_t file_count = 0;
     while ( true ){
 
@@ -251,7 +764,7 @@ void client_thread_main(zsock_t *pipe, void *user_data)
 }
 
 /* ================ client_new() ================ */
-client_t *client_new(int client_id, const char *endpoint, int op_code, uint32_t total_files, const char *key, const char *filename, int verbose)
+client_t *client_new(int client_id, const char *endpoint, int op_code, uint32_t total_files, const char *key, const char *filename, uint32_t pipeline, uint32_t batch, uint32_t slice_size, const char *output_dir, int verbose)
 {
     client_t *client = (client_t*)malloc(sizeof(client_t));
     memset(client, 0, sizeof(client_t));
@@ -262,6 +775,10 @@ client_t *client_new(int client_id, const char *endpoint, int op_code, uint32_t
     client->total_files = total_files;
     client->key = key;
     client->filename = filename;
+    client->pipeline = pipeline > 0 ? pipeline : 1;
+    client->batch = batch > 0 ? batch : 1;
+    client->slice_size = slice_size;
+    client->output_dir = output_dir;
     client->verbose = verbose;
 
     client->file_data = file_data;
@@ -289,11 +806,15 @@ typedef struct edclient_t {
     uint32_t total_files;
     const char *key;
     const char *filename;
+    uint32_t pipeline;
+    uint32_t batch;
+    uint32_t slice_size;
+    const char *output_dir;
     int verbose;
 } edclient_t;
 
 /* ================ edclient_new() ================ */
-edclient_t *edclient_new(const char *endpoint, int op_code, uint32_t total_clients, uint32_t total_files, const char *key, const char *filename, int verbose)
+edclient_t *edclient_new(const char *endpoint, int op_code, uint32_t total_clients, uint32_t total_files, const char *key, const char *filename, uint32_t pipeline, uint32_t batch, uint32_t slice_size, const char *output_dir, int verbose)
 {
     edclient_t *edclient = (edclient_t*)malloc(sizeof(edclient_t));
     memset(edclient, 0, sizeof(edclient_t));
@@ -304,6 +825,10 @@ edclient_t *edclient_new(const char *endpoint, int op_code, uint32_t total_clien
     edclient->total_files = total_files;
     edclient->key = key;
     edclient->filename = filename;
+    edclient->pipeline = pipeline;
+    edclient->batch = batch;
+    edclient->slice_size = slice_size;
+    edclient->output_dir = output_dir;
     edclient->verbose = verbose;
 
     return edclient;
@@ -328,6 +853,10 @@ void edclient_loop(edclient_t *edclient){
             edclient->total_files,
             edclient->key,
             edclient->filename,
+            edclient->pipeline,
+            edclient->batch,
+            edclient->slice_size,
+            edclient->output_dir,
             edclient->verbose);
 
     ZPIPE_NEW_END(edclient, client);
@@ -336,11 +865,14 @@ void edclient_loop(edclient_t *edclient){
 }
 
 /* ================ run_edclient() ================ */
-int run_edclient(const char *endpoint, int op_code, uint32_t total_clients, uint32_t total_files, const char *key, const char *filename, int verbose)
+int run_edclient(const char *endpoint, int op_code, uint32_t total_clients, uint32_t total_files, const char *key, const char *filename, uint32_t pipeline, uint32_t batch, uint32_t slice_size, const char *output_dir, int verbose)
 {
-    prepare_file_data(filename);
+    /* Sliced transfers stream the file instead of loading it. */
+    if ( slice_size == 0 ){
+        prepare_file_data(filename);
+    }
 
-    edclient_t *edclient = edclient_new(endpoint, op_code, total_clients, total_files, key, filename, verbose);
+    edclient_t *edclient = edclient_new(endpoint, op_code, total_clients, total_files, key, filename, pipeline, batch, slice_size, output_dir, verbose);
 
     edclient_loop(edclient);
 
@@ -13,6 +13,7 @@
 #include "filesystem.h"
 #include "sysinfo.h"
 #include "logger.h"
+#include "edbench.h"
 
 static char program_name[] = "edclient";
 
@@ -25,6 +26,12 @@ typedef struct{
     const char *key;
     const char *filename;
     int start_index;
+    int pipeline;
+    int batch;
+    int slice_size;
+    const char *output_dir;
+
+    edbench_options_t bench;
 
     int log_level;
 } program_options_t;
@@ -34,25 +41,40 @@ static struct option const long_options[] = {
 	{"write", no_argument, NULL, 'w'},
 	{"read", no_argument, NULL, 'r'},
 	{"delete", no_argument, NULL, 'x'},
+	{"delete-prefix", no_argument, NULL, 'X'},
+	{"list", no_argument, NULL, 'L'},
 	{"key", required_argument, NULL, 'k'},
 	{"start", required_argument, NULL, 's'},
 	{"count", required_argument, NULL, 'n'},
 	{"clients", required_argument, NULL, 'u'},
+	{"pipeline", required_argument, NULL, 'p'},
+	{"batch", required_argument, NULL, 'b'},
+	{"slice-size", required_argument, NULL, 'c'},
+	{"output", required_argument, NULL, 'o'},
+	{"bench", no_argument, NULL, 'B'},
+	{"mix", required_argument, NULL, 'm'},
+	{"distribution", required_argument, NULL, 'D'},
+	{"keys", required_argument, NULL, 'K'},
+	{"value-size", required_argument, NULL, 'z'},
+	{"rate", required_argument, NULL, 'R'},
+	{"duration", required_argument, NULL, 'T'},
+	{"warmup", required_argument, NULL, 'W'},
+	{"json", required_argument, NULL, 'J'},
 	{"verbose", no_argument, NULL, 'v'},
 	{"trace", no_argument, NULL, 't'},
 	{"help", no_argument, NULL, 'h'},
 
 	{NULL, 0, NULL, 0},
 };
-static const char *short_options = "e:wrxk:s:n:u:vth";
+static const char *short_options = "e:wrxXLk:s:n:u:p:b:c:o:Bm:D:K:z:R:T:W:J:vth";
 
-extern int run_edclient(const char *endpoint, int op_code, uint32_t total_clients, uint32_t total_files, const char *key, const char *filename, int verbose);
+extern int run_edclient(const char *endpoint, int op_code, uint32_t total_clients, uint32_t total_files, const char *key, const char *filename, uint32_t pipeline, uint32_t batch, uint32_t slice_size, const char *output_dir, int verbose);
 
 /* ==================== daemon_loop() ==================== */ 
 int daemon_loop(void *data)
 {
     const program_options_t *po = (const program_options_t *)data;
-    return run_edclient(po->endpoint, po->op_code, po->total_clients, po->total_files, po->key, po->filename, po->log_level >= LOG_DEBUG ? 1 : 0);
+    return run_edclient(po->endpoint, po->op_code, po->total_clients, po->total_files, po->key, po->filename, po->pipeline, po->batch, po->slice_size, po->output_dir, po->log_level >= LOG_DEBUG ? 1 : 0);
 }
 
 /* ==================== usage() ==================== */ 
@@ -66,12 +88,27 @@ static void usage(int status)
         printf("Everdata Worker\n\
                 -e, --endpoint          specify the edbroker endpoint\n\
                 -u, --clients           count of clients\n\
+                -p, --pipeline          requests in flight per client (DEALER mode)\n\
+                -b, --batch             objects per write request\n\
+                -c, --slice-size        split objects into slices of this many KB\n\
+                -o, --output            write sliced downloads into this directory\n\
                 -w, --write             upload file to server\n\
                 -r, --read              download file from server\n\
                 -x, --delete            delete file in server\n\
+                -X, --delete-prefix     delete all files of each client at once\n\
+                -L, --list              list the files of each client\n\
                 -k, --key               key of the file\n\
                 -s, --start             start of count\n\
                 -n, --count             count of loop\n\
+                -B, --bench             run a timed load, -u connections, -p requests in flight\n\
+                -m, --mix               read:write:delete percents of the bench (default 50:50:0)\n\
+                -D, --distribution      uniform or zipf[:theta] bench keys (default uniform, theta 0.99)\n\
+                -K, --keys              count of distinct bench keys\n\
+                -z, --value-size        bench value bytes, min[:max]\n\
+                -R, --rate              bench operations per second, 0 for as fast as possible\n\
+                -T, --duration          bench seconds measured\n\
+                -W, --warmup            bench seconds before measuring\n\
+                -J, --json              write the bench report as JSON here, - for stdout\n\
                 -v, --verbose           print debug messages\n\
                 -t, --trace             print trace messages\n\
                 -h, --help              display this help and exit\n\
@@ -91,8 +128,11 @@ int main(int argc, char *argv[])
     po.total_clients = 16;
     po.total_files = 6250;
     po.start_index = 0;
+    po.pipeline = 1;
+    po.batch = 1;
     po.key = "default";
     po.filename = "./data/samples/32K.dat";
+    edbench_options_init(&po.bench);
 
     po.log_level = LOG_INFO;
 
@@ -102,12 +142,36 @@ int main(int argc, char *argv[])
 		switch (ch) {
             case 'e':
                 po.endpoint = optarg;
+                po.bench.endpoint = optarg;
                 break;
             case 'u':
                 po.total_clients = atoi(optarg);
                 if ( po.total_clients < 0 ) {
                     po.total_clients = 1;
                 }
+                po.bench.total_connections = po.total_clients;
+                break;
+            case 'p':
+                po.pipeline = atoi(optarg);
+                if ( po.pipeline < 1 ) {
+                    po.pipeline = 1;
+                }
+                po.bench.concurrency = po.pipeline;
+                break;
+            case 'b':
+                po.batch = atoi(optarg);
+                if ( po.batch < 1 ) {
+                    po.batch = 1;
+                }
+                break;
+            case 'c':
+                po.slice_size = atoi(optarg) * 1024;
+                if ( po.slice_size < 0 ) {
+                    po.slice_size = 0;
+                }
+                break;
+            case 'o':
+                po.output_dir = optarg;
                 break;
             case 'w':
                 po.op_code = 1;
@@ -118,8 +182,56 @@ int main(int argc, char *argv[])
             case 'x':
                 po.op_code = 3;
                 break;
+            case 'X':
+                po.op_code = 4;
+                break;
+            case 'L':
+                po.op_code = 5;
+                break;
             case 'k':
                 po.key = optarg;
+                po.bench.key = optarg;
+                break;
+            case 'B':
+                po.op_code = 6;
+                break;
+            case 'm':
+                po.bench.read_percent = 0;
+                po.bench.write_percent = 0;
+                po.bench.delete_percent = 0;
+                sscanf(optarg, "%u:%u:%u", &po.bench.read_percent, &po.bench.write_percent, &po.bench.delete_percent);
+                break;
+            case 'D':
+                if ( strncmp(optarg, "zipf", 4) == 0 ){
+                    po.bench.zipf_theta = 0.99;
+                    if ( optarg[4] == ':' ){
+                        po.bench.zipf_theta = atof(optarg + 5);
+                    }
+                } else {
+                    po.bench.zipf_theta = 0;
+                }
+                break;
+            case 'K':
+                po.bench.total_keys = strtoull(optarg, NULL, 10);
+                break;
+            case 'z':
+                po.bench.value_size_min = atoi(optarg);
+                po.bench.value_size_max = po.bench.value_size_min;
+                if ( strchr(optarg, ':') != NULL ){
+                    po.bench.value_size_max = atoi(strchr(optarg, ':') + 1);
+                }
+                break;
+            case 'R':
+                po.bench.rate = atoi(optarg);
+                break;
+            case 'T':
+                po.bench.duration = atoi(optarg);
+                break;
+            case 'W':
+                po.bench.warmup = atoi(optarg);
+                break;
+            case 'J':
+                po.bench.json_file = optarg;
                 break;
             case 's':
                 po.start_index = atoi(optarg);
@@ -171,10 +283,14 @@ int main(int argc, char *argv[])
 
     int rc = 0;
     if ( po.op_code == 0 ){
-       warning_log("Usage: %s --write | --read | --delete", program_name);
+       warning_log("Usage: %s --write | --read | --delete | --delete-prefix | --list | --bench", program_name);
        rc = -1;
+    } else if ( po.op_code == 6 ){
+        rc = run_edbench(&po.bench);
+        notice_log("~~> End EverData Client.");
+        return rc;
     } else {
-        rc = run_edclient(po.endpoint, po.op_code, po.total_clients, po.total_files, po.key, po.filename, po.log_level >= LOG_DEBUG ? 1 : 0);
+        rc = run_edclient(po.endpoint, po.op_code, po.total_clients, po.total_files, po.key, po.filename, po.pipeline, po.batch, po.slice_size, po.output_dir, po.log_level >= LOG_DEBUG ? 1 : 0);
     }
 
     /* -------- End Timing -------- */
@@ -3,12 +3,26 @@
  * @author Jiangwen Su <uukuguy@gmail.com>
  * @date   Fri Mar  2 19:19:53 2012
  *
- * @brief
+ * @brief  FUSE filesystem over everdata objects.
  *
+ * A file is the object keyed by its path. Directories are the common
+ * prefixes of a key listing, mkdir leaves an empty "path/" marker so an
+ * empty directory shows up too.
+ *
+ * Reads go through a small page cache per open file, a page is one slice
+ * of the object. Sequential reads fetch the next pages ahead of time.
+ * Files opened for writing are buffered whole and uploaded as slices on
+ * flush and release, so nothing goes to the network per write() call.
+ *
+ * FUSE runs multi-threaded. Open files spread over a pool of clients,
+ * each with its own I/O thread and connections. Lock order is the open
+ * file table, then a file. A reader pins the pages it waits on and waits
+ * without the file lock, so the reads FUSE issues at once on one file all
+ * go out together.
  *
  */
 
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 29
 #define _FILE_OFFSET_BITS 64
 #include <fuse.h>
 
@@ -18,110 +32,656 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/time.h>
 
 #include "common.h"
 #include "logger.h"
+#include "zmalloc.h"
 #include "everdata.h"
+#include "libedclient.h"
+
+/* Slice size of the objects edfs writes. */
+#define EDFS_SLICE_SIZE (1024 * 1024)
+/* Pages cached per open file. */
+#define EDFS_CACHE_PAGES 16
+#define EDFS_DEFAULT_READAHEAD 4
+/* Slice uploads in flight per flush. */
+#define EDFS_UPLOAD_WINDOW 8
+#define EDFS_SCAN_LIMIT 1000
+#define EDFS_DEFAULT_CLIENTS 4
+#define EDFS_MAX_CLIENTS 64
+
+/* -------- struct edfs_page_t -------- */
+typedef struct edfs_page_t {
+    uint32_t slice_idx;
+    /* NULL for a free page. */
+    edc_future_t *future;
+    uint64_t last_used;
+    /* Readers waiting on the future, the page is not evicted meanwhile. */
+    uint32_t pins;
+} edfs_page_t;
+
+/* -------- struct edfs_file_t -------- */
+typedef struct edfs_file_t {
+    struct edfs_file_t *next;
+    char *key;
+    edc_t *edc;
+    /* The open handle and lookups by path, under the lock of edfs. */
+    uint32_t refs;
+    pthread_mutex_t lock;
+
+    /* Object size, nslices and slice_size, from slice 0. */
+    slice_header_t header;
+    edfs_page_t pages[EDFS_CACHE_PAGES];
+    uint64_t clock;
+    /* Where the last read ended, a read starting there is sequential. */
+    off_t next_offset;
+    /* Pages below it were requested already. */
+    uint32_t readahead_end;
+
+    /* Files opened for writing keep their whole content here. */
+    int writable;
+    int dirty;
+    char *buf;
+    uint64_t buf_size;
+    uint64_t buf_capacity;
+    /* Slices of the stored object, those past the new end are deleted. */
+    uint32_t stored_nslices;
+    /* buf is being uploaded without the lock, writers wait on uploaded. */
+    int uploading;
+    pthread_cond_t uploaded;
+} edfs_file_t;
+
+/* -------- struct edfs_t -------- */
+typedef struct edfs_t {
+    const char *endpoint;
+    uint32_t readahead;
+    uint32_t total_clients;
+    uint32_t total_connections;
+
+    edc_t *clients[EDFS_MAX_CLIENTS];
+    volatile uint32_t next_client;
+    time_t mount_time;
+    /* Open files, the ones being written show up in getattr before their
+     * first upload. */
+    pthread_mutex_t lock;
+    edfs_file_t *files;
+} edfs_t;
+
+static edfs_t g_edfs;
+
+/* ================ edfs_get() ================ */
+static edfs_t *edfs_get(void)
+{
+    return (edfs_t*)fuse_get_context()->private_data;
+}
 
-/* static const char *udfs_str = "Hello World!\n"; */
+/* ================ edfs_client() ================ */
+static edc_t *edfs_client(edfs_t *edfs)
+{
+    return edfs->clients[__sync_fetch_and_add(&edfs->next_client, 1) % edfs->total_clients];
+}
 
-static const char *udfs_path = "/hello";
-static const char *tmp_path = "/tmp";
+/* ================ edfs_status_errno() ================ */
+static int edfs_status_errno(int status)
+{
+    switch ( status ){
+    case EDC_OK:
+        return 0;
+    case EDC_NOTFOUND:
+        return -ENOENT;
+    case EDC_TIMEOUT:
+        return -ETIMEDOUT;
+    default:
+        return -EIO;
+    }
+}
 
-static const char *g_current_path = NULL;
+/* ================ edfs_dir_prefix() ================ */
+/* "/" stays "/", "/a/b" becomes "/a/b/". */
+static char *edfs_dir_prefix(const char *path)
+{
+    size_t len = strlen(path);
+    char *prefix = (char*)zmalloc(len + 2);
+    memcpy(prefix, path, len);
+    if ( len == 0 || path[len - 1] != '/' ){
+        prefix[len++] = '/';
+    }
+    prefix[len] = '\0';
+
+    return prefix;
+}
+
+/* ================ edfs_probe() ================ */
+/* The first key under prefix. 1 with its size if there is one, 0 if not,
+ * -errno on failure. exact asks for the key prefix itself. */
+static int edfs_probe(edfs_t *edfs, const char *prefix, int exact, uint64_t *object_size)
+{
+    edc_future_t *future = edc_scan(edfs_client(edfs), prefix, NULL, 0, 1, NULL, NULL);
+    int rc = edc_future_wait(future, -1);
+    if ( rc == EDC_OK ){
+        uint32_t key_len = 0;
+        uint64_t size = 0;
+        const char *key = edc_future_scan_key(future, 0, &key_len, &size);
+        if ( key != NULL && (!exact || (key_len == strlen(prefix) && memcmp(key, prefix, key_len) == 0)) ){
+            if ( object_size != NULL ) *object_size = size;
+            rc = 1;
+        } else {
+            rc = 0;
+        }
+    } else {
+        rc = edfs_status_errno(rc);
+    }
+    edc_future_free(future);
+
+    return rc;
+}
+
+/* ================ edfs_find_open_file() ================ */
+/* A file open for writing, held until edfs_file_put(). The lock of edfs is
+ * not held any more when the caller takes the lock of file. */
+static edfs_file_t *edfs_find_open_file(edfs_t *edfs, const char *key)
+{
+    pthread_mutex_lock(&edfs->lock);
+    edfs_file_t *file = edfs->files;
+    while ( file != NULL && !(file->writable && strcmp(file->key, key) == 0) ){
+        file = file->next;
+    }
+    if ( file != NULL ){
+        file->refs++;
+    }
+    pthread_mutex_unlock(&edfs->lock);
+
+    return file;
+}
+
+/* ================ edfs_fill_stat() ================ */
+static void edfs_fill_stat(edfs_t *edfs, struct stat *stbuf, int is_dir, uint64_t size)
+{
+    memset(stbuf, 0, sizeof(struct stat));
+    if ( is_dir ){
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+    } else {
+        stbuf->st_mode = S_IFREG | 0644;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = size;
+        stbuf->st_blksize = EDFS_SLICE_SIZE;
+        stbuf->st_blocks = (size + 511) / 512;
+    }
+    stbuf->st_uid = fuse_get_context()->uid;
+    stbuf->st_gid = fuse_get_context()->gid;
+    stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = edfs->mount_time;
+}
+
+/* ================ edfs_file_new() ================ */
+static edfs_file_t *edfs_file_new(edfs_t *edfs, const char *key, int writable)
+{
+    edfs_file_t *file = (edfs_file_t*)zmalloc(sizeof(edfs_file_t));
+    memset(file, 0, sizeof(edfs_file_t));
+    file->key = zstrdup(key);
+    file->edc = edfs_client(edfs);
+    file->refs = 1;
+    pthread_mutex_init(&file->lock, NULL);
+    pthread_cond_init(&file->uploaded, NULL);
+    file->writable = writable;
+
+    return file;
+}
+
+/* ================ edfs_file_free() ================ */
+static void edfs_file_free(edfs_file_t *file)
+{
+    for ( uint32_t i = 0 ; i < EDFS_CACHE_PAGES ; i++ ){
+        if ( file->pages[i].future != NULL ){
+            edc_future_free(file->pages[i].future);
+        }
+    }
+    if ( file->buf != NULL ){
+        zfree(file->buf);
+    }
+    pthread_cond_destroy(&file->uploaded);
+    pthread_mutex_destroy(&file->lock);
+    zfree(file->key);
+    zfree(file);
+}
+
+/* ================ edfs_file_put() ================ */
+static void edfs_file_put(edfs_t *edfs, edfs_file_t *file)
+{
+    pthread_mutex_lock(&edfs->lock);
+    int last = --file->refs == 0;
+    pthread_mutex_unlock(&edfs->lock);
+
+    if ( last ){
+        edfs_file_free(file);
+    }
+}
+
+/* ================ edfs_file_wait_upload() ================ */
+/* Before buf changes. Under the lock of file. */
+static void edfs_file_wait_upload(edfs_file_t *file)
+{
+    while ( file->uploading ){
+        pthread_cond_wait(&file->uploaded, &file->lock);
+    }
+}
+
+/* ================ edfs_file_resize() ================ */
+static void edfs_file_resize(edfs_file_t *file, uint64_t size)
+{
+    if ( size > file->buf_capacity ){
+        uint64_t capacity = file->buf_capacity > 0 ? file->buf_capacity : EDFS_SLICE_SIZE;
+        while ( capacity < size ){
+            capacity *= 2;
+        }
+        file->buf = (char*)zrealloc(file->buf, capacity);
+        file->buf_capacity = capacity;
+    }
+    if ( size > file->buf_size ){
+        memset(file->buf + file->buf_size, 0, size - file->buf_size);
+    }
+    file->buf_size = size;
+}
+
+/* ================ edfs_file_page() ================ */
+/* The page of slice_idx, requested now if it is not cached. NULL when
+ * every page is pinned. Under the lock of file. */
+static edfs_page_t *edfs_file_page(edfs_file_t *file, uint32_t slice_idx)
+{
+    edfs_page_t *victim = NULL;
+    for ( uint32_t i = 0 ; i < EDFS_CACHE_PAGES ; i++ ){
+        edfs_page_t *page = &file->pages[i];
+        if ( page->future != NULL && page->slice_idx == slice_idx ){
+            page->last_used = ++file->clock;
+            return page;
+        }
+        if ( page->pins > 0 ){
+            continue;
+        }
+        if ( victim == NULL || (victim->future != NULL &&
+                (page->future == NULL || page->last_used < victim->last_used)) ){
+            victim = page;
+        }
+    }
+    if ( victim == NULL ){
+        return NULL;
+    }
+
+    if ( victim->future != NULL ){
+        edc_future_free(victim->future);
+    }
+    victim->slice_idx = slice_idx;
+    victim->future = edc_get_slice(file->edc, file->key, slice_idx, NULL, NULL);
+    victim->last_used = ++file->clock;
+
+    return victim;
+}
+
+/* ================ edfs_file_open_slices() ================ */
+/* Fetch slice 0, which carries the object header, into the cache. The
+ * file is not shared yet. */
+static int edfs_file_open_slices(edfs_t *edfs, edfs_file_t *file)
+{
+    edfs_page_t *page = edfs_file_page(file, 0);
+    int rc = edc_future_wait(page->future, -1);
+    if ( rc == EDC_OK ){
+        edc_future_slice_header(page->future, &file->header);
+        file->stored_nslices = file->header.nslices;
+        file->readahead_end = 1;
+    } else {
+        edc_future_free(page->future);
+        page->future = NULL;
+    }
+
+    return edfs_status_errno(rc);
+}
+
+/* ================ edfs_file_read_slices() ================ */
+/* Read from the stored object through the page cache. */
+static int edfs_file_read_slices(edfs_t *edfs, edfs_file_t *file, char *buf, size_t size, off_t offset)
+{
+    pthread_mutex_lock(&file->lock);
+
+    uint64_t object_size = file->header.object_size;
+    uint32_t slice_size = file->header.slice_size;
+    if ( (uint64_t)offset >= object_size || slice_size == 0 ){
+        pthread_mutex_unlock(&file->lock);
+        return 0;
+    }
+    if ( offset + size > object_size ){
+        size = object_size - offset;
+    }
+
+    if ( offset == file->next_offset && edfs->readahead > 0 ){
+        uint32_t last_idx = (offset + size - 1) / slice_size + edfs->readahead;
+        if ( last_idx >= file->header.nslices ){
+            last_idx = file->header.nslices - 1;
+        }
+        uint32_t idx = file->readahead_end > offset / slice_size ? file->readahead_end : offset / slice_size;
+        for ( ; idx <= last_idx ; idx++ ){
+            if ( edfs_file_page(file, idx) == NULL ){
+                break;
+            }
+        }
+        file->readahead_end = idx;
+    } else {
+        /* Random access, start over. */
+        file->readahead_end = 0;
+    }
+
+    size_t copied = 0;
+    int rc = 0;
+    while ( copied < size ){
+        uint64_t pos = offset + copied;
+        uint32_t slice_idx = pos / slice_size;
+        uint32_t in_slice = pos % slice_size;
+
+        /* With every page pinned the slice is fetched for this read alone. */
+        edfs_page_t *page = edfs_file_page(file, slice_idx);
+        edc_future_t *future = NULL;
+        if ( page != NULL ){
+            page->pins++;
+            future = page->future;
+        } else {
+            future = edc_get_slice(file->edc, file->key, slice_idx, NULL, NULL);
+        }
+        pthread_mutex_unlock(&file->lock);
+
+        int status = edc_future_wait(future, -1);
+        size_t n = 0;
+        if ( status == EDC_OK ){
+            uint32_t data_size = 0;
+            const char *data = (const char *)edc_future_data(future, &data_size);
+            if ( in_slice < data_size ){
+                n = data_size - in_slice;
+                if ( n > size - copied ){
+                    n = size - copied;
+                }
+                memcpy(buf + copied, data + in_slice, n);
+            }
+        } else {
+            error_log("edfs read %s slice %d failed. status:%d", file->key, slice_idx, status);
+            rc = -EIO;
+        }
+
+        pthread_mutex_lock(&file->lock);
+        if ( page != NULL ){
+            page->pins--;
+            if ( status != EDC_OK && page->pins == 0 && page->future == future ){
+                edc_future_free(page->future);
+                page->future = NULL;
+            }
+        } else {
+            edc_future_free(future);
+        }
+        if ( n == 0 ){
+            break;
+        }
+        copied += n;
+    }
+    file->next_offset = offset + copied;
+
+    pthread_mutex_unlock(&file->lock);
+
+    return copied > 0 ? (int)copied : rc;
+}
+
+/* ================ edfs_file_load() ================ */
+/* The whole stored object into the write buffer, an empty one if there
+ * is none. */
+static int edfs_file_load(edfs_t *edfs, edfs_file_t *file)
+{
+    int rc = edfs_file_open_slices(edfs, file);
+    if ( rc == -ENOENT ){
+        edfs_file_resize(file, 0);
+        return 0;
+    }
+    if ( rc != 0 ){
+        return rc;
+    }
+
+    edfs_file_resize(file, file->header.object_size);
+    uint64_t loaded = 0;
+    while ( loaded < file->buf_size ){
+        int n = edfs_file_read_slices(edfs, file, file->buf + loaded, file->buf_size - loaded, loaded);
+        if ( n <= 0 ){
+            return n < 0 ? n : -EIO;
+        }
+        loaded += n;
+    }
+
+    return 0;
+}
+
+/* ================ edfs_wait_put() ================ */
+static void edfs_wait_put(edc_future_t *future, int *rc)
+{
+    int status = edc_future_wait(future, -1);
+    if ( status != EDC_OK ){
+        *rc = status;
+    }
+    edc_future_free(future);
+}
+
+/* ================ edfs_wait_del() ================ */
+static void edfs_wait_del(edc_future_t *future, int *rc)
+{
+    int status = edc_future_wait(future, -1);
+    if ( status != EDC_OK && status != EDC_NOTFOUND ){
+        *rc = status;
+    }
+    edc_future_free(future);
+}
+
+/* ================ edfs_file_delete_stale() ================ */
+/* Slices nslices up to stored_nslices are past the new end. Slice 0
+ * already says nslices, so readers never get to them meanwhile. */
+static int edfs_file_delete_stale(edfs_t *edfs, edfs_file_t *file, uint32_t nslices)
+{
+    slice_header_t slice_header;
+    memset(&slice_header, 0, sizeof(slice_header_t));
+    slice_header.object_size = file->buf_size;
+    slice_header.nslices = nslices;
+    slice_header.slice_size = EDFS_SLICE_SIZE;
+
+    edc_future_t *futures[EDFS_UPLOAD_WINDOW];
+    int rc = EDC_OK;
+    uint32_t total_stale = file->stored_nslices - nslices;
+    for ( uint32_t i = 0 ; i < total_stale ; i++ ){
+        if ( i >= EDFS_UPLOAD_WINDOW ){
+            edfs_wait_del(futures[i % EDFS_UPLOAD_WINDOW], &rc);
+        }
+        slice_header.slice_idx = nslices + i;
+        futures[i % EDFS_UPLOAD_WINDOW] = edc_del_slice(file->edc, file->key, &slice_header, NULL, NULL);
+    }
+    for ( uint32_t i = total_stale > EDFS_UPLOAD_WINDOW ? total_stale - EDFS_UPLOAD_WINDOW : 0 ; i < total_stale ; i++ ){
+        edfs_wait_del(futures[i % EDFS_UPLOAD_WINDOW], &rc);
+    }
+
+    return rc;
+}
+
+/* ================ edfs_file_upload() ================ */
+/* The new contents go up first, so a failed upload of a shrunk file keeps
+ * its old slices instead of leaving nothing behind. */
+static int edfs_file_upload(edfs_t *edfs, edfs_file_t *file)
+{
+    uint32_t nslices = (file->buf_size + EDFS_SLICE_SIZE - 1) / EDFS_SLICE_SIZE;
+    if ( nslices == 0 ){
+        nslices = 1;
+    }
+
+    slice_header_t slice_header;
+    memset(&slice_header, 0, sizeof(slice_header_t));
+    slice_header.object_size = file->buf_size;
+    slice_header.nslices = nslices;
+    slice_header.slice_size = EDFS_SLICE_SIZE;
+
+    edc_future_t *futures[EDFS_UPLOAD_WINDOW];
+    int rc = EDC_OK;
+    for ( uint32_t i = 0 ; i < nslices ; i++ ){
+        if ( i >= EDFS_UPLOAD_WINDOW ){
+            edfs_wait_put(futures[i % EDFS_UPLOAD_WINDOW], &rc);
+        }
+        uint64_t offset = (uint64_t)i * EDFS_SLICE_SIZE;
+        uint32_t data_size = file->buf_size - offset < EDFS_SLICE_SIZE ? file->buf_size - offset : EDFS_SLICE_SIZE;
+        slice_header.slice_idx = i;
+        futures[i % EDFS_UPLOAD_WINDOW] = edc_put_slice(file->edc, file->key, &slice_header, file->buf + offset, data_size, NULL, NULL);
+    }
+    for ( uint32_t i = nslices > EDFS_UPLOAD_WINDOW ? nslices - EDFS_UPLOAD_WINDOW : 0 ; i < nslices ; i++ ){
+        edfs_wait_put(futures[i % EDFS_UPLOAD_WINDOW], &rc);
+    }
+
+    if ( rc != EDC_OK ){
+        error_log("edfs upload %s failed. status:%d", file->key, rc);
+        return edfs_status_errno(rc);
+    }
+    file->dirty = 0;
+
+    /* The stale ones are garbage only, a failure leaves stored_nslices as
+     * it was so the next upload tries again. */
+    if ( file->stored_nslices > nslices ){
+        rc = edfs_file_delete_stale(edfs, file, nslices);
+        if ( rc != EDC_OK ){
+            warning_log("edfs delete stale slices of %s failed. status:%d", file->key, rc);
+            return 0;
+        }
+    }
+    file->stored_nslices = nslices;
+
+    return 0;
+}
+
+/* ================ edfs_file_sync() ================ */
+/* Uploads an open file if dirty. The lock of file is dropped meanwhile, so
+ * getattr and reads go on, writers wait for the upload to finish. Nobody
+ * else touches dirty or stored_nslices meanwhile. */
+static int edfs_file_sync(edfs_t *edfs, edfs_file_t *file)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&file->lock);
+    edfs_file_wait_upload(file);
+    if ( file->dirty ){
+        file->uploading = 1;
+        pthread_mutex_unlock(&file->lock);
+
+        rc = edfs_file_upload(edfs, file);
+
+        pthread_mutex_lock(&file->lock);
+        file->uploading = 0;
+        pthread_cond_broadcast(&file->uploaded);
+    }
+    pthread_mutex_unlock(&file->lock);
+
+    return rc;
+}
+
+/* ================ edfs_put_empty() ================ */
+static int edfs_put_empty(edfs_t *edfs, const char *key)
+{
+    return edfs_status_errno(edc_put_sync(edfs_client(edfs), key, "", 0));
+}
 
 static void* edfs_init(struct fuse_conn_info *conn)
 {
     syslog(LOG_DEBUG, "edfs_init()");
 
-    void* private_data = NULL;
-
-    return private_data;
+    edfs_t *edfs = &g_edfs;
+    /* After fuse daemonized, the client threads would not survive the fork. */
+    edc_options_t options;
+    edc_options_init(&options);
+    if ( edfs->total_connections > 0 ){
+        options.total_connections = edfs->total_connections;
+    }
+    for ( uint32_t i = 0 ; i < edfs->total_clients ; i++ ){
+        edfs->clients[i] = edc_new(edfs->endpoint, &options);
+    }
+    edfs->mount_time = time(NULL);
+
+    /* open() sees O_TRUNC instead of a truncate() call before it. */
+    uint32_t wanted = FUSE_CAP_ATOMIC_O_TRUNC | FUSE_CAP_ASYNC_READ | FUSE_CAP_BIG_WRITES |
+        FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE;
+    conn->want |= conn->capable & wanted;
+    /* Both are cut down to what the kernel and libfuse allow. */
+    conn->max_write = EDFS_SLICE_SIZE;
+    conn->max_readahead = EDFS_SLICE_SIZE * (edfs->readahead > 0 ? edfs->readahead : 1);
+    notice_log("edfs mounted. clients:%d capable:0x%x want:0x%x max_write:%d max_readahead:%d",
+            edfs->total_clients, conn->capable, conn->want, conn->max_write, conn->max_readahead);
+
+    return edfs;
 }
 
 static void edfs_destroy(void *private_data)
 {
     syslog(LOG_DEBUG, "edfs_destroy()");
+
+    edfs_t *edfs = (edfs_t*)private_data;
+    while ( edfs->files != NULL ){
+        edfs_file_t *file = edfs->files;
+        edfs->files = file->next;
+        edfs_file_free(file);
+    }
+    for ( uint32_t i = 0 ; i < edfs->total_clients ; i++ ){
+        edc_free(edfs->clients[i]);
+        edfs->clients[i] = NULL;
+    }
 }
 
-/*
-struct stat {
-    dev_t         st_dev;       //文件的设备编号
-    ino_t         st_ino;       //节点
-    mode_t        st_mode;      //文件的类型和存取的权限
-    nlink_t       st_nlink;     //连到该文件的硬连接数目，刚建立的文件值为1
-    uid_t         st_uid;       //用户ID
-    gid_t         st_gid;       //组ID
-    dev_t         st_rdev;      //(设备类型)若此文件为设备文件，则为其设备编号
-    off_t         st_size;      //文件字节数(文件大小)
-    unsigned long st_blksize;   //块大小(文件系统的I/O 缓冲区大小)
-    unsigned long st_blocks;    //块数
-    time_t        st_atime;     //最后一次访问时间
-    time_t        st_mtime;     //最后一次修改时间
-    time_t        st_ctime;     //最后一次改变时间(指属性)
-};
+static int edfs_getattr(const char *path, struct stat *stbuf)
+{
+    syslog(LOG_DEBUG, "edfs_getattr() : %s", path);
+
+    edfs_t *edfs = edfs_get();
+
+    if ( strcmp(path, "/") == 0 ){
+        edfs_fill_stat(edfs, stbuf, 1, 0);
+        return 0;
+    }
+
+    edfs_file_t *file = edfs_find_open_file(edfs, path);
+    if ( file != NULL ){
+        pthread_mutex_lock(&file->lock);
+        edfs_fill_stat(edfs, stbuf, 0, file->buf_size);
+        pthread_mutex_unlock(&file->lock);
+        edfs_file_put(edfs, file);
+        return 0;
+    }
+
+    uint64_t object_size = 0;
+    int rc = edfs_probe(edfs, path, 1, &object_size);
+    if ( rc == 1 ){
+        edfs_fill_stat(edfs, stbuf, 0, object_size);
+        return 0;
+    }
+    if ( rc < 0 ){
+        return rc;
+    }
+
+    char *prefix = edfs_dir_prefix(path);
+    rc = edfs_probe(edfs, prefix, 0, NULL);
+    zfree(prefix);
+    if ( rc == 1 ){
+        edfs_fill_stat(edfs, stbuf, 1, 0);
+        return 0;
+    }
+
+    return rc < 0 ? rc : -ENOENT;
+}
 
-S_IFMT   0170000    文件类型的位遮罩
-    S_IFSOCK 0140000    scoket
-    S_IFLNK 0120000     符号连接
-    S_IFREG 0100000     一般文件
-    S_IFBLK 0060000     区块装置
-    S_IFDIR 0040000     目录
-    S_IFCHR 0020000     字符装置
-    S_IFIFO 0010000     先进先出
-
-    S_ISUID 04000     文件的(set user-id on execution)位
-    S_ISGID 02000     文件的(set group-id on execution)位
-    S_ISVTX 01000     文件的sticky位
-
-    S_IRUSR(S_IREAD) 00400     文件所有者具可读取权限
-    S_IWUSR(S_IWRITE)00200     文件所有者具可写入权限
-    S_IXUSR(S_IEXEC) 00100     文件所有者具可执行权限
-
-    S_IRGRP 00040             用户组具可读取权限
-    S_IWGRP 00020             用户组具可写入权限
-    S_IXGRP 00010             用户组具可执行权限
-
-    S_IROTH 00004             其他用户具可读取权限
-    S_IWOTH 00002             其他用户具可写入权限
-    S_IXOTH 00001             其他用户具可执行权限
-
-  上述的文件类型在POSIX中定义了检查这些类型的宏定义：
-    S_ISLNK (st_mode)    判断是否为符号连接
-    S_ISREG (st_mode)    是否为一般文件
-    S_ISDIR (st_mode)    是否为目录
-    S_ISCHR (st_mode)    是否为字符装置文件
-    S_ISBLK (s3e)        是否为先进先出
-    S_ISSOCK (st_mode)   是否为socket
-*/
-
-static int udfs_getattr(const char *path, struct stat *stbuf)
-{
-     syslog(LOG_DEBUG, "edfs_getattr() : %s", path);
-
-    int res = 0;
-
-     memset(stbuf, 0, sizeof(struct stat));
-
-     if(strcmp(path, "/") == 0) {
-         stbuf->st_mode = S_IFDIR | 0755;
-         stbuf->st_nlink = 2;
-     }
-     else if(strcmp(path, tmp_path) == 0) {
-          stbuf->st_mode = S_IFREG | 0444;
-          stbuf->st_nlink = 1;
-          stbuf->st_size = strlen(path);
-     }
-     else {
-         stbuf->st_mode = S_IFDIR | 0755;
-         stbuf->st_nlink = 2;
-     }
-     /*else */
-          /*res = -ENOENT; */
-
-    return res;
+static int edfs_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    edfs_file_t *file = (edfs_file_t*)(uintptr_t)fi->fh;
+    pthread_mutex_lock(&file->lock);
+    edfs_fill_stat(edfs_get(), stbuf, 0, file->writable ? file->buf_size : file->header.object_size);
+    pthread_mutex_unlock(&file->lock);
+
+    return 0;
 }
 
 /** Open directory
@@ -138,13 +698,7 @@ static int edfs_opendir(const char *path, struct fuse_file_info *fi)
 {
     syslog(LOG_INFO, "edfs_opendir() : %s", path);
 
-    int ret = 0;
-
-    g_current_path = path;
-    /*if ( opendir(path) == NULL )*/
-    /*return -errno;*/
-
-    return ret;
+    return 0;
 }
 
 /** Release directory
@@ -155,25 +709,80 @@ static int edfs_releasedir(const char *path, struct fuse_file_info *fi)
 {
     syslog(LOG_DEBUG, "edfs_releasedir() : %s", path);
 
-     int ret = 0;
-
-     g_current_path = NULL;
-
-     return ret;
+    return 0;
 }
 
+/* The listing is paged through the scan of prefix "path/" rolled up at
+ * '/', so subdirectories come back as common prefixes. */
 static int edfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                         off_t offset, struct fuse_file_info *fi)
 {
     syslog(LOG_DEBUG, "edfs_readdir() : %s", path);
 
+    edfs_t *edfs = edfs_get();
+
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
 
-    filler(buf, udfs_path + 1, NULL, 0);
-    filler(buf, tmp_path + 1, NULL, 0);
-
-    return 0;
+    char *prefix = edfs_dir_prefix(path);
+    size_t prefix_len = strlen(prefix);
+    char start_after[PATH_MAX + 1];
+    start_after[0] = '\0';
+
+    int rc = 0;
+    int more = 1;
+    while ( more ){
+        edc_future_t *future = edc_scan(edfs_client(edfs), prefix, start_after, '/', EDFS_SCAN_LIMIT, NULL, NULL);
+        int status = edc_future_wait(future, -1);
+        if ( status != EDC_OK ){
+            edc_future_free(future);
+            rc = edfs_status_errno(status);
+            break;
+        }
+
+        uint32_t total_entries = edc_future_scan_size(future);
+        for ( uint32_t i = 0 ; i < total_entries ; i++ ){
+            uint32_t key_len = 0;
+            uint64_t object_size = 0;
+            const char *key = edc_future_scan_key(future, i, &key_len, &object_size);
+            if ( i == total_entries - 1 ){
+                /* The next page starts after it, whatever it is. */
+                if ( key_len > PATH_MAX ){
+                    syslog(LOG_ERR, "edfs_readdir() : key too long to resume after in %s", path);
+                    more = 0;
+                    break;
+                }
+                memcpy(start_after, key, key_len);
+                start_after[key_len] = '\0';
+            }
+            if ( key_len <= prefix_len ){
+                /* The directory's own marker. */
+                continue;
+            }
+
+            char name[NAME_MAX + 1];
+            uint32_t name_len = key_len - prefix_len;
+            int is_dir = object_size == EDC_SCAN_PREFIX_SIZE;
+            if ( is_dir ){
+                name_len--;
+            }
+            if ( name_len > NAME_MAX ){
+                continue;
+            }
+            memcpy(name, key + prefix_len, name_len);
+            name[name_len] = '\0';
+
+            struct stat st;
+            memset(&st, 0, sizeof(struct stat));
+            st.st_mode = is_dir ? S_IFDIR : S_IFREG;
+            filler(buf, name, &st, 0);
+        }
+        more = more && edc_future_scan_more(future);
+        edc_future_free(future);
+    }
+    zfree(prefix);
+
+    return rc;
 }
 
 /** Synchronize directory contents
@@ -191,15 +800,58 @@ static int edfs_fsyncdir(const char *path, int parm, struct fuse_file_info *fi)
     return ret;
 }
 
+/* ================ edfs_attach_file() ================ */
+static void edfs_attach_file(edfs_t *edfs, edfs_file_t *file, struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&edfs->lock);
+    file->next = edfs->files;
+    edfs->files = file;
+    pthread_mutex_unlock(&edfs->lock);
+    fi->fh = (uint64_t)(uintptr_t)file;
+}
+
 static int edfs_open(const char *path, struct fuse_file_info *fi)
 {
     syslog(LOG_INFO, "edfs_open() : %s", path);
 
-    /*  if(strcmp(path, udfs_path) != 0) */
-    /*       return -ENOENT; */
+    edfs_t *edfs = edfs_get();
+
+    int writable = (fi->flags & O_ACCMODE) != O_RDONLY;
+    edfs_file_t *file = edfs_file_new(edfs, path, writable);
+
+    int rc = 0;
+    if ( !writable ){
+        rc = edfs_file_open_slices(edfs, file);
+    } else if ( fi->flags & O_TRUNC ){
+        /* Still needs the old slice count for the upload. */
+        uint64_t object_size = 0;
+        if ( edfs_probe(edfs, path, 1, &object_size) == 1 ){
+            file->stored_nslices = (object_size + EDFS_SLICE_SIZE - 1) / EDFS_SLICE_SIZE;
+        }
+        file->dirty = 1;
+    } else {
+        rc = edfs_file_load(edfs, file);
+    }
+
+    if ( rc != 0 ){
+        edfs_file_free(file);
+        return rc;
+    }
+    edfs_attach_file(edfs, file, fi);
+
+    return 0;
+}
+
+static int edfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    syslog(LOG_INFO, "edfs_create() : %s", path);
+
+    edfs_t *edfs = edfs_get();
 
-    /*  if((fi->flags & 3) != O_RDONLY) */
-    /*       return -EACCES; */
+    edfs_file_t *file = edfs_file_new(edfs, path, 1);
+    /* An empty file is stored on flush even if nothing is written. */
+    file->dirty = 1;
+    edfs_attach_file(edfs, file, fi);
 
     return 0;
 }
@@ -209,20 +861,21 @@ static int edfs_read(const char *path, char *buf, size_t size, off_t offset,
 {
     syslog(LOG_DEBUG, "edfs_read() : %s size : %zu", path, size);
 
-    /*size_t len = 0; */
-    /* (void) fi; */
-    /* if(strcmp(path, udfs_path) != 0) */
-    /*      return -ENOENT; */
-
-    /* len = strlen(udfs_str); */
-    /* if (offset < len) { */
-    /*      if (offset + size > len) */
-    /*           size = len - offset; */
-    /*      memcpy(buf, udfs_str + offset, size); */
-    /* } else */
-    /*      size = 0; */
-
-    return size;
+    edfs_file_t *file = (edfs_file_t*)(uintptr_t)fi->fh;
+
+    if ( file->writable ){
+        pthread_mutex_lock(&file->lock);
+        if ( (uint64_t)offset >= file->buf_size ){
+            size = 0;
+        } else if ( offset + size > file->buf_size ){
+            size = file->buf_size - offset;
+        }
+        memcpy(buf, file->buf + offset, size);
+        pthread_mutex_unlock(&file->lock);
+        return size;
+    }
+
+    return edfs_file_read_slices(edfs_get(), file, buf, size, offset);
 }
 
 /** Write data to an open file
@@ -238,16 +891,127 @@ static int edfs_write(const char *path, const char *buf, size_t size, off_t offs
 {
     syslog(LOG_DEBUG, "edfs_write() : %s size : %zu", path, size);
 
+    edfs_file_t *file = (edfs_file_t*)(uintptr_t)fi->fh;
+    if ( !file->writable ){
+        return -EBADF;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    edfs_file_wait_upload(file);
+    if ( offset + size > file->buf_size ){
+        edfs_file_resize(file, offset + size);
+    }
+    memcpy(file->buf + offset, buf, size);
+    file->dirty = 1;
+    pthread_mutex_unlock(&file->lock);
+
     return size;
 }
 
+/* Like edfs_write(), the data goes from the FUSE buffer, a pipe when the
+ * kernel spliced it, straight into the file buffer. */
+static int edfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                          struct fuse_file_info *fi)
+{
+    edfs_file_t *file = (edfs_file_t*)(uintptr_t)fi->fh;
+    if ( !file->writable ){
+        return -EBADF;
+    }
+
+    size_t size = fuse_buf_size(buf);
+    pthread_mutex_lock(&file->lock);
+    edfs_file_wait_upload(file);
+    uint64_t old_size = file->buf_size;
+    if ( offset + size > file->buf_size ){
+        edfs_file_resize(file, offset + size);
+    }
+
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    dst.buf[0].mem = file->buf + offset;
+    ssize_t n = fuse_buf_copy(&dst, buf, (enum fuse_buf_copy_flags)0);
+
+    /* A short copy leaves no hole past what was written. */
+    uint64_t end = n > 0 ? offset + n : 0;
+    if ( file->buf_size > old_size ){
+        file->buf_size = end > old_size ? end : old_size;
+    }
+    if ( n > 0 ){
+        file->dirty = 1;
+    }
+    pthread_mutex_unlock(&file->lock);
+
+    return n;
+}
+
+static int edfs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+    syslog(LOG_DEBUG, "edfs_ftruncate() : %s size : %jd", path, (intmax_t)size);
+
+    edfs_file_t *file = (edfs_file_t*)(uintptr_t)fi->fh;
+    if ( !file->writable ){
+        return -EBADF;
+    }
+    pthread_mutex_lock(&file->lock);
+    edfs_file_wait_upload(file);
+    edfs_file_resize(file, size);
+    file->dirty = 1;
+    pthread_mutex_unlock(&file->lock);
+
+    return 0;
+}
+
+static int edfs_truncate(const char *path, off_t size)
+{
+    syslog(LOG_DEBUG, "edfs_truncate() : %s size : %jd", path, (intmax_t)size);
+
+    edfs_t *edfs = edfs_get();
+
+    edfs_file_t *file = edfs_find_open_file(edfs, path);
+    if ( file != NULL ){
+        pthread_mutex_lock(&file->lock);
+        edfs_file_wait_upload(file);
+        edfs_file_resize(file, size);
+        file->dirty = 1;
+        pthread_mutex_unlock(&file->lock);
+        edfs_file_put(edfs, file);
+        return 0;
+    }
+
+    file = edfs_file_new(edfs, path, 1);
+    int rc = 0;
+    if ( size == 0 ){
+        /* No need to fetch what is thrown away. */
+        uint64_t object_size = 0;
+        rc = edfs_probe(edfs, path, 1, &object_size);
+        if ( rc == 1 ){
+            file->stored_nslices = (object_size + EDFS_SLICE_SIZE - 1) / EDFS_SLICE_SIZE;
+        }
+        rc = rc < 0 ? rc : rc == 1 ? 0 : -ENOENT;
+    } else {
+        rc = edfs_file_load(edfs, file);
+    }
+    if ( rc == 0 ){
+        edfs_file_resize(file, size);
+        rc = edfs_file_upload(edfs, file);
+    }
+    edfs_file_free(file);
+
+    return rc;
+}
+
 static int edfs_flush(const char *path, struct fuse_file_info *fi)
 {
 
     syslog(LOG_DEBUG, "edfs_flush() : %s", path);
 
-    int ret = 0;
-    return ret;
+    edfs_file_t *file = (edfs_file_t*)(uintptr_t)fi->fh;
+
+    return edfs_file_sync(edfs_get(), file);
+}
+
+static int edfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    return edfs_flush(path, fi);
 }
 
 /** Release an open file
@@ -266,48 +1030,54 @@ static int edfs_flush(const char *path, struct fuse_file_info *fi)
  */
 static int edfs_release(const char *path, struct fuse_file_info *fi)
 {
-     syslog(LOG_DEBUG, "edfs_release() : %s", path);
+    syslog(LOG_DEBUG, "edfs_release() : %s", path);
+
+    edfs_t *edfs = edfs_get();
+    edfs_file_t *file = (edfs_file_t*)(uintptr_t)fi->fh;
+
+    /* Still listed while uploading, getattr keeps seeing its size. */
+    edfs_file_sync(edfs, file);
+
+    pthread_mutex_lock(&edfs->lock);
+    edfs_file_t **prev = &edfs->files;
+    while ( *prev != NULL && *prev != file ){
+        prev = &(*prev)->next;
+    }
+    if ( *prev != NULL ){
+        *prev = file->next;
+    }
+    pthread_mutex_unlock(&edfs->lock);
+    /* A getattr or truncate may still hold it. */
+    edfs_file_put(edfs, file);
 
-     int ret = 0;
-     return ret;
+    return 0;
 }
 
 static int edfs_unlink(const char *filename)
 {
     syslog(LOG_DEBUG, "udfs_unlink() : %s", filename);
 
-    int ret = 0;
-    return ret;
+    return edfs_status_errno(edc_del_sync(edfs_client(edfs_get()), filename));
 }
 
 static int edfs_mknod(const char *path, mode_t mode, dev_t rdev)
 {
     syslog(LOG_DEBUG, "edfs_mknod() : %s", path);
 
-    int res = 0;
-
-    /* On Linux this could just be 'mknod(path, mode, rdev)' but this
-       is more portable */
-    /* if (S_ISREG(mode)) { */
-    /*      res = open(path, O_CREAT | O_EXCL | O_WRONLY, mode); */
-    /*      if (res >= 0) */
-    /*           res = close(res); */
-    /* } else if (S_ISFIFO(mode)) */
-    /*      res = mkfifo(path, mode); */
-    /* else */
-    /*      res = mknod(path, mode, rdev); */
-    /* if (res == -1) */
-    /*      return -errno; */
+    if ( !S_ISREG(mode) ){
+        return -EPERM;
+    }
 
-    return res;
+    return edfs_put_empty(edfs_get(), path);
 }
 
 static int edfs_mkdir(const char *path, mode_t path_mode)
 {
-     syslog(LOG_DEBUG, "edfs_mkdir() : %s", path);
+    syslog(LOG_DEBUG, "edfs_mkdir() : %s", path);
 
-    int ret = 0;
-    /* path_mode |= S_IFDIR; */
+    char *prefix = edfs_dir_prefix(path);
+    int ret = edfs_put_empty(edfs_get(), prefix);
+    zfree(prefix);
 
     return ret;
 }
@@ -316,31 +1086,75 @@ static int edfs_rmdir(const char *path)
 {
     syslog(LOG_DEBUG, "edfs_rmdir() : %s", path);
 
-    int ret = 0;
+    edfs_t *edfs = edfs_get();
+
+    char *prefix = edfs_dir_prefix(path);
+    edc_future_t *future = edc_scan(edfs_client(edfs), prefix, prefix, 0, 1, NULL, NULL);
+    int ret = edfs_status_errno(edc_future_wait(future, -1));
+    if ( ret == 0 && edc_future_scan_size(future) > 0 ){
+        ret = -ENOTEMPTY;
+    }
+    edc_future_free(future);
+
+    if ( ret == 0 ){
+        ret = edfs_status_errno(edc_del_sync(edfs_client(edfs), prefix));
+    }
+    zfree(prefix);
+
     return ret;
 }
 
+/* Objects are copied whole, directories can not be renamed. */
 static int edfs_rename(const char *oldpath, const char *newpath)
 {
     syslog(LOG_DEBUG, "udfs_rename() from : %s to : %s", oldpath, newpath);
 
-    int ret = 0;
+    edfs_t *edfs = edfs_get();
+
+    uint64_t object_size = 0;
+    int ret = edfs_probe(edfs, oldpath, 1, &object_size);
+    if ( ret == 0 ){
+        char *prefix = edfs_dir_prefix(oldpath);
+        ret = edfs_probe(edfs, prefix, 0, NULL);
+        zfree(prefix);
+        return ret == 1 ? -ENOTSUP : ret < 0 ? ret : -ENOENT;
+    }
+    if ( ret < 0 ){
+        return ret;
+    }
+
+    edfs_file_t *file = edfs_file_new(edfs, oldpath, 1);
+    ret = edfs_file_load(edfs, file);
+    if ( ret == 0 ){
+        zfree(file->key);
+        file->key = zstrdup(newpath);
+        ret = edfs_probe(edfs, newpath, 1, &object_size);
+        if ( ret >= 0 ){
+            file->stored_nslices = ret == 1 ? (object_size + EDFS_SLICE_SIZE - 1) / EDFS_SLICE_SIZE : 0;
+            ret = edfs_file_upload(edfs, file);
+        }
+    }
+    edfs_file_free(file);
+
+    if ( ret == 0 ){
+        ret = edfs_status_errno(edc_del_sync(edfs_client(edfs), oldpath));
+    }
+
     return ret;
 }
 
 static int edfs_symlink(const char *path, const char *linkname)
 {
-    int ret = 0;
-    return ret;
+    return -ENOTSUP;
 }
 
 static int edfs_readlink(const char *linkname, char *buf, size_t size)
 {
-    int ret = 0;
-    return ret;
+    return -EINVAL;
 }
 
 
+/* Objects keep no mode, owner or times. */
 static int edfs_chmod(const char *path, mode_t file_mode)
 {
     syslog(LOG_DEBUG, "edfs_chmod() : %s", path);
@@ -357,11 +1171,17 @@ static int edfs_chown(const char *path, uid_t uid, gid_t gid)
     return ret;
 }
 
+static int edfs_utimens(const char *path, const struct timespec tv[2])
+{
+    return 0;
+}
+
 static struct fuse_operations udfs_oper = {
     .init       = edfs_init,
     .destroy    = edfs_destroy,
 
-    .getattr	= udfs_getattr,
+    .getattr	= edfs_getattr,
+    .fgetattr   = edfs_fgetattr,
 
     .opendir    = edfs_opendir,
     .readdir	= edfs_readdir,
@@ -369,9 +1189,14 @@ static struct fuse_operations udfs_oper = {
     .fsyncdir   = edfs_fsyncdir,
 
     .open	    = edfs_open,
+    .create     = edfs_create,
     .read	    = edfs_read,
     .write      = edfs_write,
+    .write_buf  = edfs_write_buf,
+    .truncate   = edfs_truncate,
+    .ftruncate  = edfs_ftruncate,
     .flush      = edfs_flush,
+    .fsync      = edfs_fsync,
     .release    = edfs_release,
 
     .unlink     = edfs_unlink,
@@ -385,12 +1210,54 @@ static struct fuse_operations udfs_oper = {
     .readlink   = edfs_readlink,
     .chmod      = edfs_chmod,
     .chown      = edfs_chown,
+    .utimens    = edfs_utimens,
+};
+
+/* -------- struct edfs_options_t -------- */
+typedef struct edfs_options_t {
+    char *endpoint;
+    int readahead;
+    int clients;
+    int connections;
+} edfs_options_t;
+
+#define EDFS_OPT(t, p) { t, offsetof(edfs_options_t, p), 0 }
+static struct fuse_opt edfs_opts[] = {
+    EDFS_OPT("--endpoint=%s", endpoint),
+    EDFS_OPT("endpoint=%s", endpoint),
+    EDFS_OPT("--readahead=%d", readahead),
+    EDFS_OPT("readahead=%d", readahead),
+    EDFS_OPT("--clients=%d", clients),
+    EDFS_OPT("clients=%d", clients),
+    EDFS_OPT("--connections=%d", connections),
+    EDFS_OPT("connections=%d", connections),
+    FUSE_OPT_END
 };
 
 int main(int argc, char *argv[])
 {
-    int ret = fuse_main(argc, argv, &udfs_oper, NULL);
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+    edfs_options_t options;
+    memset(&options, 0, sizeof(edfs_options_t));
+    options.readahead = EDFS_DEFAULT_READAHEAD;
+    options.clients = EDFS_DEFAULT_CLIENTS;
+    if ( fuse_opt_parse(&args, &options, edfs_opts, NULL) == -1 ){
+        return -1;
+    }
+
+    memset(&g_edfs, 0, sizeof(edfs_t));
+    g_edfs.endpoint = options.endpoint != NULL ? options.endpoint : "tcp://127.0.0.1:19977";
+    g_edfs.readahead = options.readahead > 0 ? options.readahead : 0;
+    if ( g_edfs.readahead > EDFS_CACHE_PAGES / 2 ){
+        g_edfs.readahead = EDFS_CACHE_PAGES / 2;
+    }
+    g_edfs.total_clients = options.clients < 1 ? 1 : options.clients > EDFS_MAX_CLIENTS ? EDFS_MAX_CLIENTS : options.clients;
+    g_edfs.total_connections = options.connections > 0 ? options.connections : 0;
+    pthread_mutex_init(&g_edfs.lock, NULL);
+
+    int ret = fuse_main(args.argc, args.argv, &udfs_oper, NULL);
+    fuse_opt_free_args(&args);
 
     return ret;
 }
-
@@ -38,11 +38,11 @@ const char *get_storage_type_name(int storage_type)
 }
 
 /* ================ run_edworker() ================ */
-int run_edworker(const char *broker_endpoint, uint32_t total_buckets, uint32_t total_channels, int storage_type, int verbose)
+int run_edworker(const char *broker_endpoint, uint32_t datanode_id, const char *data_dir, uint32_t total_buckets, uint32_t total_channels, int storage_type, const bucketdb_options_t *bucketdb_options, int verbose)
 {
-    info_log("run_edworker() with %d buckets %d channels connect to %s. Storage Type(%d):%s", total_buckets, total_channels, broker_endpoint, storage_type, get_storage_type_name(storage_type));
+    info_log("run_edworker() datanode %d with %d buckets %d channels connect to %s. Storage Type(%d):%s", datanode_id, total_buckets, total_channels, broker_endpoint, storage_type, get_storage_type_name(storage_type));
 
-    datanode_t *datanode = datanode_new(total_buckets, total_channels, storage_type, broker_endpoint, verbose);
+    datanode_t *datanode = datanode_new(datanode_id, data_dir, total_buckets, total_channels, storage_type, bucketdb_options, broker_endpoint, verbose);
 
     datanode_loop(datanode);
 
@@ -13,15 +13,19 @@
 #include "filesystem.h"
 #include "sysinfo.h"
 #include "bucketdb.h"
+#include "slicecodec.h"
 #include "logger.h"
 
 static char program_name[] = "edworker";
 
 typedef struct{
     const char *broker_endpoint;
+    uint32_t datanode_id;
+    const char *data_dir;
     uint32_t total_buckets;
     uint32_t total_channels;
     int storage_type;
+    bucketdb_options_t bucketdb_options;
 
     int is_daemon;
     int log_level;
@@ -29,9 +33,20 @@ typedef struct{
 
 static struct option const long_options[] = {
 	{"endpoint", required_argument, NULL, 'e'},
+	{"datanode", required_argument, NULL, 'n'},
+	{"datadir", required_argument, NULL, 'D'},
 	{"buckets", required_argument, NULL, 'w'},
 	{"channels", required_argument, NULL, 'c'},
 	{"storage", required_argument, NULL, 's'},
+	{"cache-size", required_argument, NULL, 'm'},
+	{"compact-threshold", required_argument, NULL, 'k'},
+	{"compact-rate", required_argument, NULL, 'K'},
+	{"max-open-slicedbs", required_argument, NULL, 'O'},
+	{"log-segment-size", required_argument, NULL, 'L'},
+	{"verify-reads", required_argument, NULL, 'V'},
+	{"scrub-rate", required_argument, NULL, 'S'},
+	{"compression", required_argument, NULL, 'z'},
+	{"cold-compression", required_argument, NULL, 'Z'},
 	{"daemon", no_argument, NULL, 'd'},
 	{"verbose", no_argument, NULL, 'v'},
 	{"trace", no_argument, NULL, 't'},
@@ -39,9 +54,9 @@ static struct option const long_options[] = {
 
 	{NULL, 0, NULL, 0},
 };
-static const char *short_options = "e:u:w:c:s:dvth";
+static const char *short_options = "e:u:n:D:w:c:s:m:k:K:O:L:V:S:z:Z:dvth";
 
-extern int run_edworker(const char *broker_endpoint, uint32_t total_buckets, uint32_t total_channels, int storage_type, int verbose);
+extern int run_edworker(const char *broker_endpoint, uint32_t datanode_id, const char *data_dir, uint32_t total_buckets, uint32_t total_channels, int storage_type, const bucketdb_options_t *bucketdb_options, int verbose);
 
 /* ==================== daemon_loop() ==================== */
 int daemon_loop(void *data)
@@ -49,7 +64,7 @@ int daemon_loop(void *data)
     notice_log("In daemon_loop()");
 
     const program_options_t *po = (const program_options_t *)data;
-    return run_edworker(po->broker_endpoint, po->total_buckets, po->total_channels, po->storage_type, po->log_level >= LOG_DEBUG ? 1 : 0);
+    return run_edworker(po->broker_endpoint, po->datanode_id, po->data_dir, po->total_buckets, po->total_channels, po->storage_type, &po->bucketdb_options, po->log_level >= LOG_DEBUG ? 1 : 0);
 }
 
 /* ==================== usage() ==================== */
@@ -62,9 +77,20 @@ static void usage(int status)
         printf("Usage: %s [OPTION] [PATH]\n", program_name);
         printf("Everdata Worker\n\
                 -e, --endpoint          specify the edbroker endpoint\n\
+                -n, --datanode          id of this datanode, unique in the cluster\n\
+                -D, --datadir           root dir of the storage, default ./data\n\
                 -w, --buckets           count of buckets\n\
                 -w, --channels           count of channels\n\
                 -s, --storage      NONE, LOGFILE, LMDB, EBLOB, LEVELDB, ROCKSDB, LSM\n\
+                -m, --cache-size        MB of hot slices cached per bucket, 0 disables\n\
+                -k, --compact-threshold compact slicedbs or LOGFILE segments below this live percentage, 0 disables\n\
+                -K, --compact-rate      MB per second the compactor may copy\n\
+                -O, --max-open-slicedbs slicedbs kept open by all buckets, default 64\n\
+                -L, --log-segment-size  MB per LOGFILE segment, default 256\n\
+                -V, --verify-reads      percent of reads checked against the slice CRC, default 100\n\
+                -S, --scrub-rate        MB per second the scrubber reads, 0 disables, default 4\n\
+                -z, --compression       none, lz4 or zstd for slices written to slicedbs, default none\n\
+                -Z, --cold-compression  none, lz4 or zstd for slices the compactor moves, default none\n\
                 -d, --daemon            run in the daemon mode. \n\
                 -v, --verbose           print debug messages\n\
                 -t, --trace             print trace messages\n\
@@ -80,9 +106,12 @@ int main(int argc, char *argv[])
     memset(&po, 0, sizeof(program_options_t));
 
     po.broker_endpoint = "tcp://127.0.0.1:19978";
+    po.datanode_id = 0;
+    po.data_dir = "./data";
     po.total_buckets = 4;
     po.total_channels = 2;
     po.storage_type = BUCKETDB_NONE;
+    bucketdb_options_init(&po.bucketdb_options);
     po.is_daemon = 0;
     po.log_level = LOG_INFO;
 
@@ -94,6 +123,12 @@ int main(int argc, char *argv[])
             case 'e':
                 po.broker_endpoint = optarg;
                 break;
+            case 'n':
+                po.datanode_id = atoi(optarg);
+                break;
+            case 'D':
+                po.data_dir = optarg;
+                break;
             case 'w':
                 {
                     int total_buckets = atoi(optarg);
@@ -117,6 +152,42 @@ int main(int argc, char *argv[])
             case 's':
                 sz_storage_type = optarg;
                 break;
+            case 'm':
+                po.bucketdb_options.cache_size = (uint64_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'k':
+                po.bucketdb_options.compact_threshold = atoi(optarg);
+                break;
+            case 'K':
+                po.bucketdb_options.compact_rate = (uint64_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'O':
+                po.bucketdb_options.max_open_slicedbs = atoi(optarg);
+                break;
+            case 'L':
+                po.bucketdb_options.log_segment_size = (uint64_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'V':
+                po.bucketdb_options.verify_reads = atoi(optarg);
+                break;
+            case 'S':
+                po.bucketdb_options.scrub_rate = (uint64_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'z':
+            case 'Z':
+                {
+                    int codec = slicecodec_by_name(optarg);
+                    if ( codec < 0 ){
+                        fprintf(stderr, "Unsupported compression: %s\n", optarg);
+                        usage(1);
+                    }
+                    if ( ch == 'z' ){
+                        po.bucketdb_options.compression = codec;
+                    } else {
+                        po.bucketdb_options.cold_compression = codec;
+                    }
+                }
+                break;
             case 'd':
                 po.is_daemon = 1;
                 break;
@@ -168,6 +239,6 @@ int main(int argc, char *argv[])
     if ( po.is_daemon ){
         return daemon_fork(daemon_loop, (void*)&po);
     } else
-        return run_edworker(po.broker_endpoint, po.total_buckets, po.total_channels, po.storage_type, po.log_level >= LOG_DEBUG ? 1 : 0);
+        return run_edworker(po.broker_endpoint, po.datanode_id, po.data_dir, po.total_buckets, po.total_channels, po.storage_type, &po.bucketdb_options, po.log_level >= LOG_DEBUG ? 1 : 0);
 }
 
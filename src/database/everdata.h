@@ -36,6 +36,9 @@ extern "C" {
 #define MSG_STATUS_WORKER_PENDING  "\x0A\xFE"
 #define MSG_STATUS_WORKER_ERROR    "\x0A\xFF"
 
+/* Answers WORKER_READY with a uint32_t count of broker shards. Requests
+ * come from and replies go to the backend of the shard named by the first
+ * byte of their envelope, see message_shard_endpoint(). */
 #define MSG_STATUS_BROKER_READY "\x0B\x00"
 #define MSG_STATUS_BROKER_ACK   "\x0B\x01"
 #define MSG_STATUS_BROKER_PENDING "\x0B\xFE"
@@ -49,10 +52,73 @@ extern "C" {
 #define MSG_ACTION_PUT "\x02\x01"
 #define MSG_ACTION_GET "\x02\x02"
 #define MSG_ACTION_DEL "\x02\x03"
+/* Multi-object put: key/data frame pairs follow the action frame. The
+ * worker replies MSG_STATUS_WORKER_ACK plus a uint32_t count of objects. */
+#define MSG_ACTION_PUT_BATCH "\x02\x04"
+/* Chunked objects: one message per slice, [action][key][slice_header_t][data].
+ * Each slice is routed on its own so the slices of a big object spread over
+ * all workers. Slice 0 goes where a plain PUT/GET of the key would go and
+ * also stores the object header, which GET_SLICE of slice 0 returns.
+ * Replies repeat the key and slice_header_t frames. */
+#define MSG_ACTION_PUT_SLICE "\x02\x05"
+#define MSG_ACTION_GET_SLICE "\x02\x06"
+/* Deletes go to every bucket. DEL carries [key], DEL_PREFIX [prefix] and
+ * removes all keys starting with it. Each bucket replies with a uint32_t
+ * count of removed slices, the broker sums them up and answers
+ * MSG_STATUS_WORKER_NOTFOUND when nothing was found. */
+#define MSG_ACTION_DEL_PREFIX "\x02\x07"
+/* Key listing: [action][prefix][start_after][scan_request_t]. The reply is
+ * MSG_STATUS_WORKER_ACK, scan_reply_t and total_entries [key][uint64_t size]
+ * frame pairs in key order. A common prefix has size SCAN_PREFIX_SIZE. The
+ * next page starts after the last key while more is set. Every bucket
+ * returns a page and the broker merges them into one. */
+#define MSG_ACTION_SCAN "\x02\x08"
+/* Drops one slice of a chunked object left past its end after it shrank:
+ * [action][key][slice_header_t], routed like PUT_SLICE. object_size is the
+ * new size, the key name kept with the slice's bucket is updated to it. The
+ * reply is a slice status, MSG_STATUS_WORKER_NOTFOUND if it was gone. */
+#define MSG_ACTION_DEL_SLICE "\x02\x09"
+
+#define SCAN_MAX_LIMIT 1000
+#define SCAN_PREFIX_SIZE ((uint64_t)-1)
+
+/* -------- struct scan_request_t -------- */
+typedef struct scan_request_t {
+    uint32_t limit;
+    /* Roll up keys at this character after the prefix, 0 for none. */
+    uint32_t delimiter;
+} scan_request_t;
+
+/* -------- struct scan_reply_t -------- */
+typedef struct scan_reply_t {
+    uint32_t total_entries;
+    uint32_t more;
+} scan_reply_t;
+
+/* -------- struct slice_header_t -------- */
+typedef struct slice_header_t {
+    uint64_t object_size;
+    uint32_t nslices;
+    uint32_t slice_size;
+    uint32_t slice_idx;
+    uint32_t reserved;
+} slice_header_t;
 
 #ifdef __cplusplus
 }
 #endif
 
+#ifdef __cplusplus
+#include "farmhash.h"
+
+/* ================ everdata_key_hash() ================ */
+/* Routing hash of a key, the key_hash of a request_header_t. Slice 0 stays
+ * with the key, the other slices of a chunked object scatter by slice_idx. */
+inline uint32_t everdata_key_hash(const char *key, uint32_t key_len, uint32_t slice_idx)
+{
+    return slice_idx == 0 ? util::Hash32(key, key_len) : util::Hash32WithSeed(key, key_len, slice_idx);
+}
+#endif
+
 #endif /* __EVERDATA_H__ */
 
@@ -0,0 +1,291 @@
+/**
+ * @file   executor.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-21 09:13:30
+ *
+ * @brief  Per bucket storage thread fed by the channels of the bucket.
+ *
+ * Channel threads keep storage writes off their sockets. They push every
+ * write request into an intrusive MPSC queue (Vyukov style: producers swap
+ * the head, the single consumer walks from the tail through a stub node)
+ * without taking a lock. The storage thread drains up to a batch at a time
+ * and hands it to the bucket, which may write consecutive puts in one
+ * transaction. Replies go back over an inproc PUSH socket per channel,
+ * owned by the storage thread.
+ *
+ * The storage thread only sleeps on the condition variable after it
+ * cleared the signaled flag and found the queue still empty, producers
+ * signal only when they are the first to set the flag again.
+ *
+ */
+
+#include <czmq.h>
+#include "common.h"
+#include "zmalloc.h"
+#include "logger.h"
+#include "executor.h"
+
+#define EXECUTOR_BATCH_MAX 64
+
+/* -------- struct executor_t -------- */
+typedef struct executor_t {
+    /* Producers swap head, the storage thread owns tail. */
+    executor_request_t *volatile head;
+    executor_request_t *tail;
+    executor_request_t stub;
+
+    volatile uint32_t total_pending;
+    /* Per channel, see executor_channel_pending(). */
+    volatile uint32_t *channel_pending;
+    volatile int signaled;
+    volatile int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+
+    uint32_t total_channels;
+    zsock_t **reply_socks;
+
+    executor_handler_fn *handler_fn;
+    void *user_data;
+
+    uint64_t total_handled;
+    uint64_t total_batches;
+} executor_t;
+
+/* ================ executor_push() ================ */
+static void executor_push(executor_t *executor, executor_request_t *request)
+{
+    request->next = NULL;
+    executor_request_t *prev = __sync_lock_test_and_set(&executor->head, request);
+    __sync_synchronize();
+    prev->next = request;
+}
+
+/* ================ executor_pop() ================ */
+/* NULL when empty, or while a producer is between its swap and link. */
+static executor_request_t *executor_pop(executor_t *executor)
+{
+    executor_request_t *tail = executor->tail;
+    executor_request_t *next = tail->next;
+
+    if ( tail == &executor->stub ){
+        if ( next == NULL ){
+            return NULL;
+        }
+        executor->tail = next;
+        tail = next;
+        next = next->next;
+    }
+    if ( next != NULL ){
+        executor->tail = next;
+        return tail;
+    }
+    if ( tail != executor->head ){
+        return NULL;
+    }
+
+    executor_push(executor, &executor->stub);
+    next = tail->next;
+    if ( next != NULL ){
+        executor->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+/* ================ executor_wait() ================ */
+/* Returns non-zero when the executor is asked to stop. */
+static int executor_wait(executor_t *executor)
+{
+    __sync_lock_release(&executor->signaled);
+    __sync_synchronize();
+    if ( executor->tail->next != NULL || executor->tail != &executor->stub ){
+        return executor->stop;
+    }
+
+    pthread_mutex_lock(&executor->lock);
+    while ( !executor->signaled && !executor->stop ){
+        pthread_cond_wait(&executor->cond, &executor->lock);
+    }
+    pthread_mutex_unlock(&executor->lock);
+
+    return executor->stop;
+}
+
+/* ================ executor_signal() ================ */
+static void executor_signal(executor_t *executor)
+{
+    if ( __sync_lock_test_and_set(&executor->signaled, 1) == 0 ){
+        pthread_mutex_lock(&executor->lock);
+        pthread_cond_signal(&executor->cond);
+        pthread_mutex_unlock(&executor->lock);
+    }
+}
+
+/* ================ executor_reply_endpoint() ================ */
+void executor_reply_endpoint(executor_t *executor, uint32_t channel_id, char *endpoint, size_t size)
+{
+    snprintf(endpoint, size, "inproc://executor-%p-%d", (void*)executor, channel_id);
+}
+
+/* ================ executor_connect_channels() ================ */
+static void executor_connect_channels(executor_t *executor)
+{
+    for ( uint32_t i = 0 ; i < executor->total_channels ; i++ ){
+        char endpoint[NAME_MAX];
+        executor_reply_endpoint(executor, i, endpoint, NAME_MAX);
+
+        /* inproc allows connecting before the channel binds. Never block
+         * on a channel that went away. */
+        zsock_t *sock = zsock_new(ZMQ_PUSH);
+        zsock_set_sndhwm(sock, 0);
+        zsock_set_sndtimeo(sock, 0);
+        zsock_set_linger(sock, 0);
+        if ( zsock_connect(sock, "%s", endpoint) != 0 ){
+            error_log("Executor connect to channel %d failed. endpoint:%s", i, endpoint);
+        }
+        executor->reply_socks[i] = sock;
+    }
+}
+
+/* ================ executor_thread_main() ================ */
+static void *executor_thread_main(void *user_data)
+{
+    executor_t *executor = (executor_t*)user_data;
+
+    executor_connect_channels(executor);
+
+    executor_request_t *requests[EXECUTOR_BATCH_MAX];
+    while ( 1 ){
+        uint32_t total_requests = 0;
+        while ( total_requests < EXECUTOR_BATCH_MAX ){
+            executor_request_t *request = executor_pop(executor);
+            if ( request == NULL ){
+                break;
+            }
+            request->reply_sock = executor->reply_socks[request->channel_id];
+            requests[total_requests++] = request;
+        }
+
+        if ( total_requests == 0 ){
+            if ( executor_wait(executor) ){
+                break;
+            }
+            continue;
+        }
+
+        executor->handler_fn(executor->user_data, requests, total_requests);
+        executor->total_handled += total_requests;
+        executor->total_batches++;
+
+        for ( uint32_t i = 0 ; i < total_requests ; i++ ){
+            __sync_sub_and_fetch(&executor->channel_pending[requests[i]->channel_id], 1);
+            zmsg_destroy(&requests[i]->msg);
+            zfree(requests[i]);
+        }
+        __sync_sub_and_fetch(&executor->total_pending, total_requests);
+
+        if ( executor->stop ){
+            break;
+        }
+    }
+
+    for ( uint32_t i = 0 ; i < executor->total_channels ; i++ ){
+        zsock_destroy(&executor->reply_socks[i]);
+    }
+
+    return NULL;
+}
+
+/* ================ executor_new() ================ */
+executor_t *executor_new(uint32_t total_channels, executor_handler_fn *handler_fn, void *user_data)
+{
+    executor_t *executor = (executor_t*)zmalloc(sizeof(executor_t));
+    memset(executor, 0, sizeof(executor_t));
+
+    executor->head = &executor->stub;
+    executor->tail = &executor->stub;
+
+    executor->total_channels = total_channels;
+    executor->reply_socks = (zsock_t**)zmalloc(sizeof(zsock_t*) * total_channels);
+    memset(executor->reply_socks, 0, sizeof(zsock_t*) * total_channels);
+    executor->channel_pending = (volatile uint32_t*)zmalloc(sizeof(uint32_t) * total_channels);
+    memset((void*)executor->channel_pending, 0, sizeof(uint32_t) * total_channels);
+
+    executor->handler_fn = handler_fn;
+    executor->user_data = user_data;
+
+    pthread_mutex_init(&executor->lock, NULL);
+    pthread_cond_init(&executor->cond, NULL);
+
+    if ( pthread_create(&executor->thread, NULL, executor_thread_main, executor) != 0 ){
+        error_log("Start storage executor failed.");
+        pthread_cond_destroy(&executor->cond);
+        pthread_mutex_destroy(&executor->lock);
+        zfree((void*)executor->channel_pending);
+        zfree(executor->reply_socks);
+        zfree(executor);
+        return NULL;
+    }
+
+    return executor;
+}
+
+/* ================ executor_free() ================ */
+void executor_free(executor_t *executor)
+{
+    pthread_mutex_lock(&executor->lock);
+    executor->stop = 1;
+    pthread_cond_broadcast(&executor->cond);
+    pthread_mutex_unlock(&executor->lock);
+
+    pthread_join(executor->thread, NULL);
+
+    uint32_t total_dropped = 0;
+    executor_request_t *request = NULL;
+    while ( (request = executor_pop(executor)) != NULL ){
+        zmsg_destroy(&request->msg);
+        zfree(request);
+        total_dropped++;
+    }
+
+    notice_log("Storage executor handled %llu requests in %llu batches, dropped %d.",
+            (unsigned long long)executor->total_handled, (unsigned long long)executor->total_batches, total_dropped);
+
+    pthread_cond_destroy(&executor->cond);
+    pthread_mutex_destroy(&executor->lock);
+    zfree((void*)executor->channel_pending);
+    zfree(executor->reply_socks);
+    zfree(executor);
+}
+
+/* ================ executor_submit() ================ */
+void executor_submit(executor_t *executor, uint32_t channel_id, zmsg_t *msg)
+{
+    assert(channel_id < executor->total_channels);
+
+    executor_request_t *request = (executor_request_t*)zmalloc(sizeof(executor_request_t));
+    request->msg = msg;
+    request->channel_id = channel_id;
+    request->reply_sock = NULL;
+
+    __sync_add_and_fetch(&executor->total_pending, 1);
+    __sync_add_and_fetch(&executor->channel_pending[channel_id], 1);
+    executor_push(executor, request);
+    executor_signal(executor);
+}
+
+/* ================ executor_pending() ================ */
+uint32_t executor_pending(executor_t *executor)
+{
+    return executor->total_pending;
+}
+
+/* ================ executor_channel_pending() ================ */
+uint32_t executor_channel_pending(executor_t *executor, uint32_t channel_id)
+{
+    return executor->channel_pending[channel_id];
+}
+
@@ -0,0 +1,59 @@
+/**
+ * @file   executor.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-21 09:12:47
+ *
+ * @brief  Per bucket storage thread fed by the channels of the bucket.
+ *
+ *
+ */
+
+#ifndef __EXECUTOR_H__
+#define __EXECUTOR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct _zsock_t zsock_t;
+typedef struct _zmsg_t zmsg_t;
+typedef struct executor_t executor_t;
+
+/* -------- struct executor_request_t -------- */
+typedef struct executor_request_t {
+    struct executor_request_t *volatile next;
+    /* Still wrapped in the broker envelope. */
+    zmsg_t *msg;
+    uint32_t channel_id;
+    /* Set by the storage thread, the replies to msg go here. */
+    zsock_t *reply_sock;
+} executor_request_t;
+
+/* Runs on the storage thread with up to a batch of requests in arrival
+ * order. It owns every request->msg and must leave NULL behind. */
+typedef void (executor_handler_fn)(void *user_data, executor_request_t **requests, uint32_t total_requests);
+
+executor_t *executor_new(uint32_t total_channels, executor_handler_fn *handler_fn, void *user_data);
+/* Stops the storage thread, requests still queued are dropped. */
+void executor_free(executor_t *executor);
+
+/* The channel binds a PULL socket here and forwards what arrives on it to
+ * the broker. */
+void executor_reply_endpoint(executor_t *executor, uint32_t channel_id, char *endpoint, size_t size);
+/* Queue msg for the storage thread and take it over. Called by any channel
+ * thread, never blocks. */
+void executor_submit(executor_t *executor, uint32_t channel_id, zmsg_t *msg);
+/* Requests submitted and not handled yet. */
+uint32_t executor_pending(executor_t *executor);
+/* Same for the requests of one channel, they are handled in order. */
+uint32_t executor_channel_pending(executor_t *executor, uint32_t channel_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __EXECUTOR_H__
+
@@ -0,0 +1,197 @@
+/**
+ * @file   hashring.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-17 09:42:03
+ *
+ * @brief  Consistent hash ring with virtual nodes.
+ *
+ * Every node owns total_vnodes points on a 32 bit ring, so adding or
+ * removing one of N nodes only moves about 1/N of the keys. The points
+ * are kept in one sorted vector which is rebuilt on membership changes,
+ * those are rare compared to lookups.
+ *
+ */
+
+#include "hashring.h"
+#include "farmhash.h"
+#include <stdlib.h>
+#include <memory.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+/* -------- struct ring_point_t -------- */
+typedef struct ring_point_t {
+    uint32_t hash;
+    uint64_t node_id;
+    void *data;
+
+    bool operator < (const ring_point_t &other) const {
+        if ( hash != other.hash ) return hash < other.hash;
+        return node_id < other.node_id;
+    }
+} ring_point_t;
+
+/* -------- struct hashring_t -------- */
+typedef struct hashring_t {
+    uint32_t total_vnodes;
+
+    typedef std::map<uint64_t, void*> NodeMap;
+    NodeMap *nodes;
+
+    std::vector<ring_point_t> *points;
+} hashring_t;
+
+/* ================ hashring_rebuild() ================ */
+static void hashring_rebuild(hashring_t *hashring)
+{
+    std::vector<ring_point_t> &points = *hashring->points;
+    points.clear();
+    points.reserve(hashring->nodes->size() * hashring->total_vnodes);
+
+    hashring_t::NodeMap::iterator it;
+    for ( it = hashring->nodes->begin() ; it != hashring->nodes->end() ; ++it ){
+        for ( uint32_t vnode = 0 ; vnode < hashring->total_vnodes ; vnode++ ){
+            struct {
+                uint64_t node_id;
+                uint32_t vnode;
+            } __attribute__((packed)) seed = {it->first, vnode};
+
+            ring_point_t point;
+            point.hash = util::Hash32((const char *)&seed, sizeof(seed));
+            point.node_id = it->first;
+            point.data = it->second;
+            points.push_back(point);
+        }
+    }
+
+    std::sort(points.begin(), points.end());
+}
+
+/* ================ hashring_new() ================ */
+hashring_t *hashring_new(uint32_t total_vnodes)
+{
+    hashring_t *hashring = (hashring_t*)malloc(sizeof(hashring_t));
+    memset(hashring, 0, sizeof(hashring_t));
+
+    hashring->total_vnodes = total_vnodes > 0 ? total_vnodes : 1;
+    hashring->nodes = new hashring_t::NodeMap();
+    hashring->points = new std::vector<ring_point_t>();
+
+    return hashring;
+}
+
+/* ================ hashring_free() ================ */
+void hashring_free(hashring_t *hashring)
+{
+    delete hashring->points;
+    delete hashring->nodes;
+    free(hashring);
+}
+
+/* ================ hashring_add() ================ */
+void hashring_add(hashring_t *hashring, uint64_t node_id, void *data)
+{
+    (*hashring->nodes)[node_id] = data;
+    hashring_rebuild(hashring);
+}
+
+/* ================ hashring_add_many() ================ */
+void hashring_add_many(hashring_t *hashring, const uint64_t *node_ids, void **datas, uint32_t total_nodes)
+{
+    for ( uint32_t i = 0 ; i < total_nodes ; i++ ){
+        (*hashring->nodes)[node_ids[i]] = datas[i];
+    }
+    hashring_rebuild(hashring);
+}
+
+/* ================ hashring_remove() ================ */
+void hashring_remove(hashring_t *hashring, uint64_t node_id)
+{
+    if ( hashring->nodes->erase(node_id) > 0 ){
+        hashring_rebuild(hashring);
+    }
+}
+
+/* ================ hashring_size() ================ */
+uint32_t hashring_size(hashring_t *hashring)
+{
+    return hashring->nodes->size();
+}
+
+/* ================ hashring_lookup() ================ */
+void *hashring_lookup(hashring_t *hashring, uint32_t hash)
+{
+    std::vector<ring_point_t> &points = *hashring->points;
+    if ( points.empty() ){
+        return NULL;
+    }
+
+    ring_point_t key;
+    key.hash = hash;
+    key.node_id = 0;
+    key.data = NULL;
+
+    std::vector<ring_point_t>::iterator it = std::lower_bound(points.begin(), points.end(), key);
+    if ( it == points.end() ){
+        it = points.begin();
+    }
+
+    return it->data;
+}
+
+/* ================ hashring_lookup_n() ================ */
+uint32_t hashring_lookup_n(hashring_t *hashring, uint32_t hash, uint64_t group_mask, void **datas, uint32_t total_nodes)
+{
+    std::vector<ring_point_t> &points = *hashring->points;
+    if ( points.empty() || total_nodes == 0 ){
+        return 0;
+    }
+    if ( total_nodes > hashring->nodes->size() ){
+        total_nodes = hashring->nodes->size();
+    }
+
+    ring_point_t key;
+    key.hash = hash;
+    key.node_id = 0;
+    key.data = NULL;
+
+    size_t start = std::lower_bound(points.begin(), points.end(), key) - points.begin();
+    size_t total_points = points.size();
+
+    /* One lap at most, and none of it once every node was seen, no new
+     * group can show up after that. A node of a group taken already is
+     * kept in ring order for when there are not enough groups. */
+    size_t total_node_ids = hashring->nodes->size();
+    std::vector<uint64_t> seen;
+    std::vector<uint64_t> chosen;
+    std::vector<const ring_point_t*> spares;
+    for ( size_t n = 0 ; n < total_points && chosen.size() < total_nodes && seen.size() < total_node_ids ; n++ ){
+        const ring_point_t &point = points[(start + n) % total_points];
+        if ( std::find(seen.begin(), seen.end(), point.node_id) != seen.end() ){
+            continue;
+        }
+        seen.push_back(point.node_id);
+
+        bool is_new = true;
+        for ( size_t i = 0 ; i < chosen.size() ; i++ ){
+            if ( (chosen[i] & group_mask) == (point.node_id & group_mask) ){
+                is_new = false;
+                break;
+            }
+        }
+        if ( is_new ){
+            datas[chosen.size()] = point.data;
+            chosen.push_back(point.node_id);
+        } else {
+            spares.push_back(&point);
+        }
+    }
+    for ( size_t i = 0 ; i < spares.size() && chosen.size() < total_nodes ; i++ ){
+        datas[chosen.size()] = spares[i]->data;
+        chosen.push_back(spares[i]->node_id);
+    }
+
+    return chosen.size();
+}
+
@@ -0,0 +1,48 @@
+/**
+ * @file   hashring.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-17 09:41:26
+ *
+ * @brief  Consistent hash ring with virtual nodes.
+ *
+ *
+ */
+
+#ifndef __HASHRING_H__
+#define __HASHRING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct hashring_t hashring_t;
+
+hashring_t *hashring_new(uint32_t total_vnodes);
+void hashring_free(hashring_t *hashring);
+
+/* node_id must be stable across restarts, the ring positions of a node
+ * only depend on it. Adding an existing node_id replaces its data. */
+void hashring_add(hashring_t *hashring, uint64_t node_id, void *data);
+/* Same as hashring_add() for each node, the ring is rebuilt once. */
+void hashring_add_many(hashring_t *hashring, const uint64_t *node_ids, void **datas, uint32_t total_nodes);
+void hashring_remove(hashring_t *hashring, uint64_t node_id);
+uint32_t hashring_size(hashring_t *hashring);
+
+/* Data of the first node clockwise from hash, NULL for an empty ring. */
+void *hashring_lookup(hashring_t *hashring, uint32_t hash);
+
+/* Walk clockwise from hash and collect up to total_nodes distinct nodes,
+ * like a CRUSH "choose firstn". Nodes whose ids differ under group_mask
+ * (e.g. the datanode part of the id) are taken first, the ring is then
+ * walked again for any distinct node if there are not enough groups.
+ * Returns the count stored into datas. */
+uint32_t hashring_lookup_n(hashring_t *hashring, uint32_t hash, uint64_t group_mask, void **datas, uint32_t total_nodes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __HASHRING_H__
+
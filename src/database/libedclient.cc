@@ -0,0 +1,811 @@
+/**
+ * @file   libedclient.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-24 09:41:05
+ *
+ * @brief  Asynchronous everdata client library.
+ *
+ * Callers build the request message on their own thread and queue the
+ * future under a short lock, waking the I/O thread through a pipe only
+ * when the queue was empty. The I/O thread owns everything zmq: it puts a
+ * request id in front of the empty delimiter, which the broker hands back
+ * in the reply, so any number of requests share one connection and
+ * replies may come back in any order. Requests go out in the binary
+ * format, the header repeats the id for the workers' logs and carries the
+ * key hash the broker routes on. Attempt timeouts and retry backoff
+ * run on a timer wheel. A reply for an attempt given up on still finishes
+ * the future, unless the retry is already on its way.
+ *
+ */
+
+#include <czmq.h>
+#include <fcntl.h>
+#include "common.h"
+#include "everdata.h"
+#include "message.h"
+#include "cboost.h"
+#include "timerwheel.h"
+#include "libedclient.h"
+
+/* Resolution of the attempt timeouts. */
+#define EDC_TICK 10
+#define EDC_BACKOFF_MAX 10000
+
+enum {
+    EDC_OP_PUT = 0,
+    EDC_OP_GET,
+    EDC_OP_DEL,
+    EDC_OP_SCAN,
+    EDC_OP_PUT_SLICE,
+    EDC_OP_GET_SLICE,
+    EDC_OP_DEL_SLICE,
+};
+
+enum {
+    /* In the submit or send queue. */
+    FUTURE_QUEUED = 0,
+    FUTURE_INFLIGHT,
+    /* Waiting for the next attempt. */
+    FUTURE_BACKOFF,
+    FUTURE_DONE,
+};
+
+/* -------- struct edc_future_t -------- */
+typedef struct edc_future_t {
+    struct edc_future_t *next;
+    edc_t *edc;
+    int op;
+    int state;
+    uint32_t id;
+    uint32_t attempts;
+    /* Kept for the retries, every attempt sends a copy. */
+    zmsg_t *request;
+    timerwheel_timer_t timer;
+
+    edc_callback_fn *callback;
+    void *user_data;
+
+    /* The caller and the I/O thread. */
+    volatile uint32_t refs;
+    volatile int done;
+    pthread_cond_t cond;
+
+    int status;
+    zmsg_t *reply;
+    zframe_t *frame_data;
+    zframe_t *frame_slice_header;
+    uint32_t total_entries;
+    int more;
+    zframe_t **scan_keys;
+    uint64_t *scan_sizes;
+} edc_future_t;
+
+/* -------- struct edc_t -------- */
+typedef struct edc_t {
+    char *endpoint;
+    edc_options_t options;
+
+    pthread_t thread;
+    volatile int stop;
+    /* Guards the submit queue, stop and the done flag of futures. */
+    pthread_mutex_t lock;
+    edc_future_t *submit_head;
+    edc_future_t *submit_tail;
+    int wakeup_fds[2];
+
+    /* Owned by the I/O thread. */
+    zsock_t **connections;
+    uint32_t next_connection;
+    edc_future_t *send_head;
+    edc_future_t *send_tail;
+    uint32_t total_inflight;
+    uint32_t next_id;
+    /* Futures with an id, until they are done. */
+    g_intmap_t *requests;
+    timerwheel_t *timers;
+} edc_t;
+
+/* ================ edc_options_init() ================ */
+void edc_options_init(edc_options_t *options)
+{
+    options->total_connections = 4;
+    options->max_inflight = 4096;
+    options->timeout = HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS;
+    options->retries = 3;
+    options->backoff = 100;
+}
+
+/* ================ edc_future_new() ================ */
+static edc_future_t *edc_future_new(edc_t *edc, int op, zmsg_t *request, edc_callback_fn *callback, void *user_data)
+{
+    edc_future_t *future = (edc_future_t*)malloc(sizeof(edc_future_t));
+    memset(future, 0, sizeof(edc_future_t));
+
+    future->edc = edc;
+    future->op = op;
+    future->state = FUTURE_QUEUED;
+    future->request = request;
+    future->callback = callback;
+    future->user_data = user_data;
+    future->refs = 2;
+    pthread_cond_init(&future->cond, NULL);
+
+    return future;
+}
+
+/* ================ edc_future_release() ================ */
+static void edc_future_release(edc_future_t *future)
+{
+    if ( __sync_sub_and_fetch(&future->refs, 1) > 0 ){
+        return;
+    }
+
+    if ( future->request != NULL ){
+        zmsg_destroy(&future->request);
+    }
+    if ( future->reply != NULL ){
+        zmsg_destroy(&future->reply);
+    }
+    if ( future->scan_keys != NULL ){
+        free(future->scan_keys);
+        free(future->scan_sizes);
+    }
+    pthread_cond_destroy(&future->cond);
+    free(future);
+}
+
+/* ================ edc_future_parse_scan() ================ */
+/* [msgtype][status][scan_reply_t] and total_entries [key][uint64_t size]. */
+static int edc_future_parse_scan(edc_future_t *future)
+{
+    zmsg_t *reply = future->reply;
+    if ( zmsg_size(reply) < 3 ){
+        return -1;
+    }
+    zmsg_first(reply);
+    zmsg_next(reply);
+    zframe_t *frame_scan = zmsg_next(reply);
+    if ( zframe_size(frame_scan) != sizeof(scan_reply_t) ){
+        return -1;
+    }
+    scan_reply_t scan_reply = *(scan_reply_t*)zframe_data(frame_scan);
+    if ( zmsg_size(reply) < 3 + scan_reply.total_entries * 2 ){
+        return -1;
+    }
+
+    future->total_entries = scan_reply.total_entries;
+    future->more = scan_reply.more && scan_reply.total_entries > 0;
+    future->scan_keys = (zframe_t**)malloc(sizeof(zframe_t*) * (scan_reply.total_entries + 1));
+    future->scan_sizes = (uint64_t*)malloc(sizeof(uint64_t) * (scan_reply.total_entries + 1));
+    for ( uint32_t i = 0 ; i < scan_reply.total_entries ; i++ ){
+        zframe_t *frame_key = zmsg_next(reply);
+        zframe_t *frame_size = zmsg_next(reply);
+        future->scan_keys[i] = frame_key;
+        future->scan_sizes[i] = zframe_size(frame_size) == sizeof(uint64_t) ? *(uint64_t*)zframe_data(frame_size) : 0;
+    }
+
+    return 0;
+}
+
+/* ================ edc_reply_status() ================ */
+static int edc_reply_status(edc_future_t *future, zmsg_t *reply)
+{
+    zframe_t *frame_msgtype = zmsg_first(reply);
+    if ( frame_msgtype != NULL && zframe_size(frame_msgtype) == sizeof(int16_t) &&
+            *(int16_t*)zframe_data(frame_msgtype) == MSGTYPE_DATA ){
+        return future->op == EDC_OP_GET || future->op == EDC_OP_GET_SLICE ? EDC_OK : EDC_ERROR;
+    }
+    if ( message_check_status(reply, MSG_STATUS_WORKER_ACK) == 0 ){
+        return EDC_OK;
+    }
+    if ( message_check_status(reply, MSG_STATUS_WORKER_NOTFOUND) == 0 ){
+        return EDC_NOTFOUND;
+    }
+    return EDC_ERROR;
+}
+
+/* ================ edc_future_complete() ================ */
+/* Takes reply, which may be NULL. */
+static void edc_future_complete(edc_future_t *future, int status, zmsg_t *reply)
+{
+    edc_t *edc = future->edc;
+
+    if ( future->state == FUTURE_INFLIGHT ){
+        edc->total_inflight--;
+    }
+    if ( edc->timers != NULL ){
+        timerwheel_remove(edc->timers, &future->timer);
+    }
+    if ( future->id != 0 && edc->requests != NULL ){
+        g_iterator_t *it = g_intmap_find(edc->requests, (int)future->id);
+        g_iterator_t *itend = g_intmap_end(edc->requests);
+        if ( g_iterator_compare(it, itend) != 0 ){
+            g_intmap_erase(edc->requests, it);
+        }
+        g_iterator_free(it);
+        g_iterator_free(itend);
+    }
+    future->state = FUTURE_DONE;
+    if ( future->request != NULL ){
+        zmsg_destroy(&future->request);
+    }
+
+    future->status = status;
+    future->reply = reply;
+    if ( status == EDC_OK && reply != NULL ){
+        if ( future->op == EDC_OP_GET ){
+            /* [msgtype][key][data] */
+            zmsg_first(reply);
+            zmsg_next(reply);
+            future->frame_data = zmsg_next(reply);
+            if ( future->frame_data == NULL ){
+                future->status = EDC_ERROR;
+            }
+        } else if ( future->op == EDC_OP_GET_SLICE ){
+            /* [msgtype][key][slice_header_t][data] */
+            zmsg_first(reply);
+            zmsg_next(reply);
+            future->frame_slice_header = zmsg_next(reply);
+            future->frame_data = zmsg_next(reply);
+            if ( future->frame_data == NULL || zframe_size(future->frame_slice_header) != sizeof(slice_header_t) ){
+                future->frame_slice_header = NULL;
+                future->frame_data = NULL;
+                future->status = EDC_ERROR;
+            }
+        } else if ( future->op == EDC_OP_SCAN ){
+            if ( edc_future_parse_scan(future) != 0 ){
+                future->status = EDC_ERROR;
+            }
+        }
+    }
+
+    if ( future->callback != NULL ){
+        future->callback(future, future->user_data);
+    }
+
+    pthread_mutex_lock(&edc->lock);
+    future->done = 1;
+    pthread_cond_broadcast(&future->cond);
+    pthread_mutex_unlock(&edc->lock);
+
+    edc_future_release(future);
+}
+
+/* ================ edc_send_queue_push() ================ */
+static void edc_send_queue_push(edc_t *edc, edc_future_t *future)
+{
+    future->next = NULL;
+    future->state = FUTURE_QUEUED;
+    if ( edc->send_tail != NULL ){
+        edc->send_tail->next = future;
+    } else {
+        edc->send_head = future;
+    }
+    edc->send_tail = future;
+}
+
+static void handle_future_timer(void *user_data, timerwheel_timer_t *timer);
+
+/* ================ edc_send_request() ================ */
+/* [request id][empty][request...] on the next connection. */
+static void edc_send_request(edc_t *edc, edc_future_t *future)
+{
+    if ( future->id == 0 ){
+        if ( ++edc->next_id == 0 ){
+            edc->next_id = 1;
+        }
+        future->id = edc->next_id;
+        g_intmap_insert(edc->requests, (int)future->id, future);
+
+        zframe_t *frame_header = zmsg_first(future->request);
+        if ( message_request_header(frame_header) != NULL ){
+            ((request_header_t*)zframe_data(frame_header))->request_id = future->id;
+        }
+    }
+
+    zmsg_t *msg = zmsg_dup(future->request);
+    zmsg_pushmem(msg, "", 0);
+    zmsg_pushmem(msg, &future->id, sizeof(uint32_t));
+
+    zsock_t *sock = edc->connections[edc->next_connection++ % edc->options.total_connections];
+    zmsg_send(&msg, sock);
+
+    future->attempts++;
+    future->state = FUTURE_INFLIGHT;
+    edc->total_inflight++;
+    timerwheel_add(edc->timers, &future->timer, zclock_time() + edc->options.timeout, handle_future_timer, future);
+}
+
+/* ================ edc_retry_or_fail() ================ */
+/* An attempt timed out or failed, reply is its error reply if any. */
+static void edc_retry_or_fail(edc_t *edc, edc_future_t *future, int status, zmsg_t *reply)
+{
+    if ( future->attempts > edc->options.retries || edc->stop ){
+        edc_future_complete(future, status, reply);
+        return;
+    }
+    if ( reply != NULL ){
+        zmsg_destroy(&reply);
+    }
+
+    edc->total_inflight--;
+    future->state = FUTURE_BACKOFF;
+
+    uint64_t backoff = (uint64_t)edc->options.backoff << (future->attempts - 1);
+    if ( backoff > EDC_BACKOFF_MAX ){
+        backoff = EDC_BACKOFF_MAX;
+    }
+    timerwheel_add(edc->timers, &future->timer, zclock_time() + backoff, handle_future_timer, future);
+}
+
+/* ================ handle_future_timer() ================ */
+static void handle_future_timer(void *user_data, timerwheel_timer_t *timer)
+{
+    edc_future_t *future = (edc_future_t*)user_data;
+    edc_t *edc = future->edc;
+
+    if ( future->state == FUTURE_INFLIGHT ){
+        edc_retry_or_fail(edc, future, EDC_TIMEOUT, NULL);
+    } else if ( future->state == FUTURE_BACKOFF ){
+        edc_send_queue_push(edc, future);
+    }
+}
+
+/* ================ edc_handle_reply() ================ */
+static void edc_handle_reply(edc_t *edc, zmsg_t *msg)
+{
+    zframe_t *frame_id = zmsg_pop(msg);
+    zframe_t *frame_empty = zmsg_pop(msg);
+    if ( frame_id == NULL || frame_empty == NULL || zframe_size(frame_id) != sizeof(uint32_t) ){
+        zframe_destroy(&frame_id);
+        zframe_destroy(&frame_empty);
+        zmsg_destroy(&msg);
+        return;
+    }
+    uint32_t id = *(uint32_t*)zframe_data(frame_id);
+    zframe_destroy(&frame_id);
+    zframe_destroy(&frame_empty);
+
+    edc_future_t *future = NULL;
+    g_iterator_t *it = g_intmap_find(edc->requests, (int)id);
+    g_iterator_t *itend = g_intmap_end(edc->requests);
+    if ( g_iterator_compare(it, itend) != 0 ){
+        future = (edc_future_t*)g_iterator_get(it);
+    }
+    g_iterator_free(it);
+    g_iterator_free(itend);
+
+    /* Late, or its retry is queued already. */
+    if ( future == NULL || future->state == FUTURE_QUEUED ){
+        zmsg_destroy(&msg);
+        return;
+    }
+
+    int status = edc_reply_status(future, msg);
+    if ( status == EDC_ERROR && future->state == FUTURE_BACKOFF ){
+        /* An earlier attempt failing late, the retry decides. */
+        zmsg_destroy(&msg);
+    } else if ( status == EDC_ERROR ){
+        edc_retry_or_fail(edc, future, status, msg);
+    } else {
+        edc_future_complete(future, status, msg);
+    }
+}
+
+/* ================ edc_take_submitted() ================ */
+static void edc_take_submitted(edc_t *edc)
+{
+    char buf[64];
+    while ( read(edc->wakeup_fds[0], buf, sizeof(buf)) > 0 );
+
+    pthread_mutex_lock(&edc->lock);
+    edc_future_t *head = edc->submit_head;
+    edc_future_t *tail = edc->submit_tail;
+    edc->submit_head = NULL;
+    edc->submit_tail = NULL;
+    pthread_mutex_unlock(&edc->lock);
+
+    if ( head == NULL ) return;
+    if ( edc->send_tail != NULL ){
+        edc->send_tail->next = head;
+    } else {
+        edc->send_head = head;
+    }
+    edc->send_tail = tail;
+}
+
+/* ================ edc_send_queued() ================ */
+static void edc_send_queued(edc_t *edc)
+{
+    while ( edc->send_head != NULL && edc->total_inflight < edc->options.max_inflight ){
+        edc_future_t *future = edc->send_head;
+        edc->send_head = future->next;
+        if ( edc->send_head == NULL ){
+            edc->send_tail = NULL;
+        }
+        future->next = NULL;
+        edc_send_request(edc, future);
+    }
+}
+
+/* ================ edc_close_all() ================ */
+/* On the way out of the I/O thread. */
+static void edc_close_all(edc_t *edc)
+{
+    edc_take_submitted(edc);
+    while ( edc->send_head != NULL ){
+        edc_future_t *future = edc->send_head;
+        edc->send_head = future->next;
+        edc_future_complete(future, EDC_CLOSED, NULL);
+    }
+    edc->send_tail = NULL;
+
+    while ( g_intmap_size(edc->requests) > 0 ){
+        g_iterator_t *it = g_intmap_begin(edc->requests);
+        edc_future_t *future = (edc_future_t*)g_iterator_get(it);
+        g_iterator_free(it);
+        edc_future_complete(future, EDC_CLOSED, NULL);
+    }
+}
+
+/* ================ edc_thread_main() ================ */
+static void *edc_thread_main(void *user_data)
+{
+    edc_t *edc = (edc_t*)user_data;
+    uint32_t total_connections = edc->options.total_connections;
+
+    edc->requests = g_intmap_new();
+    edc->timers = timerwheel_new(EDC_TICK, zclock_time());
+    edc->connections = (zsock_t**)malloc(sizeof(zsock_t*) * total_connections);
+    zmq_pollitem_t *items = (zmq_pollitem_t*)malloc(sizeof(zmq_pollitem_t) * (total_connections + 1));
+    memset(items, 0, sizeof(zmq_pollitem_t) * (total_connections + 1));
+    for ( uint32_t i = 0 ; i < total_connections ; i++ ){
+        zsock_t *sock = zsock_new(ZMQ_DEALER);
+        zsock_set_sndhwm(sock, 0);
+        zsock_set_rcvhwm(sock, 0);
+        zsock_set_linger(sock, 0);
+        zsock_connect(sock, "%s", edc->endpoint);
+        edc->connections[i] = sock;
+        items[i].socket = zsock_resolve(sock);
+        items[i].events = ZMQ_POLLIN;
+    }
+    items[total_connections].fd = edc->wakeup_fds[0];
+    items[total_connections].events = ZMQ_POLLIN;
+
+    while ( !edc->stop ){
+        edc_send_queued(edc);
+
+        long timeout = timerwheel_size(edc->timers) > 0 ? EDC_TICK : -1;
+        int rc = zmq_poll(items, total_connections + 1, timeout);
+        if ( rc < 0 ){
+            if ( errno == EINTR ) continue;
+            break;
+        }
+
+        for ( uint32_t i = 0 ; i < total_connections ; i++ ){
+            if ( (items[i].revents & ZMQ_POLLIN) == 0 ) continue;
+            while ( zsock_events(edc->connections[i]) & ZMQ_POLLIN ){
+                zmsg_t *msg = zmsg_recv(edc->connections[i]);
+                if ( msg == NULL ) break;
+                edc_handle_reply(edc, msg);
+            }
+        }
+        if ( items[total_connections].revents & ZMQ_POLLIN ){
+            edc_take_submitted(edc);
+        }
+
+        timerwheel_advance(edc->timers, zclock_time());
+    }
+
+    edc_close_all(edc);
+
+    for ( uint32_t i = 0 ; i < total_connections ; i++ ){
+        zsock_destroy(&edc->connections[i]);
+    }
+    free(edc->connections);
+    edc->connections = NULL;
+    free(items);
+    timerwheel_free(edc->timers);
+    edc->timers = NULL;
+    g_intmap_free(edc->requests);
+    edc->requests = NULL;
+
+    return NULL;
+}
+
+/* ================ edc_new() ================ */
+edc_t *edc_new(const char *endpoint, const edc_options_t *options)
+{
+    edc_t *edc = (edc_t*)malloc(sizeof(edc_t));
+    memset(edc, 0, sizeof(edc_t));
+
+    edc->endpoint = strdup(endpoint);
+    edc_options_init(&edc->options);
+    if ( options != NULL ){
+        edc->options = *options;
+    }
+    if ( edc->options.total_connections == 0 ) edc->options.total_connections = 1;
+    if ( edc->options.max_inflight == 0 ) edc->options.max_inflight = 1;
+
+    pthread_mutex_init(&edc->lock, NULL);
+    if ( pipe(edc->wakeup_fds) != 0 ){
+        pthread_mutex_destroy(&edc->lock);
+        free(edc->endpoint);
+        free(edc);
+        return NULL;
+    }
+    fcntl(edc->wakeup_fds[0], F_SETFL, fcntl(edc->wakeup_fds[0], F_GETFL) | O_NONBLOCK);
+
+    if ( pthread_create(&edc->thread, NULL, edc_thread_main, edc) != 0 ){
+        close(edc->wakeup_fds[0]);
+        close(edc->wakeup_fds[1]);
+        pthread_mutex_destroy(&edc->lock);
+        free(edc->endpoint);
+        free(edc);
+        return NULL;
+    }
+
+    return edc;
+}
+
+/* ================ edc_wakeup() ================ */
+static void edc_wakeup(edc_t *edc)
+{
+    if ( write(edc->wakeup_fds[1], "", 1) < 0 ){
+        /* The pipe is full, the I/O thread is awake anyway. */
+    }
+}
+
+/* ================ edc_free() ================ */
+void edc_free(edc_t *edc)
+{
+    pthread_mutex_lock(&edc->lock);
+    edc->stop = 1;
+    pthread_mutex_unlock(&edc->lock);
+    edc_wakeup(edc);
+
+    pthread_join(edc->thread, NULL);
+
+    close(edc->wakeup_fds[0]);
+    close(edc->wakeup_fds[1]);
+    pthread_mutex_destroy(&edc->lock);
+    free(edc->endpoint);
+    free(edc);
+}
+
+/* ================ edc_submit() ================ */
+static edc_future_t *edc_submit(edc_t *edc, int op, zmsg_t *request, edc_callback_fn *callback, void *user_data)
+{
+    edc_future_t *future = edc_future_new(edc, op, request, callback, user_data);
+
+    pthread_mutex_lock(&edc->lock);
+    int stopped = edc->stop;
+    int was_empty = edc->submit_head == NULL;
+    if ( !stopped ){
+        if ( edc->submit_tail != NULL ){
+            edc->submit_tail->next = future;
+        } else {
+            edc->submit_head = future;
+        }
+        edc->submit_tail = future;
+    }
+    pthread_mutex_unlock(&edc->lock);
+
+    if ( stopped ){
+        edc_future_complete(future, EDC_CLOSED, NULL);
+    } else if ( was_empty ){
+        edc_wakeup(edc);
+    }
+
+    return future;
+}
+
+/* ================ edc_put() ================ */
+edc_future_t *edc_put(edc_t *edc, const char *key, const void *data, uint32_t data_size, edc_callback_fn *callback, void *user_data)
+{
+    uint32_t key_len = strlen(key);
+    zmsg_t *request = create_request_message(MSG_ACTION_PUT, 0, everdata_key_hash(key, key_len, 0), key, key_len, data_size);
+    zmsg_addmem(request, data, data_size);
+
+    return edc_submit(edc, EDC_OP_PUT, request, callback, user_data);
+}
+
+/* ================ edc_get() ================ */
+edc_future_t *edc_get(edc_t *edc, const char *key, edc_callback_fn *callback, void *user_data)
+{
+    uint32_t key_len = strlen(key);
+    zmsg_t *request = create_request_message(MSG_ACTION_GET, 0, everdata_key_hash(key, key_len, 0), key, key_len, 0);
+
+    return edc_submit(edc, EDC_OP_GET, request, callback, user_data);
+}
+
+/* ================ edc_del() ================ */
+edc_future_t *edc_del(edc_t *edc, const char *key, edc_callback_fn *callback, void *user_data)
+{
+    uint32_t key_len = strlen(key);
+    zmsg_t *request = create_request_message(MSG_ACTION_DEL, 0, everdata_key_hash(key, key_len, 0), key, key_len, 0);
+
+    return edc_submit(edc, EDC_OP_DEL, request, callback, user_data);
+}
+
+/* ================ edc_put_slice() ================ */
+edc_future_t *edc_put_slice(edc_t *edc, const char *key, const slice_header_t *slice_header, const void *data, uint32_t data_size, edc_callback_fn *callback, void *user_data)
+{
+    uint32_t key_len = strlen(key);
+    zmsg_t *request = create_request_message(MSG_ACTION_PUT_SLICE, 0, everdata_key_hash(key, key_len, slice_header->slice_idx), key, key_len, data_size);
+    zmsg_addmem(request, slice_header, sizeof(slice_header_t));
+    zmsg_addmem(request, data, data_size);
+
+    return edc_submit(edc, EDC_OP_PUT_SLICE, request, callback, user_data);
+}
+
+/* ================ edc_get_slice() ================ */
+edc_future_t *edc_get_slice(edc_t *edc, const char *key, uint32_t slice_idx, edc_callback_fn *callback, void *user_data)
+{
+    slice_header_t slice_header;
+    memset(&slice_header, 0, sizeof(slice_header_t));
+    slice_header.slice_idx = slice_idx;
+
+    uint32_t key_len = strlen(key);
+    zmsg_t *request = create_request_message(MSG_ACTION_GET_SLICE, 0, everdata_key_hash(key, key_len, slice_idx), key, key_len, 0);
+    zmsg_addmem(request, &slice_header, sizeof(slice_header_t));
+
+    return edc_submit(edc, EDC_OP_GET_SLICE, request, callback, user_data);
+}
+
+/* ================ edc_del_slice() ================ */
+edc_future_t *edc_del_slice(edc_t *edc, const char *key, const slice_header_t *slice_header, edc_callback_fn *callback, void *user_data)
+{
+    uint32_t key_len = strlen(key);
+    zmsg_t *request = create_request_message(MSG_ACTION_DEL_SLICE, 0, everdata_key_hash(key, key_len, slice_header->slice_idx), key, key_len, 0);
+    zmsg_addmem(request, slice_header, sizeof(slice_header_t));
+
+    return edc_submit(edc, EDC_OP_DEL_SLICE, request, callback, user_data);
+}
+
+/* ================ edc_scan() ================ */
+edc_future_t *edc_scan(edc_t *edc, const char *prefix, const char *start_after, char delimiter, uint32_t limit, edc_callback_fn *callback, void *user_data)
+{
+    /* Goes to every bucket, nothing to hash. */
+    zmsg_t *request = create_request_message(MSG_ACTION_SCAN, 0, 0, prefix, strlen(prefix), 0);
+    zmsg_addmem(request, start_after, start_after != NULL ? strlen(start_after) : 0);
+    scan_request_t scan_request;
+    scan_request.limit = limit > 0 && limit < SCAN_MAX_LIMIT ? limit : SCAN_MAX_LIMIT;
+    scan_request.delimiter = (uint8_t)delimiter;
+    zmsg_addmem(request, &scan_request, sizeof(scan_request_t));
+
+    return edc_submit(edc, EDC_OP_SCAN, request, callback, user_data);
+}
+
+/* ================ edc_future_wait() ================ */
+int edc_future_wait(edc_future_t *future, int64_t timeout)
+{
+    edc_t *edc = future->edc;
+
+    struct timespec deadline;
+    if ( timeout >= 0 ){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (timeout % 1000) * 1000000;
+        if ( deadline.tv_nsec >= 1000000000 ){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&edc->lock);
+    while ( !future->done ){
+        if ( timeout < 0 ){
+            pthread_cond_wait(&future->cond, &edc->lock);
+        } else if ( pthread_cond_timedwait(&future->cond, &edc->lock, &deadline) == ETIMEDOUT ){
+            break;
+        }
+    }
+    int done = future->done;
+    pthread_mutex_unlock(&edc->lock);
+
+    return done ? future->status : EDC_TIMEOUT;
+}
+
+/* ================ edc_future_is_done() ================ */
+int edc_future_is_done(edc_future_t *future)
+{
+    return future->done;
+}
+
+/* ================ edc_future_status() ================ */
+int edc_future_status(edc_future_t *future)
+{
+    return future->status;
+}
+
+/* ================ edc_future_data() ================ */
+const void *edc_future_data(edc_future_t *future, uint32_t *data_size)
+{
+    if ( future->frame_data == NULL ){
+        if ( data_size != NULL ) *data_size = 0;
+        return NULL;
+    }
+    if ( data_size != NULL ) *data_size = zframe_size(future->frame_data);
+    return zframe_data(future->frame_data);
+}
+
+/* ================ edc_future_slice_header() ================ */
+int edc_future_slice_header(edc_future_t *future, slice_header_t *slice_header)
+{
+    if ( future->frame_slice_header == NULL ){
+        return -1;
+    }
+    memcpy(slice_header, zframe_data(future->frame_slice_header), sizeof(slice_header_t));
+    return 0;
+}
+
+/* ================ edc_future_scan_size() ================ */
+uint32_t edc_future_scan_size(edc_future_t *future)
+{
+    return future->total_entries;
+}
+
+/* ================ edc_future_scan_more() ================ */
+int edc_future_scan_more(edc_future_t *future)
+{
+    return future->more;
+}
+
+/* ================ edc_future_scan_key() ================ */
+const char *edc_future_scan_key(edc_future_t *future, uint32_t idx, uint32_t *key_len, uint64_t *object_size)
+{
+    if ( idx >= future->total_entries ){
+        return NULL;
+    }
+    if ( key_len != NULL ) *key_len = zframe_size(future->scan_keys[idx]);
+    if ( object_size != NULL ) *object_size = future->scan_sizes[idx];
+    return (const char *)zframe_data(future->scan_keys[idx]);
+}
+
+/* ================ edc_future_free() ================ */
+void edc_future_free(edc_future_t *future)
+{
+    edc_future_release(future);
+}
+
+/* ================ edc_put_sync() ================ */
+int edc_put_sync(edc_t *edc, const char *key, const void *data, uint32_t data_size)
+{
+    edc_future_t *future = edc_put(edc, key, data, data_size, NULL, NULL);
+    int rc = edc_future_wait(future, -1);
+    edc_future_free(future);
+
+    return rc;
+}
+
+/* ================ edc_get_sync() ================ */
+int edc_get_sync(edc_t *edc, const char *key, void **data, uint32_t *data_size)
+{
+    edc_future_t *future = edc_get(edc, key, NULL, NULL);
+    int rc = edc_future_wait(future, -1);
+
+    *data = NULL;
+    *data_size = 0;
+    if ( rc == EDC_OK ){
+        uint32_t size = 0;
+        const void *object = edc_future_data(future, &size);
+        *data = malloc(size > 0 ? size : 1);
+        memcpy(*data, object, size);
+        *data_size = size;
+    }
+    edc_future_free(future);
+
+    return rc;
+}
+
+/* ================ edc_del_sync() ================ */
+int edc_del_sync(edc_t *edc, const char *key)
+{
+    edc_future_t *future = edc_del(edc, key, NULL, NULL);
+    int rc = edc_future_wait(future, -1);
+    edc_future_free(future);
+
+    return rc;
+}
+
@@ -0,0 +1,104 @@
+/**
+ * @file   libedclient.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-24 09:40:12
+ *
+ * @brief  Asynchronous everdata client library.
+ *
+ * Every call returns a future at once, the requests go out from one I/O
+ * thread over a pool of DEALER connections to the broker frontend. Pass a
+ * callback to hear about the result on the I/O thread, or wait on the
+ * future. Either way the caller owns the future and frees it.
+ *
+ */
+
+#ifndef __LIBEDCLIENT_H__
+#define __LIBEDCLIENT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Status of a finished future. */
+#define EDC_OK 0
+#define EDC_NOTFOUND 1
+#define EDC_ERROR -1
+#define EDC_TIMEOUT -2
+#define EDC_CLOSED -3
+
+typedef struct edc_t edc_t;
+typedef struct edc_future_t edc_future_t;
+typedef struct slice_header_t slice_header_t;
+
+/* Runs on the I/O thread once the future is done, must not block. The
+ * future stays valid until the caller frees it, which may happen here. */
+typedef void (edc_callback_fn)(edc_future_t *future, void *user_data);
+
+/* -------- struct edc_options_t -------- */
+typedef struct edc_options_t {
+    /* DEALER sockets to the broker, requests go round robin. */
+    uint32_t total_connections;
+    /* Requests on the wire, later ones wait in the client. */
+    uint32_t max_inflight;
+    /* Milliseconds an attempt may take. */
+    uint32_t timeout;
+    /* Attempts after the first on timeout or error. */
+    uint32_t retries;
+    /* Milliseconds before the first retry, doubled for every next one. */
+    uint32_t backoff;
+} edc_options_t;
+
+void edc_options_init(edc_options_t *options);
+
+/* NULL options for the defaults. */
+edc_t *edc_new(const char *endpoint, const edc_options_t *options);
+/* Futures not done yet finish with EDC_CLOSED. */
+void edc_free(edc_t *edc);
+
+/* The key and data are copied, the buffers may be reused at once. */
+edc_future_t *edc_put(edc_t *edc, const char *key, const void *data, uint32_t data_size, edc_callback_fn *callback, void *user_data);
+edc_future_t *edc_get(edc_t *edc, const char *key, edc_callback_fn *callback, void *user_data);
+edc_future_t *edc_del(edc_t *edc, const char *key, edc_callback_fn *callback, void *user_data);
+/* One slice of a chunked object, see MSG_ACTION_PUT_SLICE. Slice 0 of a
+ * get comes back with the object size, nslices and slice_size filled in,
+ * for objects stored by a plain put too. */
+edc_future_t *edc_put_slice(edc_t *edc, const char *key, const slice_header_t *slice_header, const void *data, uint32_t data_size, edc_callback_fn *callback, void *user_data);
+edc_future_t *edc_get_slice(edc_t *edc, const char *key, uint32_t slice_idx, edc_callback_fn *callback, void *user_data);
+/* Drops slice_idx after the object shrank to object_size, see
+ * MSG_ACTION_DEL_SLICE. EDC_NOTFOUND if it was gone already. */
+edc_future_t *edc_del_slice(edc_t *edc, const char *key, const slice_header_t *slice_header, edc_callback_fn *callback, void *user_data);
+/* One page of the keys under prefix after start_after, which may be NULL.
+ * delimiter rolls keys up into common prefixes, 0 for none. */
+edc_future_t *edc_scan(edc_t *edc, const char *prefix, const char *start_after, char delimiter, uint32_t limit, edc_callback_fn *callback, void *user_data);
+
+/* Returns the status, or EDC_TIMEOUT if not done within timeout
+ * milliseconds, -1 waits for ever. */
+int edc_future_wait(edc_future_t *future, int64_t timeout);
+int edc_future_is_done(edc_future_t *future);
+int edc_future_status(edc_future_t *future);
+/* The object of a finished get, or the slice of a get_slice, valid until
+ * the future is freed. */
+const void *edc_future_data(edc_future_t *future, uint32_t *data_size);
+/* The slice header of a finished get_slice, -1 for other futures. */
+int edc_future_slice_header(edc_future_t *future, slice_header_t *slice_header);
+/* Entries of a finished scan. object_size is EDC_SCAN_PREFIX_SIZE for a
+ * common prefix. */
+#define EDC_SCAN_PREFIX_SIZE ((uint64_t)-1)
+uint32_t edc_future_scan_size(edc_future_t *future);
+int edc_future_scan_more(edc_future_t *future);
+const char *edc_future_scan_key(edc_future_t *future, uint32_t idx, uint32_t *key_len, uint64_t *object_size);
+void edc_future_free(edc_future_t *future);
+
+/* Blocking wrappers. edc_get_sync() returns a copy of the object to free(). */
+int edc_put_sync(edc_t *edc, const char *key, const void *data, uint32_t data_size);
+int edc_get_sync(edc_t *edc, const char *key, void **data, uint32_t *data_size);
+int edc_del_sync(edc_t *edc, const char *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __LIBEDCLIENT_H__
+
@@ -0,0 +1,1415 @@
+/**
+ * @file   logstore.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-26 09:13:05
+ *
+ * @brief  Append-only segment files holding the slices of a
+ *         BUCKETDB_LOGFILE bucketdb.
+ *
+ * Every write appends a self-describing record, header and data, to the
+ * active segment log-NNNNNN and a batch ends with a single fdatasync, so
+ * a slice is written once and never rewritten in place. The memory index
+ * maps the object md5 to the segment, offset and length of each of its
+ * slices. A delete appends a tombstone naming the record it kills.
+ *
+ * A checkpoint of the index is saved when a segment rolls over and at
+ * close, together with the log position it covers. Opening loads it and
+ * replays only the records behind that position, a torn record at the end
+ * of the last segment is cut off.
+ *
+ * Each segment knows how many of its bytes the index points at. The GC
+ * thread copies the live records of the emptiest sealed segment to the
+ * end of the log and removes the file, tombstones move along as long as
+ * the segment they refer to still exists.
+ *
+ * Records carry a CRC32C of header and data. Recovery and GC always check
+ * it, reads when the bucketdb samples them.
+ *
+ */
+
+#include <stddef.h>
+#include <dirent.h>
+#include <sys/uio.h>
+#include "common.h"
+#include "zmalloc.h"
+#include "logger.h"
+#include "kvdb.h"
+#include "object.h"
+#include "logstore.h"
+
+#include "crc32c.h"
+
+#define LOG_RECORD_MAGIC 0x474F4C45 /* "ELOG" */
+#define LOG_RECORD_PUT 1
+#define LOG_RECORD_DELETE 2
+
+#define LOGSTORE_SNAPSHOT "logstore.snap"
+#define LOGSTORE_SNAPSHOT_MAGIC 0x50414E53 /* "SNAP" */
+
+#define LOGSTORE_MIN_SEGMENTS 64
+#define LOGSTORE_NO_SEGMENT 0xFFFFFFFF
+#define LOGSTORE_MIN_SLOTS 1024
+#define LOGSTORE_WRITE_IOVS 64
+
+#define GC_CHECK_INTERVAL_MSEC 5000
+#define GC_BATCH_BYTES (4 * 1024 * 1024)
+
+/* -------- struct log_record_header_t -------- */
+typedef struct log_record_header_t {
+    uint32_t magic;
+    uint32_t type;
+    slice_key_t slice_key;
+    uint32_t size;
+    /* Tombstones only, the record they delete. */
+    uint32_t deleted_segment_id;
+    uint64_t deleted_offset;
+    /* Of the header up to here and the data. */
+    uint32_t crc;
+    uint32_t reserved;
+} log_record_header_t;
+
+/* -------- struct log_location_t -------- */
+typedef struct log_location_t {
+    uint32_t segment_id;
+    uint32_t size;
+    /* Of the record header. */
+    uint64_t offset;
+} log_location_t;
+
+/* -------- struct log_object_t -------- */
+/* Index slot, slices[] is indexed by slice_idx and has holes marked by
+ * LOGSTORE_NO_SEGMENT. Empty slots have slices == NULL. */
+typedef struct log_object_t {
+    md5_value_t key_md5;
+    uint32_t max_slices;
+    uint32_t live_slices;
+    log_location_t *slices;
+} log_object_t;
+
+/* -------- struct log_segment_t -------- */
+typedef struct log_segment_t {
+    uint32_t id;
+    int fd;
+    char filename[NAME_MAX];
+    /* Bytes of whole records, the append offset of the active segment. */
+    uint64_t size;
+    /* Bytes of the records the index points at. */
+    uint64_t live_bytes;
+    /* The table holds one reference, readers take their own for the
+     * pread. The last one closes the file and removes it once GC did. */
+    volatile uint32_t refs;
+    int removed;
+    int gc_failed;
+} log_segment_t;
+
+/* -------- struct log_snapshot_header_t -------- */
+typedef struct log_snapshot_header_t {
+    uint32_t magic;
+    uint32_t entry_size;
+    /* Every record before this position is in the snapshot. */
+    uint32_t segment_id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t total_entries;
+} log_snapshot_header_t;
+
+/* -------- struct log_snapshot_entry_t -------- */
+typedef struct log_snapshot_entry_t {
+    slice_key_t slice_key;
+    log_location_t location;
+} log_snapshot_entry_t;
+
+/* -------- struct log_write_t -------- */
+/* One record for logstore_append(), which fills in location. */
+typedef struct log_write_t {
+    log_record_header_t header;
+    const char *data;
+    log_location_t location;
+} log_write_t;
+
+/* -------- struct logstore_t -------- */
+struct logstore_t {
+    char dir[NAME_MAX];
+    uint64_t max_segment_size;
+
+    /* write_lock serializes appends, deletes and GC moves, the only ones
+     * changing the index and the segments table. They take lock as well
+     * when they publish, readers only take lock. */
+    pthread_mutex_t write_lock;
+    pthread_rwlock_t lock;
+
+    log_object_t *slots;
+    uint32_t total_slots;
+    uint32_t total_objects;
+
+    /* segments[i] is segment first_segment_id + i or NULL. Ids only grow,
+     * the table grows at the end and drops the holes GC leaves in front. */
+    log_segment_t **segments;
+    uint32_t first_segment_id;
+    uint32_t max_segments;
+    log_segment_t *active_segment;
+    /* Set on rollover, the next append saves a checkpoint. */
+    int checkpoint_pending;
+
+    uint32_t gc_threshold;
+    uint64_t gc_rate;
+    pthread_t gc_thread;
+    pthread_mutex_t gc_lock;
+    pthread_cond_t gc_cond;
+    int gc_started;
+    int stop;
+    uint64_t total_gc_bytes;
+    uint32_t total_gc_segments;
+};
+
+/* ================ now_usec() ================ */
+static uint64_t now_usec(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+}
+
+/* ================ log_sync() ================ */
+static int log_sync(int fd)
+{
+#if defined(__APPLE__)
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+/* ================ log_sync_dir() ================ */
+/* A new segment survives a crash only once its directory entry does. */
+static int log_sync_dir(const char *dir)
+{
+    int fd = open(dir, O_RDONLY);
+    if ( fd == -1 ){
+        return -1;
+    }
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+/* ================ log_drop_cache() ================ */
+/* Slices are written once and read rarely, keep them out of the page
+ * cache the way O_DIRECT would. Hot ones live in the slicecache. */
+static void log_drop_cache(int fd, uint64_t offset, uint64_t len)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
+/* ================ record_size() ================ */
+static inline uint64_t record_size(uint32_t data_size)
+{
+    return sizeof(log_record_header_t) + data_size;
+}
+
+/* ================ record_crc() ================ */
+static uint32_t record_crc(const log_record_header_t *header, const char *data)
+{
+    uint32_t crc = crc32c(0, (const char*)header, offsetof(log_record_header_t, crc));
+    if ( header->size > 0 ){
+        crc = crc32c(crc, data, header->size);
+    }
+    return crc;
+}
+
+/* ================ record_init() ================ */
+static void record_init(log_record_header_t *header, uint32_t type, const slice_key_t *slice_key, uint32_t size)
+{
+    memset(header, 0, sizeof(log_record_header_t));
+    header->magic = LOG_RECORD_MAGIC;
+    header->type = type;
+    header->slice_key = *slice_key;
+    header->size = size;
+    header->deleted_segment_id = LOGSTORE_NO_SEGMENT;
+}
+
+/* ================ logindex_home() ================ */
+static inline uint32_t logindex_home(logstore_t *logstore, const md5_value_t *key_md5)
+{
+    return key_md5->h0 & (logstore->total_slots - 1);
+}
+
+/* ================ logindex_find() ================ */
+/* The slot holding the object, or the empty slot ending its probe run. */
+static uint32_t logindex_find(logstore_t *logstore, const md5_value_t *key_md5)
+{
+    uint32_t mask = logstore->total_slots - 1;
+    uint32_t n = logindex_home(logstore, key_md5);
+    while ( logstore->slots[n].slices != NULL ){
+        if ( memcmp(&logstore->slots[n].key_md5, key_md5, sizeof(md5_value_t)) == 0 ){
+            break;
+        }
+        n = (n + 1) & mask;
+    }
+    return n;
+}
+
+/* ================ logindex_alloc_slots() ================ */
+static void logindex_alloc_slots(logstore_t *logstore, uint32_t total_slots)
+{
+    logstore->slots = (log_object_t*)zmalloc(sizeof(log_object_t) * total_slots);
+    memset(logstore->slots, 0, sizeof(log_object_t) * total_slots);
+    logstore->total_slots = total_slots;
+}
+
+/* ================ logindex_grow() ================ */
+static void logindex_grow(logstore_t *logstore)
+{
+    log_object_t *old_slots = logstore->slots;
+    uint32_t old_total_slots = logstore->total_slots;
+
+    logindex_alloc_slots(logstore, old_total_slots * 2);
+    for ( uint32_t i = 0 ; i < old_total_slots ; i++ ){
+        if ( old_slots[i].slices != NULL ){
+            logstore->slots[logindex_find(logstore, &old_slots[i].key_md5)] = old_slots[i];
+        }
+    }
+
+    zfree(old_slots);
+}
+
+/* ================ logindex_get() ================ */
+static int logindex_get(logstore_t *logstore, const slice_key_t *slice_key, log_location_t *location)
+{
+    log_object_t *object = &logstore->slots[logindex_find(logstore, &slice_key->key_md5)];
+    if ( object->slices == NULL || slice_key->slice_idx >= object->max_slices ){
+        return 0;
+    }
+    if ( object->slices[slice_key->slice_idx].segment_id == LOGSTORE_NO_SEGMENT ){
+        return 0;
+    }
+    *location = object->slices[slice_key->slice_idx];
+    return 1;
+}
+
+/* ================ logstore_segment() ================ */
+static inline log_segment_t *logstore_segment(logstore_t *logstore, uint32_t segment_id)
+{
+    if ( segment_id < logstore->first_segment_id || segment_id - logstore->first_segment_id >= logstore->max_segments ){
+        return NULL;
+    }
+    return logstore->segments[segment_id - logstore->first_segment_id];
+}
+
+/* ================ logstore_add_segment() ================ */
+/* Called with lock held for writing, or before the store is shared.
+ * Segments are added in id order, returns -1 for one that is not newer
+ * than all the others. */
+static int logstore_add_segment(logstore_t *logstore, log_segment_t *segment)
+{
+    uint32_t total_holes = 0;
+    while ( total_holes < logstore->max_segments && logstore->segments[total_holes] == NULL ){
+        total_holes++;
+    }
+    if ( total_holes == logstore->max_segments ){
+        logstore->first_segment_id = segment->id;
+    } else {
+        uint32_t last_segment_id = logstore->first_segment_id + logstore->max_segments - 1;
+        while ( logstore->segments[last_segment_id - logstore->first_segment_id] == NULL ){
+            last_segment_id--;
+        }
+        if ( segment->id <= last_segment_id ){
+            error_log("Segment %d is not newer than segment %d. dir:%s", segment->id, last_segment_id, logstore->dir);
+            return -1;
+        }
+        if ( total_holes > 0 ){
+            memmove(logstore->segments, logstore->segments + total_holes, sizeof(log_segment_t*) * (logstore->max_segments - total_holes));
+            memset(logstore->segments + logstore->max_segments - total_holes, 0, sizeof(log_segment_t*) * total_holes);
+            logstore->first_segment_id += total_holes;
+        }
+    }
+
+    uint32_t idx = segment->id - logstore->first_segment_id;
+    if ( idx >= logstore->max_segments ){
+        uint32_t max_segments = logstore->max_segments > 0 ? logstore->max_segments : LOGSTORE_MIN_SEGMENTS;
+        while ( max_segments <= idx ){
+            max_segments *= 2;
+        }
+        logstore->segments = (log_segment_t**)zrealloc(logstore->segments, sizeof(log_segment_t*) * max_segments);
+        memset(logstore->segments + logstore->max_segments, 0, sizeof(log_segment_t*) * (max_segments - logstore->max_segments));
+        logstore->max_segments = max_segments;
+    }
+    logstore->segments[idx] = segment;
+
+    return 0;
+}
+
+/* ================ logstore_account() ================ */
+static void logstore_account(logstore_t *logstore, const log_location_t *location, int delta)
+{
+    log_segment_t *segment = logstore_segment(logstore, location->segment_id);
+    if ( segment != NULL ){
+        segment->live_bytes += delta * (int64_t)record_size(location->size);
+    }
+}
+
+/* ================ logindex_put() ================ */
+/* Called with lock held for writing. */
+static void logindex_put(logstore_t *logstore, const slice_key_t *slice_key, const log_location_t *location)
+{
+    if ( (uint64_t)(logstore->total_objects + 1) * 10 > (uint64_t)logstore->total_slots * 7 ){
+        logindex_grow(logstore);
+    }
+
+    log_object_t *object = &logstore->slots[logindex_find(logstore, &slice_key->key_md5)];
+    if ( object->slices == NULL ){
+        object->key_md5 = slice_key->key_md5;
+        object->max_slices = 0;
+        object->live_slices = 0;
+        logstore->total_objects++;
+    }
+    if ( slice_key->slice_idx >= object->max_slices ){
+        uint32_t max_slices = object->max_slices > 0 ? object->max_slices * 2 : 1;
+        if ( max_slices <= slice_key->slice_idx ){
+            max_slices = slice_key->slice_idx + 1;
+        }
+        object->slices = (log_location_t*)zrealloc(object->slices, sizeof(log_location_t) * max_slices);
+        memset(&object->slices[object->max_slices], 0xFF, sizeof(log_location_t) * (max_slices - object->max_slices));
+        object->max_slices = max_slices;
+    }
+
+    log_location_t *slot = &object->slices[slice_key->slice_idx];
+    if ( slot->segment_id != LOGSTORE_NO_SEGMENT ){
+        logstore_account(logstore, slot, -1);
+    } else {
+        object->live_slices++;
+    }
+    *slot = *location;
+    logstore_account(logstore, slot, 1);
+}
+
+/* ================ logindex_remove_slot() ================ */
+/* Backward shift, as in sliceindex_remove(). */
+static void logindex_remove_slot(logstore_t *logstore, uint32_t hole)
+{
+    uint32_t mask = logstore->total_slots - 1;
+
+    zfree(logstore->slots[hole].slices);
+    uint32_t n = hole;
+    while ( 1 ){
+        n = (n + 1) & mask;
+        if ( logstore->slots[n].slices == NULL ){
+            break;
+        }
+        uint32_t home = logindex_home(logstore, &logstore->slots[n].key_md5);
+        if ( ((n - home) & mask) >= ((n - hole) & mask) ){
+            logstore->slots[hole] = logstore->slots[n];
+            hole = n;
+        }
+    }
+    memset(&logstore->slots[hole], 0, sizeof(log_object_t));
+    logstore->total_objects--;
+}
+
+/* ================ logindex_remove() ================ */
+/* Called with lock held for writing. Only removes the slice while the
+ * index still points at location. */
+static int logindex_remove(logstore_t *logstore, const slice_key_t *slice_key, const log_location_t *location)
+{
+    uint32_t n = logindex_find(logstore, &slice_key->key_md5);
+    log_object_t *object = &logstore->slots[n];
+    if ( object->slices == NULL || slice_key->slice_idx >= object->max_slices ){
+        return 0;
+    }
+    log_location_t *slot = &object->slices[slice_key->slice_idx];
+    if ( slot->segment_id != location->segment_id || slot->offset != location->offset ){
+        return 0;
+    }
+
+    logstore_account(logstore, slot, -1);
+    memset(slot, 0xFF, sizeof(log_location_t));
+    if ( --object->live_slices == 0 ){
+        logindex_remove_slot(logstore, n);
+    }
+
+    return 1;
+}
+
+/* ================ log_segment_open() ================ */
+static log_segment_t *log_segment_open(logstore_t *logstore, uint32_t segment_id, int create)
+{
+    log_segment_t *segment = (log_segment_t*)zmalloc(sizeof(log_segment_t));
+    memset(segment, 0, sizeof(log_segment_t));
+    segment->id = segment_id;
+    segment->refs = 1;
+    sprintf(segment->filename, "%s/log-%06d", logstore->dir, segment_id);
+
+    segment->fd = open(segment->filename, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0640);
+    if ( segment->fd == -1 ){
+        error_log("open() segment failed. file:%s errno:%d", segment->filename, errno);
+        zfree(segment);
+        return NULL;
+    }
+
+    return segment;
+}
+
+/* ================ log_segment_unref() ================ */
+static void log_segment_unref(log_segment_t *segment)
+{
+    if ( __sync_sub_and_fetch(&segment->refs, 1) == 0 ){
+        close(segment->fd);
+        if ( segment->removed ){
+            unlink(segment->filename);
+        }
+        zfree(segment);
+    }
+}
+
+/* ================ logstore_acquire() ================ */
+/* Look the slice up and pin its segment for the read. */
+static log_segment_t *logstore_acquire(logstore_t *logstore, const slice_key_t *slice_key, log_location_t *location)
+{
+    log_segment_t *segment = NULL;
+
+    pthread_rwlock_rdlock(&logstore->lock);
+    if ( logindex_get(logstore, slice_key, location) ){
+        segment = logstore_segment(logstore, location->segment_id);
+        if ( segment != NULL ){
+            __sync_add_and_fetch(&segment->refs, 1);
+        }
+    }
+    pthread_rwlock_unlock(&logstore->lock);
+
+    return segment;
+}
+
+/* ================ log_segment_read() ================ */
+/* Read the data of the record at location into data, checking its CRC
+ * too if verify is set. */
+static int log_segment_read(log_segment_t *segment, const slice_key_t *slice_key, const log_location_t *location, char *data, int verify)
+{
+    log_record_header_t header;
+    if ( pread(segment->fd, &header, sizeof(header), location->offset) != sizeof(header) ||
+            header.magic != LOG_RECORD_MAGIC || header.size != location->size ||
+            memcmp(&header.slice_key, slice_key, sizeof(slice_key_t)) != 0 ){
+        error_log("Bad record header. segment:%d offset:%llu", segment->id, (unsigned long long)location->offset);
+        return -1;
+    }
+    if ( location->size > 0 && pread(segment->fd, data, location->size, location->offset + sizeof(header)) != (ssize_t)location->size ){
+        error_log("pread() failed. segment:%d offset:%llu errno:%d", segment->id, (unsigned long long)location->offset, errno);
+        return -1;
+    }
+    if ( verify && record_crc(&header, data) != header.crc ){
+        error_log("Corrupt record. segment:%d offset:%llu", segment->id, (unsigned long long)location->offset);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ================ logstore_save_snapshot() ================ */
+/* Called under write_lock, the index can't change meanwhile. */
+static int logstore_save_snapshot(logstore_t *logstore)
+{
+    char filename[NAME_MAX];
+    char tmp_filename[NAME_MAX];
+    sprintf(filename, "%s/%s", logstore->dir, LOGSTORE_SNAPSHOT);
+    sprintf(tmp_filename, "%s.tmp", filename);
+
+    FILE *file = fopen(tmp_filename, "wb");
+    if ( file == NULL ){
+        error_log("fopen() failed. file:%s", tmp_filename);
+        return -1;
+    }
+
+    log_snapshot_header_t header;
+    memset(&header, 0, sizeof(log_snapshot_header_t));
+    header.magic = LOGSTORE_SNAPSHOT_MAGIC;
+    header.entry_size = sizeof(log_snapshot_entry_t);
+    header.segment_id = logstore->active_segment->id;
+    header.offset = logstore->active_segment->size;
+    for ( uint32_t i = 0 ; i < logstore->total_slots ; i++ ){
+        header.total_entries += logstore->slots[i].live_slices;
+    }
+
+    int rc = fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+    for ( uint32_t i = 0 ; i < logstore->total_slots && rc == 0 ; i++ ){
+        log_object_t *object = &logstore->slots[i];
+        for ( uint32_t idx = 0 ; idx < object->max_slices && rc == 0 ; idx++ ){
+            if ( object->slices[idx].segment_id == LOGSTORE_NO_SEGMENT ){
+                continue;
+            }
+            log_snapshot_entry_t entry;
+            memset(&entry, 0, sizeof(log_snapshot_entry_t));
+            entry.slice_key.key_md5 = object->key_md5;
+            entry.slice_key.slice_idx = idx;
+            entry.location = object->slices[idx];
+            if ( fwrite(&entry, sizeof(entry), 1, file) != 1 ){
+                rc = -1;
+            }
+        }
+    }
+    if ( rc == 0 && (fflush(file) != 0 || fsync(fileno(file)) != 0) ){
+        rc = -1;
+    }
+    fclose(file);
+
+    if ( rc == 0 && rename(tmp_filename, filename) != 0 ){
+        rc = -1;
+    }
+    if ( rc != 0 ){
+        error_log("Save logstore snapshot failed. file:%s", filename);
+        unlink(tmp_filename);
+    }
+
+    return rc;
+}
+
+/* ================ logstore_load_snapshot() ================ */
+/* Fills the index and returns the position replay starts at. */
+static int logstore_load_snapshot(logstore_t *logstore, uint32_t *segment_id, uint64_t *offset)
+{
+    char filename[NAME_MAX];
+    sprintf(filename, "%s/%s", logstore->dir, LOGSTORE_SNAPSHOT);
+
+    FILE *file = fopen(filename, "rb");
+    if ( file == NULL ){
+        return -1;
+    }
+
+    log_snapshot_header_t header;
+    if ( fread(&header, sizeof(header), 1, file) != 1 || header.magic != LOGSTORE_SNAPSHOT_MAGIC ||
+            header.entry_size != sizeof(log_snapshot_entry_t) ){
+        warning_log("Ignore bad logstore snapshot. file:%s", filename);
+        fclose(file);
+        return -1;
+    }
+
+    uint64_t total_dropped = 0;
+    for ( uint64_t i = 0 ; i < header.total_entries ; i++ ){
+        log_snapshot_entry_t entry;
+        if ( fread(&entry, sizeof(entry), 1, file) != 1 ){
+            /* Replay from the start fixes whatever was loaded so far. */
+            warning_log("Truncated logstore snapshot. file:%s", filename);
+            fclose(file);
+            return -1;
+        }
+        if ( logstore_segment(logstore, entry.location.segment_id) == NULL ){
+            total_dropped++;
+            continue;
+        }
+        logindex_put(logstore, &entry.slice_key, &entry.location);
+    }
+    fclose(file);
+
+    if ( total_dropped > 0 ){
+        warning_log("Dropped %llu snapshot entries of missing segments. dir:%s", (unsigned long long)total_dropped, logstore->dir);
+    }
+    *segment_id = header.segment_id;
+    *offset = header.offset;
+
+    return 0;
+}
+
+/* ================ logstore_replay_record() ================ */
+/* A tombstone only applies while the index still points at the record it
+ * was written for, a later put of the key replayed before a tombstone
+ * moved by GC survives it. */
+static void logstore_replay_record(logstore_t *logstore, log_segment_t *segment, uint64_t offset, const log_record_header_t *header)
+{
+    if ( header->type == LOG_RECORD_PUT ){
+        log_location_t location;
+        location.segment_id = segment->id;
+        location.size = header->size;
+        location.offset = offset;
+        logindex_put(logstore, &header->slice_key, &location);
+    } else if ( header->type == LOG_RECORD_DELETE ){
+        log_location_t location;
+        location.segment_id = header->deleted_segment_id;
+        location.size = 0;
+        location.offset = header->deleted_offset;
+        logindex_remove(logstore, &header->slice_key, &location);
+    }
+}
+
+/* ================ logstore_replay_segment() ================ */
+/* Replay the records from offset on. A bad record ends the segment, at
+ * the end of the log it is a torn write and cut off. */
+static void logstore_replay_segment(logstore_t *logstore, log_segment_t *segment, uint64_t offset, int is_last)
+{
+    struct stat st;
+    if ( fstat(segment->fd, &st) != 0 ){
+        st.st_size = 0;
+    }
+    uint64_t file_size = st.st_size;
+
+    char *data = NULL;
+    uint32_t data_size = 0;
+    uint32_t total_records = 0;
+    while ( offset < file_size ){
+        log_record_header_t header;
+        if ( file_size - offset < sizeof(header) ||
+                pread(segment->fd, &header, sizeof(header), offset) != sizeof(header) ||
+                header.magic != LOG_RECORD_MAGIC ||
+                (header.type != LOG_RECORD_PUT && header.type != LOG_RECORD_DELETE) ||
+                file_size - offset - sizeof(header) < header.size ){
+            break;
+        }
+        if ( header.size > data_size ){
+            data_size = header.size;
+            data = (char*)zrealloc(data, data_size);
+        }
+        if ( header.size > 0 && pread(segment->fd, data, header.size, offset + sizeof(header)) != (ssize_t)header.size ){
+            break;
+        }
+        if ( record_crc(&header, data) != header.crc ){
+            break;
+        }
+
+        logstore_replay_record(logstore, segment, offset, &header);
+        offset += record_size(header.size);
+        total_records++;
+    }
+    if ( data != NULL ){
+        zfree(data);
+    }
+
+    if ( offset < file_size ){
+        if ( is_last ){
+            warning_log("Cut torn tail of segment %d at %llu, %llu bytes dropped.", segment->id,
+                    (unsigned long long)offset, (unsigned long long)(file_size - offset));
+            if ( ftruncate(segment->fd, offset) != 0 ){
+                error_log("ftruncate() failed. file:%s errno:%d", segment->filename, errno);
+            }
+        } else {
+            error_log("Bad record in segment %d at %llu, the rest of it is ignored.", segment->id, (unsigned long long)offset);
+        }
+    }
+    segment->size = offset;
+
+    trace_log("Replayed %d records of segment %d.", total_records, segment->id);
+}
+
+/* ================ compare_segment_id() ================ */
+static int compare_segment_id(const void *a, const void *b)
+{
+    uint32_t id_a = *(const uint32_t*)a;
+    uint32_t id_b = *(const uint32_t*)b;
+    return id_a < id_b ? -1 : (id_a > id_b ? 1 : 0);
+}
+
+/* ================ logstore_recover() ================ */
+static int logstore_recover(logstore_t *logstore)
+{
+    DIR *dir = opendir(logstore->dir);
+    if ( dir == NULL ){
+        error_log("opendir() failed. dir:%s", logstore->dir);
+        return -1;
+    }
+    uint32_t *segment_ids = NULL;
+    uint32_t total_segments = 0;
+    uint32_t max_segment_ids = 0;
+    struct dirent *entry;
+    while ( (entry = readdir(dir)) != NULL ){
+        uint32_t segment_id = 0;
+        char c;
+        if ( sscanf(entry->d_name, "log-%u%c", &segment_id, &c) == 1 ){
+            if ( total_segments == max_segment_ids ){
+                max_segment_ids = max_segment_ids > 0 ? max_segment_ids * 2 : LOGSTORE_MIN_SEGMENTS;
+                segment_ids = (uint32_t*)zrealloc(segment_ids, sizeof(uint32_t) * max_segment_ids);
+            }
+            segment_ids[total_segments++] = segment_id;
+        }
+    }
+    closedir(dir);
+    qsort(segment_ids, total_segments, sizeof(uint32_t), compare_segment_id);
+
+    /* A segment left out would lose its records, refuse to open instead. */
+    for ( uint32_t i = 0 ; i < total_segments ; i++ ){
+        log_segment_t *segment = log_segment_open(logstore, segment_ids[i], 0);
+        if ( segment == NULL ){
+            zfree(segment_ids);
+            return -1;
+        }
+        if ( logstore_add_segment(logstore, segment) != 0 ){
+            error_log("Can't place segment file %s, two files have the same id.", segment->filename);
+            log_segment_unref(segment);
+            zfree(segment_ids);
+            return -1;
+        }
+    }
+
+    uint32_t snapshot_segment_id = 0;
+    uint64_t snapshot_offset = 0;
+    int from_snapshot = logstore_load_snapshot(logstore, &snapshot_segment_id, &snapshot_offset) == 0;
+    if ( !from_snapshot ){
+        /* A partly loaded snapshot must not mix with the replay. */
+        for ( uint32_t i = 0 ; i < logstore->total_slots ; i++ ){
+            if ( logstore->slots[i].slices != NULL ){
+                zfree(logstore->slots[i].slices);
+            }
+        }
+        memset(logstore->slots, 0, sizeof(log_object_t) * logstore->total_slots);
+        logstore->total_objects = 0;
+        for ( uint32_t i = 0 ; i < total_segments ; i++ ){
+            logstore_segment(logstore, segment_ids[i])->live_bytes = 0;
+        }
+    }
+
+    for ( uint32_t i = 0 ; i < total_segments ; i++ ){
+        log_segment_t *segment = logstore_segment(logstore, segment_ids[i]);
+        int is_last = i == total_segments - 1;
+        if ( from_snapshot && segment->id < snapshot_segment_id ){
+            struct stat st;
+            segment->size = fstat(segment->fd, &st) == 0 ? st.st_size : 0;
+        } else if ( from_snapshot && segment->id == snapshot_segment_id ){
+            logstore_replay_segment(logstore, segment, snapshot_offset, is_last);
+        } else {
+            logstore_replay_segment(logstore, segment, 0, is_last);
+        }
+    }
+
+    if ( total_segments > 0 ){
+        logstore->active_segment = logstore_segment(logstore, segment_ids[total_segments - 1]);
+    }
+    zfree(segment_ids);
+    /* Appends must land behind the checkpoint position to be replayed. */
+    if ( logstore->active_segment == NULL || (from_snapshot && logstore->active_segment->id < snapshot_segment_id) ){
+        uint32_t segment_id = from_snapshot ? snapshot_segment_id : 0;
+        log_segment_t *segment = log_segment_open(logstore, segment_id, 1);
+        if ( segment == NULL ){
+            return -1;
+        }
+        if ( logstore_add_segment(logstore, segment) != 0 ){
+            log_segment_unref(segment);
+            return -1;
+        }
+        logstore->active_segment = segment;
+        log_sync_dir(logstore->dir);
+    }
+
+    uint32_t total_slices = 0;
+    for ( uint32_t i = 0 ; i < logstore->total_slots ; i++ ){
+        total_slices += logstore->slots[i].live_slices;
+    }
+    notice_log("logstore %s recovered %d slices of %d objects in %d segments%s.", logstore->dir, total_slices,
+            logstore->total_objects, total_segments, from_snapshot ? " from checkpoint" : "");
+
+    return 0;
+}
+
+/* ================ logstore_rotate() ================ */
+/* Called under write_lock. The sealed segment was synced by its last append. */
+static int logstore_rotate(logstore_t *logstore)
+{
+    uint32_t segment_id = logstore->active_segment->id + 1;
+
+    log_segment_t *segment = log_segment_open(logstore, segment_id, 1);
+    if ( segment == NULL ){
+        return -1;
+    }
+    if ( log_sync_dir(logstore->dir) != 0 ){
+        warning_log("fsync() dir failed. dir:%s", logstore->dir);
+    }
+
+    pthread_rwlock_wrlock(&logstore->lock);
+    int rc = logstore_add_segment(logstore, segment);
+    if ( rc == 0 ){
+        logstore->active_segment = segment;
+    }
+    pthread_rwlock_unlock(&logstore->lock);
+    if ( rc != 0 ){
+        log_segment_unref(segment);
+        return -1;
+    }
+
+    logstore->checkpoint_pending = 1;
+    trace_log("logstore %s rolled over to segment %d.", logstore->dir, segment_id);
+
+    return 0;
+}
+
+/* ================ logstore_append() ================ */
+/* Called under write_lock. A batch is never split across segments, the
+ * active one rolls over before it once it is full. On failure nothing of
+ * the batch is left behind. */
+static int logstore_append(logstore_t *logstore, log_write_t *writes, uint32_t total_writes)
+{
+    if ( logstore->active_segment->size >= logstore->max_segment_size ){
+        if ( logstore_rotate(logstore) != 0 ){
+            return -1;
+        }
+    }
+
+    log_segment_t *segment = logstore->active_segment;
+    uint64_t start_offset = segment->size;
+    uint64_t offset = start_offset;
+    int rc = lseek(segment->fd, offset, SEEK_SET) == (off_t)offset ? 0 : -1;
+
+    struct iovec iov[LOGSTORE_WRITE_IOVS];
+    uint32_t total_iovs = 0;
+    uint64_t iov_bytes = 0;
+    for ( uint32_t i = 0 ; i < total_writes && rc == 0 ; i++ ){
+        log_write_t *w = &writes[i];
+        w->header.crc = record_crc(&w->header, w->data);
+        w->location.segment_id = segment->id;
+        w->location.size = w->header.size;
+        w->location.offset = offset;
+        offset += record_size(w->header.size);
+
+        iov[total_iovs].iov_base = &w->header;
+        iov[total_iovs].iov_len = sizeof(log_record_header_t);
+        total_iovs++;
+        iov_bytes += sizeof(log_record_header_t);
+        if ( w->header.size > 0 ){
+            iov[total_iovs].iov_base = (void*)w->data;
+            iov[total_iovs].iov_len = w->header.size;
+            total_iovs++;
+            iov_bytes += w->header.size;
+        }
+
+        if ( total_iovs > LOGSTORE_WRITE_IOVS - 2 || i == total_writes - 1 ){
+            if ( writev(segment->fd, iov, total_iovs) != (ssize_t)iov_bytes ){
+                error_log("writev() failed. file:%s errno:%d", segment->filename, errno);
+                rc = -1;
+            }
+            total_iovs = 0;
+            iov_bytes = 0;
+        }
+    }
+
+    if ( rc == 0 && log_sync(segment->fd) != 0 ){
+        error_log("fdatasync() failed. file:%s errno:%d", segment->filename, errno);
+        rc = -1;
+    }
+    if ( rc != 0 ){
+        if ( ftruncate(segment->fd, start_offset) != 0 ){
+            error_log("ftruncate() failed. file:%s errno:%d", segment->filename, errno);
+        }
+        return -1;
+    }
+
+    segment->size = offset;
+    log_drop_cache(segment->fd, start_offset, offset - start_offset);
+
+    return 0;
+}
+
+/* ================ logstore_end_write() ================ */
+/* Leave write_lock, saving the checkpoint due after a rollover first. By
+ * now every record before the log end is in the index. */
+static void logstore_end_write(logstore_t *logstore)
+{
+    if ( logstore->checkpoint_pending ){
+        logstore->checkpoint_pending = 0;
+        logstore_save_snapshot(logstore);
+    }
+    pthread_mutex_unlock(&logstore->write_lock);
+}
+
+/* ================ logstore_write_slices() ================ */
+int logstore_write_slices(logstore_t *logstore, slice_t **slices, uint32_t total_slices)
+{
+    if ( total_slices == 0 ){
+        return 0;
+    }
+
+    log_write_t *writes = (log_write_t*)zmalloc(sizeof(log_write_t) * total_slices);
+    for ( uint32_t i = 0 ; i < total_slices ; i++ ){
+        record_init(&writes[i].header, LOG_RECORD_PUT, &slices[i]->slice_key, slices[i]->size);
+        writes[i].data = slices[i]->data;
+    }
+
+    pthread_mutex_lock(&logstore->write_lock);
+    int rc = logstore_append(logstore, writes, total_slices);
+    if ( rc == 0 ){
+        pthread_rwlock_wrlock(&logstore->lock);
+        for ( uint32_t i = 0 ; i < total_slices ; i++ ){
+            logindex_put(logstore, &slices[i]->slice_key, &writes[i].location);
+        }
+        pthread_rwlock_unlock(&logstore->lock);
+    }
+    logstore_end_write(logstore);
+
+    zfree(writes);
+
+    return rc;
+}
+
+/* ================ logstore_read_slice() ================ */
+slice_t *logstore_read_slice(logstore_t *logstore, md5_value_t key_md5, uint32_t slice_idx, int verify)
+{
+    slice_key_t slice_key;
+    slice_key.key_md5 = key_md5;
+    slice_key.slice_idx = slice_idx;
+
+    log_location_t location;
+    log_segment_t *segment = logstore_acquire(logstore, &slice_key, &location);
+    if ( segment == NULL ){
+        return NULL;
+    }
+
+    slice_t *slice = NULL;
+    char *data = location.size > 0 ? (char*)zmalloc(location.size) : NULL;
+    if ( log_segment_read(segment, &slice_key, &location, data, verify) == 0 ){
+        slice = slice_new(key_md5, slice_idx, NULL, 0);
+        slice_attach_data(slice, data, location.size);
+    } else if ( data != NULL ){
+        zfree(data);
+    }
+    log_segment_unref(segment);
+
+    return slice;
+}
+
+/* ================ logstore_read_view() ================ */
+/* The view owns a copy, slice data never sits in a mapping to borrow. */
+kvdb_view_t *logstore_read_view(logstore_t *logstore, md5_value_t key_md5, uint32_t slice_idx, int verify)
+{
+    slice_key_t slice_key;
+    slice_key.key_md5 = key_md5;
+    slice_key.slice_idx = slice_idx;
+
+    log_location_t location;
+    log_segment_t *segment = logstore_acquire(logstore, &slice_key, &location);
+    if ( segment == NULL ){
+        return NULL;
+    }
+
+    kvdb_view_t *view = NULL;
+    char *data = location.size > 0 ? (char*)zmalloc(location.size) : NULL;
+    if ( log_segment_read(segment, &slice_key, &location, data, verify) == 0 ){
+        view = kvdb_view_new(data, location.size, NULL, data);
+    } else if ( data != NULL ){
+        zfree(data);
+    }
+    log_segment_unref(segment);
+
+    return view;
+}
+
+/* ================ logstore_delete_slices() ================ */
+/* Called under write_lock. Appends a tombstone for every live slice in
+ * slice_keys and drops them from the index, the dead ones are skipped
+ * and left out of slice_keys. Returns how many were deleted or -1. */
+static int logstore_delete_slices(logstore_t *logstore, slice_key_t *slice_keys, uint32_t total_slice_keys)
+{
+    log_write_t *writes = (log_write_t*)zmalloc(sizeof(log_write_t) * (total_slice_keys > 0 ? total_slice_keys : 1));
+    log_location_t *locations = (log_location_t*)zmalloc(sizeof(log_location_t) * (total_slice_keys > 0 ? total_slice_keys : 1));
+
+    uint32_t total_writes = 0;
+    for ( uint32_t i = 0 ; i < total_slice_keys ; i++ ){
+        if ( !logindex_get(logstore, &slice_keys[i], &locations[total_writes]) ){
+            continue;
+        }
+        log_write_t *w = &writes[total_writes];
+        record_init(&w->header, LOG_RECORD_DELETE, &slice_keys[i], 0);
+        w->header.deleted_segment_id = locations[total_writes].segment_id;
+        w->header.deleted_offset = locations[total_writes].offset;
+        w->data = NULL;
+        slice_keys[total_writes++] = slice_keys[i];
+    }
+
+    int rc = total_writes;
+    if ( total_writes > 0 ){
+        if ( logstore_append(logstore, writes, total_writes) == 0 ){
+            pthread_rwlock_wrlock(&logstore->lock);
+            for ( uint32_t i = 0 ; i < total_writes ; i++ ){
+                logindex_remove(logstore, &slice_keys[i], &locations[i]);
+            }
+            pthread_rwlock_unlock(&logstore->lock);
+        } else {
+            rc = -1;
+        }
+    }
+
+    zfree(locations);
+    zfree(writes);
+
+    return rc;
+}
+
+/* ================ logstore_delete_slice() ================ */
+int logstore_delete_slice(logstore_t *logstore, md5_value_t key_md5, uint32_t slice_idx)
+{
+    slice_key_t slice_key;
+    slice_key.key_md5 = key_md5;
+    slice_key.slice_idx = slice_idx;
+
+    pthread_mutex_lock(&logstore->write_lock);
+    int rc = logstore_delete_slices(logstore, &slice_key, 1);
+    logstore_end_write(logstore);
+
+    return rc;
+}
+
+/* ================ logstore_delete_object() ================ */
+int logstore_delete_object(logstore_t *logstore, md5_value_t key_md5, logstore_deleted_fn *deleted_fn, void *user_data, uint32_t *total_deleted)
+{
+    *total_deleted = 0;
+
+    pthread_mutex_lock(&logstore->write_lock);
+
+    slice_key_t *slice_keys = NULL;
+    uint32_t total_slice_keys = 0;
+    log_object_t *object = &logstore->slots[logindex_find(logstore, &key_md5)];
+    if ( object->slices != NULL ){
+        slice_keys = (slice_key_t*)zmalloc(sizeof(slice_key_t) * object->live_slices);
+        for ( uint32_t idx = 0 ; idx < object->max_slices ; idx++ ){
+            if ( object->slices[idx].segment_id != LOGSTORE_NO_SEGMENT ){
+                slice_keys[total_slice_keys].key_md5 = key_md5;
+                slice_keys[total_slice_keys].slice_idx = idx;
+                total_slice_keys++;
+            }
+        }
+    }
+
+    int rc = 0;
+    if ( total_slice_keys > 0 ){
+        rc = logstore_delete_slices(logstore, slice_keys, total_slice_keys);
+    }
+    logstore_end_write(logstore);
+
+    if ( rc > 0 ){
+        for ( int i = 0 ; i < rc && deleted_fn != NULL ; i++ ){
+            deleted_fn(user_data, &slice_keys[i]);
+        }
+        *total_deleted = rc;
+        rc = 0;
+    }
+    if ( slice_keys != NULL ){
+        zfree(slice_keys);
+    }
+
+    return rc;
+}
+
+/* -------- struct gc_batch_t -------- */
+typedef struct gc_batch_t {
+    log_write_t writes[GC_BATCH_BYTES / 4096];
+    /* Where the puts among writes live now. */
+    log_location_t old_locations[GC_BATCH_BYTES / 4096];
+    char *datas[GC_BATCH_BYTES / 4096];
+    uint32_t total_writes;
+    uint64_t total_bytes;
+} gc_batch_t;
+
+/* ================ gc_batch_release() ================ */
+static void gc_batch_release(gc_batch_t *batch)
+{
+    for ( uint32_t i = 0 ; i < batch->total_writes ; i++ ){
+        if ( batch->datas[i] != NULL ){
+            zfree(batch->datas[i]);
+        }
+    }
+    batch->total_writes = 0;
+    batch->total_bytes = 0;
+}
+
+/* ================ logstore_gc_sleep() ================ */
+/* Returns non-zero when the GC thread is asked to stop. */
+static int logstore_gc_sleep(logstore_t *logstore, uint64_t usec)
+{
+    uint64_t deadline_usec = now_usec() + usec;
+    struct timespec deadline;
+    deadline.tv_sec = deadline_usec / 1000000L;
+    deadline.tv_nsec = (deadline_usec % 1000000L) * 1000L;
+
+    pthread_mutex_lock(&logstore->gc_lock);
+    while ( !logstore->stop ){
+        if ( pthread_cond_timedwait(&logstore->gc_cond, &logstore->gc_lock, &deadline) == ETIMEDOUT ){
+            break;
+        }
+    }
+    int stop = logstore->stop;
+    pthread_mutex_unlock(&logstore->gc_lock);
+
+    return stop;
+}
+
+/* ================ logstore_gc_flush() ================ */
+/* Append the batch, puts only take over the index while it still points
+ * at their old place, writers may have replaced them since. */
+static int logstore_gc_flush(logstore_t *logstore, gc_batch_t *batch)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&logstore->write_lock);
+
+    uint32_t total_writes = 0;
+    for ( uint32_t i = 0 ; i < batch->total_writes ; i++ ){
+        log_write_t *w = &batch->writes[i];
+        if ( w->header.type == LOG_RECORD_PUT ){
+            log_location_t location;
+            if ( !logindex_get(logstore, &w->header.slice_key, &location) ||
+                    location.segment_id != batch->old_locations[i].segment_id || location.offset != batch->old_locations[i].offset ){
+                continue;
+            }
+        }
+        batch->writes[total_writes] = *w;
+        batch->old_locations[total_writes] = batch->old_locations[i];
+        total_writes++;
+    }
+
+    if ( total_writes > 0 ){
+        rc = logstore_append(logstore, batch->writes, total_writes);
+        if ( rc == 0 ){
+            pthread_rwlock_wrlock(&logstore->lock);
+            for ( uint32_t i = 0 ; i < total_writes ; i++ ){
+                log_write_t *w = &batch->writes[i];
+                if ( w->header.type == LOG_RECORD_PUT ){
+                    logindex_put(logstore, &w->header.slice_key, &w->location);
+                }
+            }
+            pthread_rwlock_unlock(&logstore->lock);
+        }
+    }
+
+    logstore_end_write(logstore);
+
+    return rc;
+}
+
+/* ================ logstore_gc_keep() ================ */
+/* Whether the record at offset of segment has to move on. */
+static int logstore_gc_keep(logstore_t *logstore, log_segment_t *segment, uint64_t offset, const log_record_header_t *header)
+{
+    int keep = 0;
+
+    pthread_rwlock_rdlock(&logstore->lock);
+    if ( header->type == LOG_RECORD_PUT ){
+        log_location_t location;
+        keep = logindex_get(logstore, &header->slice_key, &location) &&
+            location.segment_id == segment->id && location.offset == offset;
+    } else if ( header->type == LOG_RECORD_DELETE ){
+        /* Once that segment is gone the tombstone has nothing to kill. */
+        keep = header->deleted_segment_id != segment->id && logstore_segment(logstore, header->deleted_segment_id) != NULL;
+    }
+    pthread_rwlock_unlock(&logstore->lock);
+
+    return keep;
+}
+
+/* ================ logstore_gc_segment() ================ */
+static void logstore_gc_segment(logstore_t *logstore, log_segment_t *segment)
+{
+    notice_log("logstore %s collecting segment %d. live_bytes:%llu size:%llu", logstore->dir, segment->id,
+            (unsigned long long)segment->live_bytes, (unsigned long long)segment->size);
+
+    gc_batch_t *batch = (gc_batch_t*)zmalloc(sizeof(gc_batch_t));
+    memset(batch, 0, sizeof(gc_batch_t));
+
+    double tokens = 0;
+    uint64_t refill_usec = now_usec();
+    uint64_t moved_bytes = 0;
+    int rc = 0;
+    int stop = 0;
+    uint64_t offset = 0;
+    while ( offset < segment->size && rc == 0 && !stop ){
+        log_record_header_t header;
+        if ( pread(segment->fd, &header, sizeof(header), offset) != sizeof(header) || header.magic != LOG_RECORD_MAGIC ){
+            rc = -1;
+            break;
+        }
+        uint64_t record_offset = offset;
+        offset += record_size(header.size);
+        if ( !logstore_gc_keep(logstore, segment, record_offset, &header) ){
+            continue;
+        }
+
+        char *data = NULL;
+        if ( header.size > 0 ){
+            data = (char*)zmalloc(header.size);
+            if ( pread(segment->fd, data, header.size, record_offset + sizeof(header)) != (ssize_t)header.size ||
+                    record_crc(&header, data) != header.crc ){
+                error_log("Bad record in segment %d at %llu, GC gives up on it.", segment->id, (unsigned long long)record_offset);
+                zfree(data);
+                rc = -1;
+                break;
+            }
+        }
+
+        uint32_t n = batch->total_writes++;
+        batch->writes[n].header = header;
+        batch->writes[n].data = data;
+        batch->datas[n] = data;
+        batch->old_locations[n].segment_id = segment->id;
+        batch->old_locations[n].size = header.size;
+        batch->old_locations[n].offset = record_offset;
+        batch->total_bytes += record_size(header.size);
+
+        if ( batch->total_bytes >= GC_BATCH_BYTES || batch->total_writes >= GC_BATCH_BYTES / 4096 || offset >= segment->size ){
+            rc = logstore_gc_flush(logstore, batch);
+            moved_bytes += batch->total_bytes;
+
+            uint64_t wait_usec = 0;
+            if ( logstore->gc_rate > 0 ){
+                uint64_t now = now_usec();
+                tokens += (double)(now - refill_usec) * logstore->gc_rate / 1000000.0;
+                if ( tokens > logstore->gc_rate ){
+                    tokens = logstore->gc_rate;
+                }
+                refill_usec = now;
+                tokens -= batch->total_bytes;
+                if ( tokens < 0 ){
+                    wait_usec = (uint64_t)(-tokens * 1000000.0 / logstore->gc_rate);
+                }
+            }
+            gc_batch_release(batch);
+            stop = logstore_gc_sleep(logstore, wait_usec);
+        }
+    }
+    if ( batch->total_writes > 0 && rc == 0 && !stop ){
+        rc = logstore_gc_flush(logstore, batch);
+        moved_bytes += batch->total_bytes;
+    }
+    gc_batch_release(batch);
+    zfree(batch);
+
+    if ( stop ){
+        return;
+    }
+
+    pthread_mutex_lock(&logstore->write_lock);
+    pthread_rwlock_wrlock(&logstore->lock);
+    int removed = 0;
+    if ( rc == 0 && segment->live_bytes == 0 ){
+        logstore->segments[segment->id - logstore->first_segment_id] = NULL;
+        segment->removed = 1;
+        removed = 1;
+    } else {
+        segment->gc_failed = 1;
+    }
+    pthread_rwlock_unlock(&logstore->lock);
+    pthread_mutex_unlock(&logstore->write_lock);
+
+    if ( removed ){
+        logstore->total_gc_bytes += moved_bytes;
+        logstore->total_gc_segments++;
+        notice_log("logstore %s removed segment %d, %llu bytes moved.", logstore->dir, segment->id, (unsigned long long)moved_bytes);
+        log_segment_unref(segment);
+    } else {
+        warning_log("logstore %s could not collect segment %d.", logstore->dir, segment->id);
+    }
+}
+
+/* ================ logstore_gc_pick() ================ */
+/* The sealed segment with the lowest live ratio under the threshold,
+ * pinned for the caller. */
+static log_segment_t *logstore_gc_pick(logstore_t *logstore)
+{
+    log_segment_t *victim = NULL;
+    double min_ratio = logstore->gc_threshold / 100.0;
+
+    pthread_rwlock_rdlock(&logstore->lock);
+    for ( uint32_t i = 0 ; i < logstore->max_segments ; i++ ){
+        log_segment_t *segment = logstore->segments[i];
+        if ( segment == NULL || segment == logstore->active_segment || segment->gc_failed || segment->size == 0 ){
+            continue;
+        }
+        double ratio = (double)segment->live_bytes / segment->size;
+        if ( ratio < min_ratio ){
+            min_ratio = ratio;
+            victim = segment;
+        }
+    }
+    if ( victim != NULL ){
+        __sync_add_and_fetch(&victim->refs, 1);
+    }
+    pthread_rwlock_unlock(&logstore->lock);
+
+    return victim;
+}
+
+/* ================ logstore_gc_thread() ================ */
+static void *logstore_gc_thread(void *arg)
+{
+    logstore_t *logstore = (logstore_t*)arg;
+
+    while ( !logstore_gc_sleep(logstore, GC_CHECK_INTERVAL_MSEC * 1000L) ){
+        log_segment_t *segment;
+        while ( (segment = logstore_gc_pick(logstore)) != NULL ){
+            logstore_gc_segment(logstore, segment);
+            log_segment_unref(segment);
+            if ( logstore->stop ){
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* ================ logstore_new() ================ */
+logstore_t *logstore_new(const char *dir, uint64_t max_segment_size, uint32_t gc_threshold, uint64_t gc_rate)
+{
+    logstore_t *logstore = (logstore_t*)zmalloc(sizeof(logstore_t));
+    memset(logstore, 0, sizeof(logstore_t));
+
+    snprintf(logstore->dir, NAME_MAX, "%s", dir);
+    logstore->max_segment_size = max_segment_size;
+    logstore->gc_threshold = gc_threshold;
+    logstore->gc_rate = gc_rate;
+
+    pthread_mutex_init(&logstore->write_lock, NULL);
+    pthread_rwlock_init(&logstore->lock, NULL);
+    pthread_mutex_init(&logstore->gc_lock, NULL);
+    pthread_cond_init(&logstore->gc_cond, NULL);
+
+    logindex_alloc_slots(logstore, LOGSTORE_MIN_SLOTS);
+
+    if ( logstore_recover(logstore) != 0 ){
+        logstore_free(logstore);
+        return NULL;
+    }
+
+    if ( gc_threshold > 0 ){
+        if ( pthread_create(&logstore->gc_thread, NULL, logstore_gc_thread, logstore) == 0 ){
+            logstore->gc_started = 1;
+        } else {
+            error_log("Start logstore GC thread failed. dir:%s", dir);
+        }
+    }
+
+    return logstore;
+}
+
+/* ================ logstore_free() ================ */
+void logstore_free(logstore_t *logstore)
+{
+    if ( logstore->gc_started ){
+        pthread_mutex_lock(&logstore->gc_lock);
+        logstore->stop = 1;
+        pthread_cond_signal(&logstore->gc_cond);
+        pthread_mutex_unlock(&logstore->gc_lock);
+        pthread_join(logstore->gc_thread, NULL);
+        notice_log("logstore %s GC removed %d segments, %llu bytes moved.", logstore->dir,
+                logstore->total_gc_segments, (unsigned long long)logstore->total_gc_bytes);
+    }
+
+    if ( logstore->active_segment != NULL ){
+        logstore_save_snapshot(logstore);
+    }
+
+    for ( uint32_t i = 0 ; i < logstore->max_segments ; i++ ){
+        if ( logstore->segments[i] != NULL ){
+            log_segment_unref(logstore->segments[i]);
+            logstore->segments[i] = NULL;
+        }
+    }
+    if ( logstore->segments != NULL ){
+        zfree(logstore->segments);
+    }
+    for ( uint32_t i = 0 ; i < logstore->total_slots ; i++ ){
+        if ( logstore->slots[i].slices != NULL ){
+            zfree(logstore->slots[i].slices);
+        }
+    }
+    zfree(logstore->slots);
+
+    pthread_cond_destroy(&logstore->gc_cond);
+    pthread_mutex_destroy(&logstore->gc_lock);
+    pthread_rwlock_destroy(&logstore->lock);
+    pthread_mutex_destroy(&logstore->write_lock);
+
+    zfree(logstore);
+}
+
@@ -0,0 +1,54 @@
+/**
+ * @file   logstore.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-26 09:12:40
+ *
+ * @brief  Append-only segment files holding the slices of a
+ *         BUCKETDB_LOGFILE bucketdb.
+ *
+ *
+ */
+
+#ifndef __LOGSTORE_H__
+#define __LOGSTORE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "md5.h"
+
+typedef struct slice_t slice_t;
+typedef struct slice_key_t slice_key_t;
+typedef struct kvdb_view_t kvdb_view_t;
+typedef struct logstore_t logstore_t;
+
+/* Called by logstore_delete_object() for every deleted slice. */
+typedef void (logstore_deleted_fn)(void *user_data, const slice_key_t *slice_key);
+
+/* Opens the segments under dir and rebuilds the index from the last
+ * checkpoint and the records behind it. Segments roll over once they pass
+ * max_segment_size. Sealed segments whose live data falls below
+ * gc_threshold percent are rewritten by a background thread copying at
+ * most gc_rate bytes per second, gc_threshold 0 disables it. */
+logstore_t *logstore_new(const char *dir, uint64_t max_segment_size, uint32_t gc_threshold, uint64_t gc_rate);
+/* Stops the GC thread and leaves a checkpoint for the next open. */
+void logstore_free(logstore_t *logstore);
+
+/* Appends all slices with one fdatasync, readers see them once it is done. */
+int logstore_write_slices(logstore_t *logstore, slice_t **slices, uint32_t total_slices);
+/* A record failing its CRC with verify set reads as missing. */
+slice_t *logstore_read_slice(logstore_t *logstore, md5_value_t key_md5, uint32_t slice_idx, int verify);
+kvdb_view_t *logstore_read_view(logstore_t *logstore, md5_value_t key_md5, uint32_t slice_idx, int verify);
+/* Returns 1 if the slice was deleted, 0 if it is not there, -1 on error. */
+int logstore_delete_slice(logstore_t *logstore, md5_value_t key_md5, uint32_t slice_idx);
+/* Delete every slice of the object, *total_deleted counts them. */
+int logstore_delete_object(logstore_t *logstore, md5_value_t key_md5, logstore_deleted_fn *deleted_fn, void *user_data, uint32_t *total_deleted);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __LOGSTORE_H__
+
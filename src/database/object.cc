@@ -92,6 +92,25 @@ slice_t *slice_read_from_kvdb(kvdb_t *kvdb, md5_value_t key_md5, uint32_t slice_
     return slice;
 }
 
+/* ==================== slice_read_view_from_kvdb() ==================== */
+kvdb_view_t *slice_read_view_from_kvdb(kvdb_t *kvdb, md5_value_t key_md5, uint32_t slice_idx)
+{
+    slice_key_t slice_key;
+    slice_key.key_md5 = key_md5;
+    slice_key.slice_idx = slice_idx;
+
+    uint32_t slice_key_len = sizeof(slice_key_t);
+
+    kvdb_view_t *view = NULL;
+    int rc = kvdb_get_view(kvdb, (char*)&slice_key, slice_key_len, &view);
+    if ( rc == 0 && view != NULL && view->size == 0 ){
+        kvdb_view_release(view);
+        view = NULL;
+    }
+
+    return view;
+}
+
 /* ==================== slice_delete_from_kvdb() ==================== */
 int slice_delete_from_kvdb(kvdb_t *kvdb, md5_value_t key_md5, uint32_t slice_idx)
 {
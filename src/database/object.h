@@ -16,6 +16,7 @@
 #include "md5.h"
 
 typedef struct kvdb_t kvdb_t;
+typedef struct kvdb_view_t kvdb_view_t;
 
 typedef struct slice_key_t {
     md5_value_t key_md5;
@@ -26,6 +27,10 @@ typedef struct slice_t {
     slice_key_t slice_key;
     uint32_t size;
     char *data;
+    /* CRC32C of data, filled in by the bucketdb on the way to storage. */
+    uint32_t crc;
+    /* Encoding of data, see slicecodec.h. */
+    uint32_t codec;
 } slice_t;
 
 slice_t *slice_new(md5_value_t key_md5, uint32_t slice_idx, const char *data, uint32_t data_size);
@@ -33,9 +38,18 @@ void slice_free(slice_t *slice);
 void slice_attach_data(slice_t *slice, char *data, uint32_t data_size);
 int slice_write_to_kvdb(kvdb_t *kvdb, slice_t *slice);
 slice_t *slice_read_from_kvdb(kvdb_t *kvdb, md5_value_t key_md5, uint32_t slice_idx);
+kvdb_view_t *slice_read_view_from_kvdb(kvdb_t *kvdb, md5_value_t key_md5, uint32_t slice_idx);
 int slice_delete_from_kvdb(kvdb_t *kvdb, md5_value_t key_md5, uint32_t slice_idx);
 
 
+/* -------------------- object_header_t -------------------- */
+/* Stored with slice 0 of a chunked object. */
+typedef struct object_header_t {
+    uint64_t object_size;
+    uint32_t nslices;
+    uint32_t slice_size;
+} object_header_t;
+
 /* -------------------- object_t -------------------- */
 typedef struct object_t
 {
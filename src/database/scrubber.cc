@@ -0,0 +1,277 @@
+/**
+ * @file   scrubber.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-27 10:22:40
+ *
+ * @brief  Background checksum verification of stored slices.
+ *
+ * Reads sample only part of the slices and cold data may not be read for
+ * months, so the scrubber thread walks every slicedb once a day and checks
+ * each live slice against the CRC32C kept in the sliceindex. The scan runs
+ * in small batches spaced out by a token bucket. Suspects are re-read
+ * under the write lock after the batch, a mismatch that survives that is
+ * logged and counted in bucketdb->total_corrupt_slices.
+ *
+ */
+
+#include "common.h"
+#include "zmalloc.h"
+#include "logger.h"
+#include "kvdb.h"
+#include "object.h"
+#include "bucketdb.h"
+#include "scrubber.h"
+
+/* Let the worker warm up before the first pass. */
+#define SCRUB_START_DELAY_SEC 600
+#define SCRUB_PASS_INTERVAL_SEC (24 * 3600)
+#define SCRUB_BATCH_SLICES 256
+#define SCRUB_BATCH_BYTES (4 * 1024 * 1024)
+
+/* -------- struct scrubber_t -------- */
+typedef struct scrubber_t {
+    bucketdb_t *bucketdb;
+    uint64_t rate;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+
+    /* Token bucket, in bytes. */
+    double tokens;
+    uint64_t refill_usec;
+
+    uint32_t total_passes;
+    uint32_t total_corrupt;
+} scrubber_t;
+
+/* -------- struct scrub_batch_t -------- */
+typedef struct scrub_batch_t {
+    bucketdb_t *bucketdb;
+    uint32_t slicedb_id;
+
+    uint32_t total_slices;
+    uint64_t total_bytes;
+
+    /* Failed the check inside the scan, confirmed after it. */
+    slice_key_t suspects[SCRUB_BATCH_SLICES];
+    uint32_t total_suspects;
+
+    slice_key_t last_key;
+    int has_last_key;
+    int full;
+} scrub_batch_t;
+
+/* ================ now_usec() ================ */
+static uint64_t now_usec(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+}
+
+/* ================ scrubber_sleep() ================ */
+/* Returns non-zero when the scrubber is asked to stop. */
+static int scrubber_sleep(scrubber_t *scrubber, uint64_t usec)
+{
+    uint64_t deadline_usec = now_usec() + usec;
+    struct timespec deadline;
+    deadline.tv_sec = deadline_usec / 1000000L;
+    deadline.tv_nsec = (deadline_usec % 1000000L) * 1000L;
+
+    pthread_mutex_lock(&scrubber->lock);
+    while ( !scrubber->stop ){
+        if ( pthread_cond_timedwait(&scrubber->cond, &scrubber->lock, &deadline) == ETIMEDOUT ){
+            break;
+        }
+    }
+    int stop = scrubber->stop;
+    pthread_mutex_unlock(&scrubber->lock);
+
+    return stop;
+}
+
+/* ================ scrubber_throttle() ================ */
+static int scrubber_throttle(scrubber_t *scrubber, uint64_t bytes)
+{
+    uint64_t now = now_usec();
+    scrubber->tokens += (double)(now - scrubber->refill_usec) * scrubber->rate / 1000000.0;
+    if ( scrubber->tokens > scrubber->rate ){
+        scrubber->tokens = scrubber->rate;
+    }
+    scrubber->refill_usec = now;
+
+    scrubber->tokens -= bytes;
+    uint64_t wait_usec = 0;
+    if ( scrubber->tokens < 0 ){
+        wait_usec = (uint64_t)(-scrubber->tokens * 1000000.0 / scrubber->rate);
+    }
+
+    return scrubber_sleep(scrubber, wait_usec);
+}
+
+/* ================ verify_stored_slice() ================ */
+/* Runs inside the scan's read transaction, nothing here may open another. */
+static int verify_stored_slice(void *user_data, const char *key, uint32_t klen, const char *value, uint32_t vlen)
+{
+    scrub_batch_t *batch = (scrub_batch_t*)user_data;
+
+    if ( klen != sizeof(slice_key_t) ){
+        return 0;
+    }
+    /* The scan resumes at the last key of the previous batch. */
+    if ( batch->has_last_key && memcmp(key, &batch->last_key, sizeof(slice_key_t)) == 0 ){
+        return 0;
+    }
+    if ( batch->total_slices >= SCRUB_BATCH_SLICES || batch->total_bytes >= SCRUB_BATCH_BYTES ){
+        batch->full = 1;
+        return 1;
+    }
+
+    memcpy(&batch->last_key, key, sizeof(slice_key_t));
+    batch->has_last_key = 1;
+
+    const slice_key_t *slice_key = (const slice_key_t*)key;
+    if ( bucketdb_verify_slice(batch->bucketdb, slice_key, batch->slicedb_id, value, vlen) < 0 ){
+        batch->suspects[batch->total_suspects++] = *slice_key;
+    }
+    batch->total_slices++;
+    batch->total_bytes += vlen;
+
+    return 0;
+}
+
+/* ================ scrubber_scrub_slicedb() ================ */
+/* Returns non-zero when the scrubber is asked to stop. */
+static int scrubber_scrub_slicedb(scrubber_t *scrubber, uint32_t slicedb_id, uint64_t *total_slices, uint64_t *total_bytes)
+{
+    bucketdb_t *bucketdb = scrubber->bucketdb;
+
+    slicedb_t *slicedb = bucketdb_acquire_slicedb(bucketdb, slicedb_id);
+    if ( slicedb == NULL ){
+        return 0;
+    }
+
+    int stop = 0;
+    scrub_batch_t batch;
+    memset(&batch, 0, sizeof(scrub_batch_t));
+    batch.bucketdb = bucketdb;
+    batch.slicedb_id = slicedb_id;
+
+    do {
+        batch.total_slices = 0;
+        batch.total_bytes = 0;
+        batch.total_suspects = 0;
+        batch.full = 0;
+
+        if ( kvdb_scan(slicedb->kvdb, batch.has_last_key ? (const char*)&batch.last_key : NULL, sizeof(slice_key_t), verify_stored_slice, &batch) != 0 ){
+            error_log("Scan slicedb failed. bucketdb->id:%d slicedb_id:%d", bucketdb->id, slicedb_id);
+            break;
+        }
+
+        for ( uint32_t i = 0 ; i < batch.total_suspects ; i++ ){
+            if ( bucketdb_confirm_corrupt_slice(bucketdb, &batch.suspects[i]) < 0 ){
+                scrubber->total_corrupt++;
+            }
+        }
+        *total_slices += batch.total_slices;
+        *total_bytes += batch.total_bytes;
+
+        stop = scrubber_throttle(scrubber, batch.total_bytes);
+    } while ( batch.full && !stop );
+
+    bucketdb_release_slicedb(bucketdb, slicedb);
+
+    return stop;
+}
+
+/* ================ scrubber_scrub_bucketdb() ================ */
+static int scrubber_scrub_bucketdb(scrubber_t *scrubber)
+{
+    bucketdb_t *bucketdb = scrubber->bucketdb;
+
+    uint64_t start_usec = now_usec();
+    uint32_t total_corrupt = scrubber->total_corrupt;
+    uint64_t total_slices = 0;
+    uint64_t total_bytes = 0;
+
+    int stop = 0;
+    for ( uint32_t db_id = 0 ; db_id < SLICEDB_MAX && !stop ; db_id++ ){
+        uint64_t live_bytes = 0;
+        uint64_t dbsize = 0;
+        /* Skip the ids not in use without opening anything. */
+        if ( bucketdb_get_slicedb_usage(bucketdb, db_id, &live_bytes, &dbsize) != 0 ){
+            continue;
+        }
+        stop = scrubber_scrub_slicedb(scrubber, db_id, &total_slices, &total_bytes);
+    }
+
+    if ( !stop ){
+        scrubber->total_passes++;
+        notice_log("bucketdb(%d) scrubbed %llu slices, %llu bytes in %llu sec. corrupt:%d",
+                bucketdb->id, (unsigned long long)total_slices, (unsigned long long)total_bytes,
+                (unsigned long long)((now_usec() - start_usec) / 1000000L), scrubber->total_corrupt - total_corrupt);
+    }
+
+    return stop;
+}
+
+/* ================ scrubber_thread_main() ================ */
+static void *scrubber_thread_main(void *user_data)
+{
+    scrubber_t *scrubber = (scrubber_t*)user_data;
+
+    uint64_t interval_sec = SCRUB_START_DELAY_SEC;
+    while ( !scrubber_sleep(scrubber, interval_sec * 1000000L) ){
+        if ( scrubber_scrub_bucketdb(scrubber) ){
+            break;
+        }
+        interval_sec = SCRUB_PASS_INTERVAL_SEC;
+    }
+
+    return NULL;
+}
+
+/* ================ scrubber_new() ================ */
+scrubber_t *scrubber_new(bucketdb_t *bucketdb, uint64_t rate)
+{
+    scrubber_t *scrubber = (scrubber_t*)zmalloc(sizeof(scrubber_t));
+    memset(scrubber, 0, sizeof(scrubber_t));
+
+    scrubber->bucketdb = bucketdb;
+    scrubber->rate = rate;
+    scrubber->tokens = rate;
+    scrubber->refill_usec = now_usec();
+
+    pthread_mutex_init(&scrubber->lock, NULL);
+    pthread_cond_init(&scrubber->cond, NULL);
+
+    if ( pthread_create(&scrubber->thread, NULL, scrubber_thread_main, scrubber) != 0 ){
+        error_log("Start scrubber failed. bucketdb->id:%d", bucketdb->id);
+        pthread_cond_destroy(&scrubber->cond);
+        pthread_mutex_destroy(&scrubber->lock);
+        zfree(scrubber);
+        return NULL;
+    }
+
+    return scrubber;
+}
+
+/* ================ scrubber_free() ================ */
+void scrubber_free(scrubber_t *scrubber)
+{
+    pthread_mutex_lock(&scrubber->lock);
+    scrubber->stop = 1;
+    pthread_cond_broadcast(&scrubber->cond);
+    pthread_mutex_unlock(&scrubber->lock);
+
+    pthread_join(scrubber->thread, NULL);
+
+    notice_log("bucketdb(%d) scrubber finished %d passes, found %d corrupt slices.",
+            scrubber->bucketdb->id, scrubber->total_passes, scrubber->total_corrupt);
+
+    pthread_cond_destroy(&scrubber->cond);
+    pthread_mutex_destroy(&scrubber->lock);
+    zfree(scrubber);
+}
@@ -0,0 +1,33 @@
+/**
+ * @file   scrubber.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-27 10:21:17
+ *
+ * @brief  Background checksum verification of stored slices.
+ *
+ *
+ */
+
+#ifndef __SCRUBBER_H__
+#define __SCRUBBER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct bucketdb_t bucketdb_t;
+typedef struct scrubber_t scrubber_t;
+
+/* Starts the scrubber thread, it reads at most rate bytes per second. */
+scrubber_t *scrubber_new(bucketdb_t *bucketdb, uint64_t rate);
+/* Stops the thread, waiting for the batch in progress. */
+void scrubber_free(scrubber_t *scrubber);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SCRUBBER_H__
+
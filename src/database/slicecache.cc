@@ -0,0 +1,338 @@
+/**
+ * @file   slicecache.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-18 09:13:22
+ *
+ * @brief  Segmented LRU slice cache.
+ *
+ * New entries start in the probation segment. A second hit promotes an
+ * entry to the protected segment, which holds at most 80% of the capacity
+ * and demotes its own tail back to probation. Victims are taken from the
+ * probation tail first, so one pass over cold keys can not flush the hot
+ * set, which matters with our skewed read traffic.
+ *
+ * Entries are refcounted. The cache holds one reference while an entry is
+ * linked and every view handed out holds another, the last one frees it.
+ * Views may be released on a zmq I/O thread, hence the atomic counter.
+ *
+ */
+
+#include "common.h"
+#include "zmalloc.h"
+#include "logger.h"
+#include "kvdb.h"
+#include "object.h"
+#include "slicecache.h"
+
+#define SLICECACHE_PROBATION 0
+#define SLICECACHE_PROTECTED 1
+
+/* Slices bigger than this share of the capacity are never cached. */
+#define SLICECACHE_MAX_ENTRY_RATIO 8
+#define SLICECACHE_PROTECTED_PERCENT 80
+#define SLICECACHE_INIT_BUCKETS 1024
+
+/* -------- struct cache_entry_t -------- */
+typedef struct cache_entry_t {
+    slice_key_t slice_key;
+    struct cache_entry_t *hash_next;
+    struct cache_entry_t *prev;
+    struct cache_entry_t *next;
+    int segment;
+    volatile uint32_t refs;
+    uint32_t size;
+    char data[0];
+} cache_entry_t;
+
+/* -------- struct cache_segment_t -------- */
+typedef struct cache_segment_t {
+    cache_entry_t *head;
+    cache_entry_t *tail;
+    uint64_t used_bytes;
+} cache_segment_t;
+
+/* -------- struct slicecache_t -------- */
+typedef struct slicecache_t {
+    pthread_mutex_t lock;
+
+    cache_entry_t **buckets;
+    uint32_t total_buckets;
+    uint32_t total_entries;
+
+    cache_segment_t segments[2];
+    uint64_t capacity;
+    uint64_t protected_capacity;
+    uint64_t generation;
+
+    slicecache_stats_t stats;
+} slicecache_t;
+
+/* ================ cache_entry_release() ================ */
+static void cache_entry_release(cache_entry_t *entry)
+{
+    if ( __sync_sub_and_fetch(&entry->refs, 1) == 0 ){
+        zfree(entry);
+    }
+}
+
+/* ================ slicecache_release_view() ================ */
+static void slicecache_release_view(kvdb_view_t *view)
+{
+    cache_entry_release((cache_entry_t*)view->handle);
+}
+
+/* ================ cache_entry_view() ================ */
+/* Called with the lock held, the entry is linked so refs can't drop to 0. */
+static kvdb_view_t *cache_entry_view(cache_entry_t *entry)
+{
+    __sync_add_and_fetch(&entry->refs, 1);
+    return kvdb_view_new(entry->data, entry->size, slicecache_release_view, entry);
+}
+
+/* ================ slice_key_hash() ================ */
+static inline uint32_t slice_key_hash(const slice_key_t *slice_key)
+{
+    /* md5 is already well mixed. */
+    return slice_key->key_md5.h0 ^ (slice_key->slice_idx * 0x9E3779B1U);
+}
+
+/* ================ slice_key_equal() ================ */
+static inline int slice_key_equal(const slice_key_t *a, const slice_key_t *b)
+{
+    return a->slice_idx == b->slice_idx && memcmp(&a->key_md5, &b->key_md5, sizeof(md5_value_t)) == 0;
+}
+
+/* ================ segment_unlink() ================ */
+static void segment_unlink(cache_segment_t *segment, cache_entry_t *entry)
+{
+    if ( entry->prev != NULL ) entry->prev->next = entry->next;
+    else segment->head = entry->next;
+    if ( entry->next != NULL ) entry->next->prev = entry->prev;
+    else segment->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+    segment->used_bytes -= entry->size;
+}
+
+/* ================ segment_push_front() ================ */
+static void segment_push_front(cache_segment_t *segment, cache_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = segment->head;
+    if ( segment->head != NULL ) segment->head->prev = entry;
+    else segment->tail = entry;
+    segment->head = entry;
+    segment->used_bytes += entry->size;
+}
+
+/* ================ slicecache_find_slot() ================ */
+static cache_entry_t **slicecache_find_slot(slicecache_t *cache, const slice_key_t *slice_key)
+{
+    cache_entry_t **slot = &cache->buckets[slice_key_hash(slice_key) & (cache->total_buckets - 1)];
+    while ( *slot != NULL && !slice_key_equal(&(*slot)->slice_key, slice_key) ){
+        slot = &(*slot)->hash_next;
+    }
+    return slot;
+}
+
+/* ================ slicecache_rehash() ================ */
+static void slicecache_rehash(slicecache_t *cache)
+{
+    uint32_t total_buckets = cache->total_buckets * 2;
+    cache_entry_t **buckets = (cache_entry_t**)zmalloc(sizeof(cache_entry_t*) * total_buckets);
+    memset(buckets, 0, sizeof(cache_entry_t*) * total_buckets);
+
+    for ( uint32_t i = 0 ; i < cache->total_buckets ; i++ ){
+        cache_entry_t *entry = cache->buckets[i];
+        while ( entry != NULL ){
+            cache_entry_t *next = entry->hash_next;
+            uint32_t n = slice_key_hash(&entry->slice_key) & (total_buckets - 1);
+            entry->hash_next = buckets[n];
+            buckets[n] = entry;
+            entry = next;
+        }
+    }
+
+    zfree(cache->buckets);
+    cache->buckets = buckets;
+    cache->total_buckets = total_buckets;
+}
+
+/* ================ slicecache_remove() ================ */
+static void slicecache_remove(slicecache_t *cache, cache_entry_t **slot)
+{
+    cache_entry_t *entry = *slot;
+    *slot = entry->hash_next;
+    segment_unlink(&cache->segments[entry->segment], entry);
+    cache->total_entries--;
+    cache_entry_release(entry);
+}
+
+/* ================ slicecache_evict() ================ */
+static void slicecache_evict(slicecache_t *cache)
+{
+    while ( cache->segments[SLICECACHE_PROBATION].used_bytes + cache->segments[SLICECACHE_PROTECTED].used_bytes > cache->capacity ){
+        cache_entry_t *victim = cache->segments[SLICECACHE_PROBATION].tail;
+        if ( victim == NULL ){
+            victim = cache->segments[SLICECACHE_PROTECTED].tail;
+        }
+        if ( victim == NULL ){
+            break;
+        }
+        slicecache_remove(cache, slicecache_find_slot(cache, &victim->slice_key));
+        cache->stats.evictions++;
+    }
+}
+
+/* ================ slicecache_new() ================ */
+slicecache_t *slicecache_new(uint64_t capacity)
+{
+    slicecache_t *cache = (slicecache_t*)zmalloc(sizeof(slicecache_t));
+    memset(cache, 0, sizeof(slicecache_t));
+
+    pthread_mutex_init(&cache->lock, NULL);
+
+    cache->capacity = capacity;
+    cache->protected_capacity = capacity / 100 * SLICECACHE_PROTECTED_PERCENT;
+    cache->total_buckets = SLICECACHE_INIT_BUCKETS;
+    cache->buckets = (cache_entry_t**)zmalloc(sizeof(cache_entry_t*) * cache->total_buckets);
+    memset(cache->buckets, 0, sizeof(cache_entry_t*) * cache->total_buckets);
+
+    return cache;
+}
+
+/* ================ slicecache_free() ================ */
+void slicecache_free(slicecache_t *cache)
+{
+    for ( uint32_t i = 0 ; i < cache->total_buckets ; i++ ){
+        while ( cache->buckets[i] != NULL ){
+            slicecache_remove(cache, &cache->buckets[i]);
+        }
+    }
+    zfree(cache->buckets);
+
+    pthread_mutex_destroy(&cache->lock);
+
+    zfree(cache);
+}
+
+/* ================ slicecache_get() ================ */
+kvdb_view_t *slicecache_get(slicecache_t *cache, const slice_key_t *slice_key)
+{
+    kvdb_view_t *view = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache_entry_t *entry = *slicecache_find_slot(cache, slice_key);
+    if ( entry != NULL ){
+        segment_unlink(&cache->segments[entry->segment], entry);
+        if ( entry->segment == SLICECACHE_PROBATION ){
+            entry->segment = SLICECACHE_PROTECTED;
+        }
+        segment_push_front(&cache->segments[entry->segment], entry);
+
+        cache_segment_t *protected_segment = &cache->segments[SLICECACHE_PROTECTED];
+        while ( protected_segment->used_bytes > cache->protected_capacity && protected_segment->tail != entry ){
+            cache_entry_t *demoted = protected_segment->tail;
+            segment_unlink(protected_segment, demoted);
+            demoted->segment = SLICECACHE_PROBATION;
+            segment_push_front(&cache->segments[SLICECACHE_PROBATION], demoted);
+        }
+
+        view = cache_entry_view(entry);
+        cache->stats.hits++;
+    } else {
+        cache->stats.misses++;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return view;
+}
+
+/* ================ slicecache_generation() ================ */
+uint64_t slicecache_generation(slicecache_t *cache)
+{
+    pthread_mutex_lock(&cache->lock);
+    uint64_t generation = cache->generation;
+    pthread_mutex_unlock(&cache->lock);
+
+    return generation;
+}
+
+/* ================ slicecache_put() ================ */
+kvdb_view_t *slicecache_put(slicecache_t *cache, const slice_key_t *slice_key, const char *data, uint32_t data_size, uint64_t generation)
+{
+    if ( data_size > cache->capacity / SLICECACHE_MAX_ENTRY_RATIO ){
+        return NULL;
+    }
+
+    cache_entry_t *entry = (cache_entry_t*)zmalloc(sizeof(cache_entry_t) + data_size);
+    memset(entry, 0, sizeof(cache_entry_t));
+    entry->slice_key = *slice_key;
+    entry->segment = SLICECACHE_PROBATION;
+    entry->refs = 1;
+    entry->size = data_size;
+    if ( data_size > 0 ){
+        memcpy(entry->data, data, data_size);
+    }
+
+    kvdb_view_t *view = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+
+    if ( generation == cache->generation ){
+        cache_entry_t **slot = slicecache_find_slot(cache, slice_key);
+        if ( *slot != NULL ){
+            /* Another reader was faster. */
+            slicecache_remove(cache, slot);
+        }
+
+        if ( cache->total_entries >= cache->total_buckets ){
+            slicecache_rehash(cache);
+        }
+        slot = &cache->buckets[slice_key_hash(slice_key) & (cache->total_buckets - 1)];
+        entry->hash_next = *slot;
+        *slot = entry;
+        segment_push_front(&cache->segments[SLICECACHE_PROBATION], entry);
+        cache->total_entries++;
+        cache->stats.inserts++;
+
+        view = cache_entry_view(entry);
+        slicecache_evict(cache);
+    } else {
+        zfree(entry);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return view;
+}
+
+/* ================ slicecache_invalidate() ================ */
+void slicecache_invalidate(slicecache_t *cache, const slice_key_t *slice_key)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    cache->generation++;
+    cache_entry_t **slot = slicecache_find_slot(cache, slice_key);
+    if ( *slot != NULL ){
+        slicecache_remove(cache, slot);
+        cache->stats.invalidations++;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* ================ slicecache_get_stats() ================ */
+void slicecache_get_stats(slicecache_t *cache, slicecache_stats_t *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    *stats = cache->stats;
+    stats->used_bytes = cache->segments[SLICECACHE_PROBATION].used_bytes + cache->segments[SLICECACHE_PROTECTED].used_bytes;
+    stats->capacity = cache->capacity;
+    stats->total_entries = cache->total_entries;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
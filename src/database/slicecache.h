@@ -0,0 +1,61 @@
+/**
+ * @file   slicecache.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-18 09:12:40
+ *
+ * @brief  Memory bounded cache of hot slices for one bucketdb.
+ *
+ *
+ */
+
+#ifndef __SLICECACHE_H__
+#define __SLICECACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct slice_key_t slice_key_t;
+typedef struct kvdb_view_t kvdb_view_t;
+typedef struct slicecache_t slicecache_t;
+
+/* -------- struct slicecache_stats_t -------- */
+typedef struct slicecache_stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint64_t used_bytes;
+    uint64_t capacity;
+    uint32_t total_entries;
+} slicecache_stats_t;
+
+slicecache_t *slicecache_new(uint64_t capacity);
+void slicecache_free(slicecache_t *cache);
+
+/* Returns a view of the cached data, NULL on a miss. The entry stays alive
+ * until kvdb_view_release(), even if it is evicted meanwhile. */
+kvdb_view_t *slicecache_get(slicecache_t *cache, const slice_key_t *slice_key);
+
+/* Take the generation before reading the storage and hand it to
+ * slicecache_put(). A put is dropped if any invalidation happened in
+ * between, so a slow reader never caches data a writer just replaced. */
+uint64_t slicecache_generation(slicecache_t *cache);
+
+/* Copy data into the cache and return a view of the copy, or NULL when it
+ * was not cached (too big or stale generation). */
+kvdb_view_t *slicecache_put(slicecache_t *cache, const slice_key_t *slice_key, const char *data, uint32_t data_size, uint64_t generation);
+
+void slicecache_invalidate(slicecache_t *cache, const slice_key_t *slice_key);
+
+void slicecache_get_stats(slicecache_t *cache, slicecache_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SLICECACHE_H__
+
@@ -0,0 +1,174 @@
+/**
+ * @file   slicecodec.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-28 09:42:03
+ *
+ * @brief  Compression of slice data on its way to a slicedb.
+ *
+ * An encoded slice is the raw size followed by the codec's block, the
+ * codec id itself lives in the slice metadata. LZ4 is cheap enough for
+ * foreground writes, zstd packs tighter and suits the slices the
+ * compactor moves out of old slicedbs. Data that does not compress well
+ * is kept raw, so reading it back costs nothing.
+ *
+ */
+
+#include "common.h"
+#include "zmalloc.h"
+#include "logger.h"
+#include "object.h"
+#include "slicecodec.h"
+
+#ifdef HAS_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
+
+/* Not worth a codec call. */
+#define SLICECODEC_MIN_SIZE 128
+#define SLICECODEC_ZSTD_LEVEL 3
+/* Decoding allocates raw_size, refuse what no slice can be. */
+#define SLICECODEC_MAX_RAW_SIZE (256 * 1024 * 1024)
+
+/* ================ slicecodec_by_name() ================ */
+int slicecodec_by_name(const char *name)
+{
+    if ( strcmp(name, "none") == 0 ){
+        return SLICE_CODEC_RAW;
+    }
+#ifdef HAS_LZ4
+    if ( strcmp(name, "lz4") == 0 ){
+        return SLICE_CODEC_LZ4;
+    }
+#endif
+#ifdef HAS_ZSTD
+    if ( strcmp(name, "zstd") == 0 ){
+        return SLICE_CODEC_ZSTD;
+    }
+#endif
+
+    return -1;
+}
+
+/* ================ slicecodec_name() ================ */
+const char *slicecodec_name(uint32_t codec)
+{
+    switch ( codec ){
+    case SLICE_CODEC_RAW:
+        return "none";
+    case SLICE_CODEC_LZ4:
+        return "lz4";
+    case SLICE_CODEC_ZSTD:
+        return "zstd";
+    default:
+        return "unknown";
+    }
+}
+
+/* ================ slicecodec_bound() ================ */
+static uint32_t slicecodec_bound(uint32_t codec, uint32_t size)
+{
+#ifdef HAS_LZ4
+    if ( codec == SLICE_CODEC_LZ4 ){
+        return LZ4_compressBound(size);
+    }
+#endif
+#ifdef HAS_ZSTD
+    if ( codec == SLICE_CODEC_ZSTD ){
+        return ZSTD_compressBound(size);
+    }
+#endif
+
+    return 0;
+}
+
+/* ================ slicecodec_compress() ================ */
+/* Returns the size of the block in dst, 0 if it did not fit. */
+static uint32_t slicecodec_compress(uint32_t codec, const char *src, uint32_t size, char *dst, uint32_t capacity)
+{
+#ifdef HAS_LZ4
+    if ( codec == SLICE_CODEC_LZ4 ){
+        int rc = LZ4_compress_default(src, dst, size, capacity);
+        return rc > 0 ? rc : 0;
+    }
+#endif
+#ifdef HAS_ZSTD
+    if ( codec == SLICE_CODEC_ZSTD ){
+        size_t rc = ZSTD_compress(dst, capacity, src, size, SLICECODEC_ZSTD_LEVEL);
+        return ZSTD_isError(rc) ? 0 : rc;
+    }
+#endif
+
+    return 0;
+}
+
+/* ================ slice_encode() ================ */
+void slice_encode(slice_t *slice, uint32_t codec)
+{
+    if ( codec == SLICE_CODEC_RAW || slice->codec != SLICE_CODEC_RAW || slice->size < SLICECODEC_MIN_SIZE ){
+        return;
+    }
+    uint32_t bound = slicecodec_bound(codec, slice->size);
+    if ( bound == 0 ){
+        return;
+    }
+
+    uint32_t raw_size = slice->size;
+    uint32_t max_size = raw_size - raw_size / 8;
+    char *buf = (char*)zmalloc(sizeof(uint32_t) + bound);
+    memcpy(buf, &raw_size, sizeof(uint32_t));
+    uint32_t size = slicecodec_compress(codec, slice->data, raw_size, buf + sizeof(uint32_t), bound);
+    if ( size == 0 || sizeof(uint32_t) + size > max_size ){
+        zfree(buf);
+        return;
+    }
+
+    slice_attach_data(slice, buf, sizeof(uint32_t) + size);
+    slice->codec = codec;
+}
+
+/* ================ slicecodec_decode() ================ */
+char *slicecodec_decode(uint32_t codec, const char *data, uint32_t size, uint32_t *raw_size)
+{
+    if ( codec == SLICE_CODEC_RAW ){
+        char *buf = (char*)zmalloc(size > 0 ? size : 1);
+        memcpy(buf, data, size);
+        *raw_size = size;
+        return buf;
+    }
+
+    uint32_t expected_size = 0;
+    if ( size < sizeof(uint32_t) ){
+        return NULL;
+    }
+    memcpy(&expected_size, data, sizeof(uint32_t));
+    if ( expected_size == 0 || expected_size > SLICECODEC_MAX_RAW_SIZE ){
+        return NULL;
+    }
+    data += sizeof(uint32_t);
+    size -= sizeof(uint32_t);
+
+    char *buf = (char*)zmalloc(expected_size);
+    int ok = 0;
+#ifdef HAS_LZ4
+    if ( codec == SLICE_CODEC_LZ4 ){
+        int rc = LZ4_decompress_safe(data, buf, size, expected_size);
+        ok = rc >= 0 && (uint32_t)rc == expected_size;
+    }
+#endif
+#ifdef HAS_ZSTD
+    if ( codec == SLICE_CODEC_ZSTD ){
+        size_t rc = ZSTD_decompress(buf, expected_size, data, size);
+        ok = !ZSTD_isError(rc) && rc == expected_size;
+    }
+#endif
+    if ( !ok ){
+        zfree(buf);
+        return NULL;
+    }
+
+    *raw_size = expected_size;
+    return buf;
+}
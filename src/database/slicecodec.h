@@ -0,0 +1,44 @@
+/**
+ * @file   slicecodec.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-28 09:41:26
+ *
+ * @brief  Compression of slice data on its way to a slicedb.
+ *
+ *
+ */
+
+#ifndef __SLICECODEC_H__
+#define __SLICECODEC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct slice_t slice_t;
+
+/* Kept in the slice metadata, never renumber. */
+#define SLICE_CODEC_RAW 0
+#define SLICE_CODEC_LZ4 1
+#define SLICE_CODEC_ZSTD 2
+
+/* "none", "lz4" or "zstd", -1 for others and codecs not built in. */
+int slicecodec_by_name(const char *name);
+const char *slicecodec_name(uint32_t codec);
+
+/* Replace the raw slice->data by its codec encoding and set slice->codec,
+ * unless the data does not shrink by an eighth. Slices already encoded
+ * are left alone. */
+void slice_encode(slice_t *slice, uint32_t codec);
+/* Decode data stored with codec into a new zmalloc buffer. Returns NULL
+ * when it does not decode. */
+char *slicecodec_decode(uint32_t codec, const char *data, uint32_t size, uint32_t *raw_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SLICECODEC_H__
+
@@ -0,0 +1,294 @@
+/**
+ * @file   sliceindex.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-18 15:41:02
+ *
+ * @brief  Open addressing slice index.
+ *
+ * One flat array of 40 byte slots with linear probing, the slot comes
+ * straight from the md5 already in the key. Deletes shift the following
+ * run back instead of leaving tombstones, so lookups never slow down
+ * after many deletes. The table doubles at 70% load.
+ *
+ */
+
+#include "common.h"
+#include "zmalloc.h"
+#include "logger.h"
+#include "object.h"
+#include "sliceindex.h"
+
+#define SLICEINDEX_EMPTY 0xFFFFFFFF
+#define SLICEINDEX_MAGIC 0x58444953 /* "SIDX" */
+#define SLICEINDEX_MIN_SLOTS 1024
+
+/* -------- struct index_slot_t -------- */
+typedef struct index_slot_t {
+    slice_key_t slice_key;
+    slice_location_t location;
+} index_slot_t;
+
+/* -------- struct index_snapshot_header_t -------- */
+typedef struct index_snapshot_header_t {
+    uint32_t magic;
+    uint32_t slot_size;
+    uint32_t total_slots;
+    uint32_t total_entries;
+} index_snapshot_header_t;
+
+/* -------- struct sliceindex_t -------- */
+typedef struct sliceindex_t {
+    pthread_rwlock_t lock;
+    index_slot_t *slots;
+    uint32_t total_slots;
+    uint32_t total_entries;
+} sliceindex_t;
+
+/* ================ slot_is_empty() ================ */
+static inline int slot_is_empty(const index_slot_t *slot)
+{
+    return slot->location.slicedb_id == SLICEINDEX_EMPTY;
+}
+
+/* ================ sliceindex_home() ================ */
+static inline uint32_t sliceindex_home(sliceindex_t *sliceindex, const slice_key_t *slice_key)
+{
+    return (slice_key->key_md5.h0 ^ (slice_key->slice_idx * 0x9E3779B1U)) & (sliceindex->total_slots - 1);
+}
+
+/* ================ sliceindex_find() ================ */
+/* The slot holding the key, or the empty slot ending its probe run. */
+static uint32_t sliceindex_find(sliceindex_t *sliceindex, const slice_key_t *slice_key)
+{
+    uint32_t mask = sliceindex->total_slots - 1;
+    uint32_t n = sliceindex_home(sliceindex, slice_key);
+    while ( !slot_is_empty(&sliceindex->slots[n]) ){
+        const slice_key_t *k = &sliceindex->slots[n].slice_key;
+        if ( k->slice_idx == slice_key->slice_idx && memcmp(&k->key_md5, &slice_key->key_md5, sizeof(md5_value_t)) == 0 ){
+            break;
+        }
+        n = (n + 1) & mask;
+    }
+    return n;
+}
+
+/* ================ sliceindex_alloc_slots() ================ */
+static void sliceindex_alloc_slots(sliceindex_t *sliceindex, uint32_t total_slots)
+{
+    sliceindex->slots = (index_slot_t*)zmalloc(sizeof(index_slot_t) * total_slots);
+    memset(sliceindex->slots, 0xFF, sizeof(index_slot_t) * total_slots);
+    sliceindex->total_slots = total_slots;
+    sliceindex->total_entries = 0;
+}
+
+/* ================ sliceindex_grow() ================ */
+static void sliceindex_grow(sliceindex_t *sliceindex)
+{
+    index_slot_t *old_slots = sliceindex->slots;
+    uint32_t old_total_slots = sliceindex->total_slots;
+    uint32_t total_entries = sliceindex->total_entries;
+
+    sliceindex_alloc_slots(sliceindex, old_total_slots * 2);
+    for ( uint32_t i = 0 ; i < old_total_slots ; i++ ){
+        if ( !slot_is_empty(&old_slots[i]) ){
+            uint32_t n = sliceindex_find(sliceindex, &old_slots[i].slice_key);
+            sliceindex->slots[n] = old_slots[i];
+        }
+    }
+    sliceindex->total_entries = total_entries;
+
+    zfree(old_slots);
+}
+
+/* ================ sliceindex_new() ================ */
+sliceindex_t *sliceindex_new(uint32_t initial_slots)
+{
+    sliceindex_t *sliceindex = (sliceindex_t*)zmalloc(sizeof(sliceindex_t));
+    memset(sliceindex, 0, sizeof(sliceindex_t));
+
+    pthread_rwlock_init(&sliceindex->lock, NULL);
+
+    uint32_t total_slots = SLICEINDEX_MIN_SLOTS;
+    while ( total_slots < initial_slots ){
+        total_slots *= 2;
+    }
+    sliceindex_alloc_slots(sliceindex, total_slots);
+
+    return sliceindex;
+}
+
+/* ================ sliceindex_free() ================ */
+void sliceindex_free(sliceindex_t *sliceindex)
+{
+    zfree(sliceindex->slots);
+    pthread_rwlock_destroy(&sliceindex->lock);
+    zfree(sliceindex);
+}
+
+/* ================ sliceindex_get() ================ */
+int sliceindex_get(sliceindex_t *sliceindex, const slice_key_t *slice_key, slice_location_t *location)
+{
+    int found = 0;
+
+    pthread_rwlock_rdlock(&sliceindex->lock);
+    index_slot_t *slot = &sliceindex->slots[sliceindex_find(sliceindex, slice_key)];
+    if ( !slot_is_empty(slot) ){
+        *location = slot->location;
+        found = 1;
+    }
+    pthread_rwlock_unlock(&sliceindex->lock);
+
+    return found;
+}
+
+/* ================ sliceindex_put() ================ */
+void sliceindex_put(sliceindex_t *sliceindex, const slice_key_t *slice_key, const slice_location_t *location)
+{
+    assert(location->slicedb_id != SLICEINDEX_EMPTY);
+
+    pthread_rwlock_wrlock(&sliceindex->lock);
+
+    if ( (uint64_t)(sliceindex->total_entries + 1) * 10 > (uint64_t)sliceindex->total_slots * 7 ){
+        sliceindex_grow(sliceindex);
+    }
+
+    index_slot_t *slot = &sliceindex->slots[sliceindex_find(sliceindex, slice_key)];
+    if ( slot_is_empty(slot) ){
+        slot->slice_key = *slice_key;
+        sliceindex->total_entries++;
+    }
+    slot->location = *location;
+
+    pthread_rwlock_unlock(&sliceindex->lock);
+}
+
+/* ================ sliceindex_remove() ================ */
+void sliceindex_remove(sliceindex_t *sliceindex, const slice_key_t *slice_key)
+{
+    pthread_rwlock_wrlock(&sliceindex->lock);
+
+    uint32_t mask = sliceindex->total_slots - 1;
+    uint32_t hole = sliceindex_find(sliceindex, slice_key);
+    if ( !slot_is_empty(&sliceindex->slots[hole]) ){
+        /* Backward shift: move up every later slot of the run that may
+         * live at the hole, i.e. whose home is not in (hole, n]. */
+        uint32_t n = hole;
+        while ( 1 ){
+            n = (n + 1) & mask;
+            if ( slot_is_empty(&sliceindex->slots[n]) ){
+                break;
+            }
+            uint32_t home = sliceindex_home(sliceindex, &sliceindex->slots[n].slice_key);
+            if ( ((n - home) & mask) >= ((n - hole) & mask) ){
+                sliceindex->slots[hole] = sliceindex->slots[n];
+                hole = n;
+            }
+        }
+        memset(&sliceindex->slots[hole], 0xFF, sizeof(index_slot_t));
+        sliceindex->total_entries--;
+    }
+
+    pthread_rwlock_unlock(&sliceindex->lock);
+}
+
+/* ================ sliceindex_size() ================ */
+uint32_t sliceindex_size(sliceindex_t *sliceindex)
+{
+    pthread_rwlock_rdlock(&sliceindex->lock);
+    uint32_t total_entries = sliceindex->total_entries;
+    pthread_rwlock_unlock(&sliceindex->lock);
+
+    return total_entries;
+}
+
+/* ================ sliceindex_foreach() ================ */
+/* Runs under the read lock, foreach_fn must not modify the index. */
+void sliceindex_foreach(sliceindex_t *sliceindex, sliceindex_foreach_fn *foreach_fn, void *user_data)
+{
+    pthread_rwlock_rdlock(&sliceindex->lock);
+    for ( uint32_t i = 0 ; i < sliceindex->total_slots ; i++ ){
+        if ( !slot_is_empty(&sliceindex->slots[i]) ){
+            foreach_fn(user_data, &sliceindex->slots[i].slice_key, &sliceindex->slots[i].location);
+        }
+    }
+    pthread_rwlock_unlock(&sliceindex->lock);
+}
+
+/* ================ sliceindex_save() ================ */
+int sliceindex_save(sliceindex_t *sliceindex, const char *filename)
+{
+    char tmp_filename[PATH_MAX];
+    snprintf(tmp_filename, PATH_MAX, "%s.tmp", filename);
+
+    int fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if ( fd == -1 ){
+        error_log("open() failed. file:%s", tmp_filename);
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&sliceindex->lock);
+
+    index_snapshot_header_t header;
+    header.magic = SLICEINDEX_MAGIC;
+    header.slot_size = sizeof(index_slot_t);
+    header.total_slots = sliceindex->total_slots;
+    header.total_entries = sliceindex->total_entries;
+
+    size_t slots_size = sizeof(index_slot_t) * sliceindex->total_slots;
+    int rc = 0;
+    if ( write(fd, &header, sizeof(header)) != sizeof(header) ||
+            write(fd, sliceindex->slots, slots_size) != (ssize_t)slots_size ){
+        rc = -1;
+    }
+
+    pthread_rwlock_unlock(&sliceindex->lock);
+
+    if ( rc == 0 && fsync(fd) != 0 ){
+        rc = -1;
+    }
+    close(fd);
+
+    if ( rc == 0 && rename(tmp_filename, filename) != 0 ){
+        rc = -1;
+    }
+    if ( rc != 0 ){
+        error_log("Save sliceindex failed. file:%s", filename);
+        unlink(tmp_filename);
+    }
+
+    return rc;
+}
+
+/* ================ sliceindex_load() ================ */
+int sliceindex_load(sliceindex_t *sliceindex, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if ( fd == -1 ){
+        return -1;
+    }
+
+    int rc = -1;
+    index_snapshot_header_t header;
+    if ( read(fd, &header, sizeof(header)) == sizeof(header) &&
+            header.magic == SLICEINDEX_MAGIC && header.slot_size == sizeof(index_slot_t) &&
+            header.total_slots >= SLICEINDEX_MIN_SLOTS && (header.total_slots & (header.total_slots - 1)) == 0 ){
+
+        size_t slots_size = sizeof(index_slot_t) * header.total_slots;
+        index_slot_t *slots = (index_slot_t*)zmalloc(slots_size);
+        if ( read(fd, slots, slots_size) == (ssize_t)slots_size ){
+            pthread_rwlock_wrlock(&sliceindex->lock);
+            zfree(sliceindex->slots);
+            sliceindex->slots = slots;
+            sliceindex->total_slots = header.total_slots;
+            sliceindex->total_entries = header.total_entries;
+            pthread_rwlock_unlock(&sliceindex->lock);
+            rc = 0;
+        } else {
+            zfree(slots);
+        }
+    }
+    close(fd);
+
+    return rc;
+}
+
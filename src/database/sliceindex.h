@@ -0,0 +1,57 @@
+/**
+ * @file   sliceindex.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-18 15:40:17
+ *
+ * @brief  In-memory index from slice_key_t to the slicedb holding it.
+ *
+ *
+ */
+
+#ifndef __SLICEINDEX_H__
+#define __SLICEINDEX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct slice_key_t slice_key_t;
+typedef struct sliceindex_t sliceindex_t;
+
+/* -------- struct slice_location_t -------- */
+typedef struct slice_location_t {
+    uint32_t version;
+    uint32_t slicedb_id;
+    uint32_t size;
+    /* CRC32C of the data, for versions that store one. */
+    uint32_t crc;
+    /* size and crc are of the encoded data. */
+    uint32_t codec;
+} slice_location_t;
+
+/* Called for every indexed slice by sliceindex_foreach(). */
+typedef void (sliceindex_foreach_fn)(void *user_data, const slice_key_t *slice_key, const slice_location_t *location);
+
+sliceindex_t *sliceindex_new(uint32_t initial_slots);
+void sliceindex_free(sliceindex_t *sliceindex);
+
+/* Returns 1 and fills location when the key is indexed, 0 otherwise. */
+int sliceindex_get(sliceindex_t *sliceindex, const slice_key_t *slice_key, slice_location_t *location);
+void sliceindex_put(sliceindex_t *sliceindex, const slice_key_t *slice_key, const slice_location_t *location);
+void sliceindex_remove(sliceindex_t *sliceindex, const slice_key_t *slice_key);
+uint32_t sliceindex_size(sliceindex_t *sliceindex);
+void sliceindex_foreach(sliceindex_t *sliceindex, sliceindex_foreach_fn *foreach_fn, void *user_data);
+
+/* A snapshot is a flat dump of the slots. Loading fails (-1) on a missing,
+ * truncated or foreign file and leaves the index untouched. */
+int sliceindex_save(sliceindex_t *sliceindex, const char *filename);
+int sliceindex_load(sliceindex_t *sliceindex, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SLICEINDEX_H__
+
@@ -0,0 +1,201 @@
+/**
+ * @file   timerwheel.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-23 10:22:15
+ *
+ * @brief  Hierarchical timer wheel with intrusive timers.
+ *
+ * Four levels of 64 slots, each level 64 times coarser than the one below
+ * (the classic kernel layout). A timer sits in the lowest level whose span
+ * covers its distance, adding and removing are O(1). Every 64 ticks the
+ * next slot of the level above is cascaded down, so a tick only touches
+ * the timers that are due or move down a level.
+ *
+ */
+
+#include "timerwheel.h"
+#include <stdlib.h>
+#include <memory.h>
+
+#define TIMERWHEEL_LEVELS 4
+#define TIMERWHEEL_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_BITS)
+#define TIMERWHEEL_MASK (TIMERWHEEL_SLOTS - 1)
+#define TIMERWHEEL_MAX_TICKS ((1ULL << (TIMERWHEEL_BITS * TIMERWHEEL_LEVELS)) - 1)
+
+/* -------- struct timerwheel_t -------- */
+typedef struct timerwheel_t {
+    uint32_t tick_ms;
+    /* Next tick to run. */
+    uint64_t tick;
+    uint32_t total_timers;
+    /* Circular lists, the heads are never fired. */
+    timerwheel_timer_t slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+} timerwheel_t;
+
+/* ================ list_init() ================ */
+static void list_init(timerwheel_timer_t *head)
+{
+    head->prev = head;
+    head->next = head;
+}
+
+/* ================ list_take() ================ */
+/* Move every timer of head over to the empty list. */
+static void list_take(timerwheel_timer_t *list, timerwheel_timer_t *head)
+{
+    list_init(list);
+    if ( head->next != head ){
+        list->next = head->next;
+        list->prev = head->prev;
+        list->next->prev = list;
+        list->prev->next = list;
+        list_init(head);
+    }
+}
+
+/* ================ timerwheel_place() ================ */
+static void timerwheel_place(timerwheel_t *timerwheel, timerwheel_timer_t *timer)
+{
+    if ( timer->expires < timerwheel->tick ){
+        timer->expires = timerwheel->tick;
+    } else if ( timer->expires - timerwheel->tick > TIMERWHEEL_MAX_TICKS ){
+        timer->expires = timerwheel->tick + TIMERWHEEL_MAX_TICKS;
+    }
+
+    uint64_t delta = timer->expires - timerwheel->tick;
+    uint32_t level = 0;
+    while ( level < TIMERWHEEL_LEVELS - 1 && delta >> (TIMERWHEEL_BITS * (level + 1)) != 0 ){
+        level++;
+    }
+    uint32_t slot = (timer->expires >> (TIMERWHEEL_BITS * level)) & TIMERWHEEL_MASK;
+
+    timerwheel_timer_t *head = &timerwheel->slots[level][slot];
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/* ================ timerwheel_unlink() ================ */
+static void timerwheel_unlink(timerwheel_timer_t *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/* ================ timerwheel_cascade() ================ */
+/* Move the timers of one slot down to where they belong now. Returns the
+ * slot index, zero means the level above has to cascade too. */
+static uint32_t timerwheel_cascade(timerwheel_t *timerwheel, uint32_t level)
+{
+    uint32_t slot = (timerwheel->tick >> (TIMERWHEEL_BITS * level)) & TIMERWHEEL_MASK;
+    timerwheel_timer_t *head = &timerwheel->slots[level][slot];
+
+    timerwheel_timer_t list;
+    list_take(&list, head);
+
+    while ( list.next != &list ){
+        timerwheel_timer_t *timer = list.next;
+        timerwheel_unlink(timer);
+        timerwheel_place(timerwheel, timer);
+    }
+
+    return slot;
+}
+
+/* ================ timerwheel_new() ================ */
+timerwheel_t *timerwheel_new(uint32_t tick_ms, int64_t now)
+{
+    timerwheel_t *timerwheel = (timerwheel_t*)malloc(sizeof(timerwheel_t));
+    memset(timerwheel, 0, sizeof(timerwheel_t));
+
+    timerwheel->tick_ms = tick_ms > 0 ? tick_ms : 1;
+    timerwheel->tick = (uint64_t)now / timerwheel->tick_ms;
+    for ( uint32_t level = 0 ; level < TIMERWHEEL_LEVELS ; level++ ){
+        for ( uint32_t slot = 0 ; slot < TIMERWHEEL_SLOTS ; slot++ ){
+            list_init(&timerwheel->slots[level][slot]);
+        }
+    }
+
+    return timerwheel;
+}
+
+/* ================ timerwheel_free() ================ */
+void timerwheel_free(timerwheel_t *timerwheel)
+{
+    free(timerwheel);
+}
+
+/* ================ timerwheel_add() ================ */
+void timerwheel_add(timerwheel_t *timerwheel, timerwheel_timer_t *timer, int64_t expiry, timerwheel_fn *fn, void *user_data)
+{
+    if ( timerwheel_is_pending(timer) ){
+        timerwheel_unlink(timer);
+    } else {
+        timerwheel->total_timers++;
+    }
+
+    timer->expires = expiry > 0 ? (uint64_t)expiry / timerwheel->tick_ms : 0;
+    timer->fn = fn;
+    timer->user_data = user_data;
+    timerwheel_place(timerwheel, timer);
+}
+
+/* ================ timerwheel_remove() ================ */
+void timerwheel_remove(timerwheel_t *timerwheel, timerwheel_timer_t *timer)
+{
+    if ( timerwheel_is_pending(timer) ){
+        timerwheel_unlink(timer);
+        timerwheel->total_timers--;
+    }
+}
+
+/* ================ timerwheel_is_pending() ================ */
+int timerwheel_is_pending(const timerwheel_timer_t *timer)
+{
+    return timer->next != NULL;
+}
+
+/* ================ timerwheel_advance() ================ */
+uint32_t timerwheel_advance(timerwheel_t *timerwheel, int64_t now)
+{
+    uint64_t target = (uint64_t)now / timerwheel->tick_ms;
+    uint32_t total_fired = 0;
+
+    while ( timerwheel->tick <= target ){
+        uint32_t slot = timerwheel->tick & TIMERWHEEL_MASK;
+        if ( slot == 0 ){
+            for ( uint32_t level = 1 ; level < TIMERWHEEL_LEVELS ; level++ ){
+                if ( timerwheel_cascade(timerwheel, level) != 0 ){
+                    break;
+                }
+            }
+        }
+
+        /* Detach the slot first, callbacks add timers due now to the next tick. */
+        timerwheel_timer_t *head = &timerwheel->slots[0][slot];
+        timerwheel_timer_t list;
+        list_take(&list, head);
+        timerwheel->tick++;
+
+        while ( list.next != &list ){
+            timerwheel_timer_t *timer = list.next;
+            timerwheel_unlink(timer);
+            timerwheel->total_timers--;
+            total_fired++;
+            timer->fn(timer->user_data, timer);
+        }
+    }
+
+    return total_fired;
+}
+
+/* ================ timerwheel_size() ================ */
+uint32_t timerwheel_size(timerwheel_t *timerwheel)
+{
+    return timerwheel->total_timers;
+}
+
@@ -0,0 +1,56 @@
+/**
+ * @file   timerwheel.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-23 10:21:40
+ *
+ * @brief  Hierarchical timer wheel with intrusive timers.
+ *
+ *
+ */
+
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct timerwheel_t timerwheel_t;
+typedef struct timerwheel_timer_t timerwheel_timer_t;
+
+/* Called from timerwheel_advance() for a due timer, which is no longer
+ * pending then and may be added again or freed. */
+typedef void (timerwheel_fn)(void *user_data, timerwheel_timer_t *timer);
+
+/* -------- struct timerwheel_timer_t -------- */
+/* Embedded in the owner, zero it before the first use. */
+typedef struct timerwheel_timer_t {
+    struct timerwheel_timer_t *prev;
+    struct timerwheel_timer_t *next;
+    uint64_t expires;
+    timerwheel_fn *fn;
+    void *user_data;
+} timerwheel_timer_t;
+
+/* Times are milliseconds like zclock_time(), rounded to tick_ms. */
+timerwheel_t *timerwheel_new(uint32_t tick_ms, int64_t now);
+/* Timers still pending are left alone, they belong to their owners. */
+void timerwheel_free(timerwheel_t *timerwheel);
+
+/* Schedule or reschedule timer to fire at expiry. */
+void timerwheel_add(timerwheel_t *timerwheel, timerwheel_timer_t *timer, int64_t expiry, timerwheel_fn *fn, void *user_data);
+void timerwheel_remove(timerwheel_t *timerwheel, timerwheel_timer_t *timer);
+int timerwheel_is_pending(const timerwheel_timer_t *timer);
+
+/* Fire every timer due by now. Returns how many fired. */
+uint32_t timerwheel_advance(timerwheel_t *timerwheel, int64_t now);
+uint32_t timerwheel_size(timerwheel_t *timerwheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TIMERWHEEL_H__
+
@@ -0,0 +1,168 @@
+/**
+ * @file   workertable.cc
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-22 14:05:52
+ *
+ * @brief  Flat hash table from a zmq identity to its worker.
+ *
+ * Every backend message looks its sender up here, so lookups hash the raw
+ * identity bytes of the frame and allocate nothing. One array of slots
+ * with linear probing, the full hash is kept in the slot to skip most key
+ * compares. Deletes shift the following run back like in sliceindex.cc.
+ * The table doubles at 70% load.
+ *
+ */
+
+#include "workertable.h"
+#include "farmhash.h"
+#include <stdlib.h>
+#include <memory.h>
+
+#define WORKERTABLE_MIN_SLOTS 64
+
+/* -------- struct worker_slot_t -------- */
+typedef struct worker_slot_t {
+    const void *identity;
+    uint32_t identity_size;
+    uint32_t hash;
+    /* NULL for an empty slot. */
+    void *worker;
+} worker_slot_t;
+
+/* -------- struct workertable_t -------- */
+typedef struct workertable_t {
+    worker_slot_t *slots;
+    uint32_t total_slots;
+    uint32_t total_workers;
+} workertable_t;
+
+/* ================ workertable_find() ================ */
+/* The slot holding the identity, or the empty slot ending its probe run. */
+static uint32_t workertable_find(workertable_t *workertable, const void *identity, uint32_t identity_size, uint32_t hash)
+{
+    uint32_t mask = workertable->total_slots - 1;
+    uint32_t n = hash & mask;
+    while ( workertable->slots[n].worker != NULL ){
+        const worker_slot_t *slot = &workertable->slots[n];
+        if ( slot->hash == hash && slot->identity_size == identity_size && memcmp(slot->identity, identity, identity_size) == 0 ){
+            break;
+        }
+        n = (n + 1) & mask;
+    }
+    return n;
+}
+
+/* ================ workertable_alloc_slots() ================ */
+static void workertable_alloc_slots(workertable_t *workertable, uint32_t total_slots)
+{
+    workertable->slots = (worker_slot_t*)malloc(sizeof(worker_slot_t) * total_slots);
+    memset(workertable->slots, 0, sizeof(worker_slot_t) * total_slots);
+    workertable->total_slots = total_slots;
+}
+
+/* ================ workertable_grow() ================ */
+static void workertable_grow(workertable_t *workertable)
+{
+    worker_slot_t *old_slots = workertable->slots;
+    uint32_t old_total_slots = workertable->total_slots;
+
+    workertable_alloc_slots(workertable, old_total_slots * 2);
+    for ( uint32_t i = 0 ; i < old_total_slots ; i++ ){
+        if ( old_slots[i].worker != NULL ){
+            uint32_t n = workertable_find(workertable, old_slots[i].identity, old_slots[i].identity_size, old_slots[i].hash);
+            workertable->slots[n] = old_slots[i];
+        }
+    }
+
+    free(old_slots);
+}
+
+/* ================ workertable_new() ================ */
+workertable_t *workertable_new(uint32_t initial_slots)
+{
+    workertable_t *workertable = (workertable_t*)malloc(sizeof(workertable_t));
+    memset(workertable, 0, sizeof(workertable_t));
+
+    uint32_t total_slots = WORKERTABLE_MIN_SLOTS;
+    while ( total_slots < initial_slots ){
+        total_slots *= 2;
+    }
+    workertable_alloc_slots(workertable, total_slots);
+
+    return workertable;
+}
+
+/* ================ workertable_free() ================ */
+void workertable_free(workertable_t *workertable)
+{
+    free(workertable->slots);
+    free(workertable);
+}
+
+/* ================ workertable_put() ================ */
+void workertable_put(workertable_t *workertable, const void *identity, uint32_t identity_size, void *worker)
+{
+    if ( (uint64_t)(workertable->total_workers + 1) * 10 > (uint64_t)workertable->total_slots * 7 ){
+        workertable_grow(workertable);
+    }
+
+    uint32_t hash = util::Hash32((const char *)identity, identity_size);
+    worker_slot_t *slot = &workertable->slots[workertable_find(workertable, identity, identity_size, hash)];
+    if ( slot->worker == NULL ){
+        workertable->total_workers++;
+    }
+    slot->identity = identity;
+    slot->identity_size = identity_size;
+    slot->hash = hash;
+    slot->worker = worker;
+}
+
+/* ================ workertable_get() ================ */
+void *workertable_get(workertable_t *workertable, const void *identity, uint32_t identity_size)
+{
+    uint32_t hash = util::Hash32((const char *)identity, identity_size);
+    return workertable->slots[workertable_find(workertable, identity, identity_size, hash)].worker;
+}
+
+/* ================ workertable_remove() ================ */
+void workertable_remove(workertable_t *workertable, const void *identity, uint32_t identity_size)
+{
+    uint32_t mask = workertable->total_slots - 1;
+    uint32_t hash = util::Hash32((const char *)identity, identity_size);
+    uint32_t hole = workertable_find(workertable, identity, identity_size, hash);
+    if ( workertable->slots[hole].worker == NULL ){
+        return;
+    }
+
+    uint32_t n = hole;
+    while ( 1 ){
+        n = (n + 1) & mask;
+        if ( workertable->slots[n].worker == NULL ){
+            break;
+        }
+        uint32_t home = workertable->slots[n].hash & mask;
+        if ( ((n - home) & mask) >= ((n - hole) & mask) ){
+            workertable->slots[hole] = workertable->slots[n];
+            hole = n;
+        }
+    }
+    memset(&workertable->slots[hole], 0, sizeof(worker_slot_t));
+    workertable->total_workers--;
+}
+
+/* ================ workertable_size() ================ */
+uint32_t workertable_size(workertable_t *workertable)
+{
+    return workertable->total_workers;
+}
+
+/* ================ workertable_foreach() ================ */
+void workertable_foreach(workertable_t *workertable, workertable_foreach_fn *foreach_fn, void *user_data)
+{
+    for ( uint32_t i = 0 ; i < workertable->total_slots ; i++ ){
+        if ( workertable->slots[i].worker != NULL ){
+            foreach_fn(user_data, workertable->slots[i].worker);
+        }
+    }
+}
+
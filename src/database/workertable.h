@@ -0,0 +1,43 @@
+/**
+ * @file   workertable.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-22 14:05:18
+ *
+ * @brief  Flat hash table from a zmq identity to its worker.
+ *
+ *
+ */
+
+#ifndef __WORKERTABLE_H__
+#define __WORKERTABLE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct workertable_t workertable_t;
+
+/* Called for every worker by workertable_foreach(). */
+typedef void (workertable_foreach_fn)(void *user_data, void *worker);
+
+workertable_t *workertable_new(uint32_t initial_slots);
+void workertable_free(workertable_t *workertable);
+
+/* The identity bytes are not copied, they must stay valid until the
+ * worker is removed. worker must not be NULL. */
+void workertable_put(workertable_t *workertable, const void *identity, uint32_t identity_size, void *worker);
+/* NULL when the identity is unknown. */
+void *workertable_get(workertable_t *workertable, const void *identity, uint32_t identity_size);
+void workertable_remove(workertable_t *workertable, const void *identity, uint32_t identity_size);
+uint32_t workertable_size(workertable_t *workertable);
+/* foreach_fn must not modify the table. */
+void workertable_foreach(workertable_t *workertable, workertable_foreach_fn *foreach_fn, void *user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __WORKERTABLE_H__
+
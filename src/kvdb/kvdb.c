@@ -185,6 +185,81 @@ void kvdb_flush(kvdb_t *kvdb)
     }
 }
 
+int kvdb_begin(kvdb_t *kvdb)
+{
+    if ( kvdb->db_methods->db_begin != NULL ){
+        return kvdb->db_methods->db_begin(kvdb, 1);
+    } else {
+        return -1;
+    }
+}
+
+int kvdb_commit(kvdb_t *kvdb)
+{
+    if ( kvdb->db_methods->db_commit != NULL ){
+        return kvdb->db_methods->db_commit(kvdb, 0);
+    } else {
+        return -1;
+    }
+}
+
+int kvdb_rollback(kvdb_t *kvdb)
+{
+    if ( kvdb->db_methods->db_rollback != NULL ){
+        return kvdb->db_methods->db_rollback(kvdb, 0);
+    } else {
+        return -1;
+    }
+}
+
+int kvdb_get_view(kvdb_t *kvdb, const char *key, uint32_t klen, kvdb_view_t **view)
+{
+    *view = NULL;
+    if ( kvdb->db_methods->db_get_view != NULL ){
+        return kvdb->db_methods->db_get_view(kvdb, key, klen, view);
+    }
+
+    void *value = NULL;
+    uint32_t vlen = 0;
+    int rc = kvdb_get(kvdb, key, klen, &value, &vlen);
+    if ( rc == 0 && value != NULL ){
+        *view = kvdb_view_new((const char *)value, vlen, NULL, value);
+    }
+
+    return rc;
+}
+
+int kvdb_scan(kvdb_t *kvdb, const char *start_key, uint32_t start_klen, kvdb_scan_fn *scan_fn, void *user_data)
+{
+    if ( kvdb->db_methods->db_scan != NULL ){
+        return kvdb->db_methods->db_scan(kvdb, start_key, start_klen, scan_fn, user_data);
+    } else {
+        return -1;
+    }
+}
+
+kvdb_view_t *kvdb_view_new(const char *data, uint32_t size, void (*release)(kvdb_view_t *), void *handle)
+{
+    kvdb_view_t *view = (kvdb_view_t*)zmalloc(sizeof(kvdb_view_t));
+    view->data = data;
+    view->size = size;
+    view->release = release;
+    view->handle = handle;
+
+    return view;
+}
+
+void kvdb_view_release(kvdb_view_t *view)
+{
+    if ( view == NULL ) return;
+
+    if ( view->release != NULL ){
+        view->release(view);
+    } else if ( view->handle != NULL ){
+        zfree(view->handle);
+    }
+    zfree(view);
+}
 
 void undefined_kvdb_function(kvdb_t *kvdb)
 {
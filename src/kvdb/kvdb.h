@@ -18,6 +18,11 @@ extern "C" {
 #endif
 
     typedef struct kvdb_t kvdb_t;
+    typedef struct kvdb_view_t kvdb_view_t;
+
+    /* Called in key order by kvdb_scan(). key and value are only valid
+     * during the call. Return non-zero to stop the scan. */
+    typedef int (kvdb_scan_fn)(void *user_data, const char *key, uint32_t klen, const char *value, uint32_t vlen);
 
     typedef struct db_methods_t {
         void (*db_close)(kvdb_t *);
@@ -32,6 +37,8 @@ extern "C" {
         int (*db_begin)(kvdb_t *, int);
         int (*db_commit)(kvdb_t *, int);
         int (*db_rollback)(kvdb_t *, int);
+        int (*db_get_view)(kvdb_t *, const char *, uint32_t, kvdb_view_t **);
+        int (*db_scan)(kvdb_t *, const char *, uint32_t, kvdb_scan_fn *, void *);
     } db_methods_t;
 
     typedef struct kvenv_t{
@@ -48,6 +55,16 @@ extern "C" {
     } kvdb_t;
 
 
+    /* Borrowed value returned by kvdb_get_view(). data stays valid until
+     * kvdb_view_release(), which may be called from any thread.
+     * release == NULL means handle is a zmalloc'ed copy owned by the view. */
+    typedef struct kvdb_view_t {
+        const char *data;
+        uint32_t size;
+        void (*release)(kvdb_view_t *);
+        void *handle;
+    } kvdb_view_t;
+
     kvenv_t *kvenv_new(const char *dbclass, const char *dbpath, uint64_t max_dbsize, uint32_t max_dbs);
     void kvenv_free(kvenv_t *kvenv);
     size_t kvenv_get_dbsize(kvenv_t *kvenv);
@@ -60,6 +77,23 @@ extern "C" {
     int kvdb_del(kvdb_t *kvdb, const char *key, uint32_t klen);
     void kvdb_flush(kvdb_t *kvdb);
 
+    /* Group several put/del calls into one storage transaction.
+     * Backends without transaction support return -1 from kvdb_begin()
+     * and the following calls simply auto-commit one by one. */
+    int kvdb_begin(kvdb_t *kvdb);
+    int kvdb_commit(kvdb_t *kvdb);
+    int kvdb_rollback(kvdb_t *kvdb);
+
+    /* *view is NULL when the key does not exist. Backends without
+     * db_get_view fall back to a copying kvdb_get(). */
+    int kvdb_get_view(kvdb_t *kvdb, const char *key, uint32_t klen, kvdb_view_t **view);
+    kvdb_view_t *kvdb_view_new(const char *data, uint32_t size, void (*release)(kvdb_view_t *), void *handle);
+    void kvdb_view_release(kvdb_view_t *view);
+
+    /* Visit every record from start_key (the first one if NULL) on.
+     * Returns -1 if the backend can't iterate. */
+    int kvdb_scan(kvdb_t *kvdb, const char *start_key, uint32_t start_klen, kvdb_scan_fn *scan_fn, void *user_data);
+
     void undefined_kvdb_function(kvdb_t *);
     int undefined_transaction_function(kvdb_t *, int);
 
@@ -14,9 +14,24 @@
 #include "zmalloc.h"
 #include "logger.h"
 
+/* Reader slots views can not take, the copying reads and scans need them
+ * while many views are held. */
+#define LMDB_COPY_READERS 32
+
 typedef struct kvenv_lmdb_t{
     kvenv_t kvenv;
     MDB_env *env;
+
+    /* Write transaction opened by kvdb_begin(), owned by txn_thread. Any
+     * thread may check txn_thread, 0 while there is no transaction, only
+     * the owner touches txn and txn_level. */
+    MDB_txn *txn;
+    pthread_t txn_thread;
+    int txn_level;
+
+    /* Views hold a reader slot until they are released. */
+    volatile uint32_t total_views;
+    uint32_t max_views;
 } kvenv_lmdb_t;
 
 typedef struct kvdb_lmdb_t {
@@ -29,6 +44,11 @@ int kvdb_lmdb_put(kvdb_t *kvdb, const char *key, uint32_t klen, void *value, uin
 int kvdb_lmdb_get(kvdb_t *kvdb, const char *key, uint32_t klen, void **ppVal, uint32_t *pnVal);
 int kvdb_lmdb_del(kvdb_t *kvdb, const char *key, uint32_t klen);
 void kvdb_lmdb_flush(kvdb_t *kvdb);
+int kvdb_lmdb_begin(kvdb_t *kvdb, int level);
+int kvdb_lmdb_commit(kvdb_t *kvdb, int level);
+int kvdb_lmdb_rollback(kvdb_t *kvdb, int level);
+int kvdb_lmdb_get_view(kvdb_t *kvdb, const char *key, uint32_t klen, kvdb_view_t **view);
+int kvdb_lmdb_scan(kvdb_t *kvdb, const char *start_key, uint32_t start_klen, kvdb_scan_fn *scan_fn, void *user_data);
 
 static const db_methods_t lmdb_methods = {
     kvdb_lmdb_close,
@@ -36,11 +56,31 @@ static const db_methods_t lmdb_methods = {
     kvdb_lmdb_get,
     kvdb_lmdb_del,
     kvdb_lmdb_flush,
-    undefined_transaction_function,
-    undefined_transaction_function,
-    undefined_transaction_function
+    kvdb_lmdb_begin,
+    kvdb_lmdb_commit,
+    kvdb_lmdb_rollback,
+    kvdb_lmdb_get_view,
+    kvdb_lmdb_scan
 };
 
+/* The write transaction of kvdb_begin() if the calling thread owns it. */
+static MDB_txn *lmdb_batch_txn(kvenv_lmdb_t *kvenv_lmdb)
+{
+    pthread_t txn_thread = __atomic_load_n(&kvenv_lmdb->txn_thread, __ATOMIC_ACQUIRE);
+    if ( txn_thread != 0 && pthread_equal(txn_thread, pthread_self()) ){
+        return kvenv_lmdb->txn;
+    }
+    return NULL;
+}
+
+/* Ends the ownership before the transaction is committed or aborted. */
+static void lmdb_batch_txn_release(kvenv_lmdb_t *kvenv_lmdb)
+{
+    __atomic_store_n(&kvenv_lmdb->txn_thread, (pthread_t)0, __ATOMIC_RELEASE);
+    kvenv_lmdb->txn = NULL;
+    kvenv_lmdb->txn_level = 0;
+}
+
 kvenv_t *kvenv_new_lmdb(const char *dbpath, uint64_t max_dbsize, uint32_t max_dbs)
 {
     kvenv_lmdb_t *kvenv_lmdb = (kvenv_lmdb_t*)zmalloc(sizeof(kvenv_lmdb_t));
@@ -77,6 +117,8 @@ kvenv_t *kvenv_new_lmdb(const char *dbpath, uint64_t max_dbsize, uint32_t max_db
         error_log("mdb_env_set_maxreaders() failed.");
         return NULL;
     }
+    kvenv_lmdb->max_views = maxreaders - LMDB_COPY_READERS;
+    mdb_env_set_userctx(kvenv_lmdb->env, kvenv_lmdb);
 
     rc = mdb_env_set_maxdbs(kvenv_lmdb->env, max_dbs); 
     if ( rc != 0 ) {
@@ -90,7 +132,9 @@ kvenv_t *kvenv_new_lmdb(const char *dbpath, uint64_t max_dbsize, uint32_t max_db
     /*rc = mdb_env_open(lmdb->env, dbpath, MDB_MAPASYNC | MDB_WRITEMAP | MDB_NOTLS , 0640); */
     /*rc = mdb_env_open(kvenv_lmdb->env, dbpath, MDB_MAPASYNC | MDB_WRITEMAP, 0640); */
     /*rc = mdb_env_open(kvenv_lmdb->env, dbpath, MDB_NOMETASYNC, 0640); */
-    rc = mdb_env_open(kvenv_lmdb->env, dbpath, MDB_NOSYNC, 0640); 
+    /* MDB_NOTLS: read txns of kvdb_get_view() outlive the call and are
+     * released by whichever thread is done with the data. */
+    rc = mdb_env_open(kvenv_lmdb->env, dbpath, MDB_NOSYNC | MDB_NOTLS, 0640); 
     if ( rc != 0 ) {
         zfree(kvenv_lmdb);
         error_log("mdb_env_open() failed. dbpath=%s error: %s", dbpath, mdb_strerror(rc));
@@ -171,13 +215,23 @@ int kvdb_lmdb_put(kvdb_t *kvdb, const char *key, uint32_t klen, void *value, uin
     MDB_val m_val;
     MDB_val m_key;
     MDB_txn *txn;
+    int rc;
 
     m_val.mv_size = vlen; 
     m_val.mv_data = value;
     m_key.mv_size = klen; 
     m_key.mv_data = (void*)key;
 
-    int rc = mdb_txn_begin(kvenv_lmdb->env, NULL, 0, &txn);
+    txn = lmdb_batch_txn(kvenv_lmdb);
+    if ( txn != NULL ){
+        rc = mdb_put(txn, lmdb->dbi, &m_key, &m_val, 0);
+        if ( rc != 0 ){
+            error_log("kvdb_lmdb_put() failure. error: %s", mdb_strerror(rc));
+        }
+        return rc;
+    }
+
+    rc = mdb_txn_begin(kvenv_lmdb->env, NULL, 0, &txn);
     if( rc==0 ){
         rc = mdb_put(txn, lmdb->dbi, &m_key, &m_val, 0);
         if( rc==0 ){
@@ -202,7 +256,13 @@ int kvdb_lmdb_get(kvdb_t *kvdb, const char *key, uint32_t klen, void **ppVal, ui
     m_key.mv_size = klen;
     m_key.mv_data = (void*)key;
 
-    int rc = mdb_txn_begin(kvenv_lmdb->env, NULL, MDB_RDONLY, &txn);
+    MDB_txn *batch_txn = lmdb_batch_txn(kvenv_lmdb);
+    int rc = 0;
+    if ( batch_txn != NULL ){
+        txn = batch_txn;
+    } else {
+        rc = mdb_txn_begin(kvenv_lmdb->env, NULL, MDB_RDONLY, &txn);
+    }
     if( rc==0 ){
         MDB_val m_val = {0, 0};
         rc = mdb_get(txn, lmdb->dbi, &m_key, &m_val);
@@ -220,7 +280,9 @@ int kvdb_lmdb_get(kvdb_t *kvdb, const char *key, uint32_t klen, void **ppVal, ui
         }else{
             error_log("kvdb_lmdb_get() failure. error: %s", mdb_strerror(rc));
         }
-        mdb_txn_commit(txn);
+        if ( batch_txn == NULL ){
+            mdb_txn_commit(txn);
+        }
     }
 
     return rc;
@@ -237,6 +299,15 @@ int kvdb_lmdb_del(kvdb_t *kvdb, const char *key, uint32_t klen)
     m_key.mv_size = klen; 
     m_key.mv_data = (void*)key;
 
+    txn = lmdb_batch_txn(kvenv_lmdb);
+    if ( txn != NULL ){
+        int rc = mdb_del(txn, lmdb->dbi, &m_key, 0);
+        if ( rc != 0 && rc != MDB_NOTFOUND ){
+            error_log("kvdb_lmdb_del() failure. error: %s", mdb_strerror(rc));
+        }
+        return rc;
+    }
+
     int rc = mdb_txn_begin(kvenv_lmdb->env, NULL, 0, &txn);
     if( rc==0 ){
         rc = mdb_del(txn, lmdb->dbi, &m_key, 0);
@@ -258,3 +329,196 @@ void kvdb_lmdb_flush(kvdb_t *kvdb)
     mdb_env_sync(kvenv_lmdb->env, 1);
 }
 
+/* ---------------- kvdb_lmdb_begin() ----------------
+ * Open (or nest into) the env-wide write transaction. Other threads keep
+ * auto-committing and simply block in mdb_txn_begin() until it is done. */
+int kvdb_lmdb_begin(kvdb_t *kvdb, int level)
+{
+    kvenv_lmdb_t *kvenv_lmdb = (kvenv_lmdb_t*)kvdb->kvenv;
+
+    if ( lmdb_batch_txn(kvenv_lmdb) != NULL ){
+        kvenv_lmdb->txn_level++;
+        return 0;
+    }
+
+    MDB_txn *txn = NULL;
+    int rc = mdb_txn_begin(kvenv_lmdb->env, NULL, 0, &txn);
+    if ( rc != 0 ){
+        error_log("kvdb_lmdb_begin() failure. error: %s", mdb_strerror(rc));
+        return rc;
+    }
+
+    kvenv_lmdb->txn_level = 1;
+    kvenv_lmdb->txn = txn;
+    __atomic_store_n(&kvenv_lmdb->txn_thread, pthread_self(), __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* ---------------- kvdb_lmdb_commit() ---------------- */
+int kvdb_lmdb_commit(kvdb_t *kvdb, int level)
+{
+    kvenv_lmdb_t *kvenv_lmdb = (kvenv_lmdb_t*)kvdb->kvenv;
+
+    MDB_txn *txn = lmdb_batch_txn(kvenv_lmdb);
+    if ( txn == NULL ){
+        return -1;
+    }
+    if ( --kvenv_lmdb->txn_level > level ){
+        return 0;
+    }
+
+    lmdb_batch_txn_release(kvenv_lmdb);
+
+    int rc = mdb_txn_commit(txn);
+    if ( rc != 0 ){
+        error_log("kvdb_lmdb_commit() failure. error: %s", mdb_strerror(rc));
+    }
+
+    return rc;
+}
+
+/* ---------------- kvdb_lmdb_rollback() ---------------- */
+int kvdb_lmdb_rollback(kvdb_t *kvdb, int level)
+{
+    kvenv_lmdb_t *kvenv_lmdb = (kvenv_lmdb_t*)kvdb->kvenv;
+
+    MDB_txn *txn = lmdb_batch_txn(kvenv_lmdb);
+    if ( txn == NULL ){
+        return -1;
+    }
+
+    lmdb_batch_txn_release(kvenv_lmdb);
+
+    mdb_txn_abort(txn);
+
+    return 0;
+}
+
+/* ---------------- kvdb_lmdb_view_release() ---------------- */
+static void kvdb_lmdb_view_release(kvdb_view_t *view)
+{
+    MDB_txn *txn = (MDB_txn*)view->handle;
+    kvenv_lmdb_t *kvenv_lmdb = (kvenv_lmdb_t*)mdb_env_get_userctx(mdb_txn_env(txn));
+    mdb_txn_abort(txn);
+    __sync_sub_and_fetch(&kvenv_lmdb->total_views, 1);
+}
+
+/* ---------------- kvdb_lmdb_copy_view() ---------------- */
+static int kvdb_lmdb_copy_view(kvdb_t *kvdb, const char *key, uint32_t klen, kvdb_view_t **view)
+{
+    void *value = NULL;
+    uint32_t vlen = 0;
+    int rc = kvdb_lmdb_get(kvdb, key, klen, &value, &vlen);
+    if ( rc == 0 && value != NULL ){
+        *view = kvdb_view_new((const char *)value, vlen, NULL, value);
+    }
+    return rc;
+}
+
+/* ---------------- kvdb_lmdb_get_view() ----------------
+ * Point straight into the mmap. The read txn stays open until the view
+ * is released so the pages can not be reused underneath. Past max_views,
+ * or with the reader table full anyway, the data is copied instead. */
+int kvdb_lmdb_get_view(kvdb_t *kvdb, const char *key, uint32_t klen, kvdb_view_t **view)
+{
+    kvdb_lmdb_t *lmdb = (kvdb_lmdb_t*)kvdb;
+    kvenv_lmdb_t *kvenv_lmdb = (kvenv_lmdb_t*)kvdb->kvenv;
+
+    *view = NULL;
+
+    /* Data written by our own batch txn is gone once it commits. */
+    if ( lmdb_batch_txn(kvenv_lmdb) != NULL ){
+        return kvdb_lmdb_copy_view(kvdb, key, klen, view);
+    }
+
+    if ( __sync_add_and_fetch(&kvenv_lmdb->total_views, 1) > kvenv_lmdb->max_views ){
+        __sync_sub_and_fetch(&kvenv_lmdb->total_views, 1);
+        return kvdb_lmdb_copy_view(kvdb, key, klen, view);
+    }
+
+    MDB_val m_key;
+    m_key.mv_size = klen;
+    m_key.mv_data = (void*)key;
+
+    MDB_txn *txn;
+    int rc = mdb_txn_begin(kvenv_lmdb->env, NULL, MDB_RDONLY, &txn);
+    if ( rc != 0 ){
+        __sync_sub_and_fetch(&kvenv_lmdb->total_views, 1);
+        if ( rc == MDB_READERS_FULL ){
+            return kvdb_lmdb_copy_view(kvdb, key, klen, view);
+        }
+        error_log("kvdb_lmdb_get_view() failure. error: %s", mdb_strerror(rc));
+        return rc;
+    }
+
+    MDB_val m_val = {0, 0};
+    rc = mdb_get(txn, lmdb->dbi, &m_key, &m_val);
+    if ( rc == 0 ){
+        *view = kvdb_view_new((const char *)m_val.mv_data, m_val.mv_size, kvdb_lmdb_view_release, txn);
+        return 0;
+    }
+
+    mdb_txn_abort(txn);
+    __sync_sub_and_fetch(&kvenv_lmdb->total_views, 1);
+    if ( rc == MDB_NOTFOUND ){
+        rc = 0;
+    } else {
+        error_log("kvdb_lmdb_get_view() failure. error: %s", mdb_strerror(rc));
+    }
+
+    return rc;
+}
+/* ---------------- kvdb_lmdb_scan() ----------------
+ * Inside our own batch txn the scan sees its uncommitted writes. */
+int kvdb_lmdb_scan(kvdb_t *kvdb, const char *start_key, uint32_t start_klen, kvdb_scan_fn *scan_fn, void *user_data)
+{
+    kvdb_lmdb_t *lmdb = (kvdb_lmdb_t*)kvdb;
+    kvenv_lmdb_t *kvenv_lmdb = (kvenv_lmdb_t*)kvdb->kvenv;
+
+    MDB_txn *txn = lmdb_batch_txn(kvenv_lmdb);
+    int own_txn = 0;
+    int rc = 0;
+    if ( txn == NULL ){
+        rc = mdb_txn_begin(kvenv_lmdb->env, NULL, MDB_RDONLY, &txn);
+        if ( rc != 0 ){
+            error_log("kvdb_lmdb_scan() failure. error: %s", mdb_strerror(rc));
+            return rc;
+        }
+        own_txn = 1;
+    }
+
+    MDB_cursor *cursor = NULL;
+    rc = mdb_cursor_open(txn, lmdb->dbi, &cursor);
+    if ( rc == 0 ){
+        MDB_val m_key = {0, 0};
+        MDB_val m_val = {0, 0};
+        MDB_cursor_op op = MDB_FIRST;
+        if ( start_key != NULL ){
+            m_key.mv_size = start_klen;
+            m_key.mv_data = (void*)start_key;
+            op = MDB_SET_RANGE;
+        }
+        rc = mdb_cursor_get(cursor, &m_key, &m_val, op);
+        while ( rc == 0 ){
+            if ( scan_fn(user_data, (const char *)m_key.mv_data, m_key.mv_size, (const char *)m_val.mv_data, m_val.mv_size) != 0 ){
+                break;
+            }
+            rc = mdb_cursor_get(cursor, &m_key, &m_val, MDB_NEXT);
+        }
+        if ( rc == MDB_NOTFOUND ){
+            rc = 0;
+        }
+        mdb_cursor_close(cursor);
+    }
+    if ( rc != 0 ){
+        error_log("kvdb_lmdb_scan() failure. error: %s", mdb_strerror(rc));
+    }
+
+    if ( own_txn ){
+        mdb_txn_abort(txn);
+    }
+
+    return rc;
+}
+
@@ -713,8 +713,8 @@ g_iterator_t *g_intmap_end(g_intmap_t *map)
 
 void g_intmap_erase(g_intmap_t *map, g_iterator_t *iter)
 {
-    g_intmap_iterator_t *mapIter = g_intmap_iterator_new(map);
-    map->map->erase(mapIter->it);
+    g_intmap_iterator_t *mapIter = (g_intmap_iterator_t*)iter;
+    mapIter->it = map->map->erase(mapIter->it);
 }
 
 g_iterator_t *g_intmap_find(g_intmap_t *map, int key)
@@ -92,8 +92,8 @@ extern void g_intmap_clear(g_intmap_t *map);
 extern size_t g_intmap_size(g_intmap_t *map);
 extern int g_intmap_empty(g_intmap_t *map);
 extern void g_intmap_insert(g_intmap_t *map, int key, void *value);
-extern g_iterator_t *g_map_begin(g_intmap_t *map);
-extern g_iterator_t *g_map_end(g_intmap_t *map);
+extern g_iterator_t *g_intmap_begin(g_intmap_t *map);
+extern g_iterator_t *g_intmap_end(g_intmap_t *map);
 extern void g_intmap_erase(g_intmap_t *map, g_iterator_t *iter);
 extern g_iterator_t *g_intmap_find(g_intmap_t *map, int key);
 
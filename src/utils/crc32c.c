@@ -0,0 +1,130 @@
+/**
+ * @file   crc32c.c
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-27 10:22:04
+ *
+ * @brief  CRC-32C (Castagnoli), SSE4.2 when the CPU has it.
+ *
+ * The crc32 instruction of SSE4.2 computes this polynomial 8 bytes per
+ * cycle or so. The choice is made once at run time, the library is built
+ * without -msse4.2 and the fallback is slicing-by-8 over generated tables.
+ *
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32C_X86 1
+#include <nmmintrin.h>
+#endif
+
+/* Reflected 0x1EDC6F41. */
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static int crc32c_use_hardware = 0;
+
+/* ================ crc32c_init() ================ */
+static void crc32c_init(void)
+{
+    for ( uint32_t n = 0 ; n < 256 ; n++ ){
+        uint32_t crc = n;
+        for ( int k = 0 ; k < 8 ; k++ ){
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][n] = crc;
+    }
+    for ( uint32_t n = 0 ; n < 256 ; n++ ){
+        uint32_t crc = crc32c_table[0][n];
+        for ( int k = 1 ; k < 8 ; k++ ){
+            crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc32c_table[k][n] = crc;
+        }
+    }
+
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    crc32c_use_hardware = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+/* ================ crc32c_software() ================ */
+/* Little endian only, like the rest of the storage formats. */
+static uint32_t crc32c_software(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while ( len > 0 && ((uintptr_t)p & 7) != 0 ){
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    while ( len >= 8 ){
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xFF] ^
+            crc32c_table[6][(word >> 8) & 0xFF] ^
+            crc32c_table[5][(word >> 16) & 0xFF] ^
+            crc32c_table[4][(word >> 24) & 0xFF] ^
+            crc32c_table[3][(word >> 32) & 0xFF] ^
+            crc32c_table[2][(word >> 40) & 0xFF] ^
+            crc32c_table[1][(word >> 48) & 0xFF] ^
+            crc32c_table[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while ( len > 0 ){
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+/* ================ crc32c_sse42() ================ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while ( len > 0 && ((uintptr_t)p & 7) != 0 ){
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+    uint64_t crc64 = crc;
+    while ( len >= 8 ){
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while ( len > 0 ){
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+    return crc;
+}
+#endif
+
+/* ================ crc32c() ================ */
+uint32_t crc32c(uint32_t crc, const char *buf, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+
+    crc = ~crc;
+#ifdef CRC32C_X86
+    if ( crc32c_use_hardware ){
+        return ~crc32c_sse42(crc, (const unsigned char*)buf, len);
+    }
+#endif
+    return ~crc32c_software(crc, (const unsigned char*)buf, len);
+}
+
+/* ================ crc32c_hardware() ================ */
+int crc32c_hardware(void)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_use_hardware;
+}
+
@@ -0,0 +1,31 @@
+/**
+ * @file   crc32c.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-27 10:21:36
+ *
+ * @brief  CRC-32C (Castagnoli), SSE4.2 when the CPU has it.
+ *
+ *
+ */
+
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Start with crc 0, pass the previous result to continue a stream. */
+uint32_t crc32c(uint32_t crc, const char *buf, size_t len);
+/* Non-zero when crc32c() runs on the crc32 instruction. */
+int crc32c_hardware(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CRC32C_H__ */
+
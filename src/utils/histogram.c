@@ -0,0 +1,163 @@
+/**
+ * @file   histogram.c
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-25 10:03:10
+ *
+ * @brief  Latency histogram with three significant digits, HdrHistogram
+ *         layout.
+ *
+ * Buckets double in size, each split in SUB_BUCKET_COUNT linear sub
+ * buckets, so every recorded value is kept to within 1/1024 of itself.
+ * The lower half of every bucket but the first repeats the range of the
+ * one below and is left out of the counts array.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+
+#define SUB_BUCKET_MAGNITUDE 11
+#define SUB_BUCKET_COUNT (1 << SUB_BUCKET_MAGNITUDE)
+#define SUB_BUCKET_HALF_MAGNITUDE (SUB_BUCKET_MAGNITUDE - 1)
+#define SUB_BUCKET_HALF_COUNT (1 << SUB_BUCKET_HALF_MAGNITUDE)
+#define SUB_BUCKET_MASK ((uint64_t)SUB_BUCKET_COUNT - 1)
+
+/* -------- struct histogram_t -------- */
+struct histogram_t {
+    uint64_t highest_value;
+    uint32_t total_counts;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    uint64_t *counts;
+};
+
+/* ================ counts_index() ================ */
+static uint32_t counts_index(uint64_t value)
+{
+    uint32_t bucket_idx = 63 - __builtin_clzll(value | SUB_BUCKET_MASK) - SUB_BUCKET_MAGNITUDE + 1;
+    uint32_t sub_bucket_idx = value >> bucket_idx;
+    return ((bucket_idx + 1) << SUB_BUCKET_HALF_MAGNITUDE) + sub_bucket_idx - SUB_BUCKET_HALF_COUNT;
+}
+
+/* ================ highest_equivalent_value() ================ */
+static uint64_t highest_equivalent_value(uint32_t idx)
+{
+    int32_t bucket_idx = (int32_t)(idx >> SUB_BUCKET_HALF_MAGNITUDE) - 1;
+    uint64_t sub_bucket_idx = (idx & (SUB_BUCKET_HALF_COUNT - 1)) + SUB_BUCKET_HALF_COUNT;
+    if ( bucket_idx < 0 ){
+        sub_bucket_idx -= SUB_BUCKET_HALF_COUNT;
+        bucket_idx = 0;
+    }
+    return (sub_bucket_idx << bucket_idx) + ((uint64_t)1 << bucket_idx) - 1;
+}
+
+/* ================ histogram_new() ================ */
+histogram_t *histogram_new(uint64_t highest_value)
+{
+    histogram_t *histogram = (histogram_t*)malloc(sizeof(histogram_t));
+    memset(histogram, 0, sizeof(histogram_t));
+
+    if ( highest_value < SUB_BUCKET_COUNT ){
+        highest_value = SUB_BUCKET_COUNT;
+    }
+    histogram->highest_value = highest_value;
+    histogram->total_counts = counts_index(highest_value) + 1;
+    histogram->counts = (uint64_t*)malloc(sizeof(uint64_t) * histogram->total_counts);
+    histogram_reset(histogram);
+
+    return histogram;
+}
+
+/* ================ histogram_free() ================ */
+void histogram_free(histogram_t *histogram)
+{
+    free(histogram->counts);
+    free(histogram);
+}
+
+/* ================ histogram_reset() ================ */
+void histogram_reset(histogram_t *histogram)
+{
+    memset(histogram->counts, 0, sizeof(uint64_t) * histogram->total_counts);
+    histogram->total = 0;
+    histogram->min = (uint64_t)-1;
+    histogram->max = 0;
+    histogram->sum = 0;
+}
+
+/* ================ histogram_record() ================ */
+void histogram_record(histogram_t *histogram, uint64_t value)
+{
+    if ( value > histogram->highest_value ){
+        value = histogram->highest_value;
+    }
+    histogram->counts[counts_index(value)]++;
+    histogram->total++;
+    histogram->sum += value;
+    if ( value < histogram->min ) histogram->min = value;
+    if ( value > histogram->max ) histogram->max = value;
+}
+
+/* ================ histogram_merge() ================ */
+void histogram_merge(histogram_t *histogram, const histogram_t *from)
+{
+    uint32_t total_counts = histogram->total_counts < from->total_counts ? histogram->total_counts : from->total_counts;
+    for ( uint32_t i = 0 ; i < total_counts ; i++ ){
+        histogram->counts[i] += from->counts[i];
+    }
+    histogram->total += from->total;
+    histogram->sum += from->sum;
+    if ( from->min < histogram->min ) histogram->min = from->min;
+    if ( from->max > histogram->max ) histogram->max = from->max;
+}
+
+/* ================ histogram_total() ================ */
+uint64_t histogram_total(const histogram_t *histogram)
+{
+    return histogram->total;
+}
+
+/* ================ histogram_min() ================ */
+uint64_t histogram_min(const histogram_t *histogram)
+{
+    return histogram->total > 0 ? histogram->min : 0;
+}
+
+/* ================ histogram_max() ================ */
+uint64_t histogram_max(const histogram_t *histogram)
+{
+    return histogram->max;
+}
+
+/* ================ histogram_mean() ================ */
+double histogram_mean(const histogram_t *histogram)
+{
+    return histogram->total > 0 ? histogram->sum / histogram->total : 0;
+}
+
+/* ================ histogram_percentile() ================ */
+uint64_t histogram_percentile(const histogram_t *histogram, double percentile)
+{
+    if ( histogram->total == 0 ){
+        return 0;
+    }
+    if ( percentile > 100.0 ) percentile = 100.0;
+
+    uint64_t count_at_percentile = (uint64_t)(percentile / 100.0 * histogram->total + 0.5);
+    if ( count_at_percentile < 1 ) count_at_percentile = 1;
+
+    uint64_t count = 0;
+    for ( uint32_t i = 0 ; i < histogram->total_counts ; i++ ){
+        count += histogram->counts[i];
+        if ( count >= count_at_percentile ){
+            uint64_t value = highest_equivalent_value(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
@@ -0,0 +1,44 @@
+/**
+ * @file   histogram.h
+ * @author Jiangwen Su <uukuguy@gmail.com>
+ * @date   2015-03-25 10:02:33
+ *
+ * @brief  Latency histogram with three significant digits, HdrHistogram
+ *         layout.
+ *
+ *
+ */
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef struct histogram_t histogram_t;
+
+/* Values from 0 to highest_value, larger ones are counted as highest_value. */
+histogram_t *histogram_new(uint64_t highest_value);
+void histogram_free(histogram_t *histogram);
+void histogram_reset(histogram_t *histogram);
+
+void histogram_record(histogram_t *histogram, uint64_t value);
+/* Adds the counts of from, both must have the same highest_value. */
+void histogram_merge(histogram_t *histogram, const histogram_t *from);
+
+uint64_t histogram_total(const histogram_t *histogram);
+uint64_t histogram_min(const histogram_t *histogram);
+uint64_t histogram_max(const histogram_t *histogram);
+double histogram_mean(const histogram_t *histogram);
+/* Highest value at or below which percentile (0..100) of the values fall. */
+uint64_t histogram_percentile(const histogram_t *histogram, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HISTOGRAM_H__ */
+
@@ -31,6 +31,24 @@ void message_add_key_data(zmsg_t *msg, const char *key, const char *data, uint32
     zmsg_addmem(msg, data, data_size);
 }
 
+/* A tcp shard listens on the ports following the backend's, others get
+ * a suffix. */
+int message_shard_endpoint(const char *endpoint, uint32_t shard_id, char *shard_endpoint, size_t size)
+{
+    const char *colon = strrchr(endpoint, ':');
+    if ( strncmp(endpoint, "tcp://", 6) == 0 ){
+        int port = colon != NULL ? atoi(colon + 1) : 0;
+        if ( port <= 0 ){
+            return -1;
+        }
+        snprintf(shard_endpoint, size, "%.*s:%d", (int)(colon - endpoint), endpoint, port + 1 + (int)shard_id);
+    } else {
+        snprintf(shard_endpoint, size, "%s-shard-%d", endpoint, shard_id);
+    }
+
+    return 0;
+}
+
 zmsg_t *create_base_message(int16_t msgtype)
 {
     zmsg_t *msg = zmsg_new();
@@ -63,6 +81,25 @@ zmsg_t *create_action_message(const char *action)
     return msg;
 }
 
+zmsg_t *create_request_message(const char *action, uint32_t request_id, uint32_t key_hash, const char *key, uint32_t key_len, uint32_t value_len)
+{
+    request_header_t header;
+    memset(&header, 0, sizeof(request_header_t));
+    header.msgtype = MSGTYPE_REQUEST;
+    header.version = REQUEST_VERSION;
+    memcpy(header.opcode, action, sizeof(header.opcode));
+    header.request_id = request_id;
+    header.key_hash = key_hash;
+    header.key_len = key_len;
+    header.value_len = value_len;
+
+    zmsg_t *msg = zmsg_new();
+    zmsg_addmem(msg, &header, sizeof(request_header_t));
+    zmsg_addmem(msg, key, key_len);
+
+    return msg;
+}
+
 zmsg_t *create_key_data_message(const char *key, const char *data, uint32_t data_size)
 {
     zmsg_t *msg = create_base_message(MSGTYPE_DATA);
@@ -119,6 +156,43 @@ int message_send_heartbeat(zsock_t *sock, const char *heartbeat)
     return __message_send_str(sock, MSGTYPE_HEARTBEAT, heartbeat);
 }
 
+/* Send msg and append one last frame that references data in place.
+ * czmq has no zframe_frommem() in this version, so the final part goes
+ * through zmq_msg_init_data(); free_fn(data, hint) runs once zmq is done
+ * with the buffer, possibly on a zmq I/O thread. */
+int message_send_zerocopy(zmsg_t **msg_p, zsock_t *sock, void *data, uint32_t data_size, message_free_fn *free_fn, void *hint)
+{
+    zmsg_t *msg = *msg_p;
+    *msg_p = NULL;
+
+    int rc = 0;
+    zframe_t *frame = zmsg_pop(msg);
+    while ( frame != NULL ){
+        if ( rc == 0 ){
+            rc = zframe_send(&frame, sock, ZFRAME_MORE);
+        }
+        if ( frame != NULL ){
+            zframe_destroy(&frame);
+        }
+        frame = zmsg_pop(msg);
+    }
+    zmsg_destroy(&msg);
+
+    zmq_msg_t part;
+    if ( data_size > 0 ){
+        zmq_msg_init_data(&part, data, data_size, free_fn, hint);
+    } else {
+        zmq_msg_init(&part);
+        free_fn(data, hint);
+    }
+    if ( rc != 0 || zmq_msg_send(&part, zsock_resolve(sock), 0) < 0 ){
+        zmq_msg_close(&part);
+        rc = -1;
+    }
+
+    return rc;
+}
+
 int message_send_data(zsock_t *sock, const char *data, uint32_t data_size)
 {
     return __message_send_data(sock, MSGTYPE_DATA, data, data_size);
@@ -129,11 +203,26 @@ int message_send_str(zsock_t *sock, const char *data)
     return __message_send_str(sock, MSGTYPE_DATA, data);
 }
 
+const request_header_t *message_request_header(zframe_t *frame)
+{
+    if ( frame != NULL && zframe_size(frame) == sizeof(request_header_t) ){
+        const request_header_t *header = (const request_header_t*)zframe_data(frame);
+        if ( header->msgtype == MSGTYPE_REQUEST && header->version == REQUEST_VERSION ){
+            return header;
+        }
+    }
+
+    return NULL;
+}
+
 int16_t message_get_msgtype(zmsg_t *msg){
     zframe_t *frame_msgtype = zmsg_first(msg);
     if ( frame_msgtype != NULL && zframe_size(frame_msgtype) == sizeof(int16_t) ){
         return *(int16_t*)zframe_data(frame_msgtype);
     }
+    if ( message_request_header(frame_msgtype) != NULL ){
+        return MSGTYPE_REQUEST;
+    }
 
     return MSGTYPE_UNKNOWN;
 }
@@ -163,6 +252,29 @@ int message_check_heartbeat(zmsg_t *msg, const char *heartbeat)
 
 int message_check_action(zmsg_t *msg, const char *action)
 {
+    const request_header_t *header = message_request_header(zmsg_first(msg));
+    if ( header != NULL ){
+        return memcmp(header->opcode, action, sizeof(header->opcode));
+    }
     return message_check_msgid(msg, MSGTYPE_ACTION, action);
 }
 
+zframe_t *message_first_argument(zmsg_t *msg)
+{
+    if ( message_request_header(zmsg_first(msg)) != NULL ){
+        return zmsg_next(msg);
+    }
+    if ( zmsg_next(msg) == NULL ){
+        return NULL;
+    }
+    return zmsg_next(msg);
+}
+
+uint32_t message_total_arguments(zmsg_t *msg)
+{
+    uint32_t total_head_frames = message_request_header(zmsg_first(msg)) != NULL ? 1 : 2;
+    uint32_t total_frames = zmsg_size(msg);
+
+    return total_frames > total_head_frames ? total_frames - total_head_frames : 0;
+}
+
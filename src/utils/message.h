@@ -22,6 +22,9 @@ extern "C" {
 #define MSGTYPE_DATA    0x00FD
 #define MSGTYPE_HEARTBEAT 0x00FC
 #define MSGTYPE_ACTION 0x00FB
+#define MSGTYPE_REQUEST 0x00FA
+
+#define REQUEST_VERSION 1
 
 #define MSG_STATUS_ACTOR_READY  "\x01\x01"
 #define MSG_STATUS_ACTOR_OVER   "\x01\xFF"
@@ -29,6 +32,27 @@ extern "C" {
 typedef struct _zsock_t zsock_t;
 typedef struct _zmsg_t zmsg_t;
 
+typedef struct _zframe_t zframe_t;
+
+typedef void (message_free_fn)(void *data, void *hint);
+
+/* -------- struct request_header_t -------- */
+/* Binary request: one fixed header frame in place of the msgtype and
+ * action frames, then [key] and the frames of the action, any value last
+ * and untouched. opcode holds the two bytes of the MSG_ACTION_* code.
+ * key_hash is what the broker routes on so it never reads the key. */
+typedef struct request_header_t {
+    int16_t msgtype;        /* MSGTYPE_REQUEST */
+    uint8_t version;
+    uint8_t flags;
+    char opcode[2];
+    uint16_t reserved;
+    uint32_t request_id;
+    uint32_t key_hash;
+    uint32_t key_len;
+    uint32_t value_len;
+} request_header_t;
+
 int16_t message_get_msgtype(zmsg_t *msg);
 
 int message_check_msgid(zmsg_t *msg, int16_t the_msgtype, const char *id);
@@ -36,16 +60,31 @@ int message_check_status(zmsg_t *msg, const char *status);
 int message_check_heartbeat(zmsg_t *msg, const char *heartbeat);
 int message_check_action(zmsg_t *msg, const char *action);
 
+/* NULL unless frame is a request_header_t of this version. */
+const request_header_t *message_request_header(zframe_t *frame);
+/* The key frame of an action or binary request, the frames after it
+ * follow with zmsg_next(). */
+zframe_t *message_first_argument(zmsg_t *msg);
+/* Frames from the key on. */
+uint32_t message_total_arguments(zmsg_t *msg);
+
 void message_add_status(zmsg_t *msg, const char *status);
 void message_add_heartbeat(zmsg_t *msg, const char *heartbeat);
 void message_add_key_data(zmsg_t *msg, const char *key, const char *data, uint32_t data_size);
 int message_send_status(zsock_t *sock, const char *status);
 int message_send_heartbeat(zsock_t *sock, const char *heartbeat);
+int message_send_zerocopy(zmsg_t **msg_p, zsock_t *sock, void *data, uint32_t data_size, message_free_fn *free_fn, void *hint);
+
+/* Backend endpoint of broker shard shard_id, the bind and the connect
+ * form of endpoint map alike. */
+int message_shard_endpoint(const char *endpoint, uint32_t shard_id, char *shard_endpoint, size_t size);
 
 zmsg_t *create_base_message(int16_t msgtype);
 zmsg_t *create_status_message(const char *status);
 zmsg_t *create_heartbeat_message(const char *heartbeat);
 zmsg_t *create_action_message(const char *action);
+/* [request_header_t][key], the caller appends the rest. */
+zmsg_t *create_request_message(const char *action, uint32_t request_id, uint32_t key_hash, const char *key, uint32_t key_len, uint32_t value_len);
 zmsg_t *create_data_message(const char *data, uint32_t data_size);
 zmsg_t *create_key_data_message(const char *key, const char *data, uint32_t data_size);
 zmsg_t *create_sendback_message(zmsg_t *msg);